@@ -8,6 +8,9 @@
 #include <BaseNvm.hxx>
 
 BaseNvm::BaseNvm()
+    : _nvm_authchans_indexed(0),
+      _nvm_admins_indexed(0),
+      _nvm_mates_indexed(0)
 {
 
 }
@@ -17,27 +20,124 @@ BaseNvm::~BaseNvm()
 
 }
 
+/*
+ * The vectors may be filled in directly by loadNvm(); a subclass doing so
+ * should call this afterwards, although a change in size is noticed
+ * regardless.
+ */
+void BaseNvm::reindexNvm(void)
+{
+    size_t i;
+
+    _nvm_authchan_index.clear();
+    for (i = 0; i < _nvm_authchans.size(); i++) {
+        _nvm_authchan_index.insert(
+            make_pair(authChannelName(_nvm_authchans[i]), i));
+    }
+    _nvm_authchans_indexed = _nvm_authchans.size();
+
+    _nvm_admin_index.clear();
+    for (i = 0; i < _nvm_admins.size(); i++) {
+        _nvm_admin_index.insert(make_pair((uint32_t) _nvm_admins[i].node_num, i));
+    }
+    _nvm_admins_indexed = _nvm_admins.size();
+
+    _nvm_mate_index.clear();
+    for (i = 0; i < _nvm_mates.size(); i++) {
+        _nvm_mate_index.insert(make_pair((uint32_t) _nvm_mates[i].node_num, i));
+    }
+    _nvm_mates_indexed = _nvm_mates.size();
+}
+
+string BaseNvm::authChannelName(const struct nvm_authchan_entry &entry)
+{
+    return string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+}
+
+int BaseNvm::findNvmAuthChannel(const string &channel)
+{
+    unordered_map<string, size_t>::const_iterator it;
+
+    if (_nvm_authchans_indexed != _nvm_authchans.size()) {
+        reindexNvm();
+    }
+
+    it = _nvm_authchan_index.find(channel);
+    if ((it == _nvm_authchan_index.end()) ||
+        (authChannelName(_nvm_authchans[it->second]) != channel)) {
+        return -1;
+    }
+
+    return (int) it->second;
+}
+
+int BaseNvm::findNvmAdmin(uint32_t node_num)
+{
+    unordered_map<uint32_t, size_t>::const_iterator it;
+
+    if (_nvm_admins_indexed != _nvm_admins.size()) {
+        reindexNvm();
+    }
+
+    it = _nvm_admin_index.find(node_num);
+    if ((it == _nvm_admin_index.end()) ||
+        (_nvm_admins[it->second].node_num != node_num)) {
+        return -1;
+    }
+
+    return (int) it->second;
+}
+
+int BaseNvm::findNvmMate(uint32_t node_num)
+{
+    unordered_map<uint32_t, size_t>::const_iterator it;
+
+    if (_nvm_mates_indexed != _nvm_mates.size()) {
+        reindexNvm();
+    }
+
+    it = _nvm_mate_index.find(node_num);
+    if ((it == _nvm_mate_index.end()) ||
+        (_nvm_mates[it->second].node_num != node_num)) {
+        return -1;
+    }
+
+    return (int) it->second;
+}
+
+/*
+ * Resolves a node by id, short name or long name, for the name based
+ * add/del functions below; only nodes with a known user qualify.
+ */
+static const Node *resolveNode(const string &name, const SimpleClient &client)
+{
+    const Node *node;
+
+    node = client.nodes().find(client.getId(name));
+    if ((node == NULL) || (node->info.has_user != true)) {
+        return NULL;
+    }
+
+    return node;
+}
+
 bool BaseNvm::addNvmAuthChannel(const string &channel,
                                 meshtastic_ChannelSettings_psk_t psk,
                                 bool ignoreDup)
 {
     bool result = false;
     struct nvm_authchan_entry entry;
-    vector<struct nvm_authchan_entry>::iterator it;
+    int index;
 
     if (channel.length() > sizeof(entry.name)) {
         result = false;
         goto done;
     }
 
-    for (it = _nvm_authchans.begin(); it != _nvm_authchans.end(); it++) {
-        if (channel == it->name) {
-            if (ignoreDup == false) {
-                result = false;
-                goto done;
-            }
-            break;
-        }
+    index = findNvmAuthChannel(channel);
+    if ((index >= 0) && (ignoreDup == false)) {
+        result = false;
+        goto done;
     }
 
     memset(&entry, 0x0, sizeof(entry));
@@ -45,10 +145,12 @@ bool BaseNvm::addNvmAuthChannel(const string &channel,
     entry.psk.size = psk.size;
     memcpy(entry.psk.bytes, psk.bytes, psk.size);
 
-    if (it == _nvm_authchans.end()) {
+    if (index < 0) {
+        _nvm_authchan_index[channel] = _nvm_authchans.size();
         _nvm_authchans.push_back(entry);
+        _nvm_authchans_indexed = _nvm_authchans.size();
     } else {
-        *it = entry;
+        _nvm_authchans[index] = entry;
     }
 
     result = true;
@@ -59,22 +161,17 @@ done:
 }
 
 
+/* From a snapshot, as the shell runs apart from the client's thread */
 bool BaseNvm::addNvmAuthChannel(const string &channel,
-                                const SimpleClient &client)
+                                const ClientSnapshot &snap)
 {
     bool result = false;
     map<uint8_t, meshtastic_Channel>::const_iterator it;
 
-    for (it = client.channels().begin(); it != client.channels().end(); it++) {
-        if (it->second.has_settings != true) {
-            continue;
-        }
-        if (channel == it->second.settings.name) {
-            break;
-        }
-    }
-
-    if (it != client.channels().end()) {
+    it = snap.channels->find(SimpleClient::getChannel(snap, channel));
+    if ((it != snap.channels->end()) &&
+        (it->second.has_settings == true) &&
+        (channel == it->second.settings.name)) {
         result = addNvmAuthChannel(channel, it->second.settings.psk);
     }
 
@@ -83,21 +180,24 @@ bool BaseNvm::addNvmAuthChannel(const string &channel,
 
 bool BaseNvm::delNvmAuthChannel(const string &channel)
 {
-    vector<struct nvm_authchan_entry>::iterator it;
+    int index = findNvmAuthChannel(channel);
 
-    for (it = _nvm_authchans.begin(); it != _nvm_authchans.end(); it++) {
-        if (channel == it->name) {
-            _nvm_authchans.erase(it);
-            return true;
-        }
+    if (index < 0) {
+        return false;
     }
 
-    return false;
+    /* Rare enough that renumbering the rest is fine */
+    _nvm_authchans.erase(_nvm_authchans.begin() + index);
+    reindexNvm();
+
+    return true;
 }
 
 void BaseNvm::clearNvmAuthChannels(void)
 {
     _nvm_authchans.clear();
+    _nvm_authchan_index.clear();
+    _nvm_authchans_indexed = 0;
 }
 
 bool BaseNvm::addNvmAdmin(uint32_t node_num,
@@ -106,16 +206,12 @@ bool BaseNvm::addNvmAdmin(uint32_t node_num,
 {
     bool result = false;
     struct nvm_admin_entry entry;
-    vector<struct nvm_admin_entry>::iterator it;
-
-    for (it = _nvm_admins.begin(); it != _nvm_admins.end(); it++) {
-        if (node_num == it->node_num) {
-            if (ignoreDup == false) {
-                result = false;
-                goto done;
-            }
-            break;
-        }
+    int index;
+
+    index = findNvmAdmin(node_num);
+    if ((index >= 0) && (ignoreDup == false)) {
+        result = false;
+        goto done;
     }
 
     memset(&entry, 0x0, sizeof(entry));
@@ -123,10 +219,12 @@ bool BaseNvm::addNvmAdmin(uint32_t node_num,
     entry.pubkey.size = pubkey.size;
     memcpy(entry.pubkey.bytes, pubkey.bytes, pubkey.size);
 
-    if (it == _nvm_admins.end()) {
+    if (index < 0) {
+        _nvm_admin_index[node_num] = _nvm_admins.size();
         _nvm_admins.push_back(entry);
+        _nvm_admins_indexed = _nvm_admins.size();
     } else {
-        *it = entry;
+        _nvm_admins[index] = entry;
     }
 
 #if 0
@@ -144,23 +242,11 @@ done:
 bool BaseNvm::addNvmAdmin(const string &name, const SimpleClient &client)
 {
     bool result = false;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
-
-    for (it = client.nodeInfos().begin(); it != client.nodeInfos().end(); it++) {
-        if (it->second.has_user != true) {
-            continue;
-        }
-        string id = client.idString(it->second.num);
-        string exid = "!" + id;
-        if ((name == id) || (name == exid) ||
-            (name == client.lookupShortName(it->second.num)) ||
-            (name == client.lookupLongName(it->second.num))) {
-            break;
-        }
-    }
+    const Node *node;
 
-    if (it != client.nodeInfos().end()) {
-        result = addNvmAdmin(it->second.num, it->second.user.public_key);
+    node = resolveNode(name, client);
+    if (node != NULL) {
+        result = addNvmAdmin(node->info.num, node->info.user.public_key);
     }
 
     return result;
@@ -168,38 +254,26 @@ bool BaseNvm::addNvmAdmin(const string &name, const SimpleClient &client)
 
 bool BaseNvm::delNvmAdmin(uint32_t node_num)
 {
-    vector<struct nvm_admin_entry>::iterator it;
+    int index = findNvmAdmin(node_num);
 
-    for (it = _nvm_admins.begin(); it != _nvm_admins.end(); it++) {
-        if (node_num == it->node_num) {
-            _nvm_admins.erase(it);
-            return true;
-        }
+    if (index < 0) {
+        return false;
     }
 
-    return false;
+    _nvm_admins.erase(_nvm_admins.begin() + index);
+    reindexNvm();
+
+    return true;
 }
 
 bool BaseNvm::delNvmAdmin(const string &name, const SimpleClient &client)
 {
     bool result = false;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
-
-    for (it = client.nodeInfos().begin(); it != client.nodeInfos().end(); it++) {
-        if (it->second.has_user != true) {
-            continue;
-        }
-        string id = client.idString(it->second.num);
-        string exid = "!" + id;
-        if ((name == id) || (name == exid) ||
-            (name == client.lookupShortName(it->second.num)) ||
-            (name == client.lookupLongName(it->second.num))) {
-            break;
-        }
-    }
+    const Node *node;
 
-    if (it != client.nodeInfos().end()) {
-        result = delNvmAdmin(it->second.num);
+    node = resolveNode(name, client);
+    if (node != NULL) {
+        result = delNvmAdmin(node->info.num);
     }
 
     return result;
@@ -208,6 +282,8 @@ bool BaseNvm::delNvmAdmin(const string &name, const SimpleClient &client)
 void BaseNvm::clearNvmAdmins(void)
 {
     _nvm_admins.clear();
+    _nvm_admin_index.clear();
+    _nvm_admins_indexed = 0;
 }
 
 bool BaseNvm::addNvmMate(uint32_t node_num,
@@ -216,16 +292,12 @@ bool BaseNvm::addNvmMate(uint32_t node_num,
 {
     bool result = false;
     struct nvm_mate_entry entry;
-    vector<struct nvm_mate_entry>::iterator it;
-
-    for (it = _nvm_mates.begin(); it != _nvm_mates.end(); it++) {
-        if (node_num == it->node_num) {
-            if (ignoreDup == false) {
-                result = false;
-                goto done;
-            }
-            break;
-        }
+    int index;
+
+    index = findNvmMate(node_num);
+    if ((index >= 0) && (ignoreDup == false)) {
+        result = false;
+        goto done;
     }
 
     memset(&entry, 0x0, sizeof(entry));
@@ -233,10 +305,12 @@ bool BaseNvm::addNvmMate(uint32_t node_num,
     entry.pubkey.size = pubkey.size;
     memcpy(entry.pubkey.bytes, pubkey.bytes, pubkey.size);
 
-    if (it == _nvm_mates.end()) {
+    if (index < 0) {
+        _nvm_mate_index[node_num] = _nvm_mates.size();
         _nvm_mates.push_back(entry);
+        _nvm_mates_indexed = _nvm_mates.size();
     } else {
-        *it = entry;
+        _nvm_mates[index] = entry;
     }
 
     result = true;
@@ -250,24 +324,12 @@ bool BaseNvm::addNvmMate(const string &name, const SimpleClient &client,
                          bool ignoreDup)
 {
     bool result = false;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
-
-    for (it = client.nodeInfos().begin(); it != client.nodeInfos().end(); it++) {
-        if (it->second.has_user != true) {
-            continue;
-        }
-        string id = client.idString(it->second.num);
-        string exid = "!" + id;
-        if ((name == id) || (name == exid) ||
-            (name == client.lookupShortName(it->second.num)) ||
-            (name == client.lookupLongName(it->second.num))) {
-            break;
-        }
-    }
+    const Node *node;
 
-    if (it != client.nodeInfos().end()) {
-        result = addNvmMate(it->second.num,
-                            it->second.user.public_key,
+    node = resolveNode(name, client);
+    if (node != NULL) {
+        result = addNvmMate(node->info.num,
+                            node->info.user.public_key,
                             ignoreDup);
     }
 
@@ -276,41 +338,29 @@ bool BaseNvm::addNvmMate(const string &name, const SimpleClient &client,
 
 bool BaseNvm::delNvmMate(uint32_t node_num)
 {
-    vector<struct nvm_mate_entry>::iterator it;
+    int index = findNvmMate(node_num);
 
-    for (it = _nvm_mates.begin(); it != _nvm_mates.end(); it++) {
-        if (node_num == it->node_num) {
-            _nvm_mates.erase(it);
-            return true;
-        }
+    if (index < 0) {
+        return false;
     }
 
-    return false;
+    _nvm_mates.erase(_nvm_mates.begin() + index);
+    reindexNvm();
+
+    return true;
 }
 
 bool BaseNvm::delNvmMate(const string &name, const SimpleClient &client)
 {
     bool result = false;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
-
-    for (it = client.nodeInfos().begin(); it != client.nodeInfos().end(); it++) {
-        if (it->second.has_user != true) {
-            continue;
-        }
-        string id = client.idString(it->second.num);
-        string exid = "!" + id;
-        if ((name == id) || (name == exid) ||
-            (name == client.lookupShortName(it->second.num)) ||
-            (name == client.lookupLongName(it->second.num))) {
-            break;
-        }
-    }
+    const Node *node;
 
-    if (it != client.nodeInfos().end()) {
+    node = resolveNode(name, client);
+    if (node != NULL) {
 #if 0
-        delNvmAdmin(it->secon.num);  // automatic removal from admin
+        delNvmAdmin(node->info.num);  // automatic removal from admin
 #endif
-        result = delNvmMate(it->second.num);
+        result = delNvmMate(node->info.num);
     }
 
     return result;
@@ -319,6 +369,8 @@ bool BaseNvm::delNvmMate(const string &name, const SimpleClient &client)
 void BaseNvm::clearNvmMates(void)
 {
     _nvm_mates.clear();
+    _nvm_mate_index.clear();
+    _nvm_mates_indexed = 0;
 }
 
 /*
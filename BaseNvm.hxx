@@ -9,6 +9,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <libmeshtastic.h>
 #include <SimpleClient.hxx>
 
@@ -54,7 +55,7 @@ public:
     bool addNvmAuthChannel(const string &channel,
                            meshtastic_ChannelSettings_psk_t psk,
                            bool ignoreDup = true);
-    bool addNvmAuthChannel(const string &channel, const SimpleClient &client);
+    bool addNvmAuthChannel(const string &channel, const ClientSnapshot &snap);
     bool delNvmAuthChannel(const string &channel);
     void clearNvmAuthChannels(void);
     bool addNvmAdmin(uint32_t node_num,
@@ -73,12 +74,28 @@ public:
     bool delNvmMate(const string &name, const SimpleClient &client);
     void clearNvmMates(void);
 
+protected:
+
+    void reindexNvm(void);
+    int findNvmAuthChannel(const string &channel);
+    int findNvmAdmin(uint32_t node_num);
+    int findNvmMate(uint32_t node_num);
+
+    static string authChannelName(const struct nvm_authchan_entry &entry);
+
 protected:
 
     vector<struct nvm_authchan_entry> _nvm_authchans;
     vector<struct nvm_admin_entry> _nvm_admins;
     vector<struct nvm_mate_entry> _nvm_mates;
 
+    unordered_map<string, size_t> _nvm_authchan_index;
+    unordered_map<uint32_t, size_t> _nvm_admin_index;
+    unordered_map<uint32_t, size_t> _nvm_mate_index;
+    size_t _nvm_authchans_indexed;
+    size_t _nvm_admins_indexed;
+    size_t _nvm_mates_indexed;
+
 };
 
 #endif
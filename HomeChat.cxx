@@ -39,6 +39,10 @@ HomeChat::HomeChat(shared_ptr<SimpleClient> client)
     setClient(client);
     _since = time(NULL);
     clearAuthchansAdminsMates();
+    _mMessages = mt_metric_register("homechat.messages", MT_METRIC_COUNTER);
+    _mReplies = mt_metric_register("homechat.replies", MT_METRIC_COUNTER);
+    _mReplyErrors = mt_metric_register("homechat.reply_errors",
+                                       MT_METRIC_COUNTER);
 }
 
 HomeChat::~HomeChat()
@@ -206,31 +210,42 @@ HomeChat::mates(void) const
 }
 
 bool HomeChat::handleTextMessage(const meshtastic_MeshPacket &packet,
-                                 const string &_message)
+                                 const string &message)
+{
+    return handleTextView(packet, TextView(message));
+}
+
+bool HomeChat::handleTextView(const meshtastic_MeshPacket &packet,
+                              TextView text)
 {
     bool result = false;
     bool directMessage = false;
     bool channelMessage = false;
     bool fromAuthChan = false;
     bool addressed2Me = false;
-    string message = _message;
-    string first_word;
+    string &message = _message;
+    string &first_word = _firstWord;
     string reply;
     uint32_t dest = 0xffffffffU;
     uint8_t channel = 0xffU;
     bool isAdmin = false;
     bool isMate = false;
+    NodeNames scratch;
+
+    message.assign(text.data(), text.size());
 
     if (_client == NULL) {
         goto done;
     }
 
+    mt_metric_add(_mMessages, 1);
+
     if (packet.to == _client->whoami()) {
         directMessage = true;
         dest = packet.from;
         channel = packet.channel;
         this->printf("%s:%c%s\n",
-                     _client->getDisplayName(packet.from).c_str(),
+                     _client->displayName(packet.from, scratch),
                      message.find('\n') == string::npos ? ' ' : '\n',
                      message.c_str());
     } else {
@@ -238,7 +253,7 @@ bool HomeChat::handleTextMessage(const meshtastic_MeshPacket &packet,
         dest = 0xffffffffU;
         channel = packet.channel;
         this->printf("%s on #%s:%c%s\n",
-                     _client->getDisplayName(packet.from).c_str(),
+                     _client->displayName(packet.from, scratch),
                      _client->getChannelName(packet.channel).c_str(),
                      message.find('\n') == string::npos ? ' ' : '\n',
                      message.c_str());
@@ -246,7 +261,7 @@ bool HomeChat::handleTextMessage(const meshtastic_MeshPacket &packet,
 
     // get first word
     trimWhitespace(message);
-    first_word = message.substr(0, message.find(' '));
+    first_word.assign(message, 0, message.find(' '));
     toLowercase(first_word);
 
     if (channelMessage &&
@@ -254,7 +269,7 @@ bool HomeChat::handleTextMessage(const meshtastic_MeshPacket &packet,
         fromAuthChan = true;
 
         // on authorized channel, add sender as a mate (if not already)
-        if (_nvm->addNvmMate(_client->lookupShortName(packet.from),
+        if (_nvm->addNvmMate(_client->idString(packet.from),
                              *_client,
                              false)) {
             _nvm->saveNvm();
@@ -263,13 +278,13 @@ bool HomeChat::handleTextMessage(const meshtastic_MeshPacket &packet,
     }
 
     if (channelMessage &&
-        ((first_word == _client->lookupShortName(_client->whoami())) ||
-         (first_word == _client->lookupLongName(_client->whoami())) ||
+        ((first_word == _client->shortName(_client->whoami(), scratch)) ||
+         (first_word == _client->longName(_client->whoami(), scratch)) ||
          (first_word.find(_client->whoamiString()) != string::npos) ||
          (first_word == "all"))) {
         // message is addressed to me
         addressed2Me = true;
-        message = message.substr(first_word.size());
+        message.erase(0, first_word.size());
         trimWhitespace(message);
     }
 
@@ -370,11 +385,13 @@ done:
     if (!reply.empty()) {
         result = _client->textMessage(dest, channel, reply);
         if (result == false) {
+            mt_metric_add(_mReplyErrors, 1);
             this->printf("textMessage '%s' failed!\n",
                          reply.c_str());
         } else {
+            mt_metric_add(_mReplies, 1);
             this->printf("my_reply to %s: %s\n",
-                         _client->getDisplayName(packet.from).c_str(),
+                         _client->displayName(packet.from, scratch),
                          reply.c_str());
         }
     }
@@ -418,25 +435,25 @@ bool HomeChat::syncFromNvm(void)
 void HomeChat::getAuthority(uint32_t node_num,
                             bool &isAdmin, bool &isMate) const
 {
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator itNodeInfo;
+    const Node *node;
     map<uint32_t, meshtastic_User_public_key_t>::const_iterator itAdmin;
     map<uint32_t, meshtastic_User_public_key_t>::const_iterator itMate;
 
     isAdmin = false;
     isMate = false;
 
-    itNodeInfo = _client->nodeInfos().find(node_num);
-    if (itNodeInfo == _client->nodeInfos().end()) {
+    node = _client->nodes().find(node_num);
+    if (node == NULL) {
         goto done;
-    } else if (itNodeInfo->second.has_user == false) {
+    } else if (node->info.has_user == false) {
         goto done;
     }
 
     itAdmin = _admins.find(node_num);
     if (itAdmin != _admins.end()) {
-        if ((itNodeInfo->second.user.public_key.size ==
+        if ((node->info.user.public_key.size ==
              itAdmin->second.size) &&
-            (memcmp(itNodeInfo->second.user.public_key.bytes,
+            (memcmp(node->info.user.public_key.bytes,
                     itAdmin->second.bytes, itAdmin->second.size) == 0)) {
             isAdmin = true;
         }
@@ -444,9 +461,9 @@ void HomeChat::getAuthority(uint32_t node_num,
 
     itMate = _mates.find(node_num);
     if (itMate != _mates.end()) {
-        if ((itNodeInfo->second.user.public_key.size ==
+        if ((node->info.user.public_key.size ==
              itMate->second.size) &&
-            (memcmp(itNodeInfo->second.user.public_key.bytes,
+            (memcmp(node->info.user.public_key.bytes,
                     itMate->second.bytes, itMate->second.size) == 0)) {
             isMate = true;
         }
@@ -519,25 +536,27 @@ string HomeChat::handleUptime(uint32_t node_num, string &message)
 string HomeChat::handleZeroHops(uint32_t node_num, string &message)
 {
     string reply;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
+    const NodeTable &nodes = _client->nodes();
+    size_t i;
+    NodeNames scratch;
 
     (void)(node_num);
     (void)(message);
 
     reply = "my zero-hop neighbors:";
-    for (it = _client->nodeInfos().begin();
-         it != _client->nodeInfos().end();
-         it++) {
-        if (it->second.num == _client->whoami()) {
+    for (i = 0; i < nodes.size(); i++) {
+        const NodeHot &hot = nodes.hot(i);
+
+        if (hot.num == _client->whoami()) {
             continue;
         }
 
-        if (!(it->second.has_hops_away) || (it->second.hops_away > 0)) {
+        if (!(hot.has_hops_away) || (hot.hops_away > 0)) {
             continue;
         }
 
         reply += "\n";
-        reply += _client->getDisplayName(it->second.num);
+        reply += _client->displayName(hot.num, scratch);
     }
 
     return reply;
@@ -546,35 +565,38 @@ string HomeChat::handleZeroHops(uint32_t node_num, string &message)
 string HomeChat::handleNodes(uint32_t node_num, string &message)
 {
     string reply;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
-    unsigned int hops, count;
+    const NodeTable &nodes = _client->nodes();
+    unsigned int counts[15];
+    unsigned int hops;
+    size_t i;
 
     (void)(node_num);
     (void)(message);
 
     reply = "nodes seen: ";
-    reply += to_string(_client->nodeInfos().size());
+    reply += to_string(nodes.size());
 
-    for (hops = 0; hops < 15; hops++) {
-        count = 0;
-        for (it = _client->nodeInfos().begin();
-             it != _client->nodeInfos().end();
-             it++) {
-            if (it->second.num == _client->whoami()) {
-                continue;
-            }
+    /* One pass over the hot records rather than one per hop count */
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < nodes.size(); i++) {
+        const NodeHot &hot = nodes.hot(i);
 
-            if (it->second.hops_away == hops) {
-                count++;
-            }
+        if (hot.num == _client->whoami()) {
+            continue;
+        }
+
+        if (hot.hops_away < 15) {
+            counts[hot.hops_away]++;
         }
+    }
 
-        if (count > 0) {
+    for (hops = 0; hops < 15; hops++) {
+        if (counts[hops] > 0) {
             reply += "\n";
             reply += "hop";
             reply += to_string(hops);
             reply += "=";
-            reply += to_string(count);
+            reply += to_string(counts[hops]);
         }
     }
 
@@ -584,7 +606,7 @@ string HomeChat::handleNodes(uint32_t node_num, string &message)
 string HomeChat::handleMeshStats(uint32_t node_num, string &message)
 {
     stringstream ss;
-    map<uint32_t, meshtastic_DeviceMetrics>::const_iterator dev;
+    const NodeMetrics *metrics;
 
     (void)(node_num);
     (void)(message);
@@ -595,15 +617,17 @@ string HomeChat::handleMeshStats(uint32_t node_num, string &message)
     ss << "channel messages (sent/recv): "
        << to_string(_client->cmTx()) << "/" << to_string(_client->cmRx());
 
-    dev = _client->deviceMetrics().find(_client->whoami());
-    if (dev != _client->deviceMetrics().end()) {
-        if (dev->second.has_channel_utilization) {
+    metrics = _client->nodes().findMetrics(_client->whoami());
+    if ((metrics != NULL) && metrics->has_device_metrics) {
+        const meshtastic_DeviceMetrics *dev = &metrics->device_metrics;
+
+        if (dev->has_channel_utilization) {
             ss << endl << "channel_utilization: "
-               << setprecision(3) << dev->second.channel_utilization << "%";
+               << setprecision(3) << dev->channel_utilization << "%";
         }
-        if (dev->second.has_air_util_tx) {
+        if (dev->has_air_util_tx) {
             ss << endl << "air_util_tx: "
-               << setprecision(3) << dev->second.air_util_tx << "%";
+               << setprecision(3) << dev->air_util_tx << "%";
         }
     }
 
@@ -622,8 +646,10 @@ string HomeChat::handleAuthchan(uint32_t node_num, string &message)
     unsigned int i;
     bool result;
     int pass = 0, fail = 0;
+    shared_ptr<const ClientSnapshot> snap;
 
     getAuthority(node_num, isAdmin, isMate);
+    snap = _client->snapshot();
 
     trimWhitespace(message);
     iss = istringstream(message);
@@ -647,7 +673,7 @@ string HomeChat::handleAuthchan(uint32_t node_num, string &message)
                 goto done;
             }
 
-            if (_nvm->addNvmAuthChannel(tokens[2], *_client) &&
+            if (_nvm->addNvmAuthChannel(tokens[2], *snap) &&
                 _nvm->saveNvm() && syncFromNvm()) {
                 result = true;
             } else {
@@ -685,7 +711,7 @@ string HomeChat::handleAuthchan(uint32_t node_num, string &message)
 
             _nvm->clearNvmAuthChannels();
             for (i = 2; i < tokens.size(); i++) {
-                result = _nvm->addNvmAuthChannel(tokens[i], *_client);
+                result = _nvm->addNvmAuthChannel(tokens[i], *snap);
                 if (result == true) {
                     pass++;
                 } else {
@@ -927,30 +953,33 @@ done:
 string HomeChat::handleEnv(uint32_t node_num, string &message)
 {
     stringstream ss;
-    map<uint32_t, meshtastic_EnvironmentMetrics>::const_iterator env;
+    const NodeMetrics *metrics;
 
     (void)(node_num);
     (void)(message);
 
-    env = _client->environmentMetrics().find(_client->whoami());
-    if (env != _client->environmentMetrics().end()) {
-        if (env->second.has_temperature) {
+    metrics = _client->nodes().findMetrics(_client->whoami());
+    if ((metrics != NULL) && metrics->has_environment_metrics) {
+        const meshtastic_EnvironmentMetrics *env =
+            &metrics->environment_metrics;
+
+        if (env->has_temperature) {
             ss << "temperature: ";
-            ss << setprecision(3) << env->second.temperature;
+            ss << setprecision(3) << env->temperature;
         }
-        if (env->second.has_relative_humidity) {
+        if (env->has_relative_humidity) {
             if (ss.tellp() != 0) {
                 ss << endl;
             }
             ss << "relative_humidity: ";
-            ss << setprecision(3) << env->second.relative_humidity;
+            ss << setprecision(3) << env->relative_humidity;
         }
-        if (env->second.has_barometric_pressure) {
+        if (env->has_barometric_pressure) {
             if (ss.tellp() != 0) {
                 ss << endl;
             }
             ss << "barometric_pressure: ";
-                ss << setprecision(3) << env->second.barometric_pressure;
+                ss << setprecision(3) << env->barometric_pressure;
         }
     }
 
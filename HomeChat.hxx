@@ -56,8 +56,14 @@ public:
     const map<uint32_t, meshtastic_User_public_key_t> &admins(void) const;
     const map<uint32_t, meshtastic_User_public_key_t> &mates(void) const;
 
-    virtual bool handleTextMessage(const meshtastic_MeshPacket &packet,
-                                   const string &message);
+    /*
+     * The view overload works on the packet's payload in place; the string
+     * one is kept for callers that already have a copy.
+     */
+    bool handleTextMessage(const meshtastic_MeshPacket &packet,
+                           const string &message);
+    virtual bool handleTextView(const meshtastic_MeshPacket &packet,
+                                TextView message);
 
 protected:
 
@@ -96,6 +102,17 @@ protected:
 
     vector<struct vprintf_callback> _vpfcb;
 
+    /*
+     * The message being handled and its first word; kept from one message
+     * to the next so that, once grown, parsing allocates nothing.
+     */
+    string _message;
+    string _firstWord;
+
+    struct mt_metric *_mMessages;
+    struct mt_metric *_mReplies;
+    struct mt_metric *_mReplyErrors;
+
 };
 
 #endif
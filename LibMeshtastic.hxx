@@ -9,6 +9,7 @@
 
 #include <MeshPrint.hxx>
 #include <MeshClient.hxx>
+#include <MeshLoop.hxx>
 
 #endif
 
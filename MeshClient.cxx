@@ -8,9 +8,45 @@
 #include <iostream>
 #include <iomanip>
 #include <LibMeshtastic.hxx>
+#include <HomeChat.hxx>
 
 #define DEFAULT_HEARTBEAT_SECONDS 30
 
+/*
+ * Retransmit timeouts for tracked requests, in milliseconds. LoRa hops are
+ * slow and duty-cycle limited, so start conservatively until a destination
+ * has been measured.
+ */
+#define REQUEST_INITIAL_RTO_MS    30000U
+#define REQUEST_MIN_RTO_MS         5000U
+#define REQUEST_MAX_RTO_MS       120000U
+
+#define SNAPSHOT_INTERVAL_MS        100
+
+#define WARM_SAVE_SECONDS           300
+
+static struct mt_metric *mutex_wait_ns = NULL;
+
+/*
+ * Uncontended acquisitions cost nothing extra; only time spent actually
+ * blocked is observed.
+ */
+static void lock_timed(mutex &m)
+{
+    uint64_t t0;
+
+    if (m.try_lock()) {
+        return;
+    }
+
+    t0 = mt_impl_now_ns();
+    m.lock();
+    mt_metric_observe(mt_metric_lazy(&mutex_wait_ns,
+                                     "meshclient.mutex_wait_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      mt_impl_now_ns() - t0);
+}
+
 MeshClient::MeshClient()
     : SimpleClient()
 {
@@ -24,12 +60,49 @@ MeshClient::MeshClient()
     _mtc.logger = logEvent;
     _mtc.ctx = this;
     _thread = NULL;
+    _loop = NULL;
     _isRunning = false;
+    _lastHeartbeat = 0;
+    _lastWantConfig = 0;
+    _lastMin = -1;
+    _lastConnects = 0;
+    _loopConnects = 0;
+    _loopPendingInput = false;
+    _loopPendingTxq = false;
+    _clearPending = false;
+    _saveWarmPending = false;
+    _lastSyncStages = 0;
+    _lastSyncNodeInfos = 0;
+    _warmStart = false;
+    _warmNodeNum = 0;
+    _warmFor = 0;
+    _warm = false;
+    _applyingWarm = false;
+    _warmSavedAt = 0;
+    _lastWarmSave = 0;
+    _warmGeneration = 0;
+    _autoReconnect = false;
+    _livenessSeconds = 0;
+    _reconnects = 0;
+    _lastLink = 0;
+    _lastProbe = 0;
+    _lastTxqErrors = 0;
+    _mRequests = NULL;
+    _mRetransmits = NULL;
+    _mRequestTimeouts = NULL;
+    _mStaleNodes = NULL;
+    _mReconnects = NULL;
 }
 
 MeshClient::~MeshClient()
 {
     stop();
+    if ((_loop != NULL) && _loop->remove(this)) {
+        teardown();
+    }
+    mt_txq_detach(&_mtc);
+    mt_capture_stop(&_mtc);
+    mt_trace_stop(&_mtc);
 }
 
 void MeshClient::clear(void)
@@ -61,9 +134,78 @@ void MeshClient::clear(void)
     _modAmbientLighting = meshtastic_ModuleConfig_AmbientLightingConfig();
     _modDetectionSensor = meshtastic_ModuleConfig_DetectionSensorConfig();
     _modPaxcounter = meshtastic_ModuleConfig_PaxcounterConfig();
+
+    _warmCache.clear();
+    _warmFor = 0;
+    _warm = false;
+    _staleNodes.clear();
+    staleChanged();
 }
 
-bool MeshClient::attachSerial(string device)
+bool MeshClient::registerMetrics(const string &prefix)
+{
+    bool result;
+
+    result = SimpleClient::registerMetrics(prefix);
+    _mRequests = mt_metric_register((prefix + ".requests").c_str(),
+                                    MT_METRIC_COUNTER);
+    _mRetransmits = mt_metric_register((prefix + ".retransmits").c_str(),
+                                       MT_METRIC_COUNTER);
+    _mRequestTimeouts =
+        mt_metric_register((prefix + ".request_timeouts").c_str(),
+                           MT_METRIC_COUNTER);
+    _mStaleNodes = mt_metric_register((prefix + ".stale_nodes").c_str(),
+                                      MT_METRIC_GAUGE);
+    _mReconnects = mt_metric_register((prefix + ".reconnects").c_str(),
+                                      MT_METRIC_COUNTER);
+
+    result = result && (_mRequests != NULL) && (_mRetransmits != NULL) &&
+        (_mRequestTimeouts != NULL) && (_mStaleNodes != NULL) &&
+        (_mReconnects != NULL);
+
+    return result;
+}
+
+/* "client.<base name of the device>", e.g. client.ttyACM0 */
+static string metrics_prefix(const struct mt_client *mtc)
+{
+    string prefix = "client.";
+    const char *name, *p;
+
+    name = mtc->device;
+    if (name == NULL) {
+        name = (mtc->ops != NULL) ? mtc->ops->name : "unknown";
+    }
+    p = strrchr(name, '/');
+    if ((p != NULL) && (p[1] != '\0')) {
+        name = p + 1;
+    }
+
+    /* Room for the longest metric name after it */
+    for (p = name; (*p != '\0') && (prefix.size() < 28); p++) {
+        prefix += (isalnum((unsigned char) *p) || (*p == '-')) ? *p : '_';
+    }
+
+    return prefix;
+}
+
+bool MeshClient::attach(const struct mt_transport_ops *ops, string device,
+                        shared_ptr<MeshLoop> loop)
+{
+    bool result = false;
+
+    if (mt_attach(&_mtc, ops, device.c_str()) != 0) {
+        goto done;
+    }
+
+    result = launch(loop);
+
+done:
+
+    return result;
+}
+
+bool MeshClient::attachSerial(string device, shared_ptr<MeshLoop> loop)
 {
     bool result = false;
 
@@ -71,8 +213,73 @@ bool MeshClient::attachSerial(string device)
         goto done;
     }
 
+    result = launch(loop);
+
+done:
+
+    return result;
+}
+
+bool MeshClient::attachTcp(string host, uint16_t port,
+                           shared_ptr<MeshLoop> loop)
+{
+    bool result = false;
+
+    if (mt_tcp_attach(&_mtc, host.c_str(), port) != 0) {
+        goto done;
+    }
+
+    result = launch(loop);
+
+done:
+
+    return result;
+}
+
+bool MeshClient::attachReplay(string path, float speed)
+{
+    bool result = false;
+
+    if (mt_replay_attach(&_mtc, path.c_str(), speed) != 0) {
+        goto done;
+    }
+
+    /* Nothing to wait on, so always serviced by a thread of its own */
+    result = launch(NULL);
+
+done:
+
+    return result;
+}
+
+bool MeshClient::launch(shared_ptr<MeshLoop> loop)
+{
+    bool result = false;
+
+    /* Senders on any thread queue frames for the I/O thread to write */
+    if (mt_txq_attach(&_mtc, MT_TXQ_DEFAULT_DEPTH) != 0) {
+        mt_detach(&_mtc);
+        goto done;
+    }
+
+    if (metricsPrefix().empty()) {
+        registerMetrics(metrics_prefix(&_mtc));
+    }
+
     _isRunning = true;
-    _thread = make_shared<thread>(thread_function, this);
+
+    if (loop != NULL) {
+        _loop = loop;
+        begin();
+        if (_loop->add(this) != true) {
+            _isRunning = false;
+            teardown();
+            _loop = NULL;
+            goto done;
+        }
+    } else {
+        _thread = make_shared<thread>(thread_function, this);
+    }
 
     result = true;
 
@@ -84,6 +291,9 @@ done:
 void MeshClient::detach(void)
 {
     stop();
+    if ((_loop != NULL) && _loop->remove(this)) {
+        teardown();
+    }
 }
 
 void MeshClient::join(void)
@@ -92,6 +302,9 @@ void MeshClient::join(void)
         if (_thread->joinable()) {
             _thread->join();
         }
+    } else if (_loop != NULL) {
+        unique_lock<mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return !_isRunning && (_mtc.ops == NULL); });
     }
 }
 
@@ -125,13 +338,353 @@ void MeshClient::setHeartbeatSeconds(unsigned int seconds)
     _heartbeatSeconds = seconds;
 }
 
+bool MeshClient::startCapture(const string &path)
+{
+    bool result = false;
+
+    if (_isRunning) {
+        goto done;
+    }
+
+    result = (mt_capture_start(&_mtc, path.c_str()) == 0);
+
+done:
+
+    return result;
+}
+
+void MeshClient::stopCapture(void)
+{
+    if (!_isRunning) {
+        mt_capture_stop(&_mtc);
+    }
+}
+
+bool MeshClient::isCapturing(void) const
+{
+    return (_mtc.capture != NULL);
+}
+
+bool MeshClient::startTrace(const string &path, unsigned int sample)
+{
+    bool result = false;
+
+    if (_isRunning) {
+        goto done;
+    }
+
+    result = (mt_trace_start(&_mtc, path.empty() ? NULL : path.c_str(),
+                             sample) == 0);
+
+done:
+
+    return result;
+}
+
+void MeshClient::stopTrace(void)
+{
+    if (!_isRunning) {
+        mt_trace_stop(&_mtc);
+    }
+}
+
+bool MeshClient::isTracing(void) const
+{
+    return (_mtc.trace != NULL);
+}
+
+bool MeshClient::warmStart(void) const
+{
+    return _warmStart;
+}
+
+void MeshClient::enableWarmStart(bool enable, uint32_t node_num)
+{
+    _warmStart = enable;
+    _warmNodeNum = enable ? node_num : 0;
+}
+
+bool MeshClient::isWarm(void) const
+{
+    return atomic_load(&_snapshot)->warm;
+}
+
+unsigned int MeshClient::warmAgeSeconds(void) const
+{
+    shared_ptr<const ClientSnapshot> snap = atomic_load(&_snapshot);
+    time_t now;
+
+    if (!snap->warm || (snap->warmSavedAt == 0)) {
+        return 0;
+    }
+
+    now = time(NULL);
+
+    return (now > snap->warmSavedAt) ?
+        (unsigned int) (now - snap->warmSavedAt) : 0;
+}
+
+size_t MeshClient::staleNodes(void) const
+{
+    return atomic_load(&_snapshot)->staleNodes->size();
+}
+
+bool MeshClient::isStale(uint32_t node_num) const
+{
+    return atomic_load(&_snapshot)->staleNodes->count(node_num) != 0;
+}
+
+bool MeshClient::saveWarmStart(void)
+{
+    if (!_warmStart) {
+        return false;
+    }
+
+    _saveWarmPending = true;
+
+    return true;
+}
+
+/* Only a complete session is saved, never one still being reconciled */
+bool MeshClient::writeWarmStart(void)
+{
+    bool result = false;
+
+    if (!_warmStart || _warm || !isConnected() || (whoami() == 0)) {
+        goto done;
+    }
+
+    if ((_warmCache.nodeNum() != whoami()) &&
+        !_warmCache.setupFor(whoami())) {
+        goto done;
+    }
+
+    _lastWarmSave = time(NULL);
+    result = _warmCache.save(_nodes);
+    if (result) {
+        _warmGeneration = _nodes.generation();
+    }
+
+done:
+
+    return result;
+}
+
+bool MeshClient::loadWarmStart(uint32_t node_num)
+{
+    bool result = false;
+
+    /* Whatever the cache holds, this session now belongs to node_num */
+    _warmFor = node_num;
+
+    if (!_warmCache.setupFor(node_num)) {
+        goto done;
+    }
+
+    _applyingWarm = true;
+    result = _warmCache.load([this](const meshtastic_FromRadio &fromRadio) {
+        applyWarmStart(fromRadio);
+    });
+    _applyingWarm = false;
+
+    /* A truncated file still leaves what was read before it */
+    _warm = result || !_staleNodes.empty();
+    _warmSavedAt = _warmCache.savedAt();
+    staleChanged();
+
+done:
+
+    return result;
+}
+
+/*
+ * A record from the cache fills in what this session has not brought in
+ * yet. my_info and nodes never overwrite what it has; configs, module
+ * configs and channels are applied as they are, which is only safe
+ * because the cache is loaded before the session brings in any of its
+ * own: at attach, or at my_info, which comes first.
+ */
+void MeshClient::applyWarmStart(const meshtastic_FromRadio &fromRadio)
+{
+    switch (fromRadio.which_payload_variant) {
+    case meshtastic_FromRadio_my_info_tag:
+        if (whoami() == 0) {
+            gotMyNodeInfo(fromRadio.my_info);
+        }
+        break;
+    case meshtastic_FromRadio_node_info_tag:
+        if (_nodes.indexOf(fromRadio.node_info.num) < 0) {
+            gotNodeInfo(fromRadio.node_info);
+            _staleNodes.insert(fromRadio.node_info.num);
+        }
+        break;
+    case meshtastic_FromRadio_config_tag:
+        gotConfig(fromRadio.config);
+        break;
+    case meshtastic_FromRadio_moduleConfig_tag:
+        gotModuleConfig(fromRadio.moduleConfig);
+        break;
+    case meshtastic_FromRadio_channel_tag:
+        gotChannel(fromRadio.channel);
+        break;
+    case meshtastic_FromRadio_metadata_tag:
+        gotDeviceMetadata(fromRadio.metadata);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * The radio starts a new session after a reboot or reconnect: keep what
+ * the last one brought in, as if it had been loaded from the cache, and
+ * let the new one reconcile it.
+ */
+void MeshClient::rewarm(void)
+{
+    NodeTable::const_iterator it;
+
+    resetSync();
+
+    for (it = _nodes.begin(); it != _nodes.end(); it++) {
+        _staleNodes.insert(it->info.num);
+    }
+
+    if (!_warm) {
+        _warm = true;
+        _warmSavedAt = time(NULL);
+    }
+
+    staleChanged();
+    touch(SNAPSHOT_STATE);
+}
+
+/* The session is complete: whatever it did not report again is gone */
+void MeshClient::reconcileWarmStart(void)
+{
+    if (!_staleNodes.empty()) {
+        _nodes.prune(_staleNodes);
+        _staleNodes.clear();
+        touch(SNAPSHOT_STATE);
+    }
+
+    _warm = false;
+    _warmSavedAt = 0;
+    staleChanged();
+    writeWarmStart();
+}
+
+void MeshClient::staleChanged(void)
+{
+    mt_metric_set(_mStaleNodes, (int64_t) _staleNodes.size());
+    touch(SNAPSHOT_WARM);
+}
+
+void MeshClient::publishing(ClientSnapshot &snap, const ClientSnapshot *prev)
+{
+    snap.warm = _warm;
+    snap.warmSavedAt = _warmSavedAt;
+    if ((prev == NULL) || (_touched & SNAPSHOT_WARM)) {
+        snap.staleNodes =
+            make_shared<const unordered_set<uint32_t>>(_staleNodes);
+    }
+}
+
+bool MeshClient::autoReconnect(void) const
+{
+    return _autoReconnect;
+}
+
+void MeshClient::enableAutoReconnect(bool enable,
+                                     unsigned int livenessSeconds)
+{
+    _autoReconnect = enable;
+    _livenessSeconds = enable ? livenessSeconds : 0;
+}
+
+unsigned int MeshClient::livenessSeconds(void) const
+{
+    return _livenessSeconds;
+}
+
+uint32_t MeshClient::reconnects(void) const
+{
+    return _reconnects;
+}
+
+/*
+ * Called from tick() with auto-reconnect on. Every frame that comes in
+ * refreshes last_packet_ts; the probe gets the radio to send one even
+ * when the mesh is quiet.
+ */
+void MeshClient::supervise(time_t now)
+{
+    time_t last, idle;
+    uint32_t errors;
+
+    errors = mt_txq_errors(&_mtc);
+    if ((_mtc.fd < 0) || mt_connecting(&_mtc)) {
+        /* Down: reopened by whoever drives mt_process(), off any lock */
+        _lastTxqErrors = errors;
+        return;
+    }
+
+    if (errors != _lastTxqErrors) {
+        /* Writes out of the transmit queue failed on a live link */
+        _lastTxqErrors = errors;
+        reconnect("write to the radio failed");
+        return;
+    }
+
+    if (_livenessSeconds == 0) {
+        return;
+    }
+
+    last = max((time_t) _mtc.last_packet_ts, _lastLink);
+    idle = now - last;
+
+    if (idle >= (time_t) _livenessSeconds) {
+        reconnect("no frame from the radio");
+    } else if ((idle >= (time_t) (_livenessSeconds / 2)) &&
+               (_lastProbe < last)) {
+        _lastProbe = now;
+        mt_admin_message_device_metadata_request(&_mtc);
+    }
+}
+
+bool MeshClient::reconnect(const char *why)
+{
+    bool result = false;
+
+    if (!_autoReconnect) {
+        goto done;
+    }
+
+    result = (mt_reconnect(&_mtc) == 0);
+    if (result) {
+        cerr << ((_mtc.device != NULL) ? _mtc.device : "radio") << ": "
+             << why << ", reconnecting" << endl;
+        _reconnects++;
+        mt_metric_add(_mReconnects, 1);
+    }
+
+done:
+
+    return result;
+}
+
+/*
+ * Lock-free like the other senders. The client state belongs to the I/O
+ * thread, which alone runs clear(): the next tick does it.
+ */
 bool MeshClient::sendDisconnect(void)
 {
     bool result = false;
 
-    _mutex.lock();
-    result = SimpleClient::sendDisconnect();
-    _mutex.unlock();
+    result = (mt_send_disconnect(&_mtc) == 0);
+    if (result) {
+        _clearPending = true;
+    }
 
     return result;
 }
@@ -140,9 +693,7 @@ bool MeshClient::sendWantConfig(void)
 {
     bool result = false;
 
-    _mutex.lock();
     result = SimpleClient::sendWantConfig();
-    _mutex.unlock();
 
     return result;
 }
@@ -151,9 +702,7 @@ bool MeshClient::sendHeartbeat(void)
 {
     bool result = false;
 
-    _mutex.lock();
     result = SimpleClient::sendHeartbeat();
-    _mutex.unlock();
 
     return result;
 }
@@ -164,10 +713,8 @@ bool MeshClient::textMessage(uint32_t dest, uint8_t channel,
 {
     bool result = false;
 
-    _mutex.lock();
     result = SimpleClient::textMessage(dest, channel, message,
                                        hop_start, want_ack);
-    _mutex.unlock();
 
     return result;
 }
@@ -176,22 +723,156 @@ bool MeshClient::adminMessageReboot(unsigned int seconds)
 {
     bool result = false;
 
-    _mutex.lock();
     result = (mt_admin_message_reboot(&_mtc, seconds) == 0);
-    _mutex.unlock();
 
     return result;
 }
 
+bool MeshClient::sendRequest(meshtastic_MeshPacket &packet,
+                             RequestCallback callback, unsigned int retries)
+{
+    bool result = false;
+    shared_ptr<PendingRequest> request;
+
+    if (packet.which_payload_variant != meshtastic_MeshPacket_decoded_tag) {
+        goto done;
+    }
+
+    if (packet.id == 0) {
+        packet.id = mt_packet_id(&_mtc);
+    }
+    packet.want_ack = true;
+
+    request = make_shared<PendingRequest>();
+    request->id = packet.id;
+    request->ids.push_back(packet.id);
+    request->packet = packet;
+    request->callback = callback;
+    request->retries = retries;
+    request->attempts = 1;
+    request->sent = chrono::steady_clock::now();
+
+    /* Track it before sending, the answer may beat us back */
+    lock_timed(_requestMutex);
+    request->rto = rto(packet.to);
+    request->deadline = request->sent + chrono::milliseconds(request->rto);
+    _requests[packet.id] = request;
+    _requestMutex.unlock();
+
+    if (mt_send_packet(&_mtc, &packet) != 0) {
+        lock_timed(_requestMutex);
+        _requests.erase(packet.id);
+        _requestMutex.unlock();
+        goto done;
+    }
+
+    mt_metric_add(_mRequests, 1);
+    result = true;
+
+done:
+
+    return result;
+}
+
+bool MeshClient::textMessageRequest(uint32_t dest, uint8_t channel,
+                                    const string &message,
+                                    RequestCallback callback,
+                                    unsigned int hop_start,
+                                    unsigned int retries)
+{
+    bool result = false;
+    meshtastic_MeshPacket packet;
+
+    if ((hop_start > 7) ||
+        (message.size() > sizeof(packet.decoded.payload.bytes))) {
+        goto done;
+    }
+
+    if (hop_start == 0) {
+        hop_start = 3;
+    }
+
+    bzero(&packet, sizeof(packet));
+    packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+    packet.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+    packet.to = dest;
+    packet.channel = channel;
+    packet.hop_start = hop_start;
+    packet.hop_limit = hop_start;
+    packet.decoded.payload.size = message.size();
+    memcpy(packet.decoded.payload.bytes, message.data(), message.size());
+
+    result = sendRequest(packet, callback, retries);
+
+done:
+
+    return result;
+}
+
+future<meshtastic_Routing_Error> MeshClient::textMessageAsync(
+    uint32_t dest, uint8_t channel, const string &message,
+    unsigned int hop_start, unsigned int retries)
+{
+    shared_ptr<promise<meshtastic_Routing_Error>> p =
+        make_shared<promise<meshtastic_Routing_Error>>();
+    future<meshtastic_Routing_Error> f = p->get_future();
+
+    if (textMessageRequest(
+            dest, channel, message,
+            [p](uint32_t id, meshtastic_Routing_Error error,
+                const meshtastic_MeshPacket *reply) {
+                (void)(id);
+                (void)(reply);
+                p->set_value(error);
+            }, hop_start, retries) != true) {
+        p->set_value(meshtastic_Routing_Error_NO_INTERFACE);
+    }
+
+    return f;
+}
+
+size_t MeshClient::pendingRequests(void) const
+{
+    size_t n = 0;
+    map<uint32_t, shared_ptr<PendingRequest>>::const_iterator it;
+
+    lock_timed(_requestMutex);
+    for (it = _requests.begin(); it != _requests.end(); it++) {
+        /* Once per request, under the id of its first try */
+        if (it->first == it->second->id) {
+            n++;
+        }
+    }
+    _requestMutex.unlock();
+
+    return n;
+}
+
+unsigned int MeshClient::retransmitTimeoutMs(uint32_t dest) const
+{
+    unsigned int ms;
+
+    lock_timed(_requestMutex);
+    ms = rto(dest);
+    _requestMutex.unlock();
+
+    return ms;
+}
+
+
+shared_ptr<const ClientSnapshot> MeshClient::snapshot(void)
+{
+    return atomic_load(&_snapshot);
+}
 
 unsigned int MeshClient::hopsAway(uint32_t node_num) const
 {
     uint8_t hops = 0xffU;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
+    const NodeHot *hot;
 
-    it = _nodeInfos.find(node_num);
-    if ((it != _nodeInfos.end()) && it->second.has_hops_away) {
-        hops = it->second.hops_away;
+    hot = _nodes.findHot(node_num);
+    if ((hot != NULL) && hot->has_hops_away) {
+        hops = hot->hops_away;
     }
 
     return (unsigned int) hops;
@@ -207,48 +888,66 @@ void MeshClient::mtEvent(struct mt_client *mtc,
                          const meshtastic_FromRadio *fromRadio)
 {
     MeshClient *client = (MeshClient *) mtc->ctx;
+    const char *name = NULL;
+    uint64_t t0;
 
     (void)(packet);
     (void)(size);
 
+    client->trackSync(*fromRadio);
+
+    t0 = mt_trace_now(mtc);
     switch (fromRadio->which_payload_variant) {
     case meshtastic_FromRadio_packet_tag:
+        name = "gotPacket";
         client->gotPacket(fromRadio->packet);
         break;
     case meshtastic_FromRadio_my_info_tag:
+        name = "gotMyNodeInfo";
         client->gotMyNodeInfo(fromRadio->my_info);
         break;
     case meshtastic_FromRadio_node_info_tag:
+        name = "gotNodeInfo";
         client->gotNodeInfo(fromRadio->node_info);
         break;
     case meshtastic_FromRadio_config_tag :
+        name = "gotConfig";
         client->gotConfig(fromRadio->config);
         break;
     case meshtastic_FromRadio_moduleConfig_tag:
+        name = "gotModuleConfig";
         client->gotModuleConfig(fromRadio->moduleConfig);
         break;
     case meshtastic_FromRadio_channel_tag:
+        name = "gotChannel";
         client->gotChannel(fromRadio->channel);
         break;
     case meshtastic_FromRadio_config_complete_id_tag:
+        name = "gotConfigCompleteId";
         client->gotConfigCompleteId(fromRadio->config_complete_id);
         break;
     case meshtastic_FromRadio_rebooted_tag:
+        name = "gotRebooted";
         client->gotRebooted(fromRadio->rebooted);
         break;
     case meshtastic_FromRadio_queueStatus_tag:
+        name = "gotQueueStatus";
         client->gotQueueStatus(fromRadio->queueStatus);
         break;
     case meshtastic_FromRadio_metadata_tag:
+        name = "gotDeviceMetadata";
         client->gotDeviceMetadata(fromRadio->metadata);
         break;
     case meshtastic_FromRadio_fileInfo_tag:
+        name = "gotFileInfo";
         client->gotFileInfo(fromRadio->fileInfo);
         break;
     case meshtastic_FromRadio_deviceuiConfig_tag:
+        name = "gotDeviceUIConfig";
         client->gotDeviceUIConfig(fromRadio->deviceuiConfig);
         break;
     case meshtastic_FromRadio_mqttClientProxyMessage_tag:
+        name = "gotMqttClientProxyMessage";
         client->gotMqttClientProxyMessage(fromRadio->mqttClientProxyMessage);
         break;
     default:
@@ -256,6 +955,14 @@ void MeshClient::mtEvent(struct mt_client *mtc,
              << fromRadio->which_payload_variant << endl;
         break;
     }
+
+    mt_trace_span(mtc, name, t0);
+
+    if (client->_warmStart) {
+        client->_warmCache.put(*fromRadio);
+    }
+
+    client->notify(*fromRadio);
 }
 
 void MeshClient::logEvent(struct mt_client *mtc, const char *msg, size_t size)
@@ -269,132 +976,93 @@ void MeshClient::logEvent(struct mt_client *mtc, const char *msg, size_t size)
 
 void MeshClient::gotPacket(const meshtastic_MeshPacket &packet)
 {
-    int ret;
-    pb_istream_t stream;
-
     if (_verbose) {
         cout << packet;
     }
 
-    if (packet.which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
-        switch (packet.decoded.portnum) {
-        case meshtastic_PortNum_TEXT_MESSAGE_APP:
-            if (packet.which_payload_variant ==
-                meshtastic_MeshPacket_decoded_tag) {
-                string message((const char *) packet.decoded.payload.bytes,
-                               packet.decoded.payload.size);
-                gotTextMessage(packet, message);
-            }
-            break;
-        case meshtastic_PortNum_POSITION_APP:
-        {
-            meshtastic_Position position;
-            bzero(&position, sizeof(position));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Position_fields, &position);
-            if (ret == 1) {
-                gotPosition(packet, position);
-            } else {
-                cerr << "pb_decode position failed!" << endl;
-            }
-        }
-        break;
-        case meshtastic_PortNum_NODEINFO_APP:
-        {
-            meshtastic_User user;
-            bzero(&user, sizeof(user));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_User_fields, &user);
-            if (ret == 1) {
-                gotUser(packet, user);
-            } else {
-                cerr << "pb_decode user failed!" << endl;
-            }
-        }
-        break;
-        case meshtastic_PortNum_ROUTING_APP:
-        {
-            meshtastic_Routing routing;
-            bzero(&routing, sizeof(routing));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Routing_fields, &routing);
-            if (ret == 1) {
-                gotRouting(packet, routing);
-            } else {
-                cerr << "pb_decode routing failed!" << endl;
-            }
-        }
-        break;
-        case meshtastic_PortNum_ADMIN_APP:
-        {
-            meshtastic_AdminMessage admmsg;
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_AdminMessage_fields, &admmsg);
-            if (ret == 1) {
-                gotAdminMessage(packet, admmsg);
-            } else {
-                cerr << "pb_decode admmsg failed!" << endl;
-            }
-        }
-        break;
-        case meshtastic_PortNum_TELEMETRY_APP:
-        {
-            meshtastic_Telemetry telemetry;
-            bzero(&telemetry, sizeof(telemetry));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Telemetry_fields, &telemetry);
-            if (ret == 1) {
-                gotTelemetry(packet, telemetry);
-            } else {
-                cerr << "pb_decode telmetry failed!" << endl;
-            }
-        }
-        break;
-        case meshtastic_PortNum_TRACEROUTE_APP:
-        {
-            meshtastic_RouteDiscovery routeDiscovery;
-            bzero(&routeDiscovery, sizeof(routeDiscovery));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_RouteDiscovery_fields,
-                            &routeDiscovery);
-            if (ret == 1) {
-                gotTraceRoute(packet, routeDiscovery);
-            } else {
-                cerr << "pb_decode routeDiscovery failed!" << endl;
-            }
-        }
-        break;
-        default:
-            cout << "Unhandled portnum: "
-                 << packet.decoded.portnum << endl;
-            break;
-        }
+    /* Routing replies are matched once decoded, in gotRouting() */
+    if ((packet.which_payload_variant == meshtastic_MeshPacket_decoded_tag) &&
+        (packet.decoded.request_id != 0) &&
+        (packet.decoded.portnum != meshtastic_PortNum_ROUTING_APP)) {
+        matchRequest(packet, NULL);
+    }
+
+    SimpleClient::gotPacket(packet);
+}
+
+void MeshClient::gotRouting(const meshtastic_MeshPacket &packet,
+                            const meshtastic_Routing &routing)
+{
+    if (packet.decoded.request_id != 0) {
+        matchRequest(packet, &routing);
     }
+
+    SimpleClient::gotRouting(packet, routing);
+}
+
+void MeshClient::gotTextView(const meshtastic_MeshPacket &packet,
+                             TextView message)
+{
+    HomeChat *homeChat = getHomeChat();
+
+    if (homeChat != NULL) {
+        homeChat->handleTextView(packet, message);
+    } else {
+        SimpleClient::gotTextView(packet, message);
+    }
+}
+
+void MeshClient::gotBadPayload(const meshtastic_MeshPacket &packet)
+{
+    SimpleClient::gotBadPayload(packet);
+    cerr << "pb_decode failed for portnum "
+         << packet.decoded.portnum << "!" << endl;
 }
 
 void MeshClient::gotMyNodeInfo(const meshtastic_MyNodeInfo &myNodeInfo)
 {
+    uint32_t num = myNodeInfo.my_node_num;
+    unsigned int sync = _sync;
+    bool other = false;
+
+    if (!_applyingWarm) {
+        if (_warmStart) {
+            other = (_warmFor != 0) && (_warmFor != num);
+        } else {
+            other = _warm && (whoami() != 0) && (whoami() != num);
+        }
+    }
+
+    if (other) {
+        /* Not the radio whose state is held: forget it, not the session */
+        clear();
+        _sync = sync;
+    }
+
     _myNodeInfo = myNodeInfo;
+    touch(SNAPSHOT_STATE);
 
     if (_verbose) {
         cout << _myNodeInfo;
     }
+
+    if (_warmStart && !_applyingWarm && (_warmFor != num)) {
+        loadWarmStart(num);
+    }
 }
 
 void MeshClient::gotNodeInfo(const meshtastic_NodeInfo &nodeInfo)
 {
-    uint32_t num = nodeInfo.num;
+    size_t index;
+
+    index = _nodes.put(nodeInfo);
 
-    _nodeInfos[num] = nodeInfo;
+    if (!_applyingWarm && (_staleNodes.erase(nodeInfo.num) != 0)) {
+        staleChanged();
+    }
 
     if (_verbose) {
-        cout << _nodeInfos[num];
+        cout << _nodes.node(index).info;
     }
 }
 
@@ -467,7 +1135,7 @@ void MeshClient::gotDisplayConfig(const meshtastic_Config_DisplayConfig &c)
 
 void MeshClient::gotLoraConfig(const meshtastic_Config_LoRaConfig &c)
 {
-    _loraConfig = c;
+    SimpleClient::gotLoraConfig(c);
 }
 
 void MeshClient::gotBluetoothConfig(const meshtastic_Config_BluetoothConfig &c)
@@ -612,6 +1280,11 @@ void MeshClient::gotChannel(const meshtastic_Channel &channel)
 void MeshClient::gotConfigCompleteId(uint32_t id)
 {
     SimpleClient::gotConfigCompleteId(id);
+    if ((_warmStart || _warm) && isReady(SYNC_NODES) &&
+        (id != MT_WANT_CONFIG_ONLY_CONFIG)) {
+        /* Only a session that brought in the nodes can tell who is gone */
+        reconcileWarmStart();
+    }
     if (_verbose) {
         cout << "ConfigCompleteId: 0x"
              << hex << setfill('0') << setw(8) << id << dec << endl;
@@ -620,7 +1293,11 @@ void MeshClient::gotConfigCompleteId(uint32_t id)
 
 void MeshClient::gotRebooted(bool rebooted)
 {
-    SimpleClient::gotRebooted(rebooted);
+    if (rebooted && (_warmStart || _autoReconnect)) {
+        rewarm();
+    } else {
+        SimpleClient::gotRebooted(rebooted);
+    }
     if (_verbose) {
         cout << "Rebooted: %d\n" << (int) rebooted << endl;
     }
@@ -682,63 +1359,367 @@ void MeshClient::run(void)
 {
     int ret = 0;
     uint32_t timeout_ms = 1000;
-    time_t last_heartbeat, last_want_config, now;
-    time_t currentTime;
-    tm *localTime;
-    int last_min = -1;
+
+    begin();
+
+    while (_isRunning) {
+        if (tick() != true) {
+            _isRunning = false;
+            break;
+        }
+
+        ret = mt_process(&_mtc, timeout_ms);
+        if ((ret < 0) && !reconnect(strerror(errno))) {
+            _isRunning = false;
+            continue;
+        }
+
+        publishIfDue();
+    }
+
+    teardown();
+
+    return;
+}
+
+void MeshClient::begin(void)
+{
+    time_t now;
 
     now = time(NULL);
-    last_heartbeat = now;
-    last_want_config = now;
+    _lastHeartbeat = now;
+    /* Ask for the config on the first tick rather than 5 seconds in */
+    _lastWantConfig = now - 5;
+    _lastMin = -1;
+    _lastConnects = _mtc.connects;
+    _lastSyncStages = 0;
+    _lastSyncNodeInfos = 0;
+    _lastLink = now;
+    _lastProbe = 0;
+    _lastTxqErrors = mt_txq_errors(&_mtc);
+    _clearPending = false;
+
+    SimpleClient::sendDisconnect();
+
+    if (_warmStart && (_warmNodeNum != 0)) {
+        loadWarmStart(_warmNodeNum);
+    }
+}
 
-    sendDisconnect();
+bool MeshClient::tick(void)
+{
+    bool result = true;
+    time_t now;
+    struct tm localTime;
 
-    while (_isRunning) {
-        now = time(NULL);
-        if (!isConnected() && ((now - last_want_config) >= 5)) {
-            ret = sendWantConfig();
-            if (ret != true) {
-                _isRunning = false;
-                continue;
-            }
+    now = time(NULL);
 
-            last_want_config = now;
-        } else if (isConnected()) {
-            last_want_config = now;
+    if (_clearPending.exchange(false)) {
+        /* Disconnected from another thread */
+        clear();
+        _isConnected = false;
+    }
+
+    if (_autoReconnect) {
+        supervise(now);
+    }
+
+    if (_mtc.connects != _lastConnects) {
+        /* The link came back: the radio expects a fresh config session */
+        _lastConnects = _mtc.connects;
+        _lastLink = now;
+        if (_warmStart || _autoReconnect) {
+            rewarm();
+        } else {
+            clear();
+            _isConnected = false;
+        }
+        _lastWantConfig = now - 5;
+    }
+
+    if (!isConnected() && ((syncStages() != _lastSyncStages) ||
+                           (syncNodeInfos() != _lastSyncNodeInfos))) {
+        /* Still coming in: asking again would only restart the session */
+        _lastSyncStages = syncStages();
+        _lastSyncNodeInfos = syncNodeInfos();
+        _lastWantConfig = now;
+    } else if (!isConnected() && ((now - _lastWantConfig) >= 5)) {
+        if (sendWantConfig() != true) {
+            /*
+             * EAGAIN: the transport is reconnecting, ENOBUFS: the transmit
+             * queue is full; either way try again later
+             */
+            result = (errno == EAGAIN) || (errno == ENOBUFS) ||
+                reconnect(strerror(errno));
+            goto cron;
         }
 
-        if (_heartbeatSeconds > 0) {
-            if (isConnected() &&
-                ((now - last_heartbeat) >= (time_t) _heartbeatSeconds)) {
-                if (sendHeartbeat() != true) {
-                    _isRunning = false;
-                    break;
-                }
+        _lastWantConfig = now;
+    } else if (isConnected()) {
+        _lastWantConfig = now;
+    }
+
+    expireRequests();
 
-                last_heartbeat = now;
+    if (_saveWarmPending.exchange(false)) {
+        /* Asked for from another thread */
+        writeWarmStart();
+    } else if (_warmStart && isConnected() &&
+               ((now - _lastWarmSave) >= WARM_SAVE_SECONDS) &&
+               (_nodes.generation() != _warmGeneration)) {
+        writeWarmStart();
+    }
+
+    if (_heartbeatSeconds > 0) {
+        if (isConnected() &&
+            ((now - _lastHeartbeat) >= (time_t) _heartbeatSeconds)) {
+            if (sendHeartbeat() != true) {
+                result = (errno == EAGAIN) || (errno == ENOBUFS) ||
+                    reconnect(strerror(errno));
+                goto cron;
             }
+
+            _lastHeartbeat = now;
         }
+    }
 
-        do {
-            ret = mt_serial_process(&_mtc, timeout_ms);
-            if (ret != 0) {
-                _isRunning = false;
-                continue;
-            }
-        } while (ret > 0);
+cron:
+
+    localtime_r(&now, &localTime);
+    if (_lastMin != localTime.tm_min) {
+        _lastMin = localTime.tm_min;
+        crontab(&localTime);
+    }
+
+    publishIfDue();
+
+    return result;
+}
+
+void MeshClient::teardown(void)
+{
+    if (_warmStart && (_nodes.generation() != _warmGeneration)) {
+        writeWarmStart();
+    }
+
+    SimpleClient::sendDisconnect();
+    mt_txq_flush(&_mtc);
+    mt_detach(&_mtc);
+    failRequests(meshtastic_Routing_Error_NO_INTERFACE);
+
+    lock_timed(_mutex);
+    _mutex.unlock();
+    _cv.notify_all();
+}
+
+/*
+ * Called on the I/O thread after every batch of input; copying a large
+ * node table for every single packet would cost more than it is worth.
+ */
+void MeshClient::publishIfDue(void)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
 
-        currentTime = time(NULL);
-        localTime = localtime(&currentTime);
-        if (last_min != localTime->tm_min) {
-            last_min = localTime->tm_min;
-            crontab(localTime);
+    if ((now - _lastPublish) <
+        chrono::milliseconds(SNAPSHOT_INTERVAL_MS)) {
+        return;
+    }
+
+    _lastPublish = now;
+    publish();
+}
+
+void MeshClient::matchRequest(const meshtastic_MeshPacket &packet,
+                              const meshtastic_Routing *routing)
+{
+    meshtastic_Routing_Error error = meshtastic_Routing_Error_NONE;
+    map<uint32_t, shared_ptr<PendingRequest>>::iterator it;
+    shared_ptr<PendingRequest> request;
+    RequestCallback callback;
+    uint32_t id = packet.decoded.request_id;
+    unsigned int ms;
+
+    if ((routing != NULL) &&
+        (routing->which_variant == meshtastic_Routing_error_reason_tag)) {
+        error = routing->error_reason;
+    }
+
+    lock_timed(_requestMutex);
+
+    it = _requests.find(id);
+    if (it == _requests.end()) {
+        /* Not ours, or already completed */
+        _requestMutex.unlock();
+        return;
+    }
+    request = it->second;
+
+    /* Karn: only a first transmission gives an unambiguous sample */
+    if ((request->attempts == 1) &&
+        (error == meshtastic_Routing_Error_NONE)) {
+        ms = (unsigned int) chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - request->sent).count();
+        sampleRtt(request->packet.to, ms);
+    }
+
+    if ((routing != NULL) && (error == meshtastic_Routing_Error_NONE) &&
+        request->packet.decoded.want_response) {
+        /* Only the hop ACK, keep waiting for the reply itself */
+        _requestMutex.unlock();
+        return;
+    }
+
+    if ((error == meshtastic_Routing_Error_MAX_RETRANSMIT) ||
+        (error == meshtastic_Routing_Error_TIMEOUT)) {
+        if (id != request->packet.id) {
+            /* The radio gave up on an earlier try, a later one is out */
+            _requestMutex.unlock();
+            return;
+        }
+
+        if (request->retries > 0) {
+            /* The radio gave up on it; let the next tick resend */
+            request->deadline = chrono::steady_clock::now();
+            _requestMutex.unlock();
+            return;
         }
     }
 
-    sendDisconnect();
-    mt_serial_detach(&_mtc);
+    callback = request->callback;
+    completeRequest(*request);
 
-    return;
+    _requestMutex.unlock();
+
+    if (callback) {
+        callback(request->id, error, (routing == NULL) ? &packet : NULL);
+    }
+}
+
+void MeshClient::expireRequests(void)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    vector<shared_ptr<PendingRequest>> due, expired;
+    vector<meshtastic_MeshPacket> resend;
+    map<uint32_t, shared_ptr<PendingRequest>>::iterator it;
+    vector<shared_ptr<PendingRequest>>::iterator r;
+
+    lock_timed(_requestMutex);
+
+    for (it = _requests.begin(); it != _requests.end(); it++) {
+        /* Once per request: its deadline is that of the latest try */
+        if ((it->first == it->second->packet.id) &&
+            (now >= it->second->deadline)) {
+            due.push_back(it->second);
+        }
+    }
+
+    /*
+     * Each retry goes out under a fresh id so relays do not drop it as a
+     * duplicate, with the timeout backed off from the RTT estimate. The
+     * ids of the earlier tries stay mapped, their ACKs may still come in.
+     */
+    for (r = due.begin(); r != due.end(); r++) {
+        PendingRequest &request = **r;
+
+        if (request.retries == 0) {
+            completeRequest(request);
+            expired.push_back(*r);
+            continue;
+        }
+
+        request.retries--;
+        request.attempts++;
+        request.rto = min(max(request.rto * 2, rto(request.packet.to)),
+                          REQUEST_MAX_RTO_MS);
+        request.packet.id = mt_packet_id(&_mtc);
+        request.ids.push_back(request.packet.id);
+        request.sent = now;
+        request.deadline = now + chrono::milliseconds(request.rto);
+        _requests[request.packet.id] = *r;
+        resend.push_back(request.packet);
+    }
+
+    _requestMutex.unlock();
+
+    for (vector<meshtastic_MeshPacket>::iterator p = resend.begin();
+         p != resend.end(); p++) {
+        /* A failed write is simply retried (or expired) on its deadline */
+        mt_send_packet(&_mtc, &*p);
+    }
+
+    mt_metric_add(_mRetransmits, resend.size());
+    mt_metric_add(_mRequestTimeouts, expired.size());
+
+    for (r = expired.begin(); r != expired.end(); r++) {
+        if ((*r)->callback) {
+            (*r)->callback((*r)->id, meshtastic_Routing_Error_TIMEOUT, NULL);
+        }
+    }
+}
+
+void MeshClient::failRequests(meshtastic_Routing_Error error)
+{
+    map<uint32_t, shared_ptr<PendingRequest>> requests;
+    map<uint32_t, shared_ptr<PendingRequest>>::iterator it;
+
+    lock_timed(_requestMutex);
+    requests.swap(_requests);
+    _requestMutex.unlock();
+
+    for (it = requests.begin(); it != requests.end(); it++) {
+        if ((it->first == it->second->id) && it->second->callback) {
+            it->second->callback(it->first, error, NULL);
+        }
+    }
+}
+
+/* Forgets every try of a request. Callers hold _requestMutex. */
+void MeshClient::completeRequest(const PendingRequest &request)
+{
+    vector<uint32_t>::const_iterator it;
+
+    for (it = request.ids.begin(); it != request.ids.end(); it++) {
+        _requests.erase(*it);
+    }
+}
+
+/*
+ * RFC 6298 style estimator, kept per destination node and in milliseconds.
+ * Callers hold _requestMutex.
+ */
+unsigned int MeshClient::rto(uint32_t dest) const
+{
+    map<uint32_t, RttEstimate>::const_iterator it;
+    unsigned int ms;
+
+    it = _rtt.find(dest);
+    if (it == _rtt.end()) {
+        return REQUEST_INITIAL_RTO_MS;
+    }
+
+    ms = it->second.srtt + 4 * it->second.rttvar;
+    ms = max(ms, REQUEST_MIN_RTO_MS);
+    ms = min(ms, REQUEST_MAX_RTO_MS);
+
+    return ms;
+}
+
+void MeshClient::sampleRtt(uint32_t dest, unsigned int ms)
+{
+    map<uint32_t, RttEstimate>::iterator it;
+    unsigned int delta;
+
+    it = _rtt.find(dest);
+    if (it == _rtt.end()) {
+        _rtt[dest].srtt = ms;
+        _rtt[dest].rttvar = ms / 2;
+        return;
+    }
+
+    delta = (it->second.srtt > ms) ?
+        (it->second.srtt - ms) : (ms - it->second.srtt);
+    it->second.rttvar = (3 * it->second.rttvar + delta) / 4;
+    it->second.srtt = (7 * it->second.srtt + ms) / 8;
 }
 
 void MeshClient::crontab(const struct tm *now)
@@ -13,12 +13,18 @@
 #include <condition_variable>
 #include <thread>
 #include <memory>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <unordered_set>
 #include <libmeshtastic.h>
 #include <SimpleClient.hxx>
+#include <WarmCache.hxx>
 
 using namespace std;
 
 class HomeChat;
+class MeshLoop;
 
 /*
  * Suitable for use on a full system with OS (x86, aarch64, etc.)
@@ -32,7 +38,12 @@ public:
 
     virtual void clear(void);
 
-    bool attachSerial(string device);
+    bool attach(const struct mt_transport_ops *ops, string device,
+                shared_ptr<MeshLoop> loop = NULL);
+    bool attachSerial(string device, shared_ptr<MeshLoop> loop = NULL);
+    bool attachTcp(string host, uint16_t port = MT_TCP_DEFAULT_PORT,
+                   shared_ptr<MeshLoop> loop = NULL);
+    bool attachReplay(string path, float speed = 0.0f);
     void detach(void);
     void join(void);
 
@@ -45,6 +56,57 @@ public:
     unsigned int heartbeatSeconds(void) const;
     void setHeartbeatSeconds(unsigned int seconds);
 
+    /* pcapng capture of every frame; start it before attaching */
+    bool startCapture(const string &path);
+    void stopCapture(void);
+    bool isCapturing(void) const;
+
+    /*
+     * Per-packet latency tracing into the trace.* metrics; with a path,
+     * every sample'th frame is also written as Chrome trace events
+     */
+    bool startTrace(const string &path = "", unsigned int sample = 1);
+    void stopTrace(void);
+    bool isTracing(void) const;
+
+    /*
+     * Warm start: the config and node DB of the last complete session are
+     * kept in a WarmCache. They are loaded at attach if the node is given
+     * here, or else as soon as the radio names itself in my_info, so the
+     * nodes, channels and configs are there right away; the records that
+     * want_config brings in then replace them one by one. Until the
+     * session completes, isWarm() is true and the nodes that the radio has
+     * not reported again are stale; those it never does are dropped once
+     * it completes. A reboot or reconnect keeps the state the same way
+     * instead of clearing it. isWarm() and the rest read the snapshot,
+     * so they may lag by up to a tick; saveWarmStart() has the I/O thread
+     * save at its next tick.
+     */
+    bool warmStart(void) const;
+    void enableWarmStart(bool enable, uint32_t node_num = 0);
+    bool isWarm(void) const;
+    unsigned int warmAgeSeconds(void) const;
+    size_t staleNodes(void) const;
+    bool isStale(uint32_t node_num) const;
+    bool saveWarmStart(void);
+
+    /*
+     * Auto-reconnect: instead of stopping the client, a link that fails,
+     * that the transmit queue cannot write to, or that brings in no frame
+     * for livenessSeconds is dropped and reopened by the transport with
+     * exponential backoff, serial through its /dev/serial/by-id link so
+     * that USB re-enumeration is followed. Half way through a silent
+     * window the radio is probed with a metadata request, so a quiet mesh
+     * is not taken for a dead link; 0 turns the watchdog off. A full
+     * transmit queue is not a failure, the send is retried. The node DB
+     * and counters are kept across a reconnect or reboot, as with warm
+     * start. Set it up before attaching.
+     */
+    bool autoReconnect(void) const;
+    void enableAutoReconnect(bool enable, unsigned int livenessSeconds = 90);
+    unsigned int livenessSeconds(void) const;
+    uint32_t reconnects(void) const;
+
     bool sendDisconnect(void);
     bool sendWantConfig(void);
     bool sendHeartbeat(void);
@@ -54,9 +116,51 @@ public:
 
     bool adminMessageReboot(unsigned int seconds = 0);
 
+    /*
+     * Tracked requests: the packet goes out with want_ack and is kept until
+     * the mesh ACKs it (or, with decoded.want_response, the reply carrying
+     * its id in request_id arrives). Unanswered sends are retried after a
+     * timeout derived from the measured RTT to the destination, each try
+     * under a fresh id; an answer to any of them completes the request.
+     * The callback runs on the I/O thread with the id of the first try
+     * and meshtastic_Routing_Error_NONE, the NAK reason, or TIMEOUT once
+     * the retries are used up; reply is only set for want_response
+     * replies.
+     */
+    typedef function<void(uint32_t id, meshtastic_Routing_Error error,
+                          const meshtastic_MeshPacket *reply)> RequestCallback;
+
+    bool sendRequest(meshtastic_MeshPacket &packet, RequestCallback callback,
+                     unsigned int retries = 2);
+    bool textMessageRequest(uint32_t dest, uint8_t channel,
+                            const string &message, RequestCallback callback,
+                            unsigned int hop_start = 3,
+                            unsigned int retries = 2);
+    future<meshtastic_Routing_Error> textMessageAsync(
+        uint32_t dest, uint8_t channel, const string &message,
+        unsigned int hop_start = 3, unsigned int retries = 2);
+
+    size_t pendingRequests(void) const;
+    unsigned int retransmitTimeoutMs(uint32_t dest) const;
+
     unsigned int hopsAway(uint32_t node_num) const;
     unsigned int hopsAway(const meshtastic_MeshPacket &packet) const;
 
+    /*
+     * Other threads must not touch nodes(), channels() and the like while
+     * the client runs; they take a snapshot instead. The I/O thread
+     * publishes those in batches, no more than ten a second, so a
+     * snapshot may lag the client by up to a tick.
+     */
+    virtual shared_ptr<const ClientSnapshot> snapshot(void);
+
+    /*
+     * Unless one was registered before, attaching registers the client's
+     * metrics as "client.<device>", the device's base name with anything
+     * but letters, digits, '-' and '_' turned into '_'.
+     */
+    virtual bool registerMetrics(const string &prefix);
+
     inline uint32_t whoami(void) const {
         return SimpleClient::whoami();
     }
@@ -223,6 +327,14 @@ protected:
     virtual void gotFileInfo(const meshtastic_FileInfo &fileInfo);
     virtual void gotDeviceUIConfig(const meshtastic_DeviceUIConfig &deviceUIConfig);
     virtual void gotMqttClientProxyMessage(const meshtastic_MqttClientProxyMessage &m);
+    virtual void gotBadPayload(const meshtastic_MeshPacket &packet);
+
+    /*
+     * Text goes to the HomeChat, if there is one, as a view of the payload;
+     * gotTextMessage() and its copy are only used without one.
+     */
+    virtual void gotTextView(const meshtastic_MeshPacket &packet,
+                             TextView message);
 
     inline virtual void gotTextMessage(const meshtastic_MeshPacket &packet,
                                        const string &message) {
@@ -239,10 +351,8 @@ protected:
         SimpleClient::gotUser(packet, user);
     }
 
-    inline void gotRouting(const meshtastic_MeshPacket &packet,
-                           const meshtastic_Routing &routing) {
-        SimpleClient::gotRouting(packet, routing);
-    }
+    virtual void gotRouting(const meshtastic_MeshPacket &packet,
+                            const meshtastic_Routing &routing);
 
     inline void gotAdminMessage(const meshtastic_MeshPacket &packet,
                          const meshtastic_AdminMessage &adminMessage) {
@@ -346,20 +456,111 @@ protected:
 
 private:
 
+    friend class MeshLoop;
+
+    bool launch(shared_ptr<MeshLoop> loop);
     void stop(void);
     static void thread_function(MeshClient *mtc);
     void run(void);
+    void begin(void);
+    bool tick(void);
+    void teardown(void);
+    void publishIfDue(void);
+    virtual void publishing(ClientSnapshot &snap,
+                            const ClientSnapshot *prev);
+
+    bool loadWarmStart(uint32_t node_num);
+    bool writeWarmStart(void);
+    void staleChanged(void);
+    void applyWarmStart(const meshtastic_FromRadio &fromRadio);
+    void rewarm(void);
+    void reconcileWarmStart(void);
+
+    void supervise(time_t now);
+    bool reconnect(const char *why);
+
+    struct PendingRequest;
+
+    void matchRequest(const meshtastic_MeshPacket &packet,
+                      const meshtastic_Routing *routing);
+    void expireRequests(void);
+    void failRequests(meshtastic_Routing_Error error);
+    void completeRequest(const PendingRequest &request);
+    unsigned int rto(uint32_t dest) const;
+    void sampleRtt(uint32_t dest, unsigned int ms);
 
 private:
 
+    /* Shared by the ids of all its tries, the first one being id */
+    struct PendingRequest {
+        uint32_t id;
+        vector<uint32_t> ids;
+        meshtastic_MeshPacket packet;
+        RequestCallback callback;
+        chrono::steady_clock::time_point sent;
+        chrono::steady_clock::time_point deadline;
+        unsigned int rto;
+        unsigned int retries;
+        unsigned int attempts;
+    };
+
+    struct RttEstimate {
+        unsigned int srtt;
+        unsigned int rttvar;
+    };
+
     bool _verbose;
     bool _logStderr;
     unsigned int _heartbeatSeconds;
 
     shared_ptr<thread> _thread;
+    shared_ptr<MeshLoop> _loop;
     mutex _mutex;
+    mutex _loopMutex;
+    condition_variable _cv;
     bool _isRunning;
 
+    time_t _lastHeartbeat;
+    time_t _lastWantConfig;
+    int _lastMin;
+    uint32_t _lastConnects;
+    uint32_t _loopConnects;
+    atomic<bool> _loopPendingInput;
+    atomic<bool> _loopPendingTxq;
+    atomic<bool> _clearPending;
+    atomic<bool> _saveWarmPending;
+    unsigned int _lastSyncStages;
+    unsigned int _lastSyncNodeInfos;
+    chrono::steady_clock::time_point _lastPublish;
+
+    mutable mutex _requestMutex;
+    map<uint32_t, shared_ptr<PendingRequest>> _requests;
+    map<uint32_t, RttEstimate> _rtt;
+
+    WarmCache _warmCache;
+    bool _warmStart;
+    uint32_t _warmNodeNum;
+    uint32_t _warmFor;
+    bool _warm;
+    bool _applyingWarm;
+    time_t _warmSavedAt;
+    time_t _lastWarmSave;
+    uint64_t _warmGeneration;
+    unordered_set<uint32_t> _staleNodes;
+
+    bool _autoReconnect;
+    unsigned int _livenessSeconds;
+    uint32_t _reconnects;
+    time_t _lastLink;
+    time_t _lastProbe;
+    uint32_t _lastTxqErrors;
+
+    struct mt_metric *_mRequests;
+    struct mt_metric *_mRetransmits;
+    struct mt_metric *_mRequestTimeouts;
+    struct mt_metric *_mStaleNodes;
+    struct mt_metric *_mReconnects;
+
 };
 
 #endif
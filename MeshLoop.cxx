@@ -0,0 +1,534 @@
+/*
+ * MeshLoop.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <iostream>
+#include <algorithm>
+#include <LibMeshtastic.hxx>
+
+#define MESHLOOP_MAX_EVENTS 16
+
+/*
+ * A client's transmit queue eventfd is registered under the client pointer
+ * with the low bit set, to tell it apart from the transport fd.
+ */
+#define MESHLOOP_TXQ_TAG ((uintptr_t) 1)
+
+static struct mt_metric *mutex_wait_ns = NULL;
+static struct mt_metric *busy_skips = NULL;
+
+/* A link still connecting is waited on until it turns writable */
+static uint32_t input_events(MeshClient *client)
+{
+    return (mt_connecting(&client->_mtc) ? EPOLLOUT : EPOLLIN) |
+        EPOLLONESHOT;
+}
+
+static void lock_timed(mutex &m)
+{
+    uint64_t t0;
+
+    if (m.try_lock()) {
+        return;
+    }
+
+    t0 = mt_impl_now_ns();
+    m.lock();
+    mt_metric_observe(mt_metric_lazy(&mutex_wait_ns,
+                                     "meshloop.mutex_wait_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      mt_impl_now_ns() - t0);
+}
+
+MeshLoop::MeshLoop()
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+
+    _isRunning = false;
+
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd == -1) {
+        cerr << "epoll_create1: " << strerror(errno) << endl;
+    }
+
+    /* One periodic tick drives want_config/heartbeat/crontab for everyone */
+    _timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_timerfd == -1) {
+        cerr << "timerfd_create: " << strerror(errno) << endl;
+    } else {
+        bzero(&its, sizeof(its));
+        its.it_value.tv_sec = 1;
+        its.it_interval.tv_sec = 1;
+        if (timerfd_settime(_timerfd, 0, &its, NULL) == -1) {
+            cerr << "timerfd_settime: " << strerror(errno) << endl;
+        }
+
+        bzero(&ev, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = this;
+        if ((_epfd != -1) &&
+            (epoll_ctl(_epfd, EPOLL_CTL_ADD, _timerfd, &ev) == -1)) {
+            cerr << "epoll_ctl: " << strerror(errno) << endl;
+        }
+    }
+}
+
+MeshLoop::~MeshLoop()
+{
+    stop();
+    join();
+
+    if (_timerfd != -1) {
+        close(_timerfd);
+        _timerfd = -1;
+    }
+
+    if (_epfd != -1) {
+        close(_epfd);
+        _epfd = -1;
+    }
+}
+
+bool MeshLoop::start(unsigned int threads)
+{
+    bool result = false;
+    unsigned int i;
+
+    if ((_epfd == -1) || (_timerfd == -1)) {
+        goto done;
+    }
+
+    if (_isRunning) {
+        goto done;
+    }
+
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    _isRunning = true;
+    for (i = 0; i < threads; i++) {
+        _threads.push_back(make_shared<thread>(thread_function, this));
+    }
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+void MeshLoop::stop(void)
+{
+    _isRunning = false;
+}
+
+void MeshLoop::join(void)
+{
+    for (vector<shared_ptr<thread>>::iterator it = _threads.begin();
+         it != _threads.end(); it++) {
+        if ((*it)->joinable()) {
+            (*it)->join();
+        }
+    }
+
+    _threads.clear();
+}
+
+size_t MeshLoop::clients(void) const
+{
+    size_t n;
+
+    lock_timed(_mutex);
+    n = _clients.size();
+    _mutex.unlock();
+
+    return n;
+}
+
+bool MeshLoop::add(MeshClient *client)
+{
+    bool result = false;
+    struct epoll_event ev;
+
+    if ((client == NULL) || (mt_poll_fd(&client->_mtc) < 0)) {
+        goto done;
+    }
+
+    lock_timed(_mutex);
+
+    if (find(_clients.begin(), _clients.end(), client) != _clients.end()) {
+        _mutex.unlock();
+        goto done;
+    }
+
+    if (!watch(client)) {
+        _mutex.unlock();
+        goto done;
+    }
+
+    if (mt_txq_fd(&client->_mtc) >= 0) {
+        bzero(&ev, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = (uintptr_t) client | MESHLOOP_TXQ_TAG;
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, mt_txq_fd(&client->_mtc),
+                      &ev) == -1) {
+            cerr << "epoll_ctl: " << strerror(errno) << endl;
+            epoll_ctl(_epfd, EPOLL_CTL_DEL, mt_poll_fd(&client->_mtc), NULL);
+            _mutex.unlock();
+            goto done;
+        }
+    }
+
+    _clients.push_back(client);
+
+    _mutex.unlock();
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+/*
+ * Oneshot so that exactly one loop thread owns a client's input at a
+ * time; it is re-armed once the ring has been drained. Called again once
+ * the transport has started or finished reconnecting, as closing the old
+ * fd took it out of the epoll set.
+ */
+bool MeshLoop::watch(MeshClient *client)
+{
+    bool result = false;
+    struct epoll_event ev;
+    int fd = mt_poll_fd(&client->_mtc);
+
+    if (fd < 0) {
+        goto done;
+    }
+
+    bzero(&ev, sizeof(ev));
+    ev.events = input_events(client);
+    ev.data.ptr = client;
+    if ((epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) &&
+        ((errno != EEXIST) ||
+         (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == -1))) {
+        cerr << "epoll_ctl: " << strerror(errno) << endl;
+        goto done;
+    }
+
+    client->_loopConnects = client->_mtc.connects;
+    result = true;
+
+done:
+
+    return result;
+}
+
+/* Same as watch(), unless remove() got there first */
+void MeshLoop::rewatch(MeshClient *client)
+{
+    lock_timed(_mutex);
+    if (find(_clients.begin(), _clients.end(), client) != _clients.end()) {
+        watch(client);
+    }
+    _mutex.unlock();
+}
+
+bool MeshLoop::remove(MeshClient *client)
+{
+    bool result = false;
+    vector<MeshClient *>::iterator it;
+
+    lock_timed(_mutex);
+
+    it = find(_clients.begin(), _clients.end(), client);
+    if (it == _clients.end()) {
+        _mutex.unlock();
+        goto done;
+    }
+
+    _clients.erase(it);
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, mt_poll_fd(&client->_mtc), NULL);
+    if (mt_txq_fd(&client->_mtc) >= 0) {
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, mt_txq_fd(&client->_mtc), NULL);
+    }
+
+    _mutex.unlock();
+
+    /* Wait out any loop thread that is still inside this client */
+    client->_loopMutex.lock();
+    client->_loopMutex.unlock();
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+void MeshLoop::thread_function(MeshLoop *loop)
+{
+    loop->run();
+}
+
+void MeshLoop::run(void)
+{
+    struct epoll_event events[MESHLOOP_MAX_EVENTS];
+    uint64_t expirations;
+    int i, n;
+
+    while (_isRunning) {
+        n = epoll_wait(_epfd, events, MESHLOOP_MAX_EVENTS, 500);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            cerr << "epoll_wait: " << strerror(errno) << endl;
+            _isRunning = false;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == this) {
+                /* Only the thread that consumes the expiration ticks */
+                if (read(_timerfd, &expirations, sizeof(expirations)) ==
+                    sizeof(expirations)) {
+                    tick();
+                }
+            } else if (events[i].data.u64 & MESHLOOP_TXQ_TAG) {
+                service((MeshClient *) (uintptr_t)
+                        (events[i].data.u64 & ~MESHLOOP_TXQ_TAG), true);
+            } else {
+                service((MeshClient *) events[i].data.ptr, false);
+            }
+        }
+    }
+}
+
+/*
+ * Ticks every client under the list lock, then moves the links that are
+ * down along once it has been released: the transport starts a reconnect
+ * once its backoff has expired, without blocking. The connecting fd is
+ * then watched for EPOLLOUT and service() finishes the connect; ticks
+ * only give up on one that has stalled past its deadline.
+ */
+void MeshLoop::tick(void)
+{
+    vector<MeshClient *> retired, down, busy;
+
+    lock_timed(_mutex);
+
+    for (vector<MeshClient *>::iterator it = _clients.begin();
+         it != _clients.end(); it++) {
+        MeshClient *client = *it;
+
+        if (!client->_loopMutex.try_lock()) {
+            continue;
+        }
+
+        if (client->_isRunning && (client->tick() != true)) {
+            client->_isRunning = false;
+        }
+
+        if (!client->_isRunning) {
+            retired.push_back(client);
+        } else if (client->_autoReconnect &&
+                   ((client->_mtc.fd < 0) ||
+                    mt_connecting(&client->_mtc))) {
+            /* Reopened below, still holding the client's own lock */
+            down.push_back(client);
+            continue;
+        }
+
+        client->_loopMutex.unlock();
+
+        if (client->_isRunning && pending(client)) {
+            busy.push_back(client);
+        }
+    }
+
+    _mutex.unlock();
+
+    for (vector<MeshClient *>::iterator it = down.begin();
+         it != down.end(); it++) {
+        MeshClient *client = *it;
+
+        /* The transport reopens it once its backoff has expired */
+        if ((mt_process(&client->_mtc, 0) < 0) &&
+            !client->reconnect(strerror(errno))) {
+            client->_isRunning = false;
+        }
+
+        if (client->_isRunning &&
+            (mt_connecting(&client->_mtc) ||
+             (client->_loopConnects != client->_mtc.connects))) {
+            /* Input is on a new fd */
+            rewatch(client);
+        }
+
+        client->_loopMutex.unlock();
+
+        if (!client->_isRunning) {
+            retired.push_back(client);
+        } else if (pending(client)) {
+            busy.push_back(client);
+        }
+    }
+
+    for (vector<MeshClient *>::iterator it = retired.begin();
+         it != retired.end(); it++) {
+        retire(*it);
+    }
+
+    /* Events that came in for the clients while they were held */
+    for (vector<MeshClient *>::iterator it = busy.begin();
+         it != busy.end(); it++) {
+        resume(*it);
+    }
+}
+
+void MeshLoop::service(MeshClient *client, bool txq)
+{
+    if (txq) {
+        client->_loopPendingTxq = true;
+    } else {
+        client->_loopPendingInput = true;
+    }
+
+    resume(client);
+}
+
+/*
+ * Services whatever is pending on a client. A thread that finds it held
+ * by another leaves its event pending, without re-arming it, as that
+ * would only have it spin on the busy client; the holder looks at what
+ * is pending again once it has let go.
+ */
+void MeshLoop::resume(MeshClient *client)
+{
+    bool input, txq, rewatched;
+    int ret;
+
+    lock_timed(_mutex);
+
+    for (;;) {
+        if (find(_clients.begin(), _clients.end(), client) ==
+            _clients.end()) {
+            /* Stale event for a client that has since been removed */
+            _mutex.unlock();
+            return;
+        }
+
+        if (!client->_loopMutex.try_lock()) {
+            mt_metric_add(mt_metric_lazy(&busy_skips, "meshloop.busy_skips",
+                                         MT_METRIC_COUNTER), 1);
+            _mutex.unlock();
+            return;
+        }
+
+        _mutex.unlock();
+
+        input = client->_loopPendingInput.exchange(false);
+        txq = client->_loopPendingTxq.exchange(false);
+        rewatched = false;
+
+        if (txq) {
+            /* Failures are counted by the queue, the reader notices EOF */
+            mt_txq_flush(&client->_mtc);
+        }
+
+        if (input && mt_connecting(&client->_mtc)) {
+            /* Writable: the connect is done, one way or another */
+            if ((mt_process(&client->_mtc, 0) < 0) &&
+                !client->reconnect(strerror(errno))) {
+                client->_isRunning = false;
+            }
+        } else if (input) {
+            ret = mt_drain(&client->_mtc);
+            if ((ret < 0) && !client->reconnect(strerror(errno))) {
+                client->_isRunning = false;
+            }
+            client->publishIfDue();
+        }
+
+        if (input && client->_isRunning &&
+            (mt_connecting(&client->_mtc) ||
+             (client->_loopConnects != client->_mtc.connects))) {
+            /* Connected, or moved on to the next address */
+            rewatch(client);
+            rewatched = true;
+        }
+
+        client->_loopMutex.unlock();
+
+        if (!client->_isRunning) {
+            retire(client);
+            return;
+        }
+
+        if (input && !rewatched) {
+            rearm(client, false);
+        }
+
+        if (txq) {
+            rearm(client, true);
+        }
+
+        lock_timed(_mutex);
+
+        if (!pending(client)) {
+            _mutex.unlock();
+            return;
+        }
+    }
+}
+
+/* Events left for whoever holds the client, see resume() */
+bool MeshLoop::pending(const MeshClient *client)
+{
+    return client->_loopPendingInput || client->_loopPendingTxq;
+}
+
+void MeshLoop::rearm(MeshClient *client, bool txq)
+{
+    struct epoll_event ev;
+
+    bzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    if (txq) {
+        ev.data.u64 = (uintptr_t) client | MESHLOOP_TXQ_TAG;
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, mt_txq_fd(&client->_mtc), &ev);
+    } else {
+        ev.events = input_events(client);
+        ev.data.ptr = client;
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, mt_poll_fd(&client->_mtc), &ev);
+    }
+}
+
+void MeshLoop::retire(MeshClient *client)
+{
+    /* Whoever wins the removal performs the teardown */
+    if (remove(client)) {
+        client->teardown();
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
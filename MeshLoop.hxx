@@ -0,0 +1,76 @@
+/*
+ * MeshLoop.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef MESHLOOP_HXX
+#define MESHLOOP_HXX
+
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <memory>
+
+using namespace std;
+
+class MeshClient;
+
+/*
+ * Services many MeshClient instances from a small, fixed pool of threads
+ * using epoll, instead of one blocking thread per radio.
+ */
+class MeshLoop {
+
+public:
+
+    MeshLoop();
+    ~MeshLoop();
+
+    bool start(unsigned int threads = 1);
+    void stop(void);
+    void join(void);
+
+    size_t clients(void) const;
+
+private:
+
+    friend class MeshClient;
+
+    bool add(MeshClient *client);
+    bool watch(MeshClient *client);
+    void rewatch(MeshClient *client);
+    bool remove(MeshClient *client);
+
+    static void thread_function(MeshLoop *loop);
+    void run(void);
+    void tick(void);
+    void service(MeshClient *client, bool txq);
+    void resume(MeshClient *client);
+    static bool pending(const MeshClient *client);
+    void rearm(MeshClient *client, bool txq);
+    void retire(MeshClient *client);
+
+private:
+
+    int _epfd;
+    int _timerfd;
+
+    vector<MeshClient *> _clients;
+    vector<shared_ptr<thread>> _threads;
+    mutable mutex _mutex;
+    bool _isRunning;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
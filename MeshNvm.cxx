@@ -18,6 +18,9 @@ using namespace libconfig;
 MeshNvm::MeshNvm()
 {
     _node_num = 0x0U;
+    _mLoadNs = mt_metric_register("nvm.load_ns", MT_METRIC_HISTOGRAM);
+    _mSaveNs = mt_metric_register("nvm.save_ns", MT_METRIC_HISTOGRAM);
+    _mErrors = mt_metric_register("nvm.errors", MT_METRIC_COUNTER);
 }
 
 MeshNvm::~MeshNvm()
@@ -149,6 +152,36 @@ static string pubkey_to_string(const meshtastic_User_public_key_t pubkey)
 }
 
 bool MeshNvm::loadNvm(void)
+{
+    bool result = false;
+    uint64_t t0;
+
+    t0 = mt_impl_now_ns();
+    result = readNvm();
+    mt_metric_observe(_mLoadNs, mt_impl_now_ns() - t0);
+    if (!result) {
+        mt_metric_add(_mErrors, 1);
+    }
+
+    return result;
+}
+
+bool MeshNvm::saveNvm(void)
+{
+    bool result = false;
+    uint64_t t0;
+
+    t0 = mt_impl_now_ns();
+    result = writeNvm();
+    mt_metric_observe(_mSaveNs, mt_impl_now_ns() - t0);
+    if (!result) {
+        mt_metric_add(_mErrors, 1);
+    }
+
+    return result;
+}
+
+bool MeshNvm::readNvm(void)
 {
     bool result = false;
     Config cfg;
@@ -245,13 +278,15 @@ bool MeshNvm::loadNvm(void)
     } catch (const SettingNotFoundException &e) {
     }
 
+    reindexNvm();
+
     result = true;
     _changed = true;
 
     return result;
 }
 
-bool MeshNvm::saveNvm(void)
+bool MeshNvm::writeNvm(void)
 {
     bool result = false;
     Config cfg;
@@ -33,10 +33,17 @@ public:
 
 protected:
 
+    bool readNvm(void);
+    bool writeNvm(void);
+
     uint32_t _node_num;
     string _path;
     bool _changed;
 
+    struct mt_metric *_mLoadNs;
+    struct mt_metric *_mSaveNs;
+    struct mt_metric *_mErrors;
+
 };
 
 #endif
@@ -0,0 +1,462 @@
+/*
+ * NodeTable.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <atomic>
+#include <NodeTable.hxx>
+
+/*
+ * use_count() is only a relaxed load. Once it says that nothing else
+ * holds p, the fence pairs with the release in the decrement of whichever
+ * snapshot let go of it last, on another thread, so that the writes that
+ * follow cannot overtake that snapshot's reads.
+ */
+template <typename T>
+static inline bool sole_owner(const shared_ptr<T> &p)
+{
+    if (p.use_count() != 1) {
+        return false;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+
+    return true;
+}
+
+NodeTable::NodeTable()
+    : _mask(0),
+      _generation(0),
+      _indexes(make_shared<NameIndexes>())
+{
+
+}
+
+/* Only the small flat parts are copied, the rest is shared */
+NodeTable::NodeTable(const NodeTable &table)
+    : _hot(table._hot),
+      _chunks(table._chunks),
+      _slots(table._slots),
+      _mask(table._mask),
+      _generation(table._generation),
+      _indexes(table._indexes)
+{
+
+}
+
+NodeTable::~NodeTable()
+{
+
+}
+
+void NodeTable::clear(void)
+{
+    _hot.clear();
+    _chunks.clear();
+    _slots.clear();
+    _mask = 0;
+    _indexes = make_shared<NameIndexes>();
+    _generation++;
+}
+
+/*
+ * Copies are only ever taken by the writer, so a chunk that nothing else
+ * holds cannot become shared behind its back.
+ */
+NodeTable::Chunk &NodeTable::own(size_t chunk)
+{
+    shared_ptr<Chunk> &c = _chunks[chunk];
+
+    if (!sole_owner(c)) {
+        c = make_shared<Chunk>(*c);
+    }
+
+    return *c;
+}
+
+NodeTable::NameIndexes &NodeTable::ownIndexes(void)
+{
+    if (!sole_owner(_indexes)) {
+        _indexes = make_shared<NameIndexes>(*_indexes);
+    }
+
+    return *_indexes;
+}
+
+int NodeTable::indexOf(uint32_t num) const
+{
+    size_t i;
+
+    if (_slots.empty()) {
+        return -1;
+    }
+
+    for (i = hash(num) & _mask; _slots[i].index != 0; i = (i + 1) & _mask) {
+        if (_slots[i].num == num) {
+            return (int) (_slots[i].index - 1);
+        }
+    }
+
+    return -1;
+}
+
+const Node *NodeTable::find(uint32_t num) const
+{
+    int index = indexOf(num);
+
+    return (index >= 0) ? &node(index) : NULL;
+}
+
+Node *NodeTable::find(uint32_t num)
+{
+    int index = indexOf(num);
+
+    return (index >= 0) ? &node(index) : NULL;
+}
+
+const NodeHot *NodeTable::findHot(uint32_t num) const
+{
+    int index = indexOf(num);
+
+    return (index >= 0) ? &_hot[index] : NULL;
+}
+
+const NodeMetrics *NodeTable::findMetrics(uint32_t num) const
+{
+    const Node *n = find(num);
+
+    return (n != NULL) ? n->metrics.get() : NULL;
+}
+
+int NodeTable::lookup(const NameIndex &index, const string &key)
+{
+    pair<NameIndex::const_iterator, NameIndex::const_iterator> range;
+    NameIndex::const_iterator it;
+    int found = -1;
+
+    if (key.empty()) {
+        return -1;
+    }
+
+    range = index.equal_range(key);
+    for (it = range.first; it != range.second; it++) {
+        if ((found < 0) || (it->second < (uint32_t) found)) {
+            found = (int) it->second;
+        }
+    }
+
+    return found;
+}
+
+void NodeTable::unlink(NameIndex &index, const string &key, uint32_t i)
+{
+    pair<NameIndex::iterator, NameIndex::iterator> range;
+    NameIndex::iterator it;
+
+    if (key.empty()) {
+        return;
+    }
+
+    range = index.equal_range(key);
+    for (it = range.first; it != range.second; it++) {
+        if (it->second == i) {
+            index.erase(it);
+            break;
+        }
+    }
+}
+
+int NodeTable::indexOfShortName(const string &name) const
+{
+    return lookup(_indexes->shortNames, name);
+}
+
+int NodeTable::indexOfLongName(const string &name) const
+{
+    return lookup(_indexes->longNames, name);
+}
+
+int NodeTable::indexOfKey(const meshtastic_User_public_key_t &key) const
+{
+    return lookup(_indexes->publicKeys,
+                  string((const char *) key.bytes, key.size));
+}
+
+void NodeTable::rehash(size_t buckets)
+{
+    size_t i, j;
+
+    _slots.assign(buckets, Slot());
+    _mask = buckets - 1;
+
+    for (i = 0; i < _hot.size(); i++) {
+        for (j = hash(_hot[i].num) & _mask; _slots[j].index != 0;
+             j = (j + 1) & _mask);
+        _slots[j].num = _hot[i].num;
+        _slots[j].index = (uint32_t) (i + 1);
+    }
+}
+
+/*
+ * Returns the index of the node, adding it with an empty NodeInfo if it
+ * was not known yet.
+ */
+size_t NodeTable::insert(uint32_t num)
+{
+    size_t i, index;
+    NodeHot hot;
+    Node *n;
+
+    if (!_slots.empty()) {
+        for (i = hash(num) & _mask; _slots[i].index != 0;
+             i = (i + 1) & _mask) {
+            if (_slots[i].num == num) {
+                return _slots[i].index - 1;
+            }
+        }
+    }
+
+    /* Keep the load factor at or below 3/4 */
+    if (((_hot.size() + 1) * 4) > (_slots.size() * 3)) {
+        rehash(_slots.empty() ? 16 : (_slots.size() * 2));
+    }
+
+    index = _hot.size();
+    if ((index % NODE_CHUNK) == 0) {
+        _chunks.push_back(make_shared<Chunk>());
+    }
+
+    n = &node(index);
+    bzero(&n->info, sizeof(n->info));
+    n->info.num = num;
+    formatNames(n->names, num, NULL);
+    n->metrics.reset();
+
+    bzero(&hot, sizeof(hot));
+    hot.num = num;
+    _hot.push_back(hot);
+    ownIndexes().keys.push_back(Keys());
+
+    for (i = hash(num) & _mask; _slots[i].index != 0; i = (i + 1) & _mask);
+    _slots[i].num = num;
+    _slots[i].index = (uint32_t) (index + 1);
+    _generation++;
+
+    return index;
+}
+
+/*
+ * Brings what node i is indexed under up to date with the len bytes at p,
+ * if they differ; a NODEINFO that changes nothing costs no allocation.
+ */
+bool NodeTable::relink(NameIndex &index, string &key, const char *p,
+                       size_t len, uint32_t i)
+{
+    if (key.compare(0, string::npos, p, len) == 0) {
+        return false;
+    }
+
+    unlink(index, key, i);
+    key.assign(p, len);
+    if (!key.empty()) {
+        index.insert(make_pair(key, i));
+    }
+
+    return true;
+}
+
+void NodeTable::update(size_t index)
+{
+    const meshtastic_NodeInfo &info = node(index).info;
+    NodeHot &hot = _hot[index];
+    const Keys *keys = &_indexes->keys[index];
+    NameIndexes *indexes;
+    size_t shortLen = 0, longLen = 0, keyLen = 0;
+    bool renamed;
+
+    _generation++;
+
+    hot.last_heard = info.last_heard;
+    hot.snr = info.snr;
+    hot.has_user = info.has_user;
+    hot.has_hops_away = info.has_hops_away;
+    hot.hops_away = (uint8_t) info.hops_away;
+    strncpy(hot.short_name, info.user.short_name, sizeof(hot.short_name) - 1);
+    hot.short_name[sizeof(hot.short_name) - 1] = '\0';
+
+    if (info.has_user) {
+        shortLen = strnlen(info.user.short_name,
+                           sizeof(info.user.short_name));
+        longLen = strnlen(info.user.long_name, sizeof(info.user.long_name));
+        keyLen = info.user.public_key.size;
+    }
+
+    if ((keys->shortName.compare(0, string::npos, info.user.short_name,
+                                 shortLen) == 0) &&
+        (keys->longName.compare(0, string::npos, info.user.long_name,
+                                longLen) == 0) &&
+        (keys->key.compare(0, string::npos,
+                           (const char *) info.user.public_key.bytes,
+                           keyLen) == 0)) {
+        /* The usual case, and the indexes stay shared with any copy */
+        return;
+    }
+
+    indexes = &ownIndexes();
+    renamed = relink(indexes->shortNames, indexes->keys[index].shortName,
+                     info.user.short_name, shortLen, (uint32_t) index);
+    renamed = relink(indexes->longNames, indexes->keys[index].longName,
+                     info.user.long_name, longLen, (uint32_t) index) ||
+        renamed;
+    relink(indexes->publicKeys, indexes->keys[index].key,
+           (const char *) info.user.public_key.bytes, keyLen,
+           (uint32_t) index);
+
+    if (renamed) {
+        formatNames(node(index).names, info.num,
+                    info.has_user ? &info.user : NULL);
+    }
+}
+
+size_t NodeTable::put(const meshtastic_NodeInfo &info)
+{
+    size_t index = insert(info.num);
+
+    node(index).info = info;
+    update(index);
+
+    return index;
+}
+
+size_t NodeTable::putUser(uint32_t num, const meshtastic_User &user)
+{
+    size_t index = insert(num);
+    meshtastic_NodeInfo &info = node(index).info;
+
+    info.user = user;
+    info.has_user = true;
+    update(index);
+
+    return index;
+}
+
+/*
+ * Drops the given nodes, keeping the others in order. They are numbered
+ * anew, so like clear() this invalidates indexes and Node addresses.
+ */
+size_t NodeTable::prune(const unordered_set<uint32_t> &nums)
+{
+    vector<shared_ptr<Chunk>> chunks;
+    size_t i, n = _hot.size(), index, dropped = 0;
+
+    if (nums.empty()) {
+        return 0;
+    }
+
+    /* Hold on to the old nodes while the table is filled again */
+    chunks.swap(_chunks);
+    clear();
+
+    for (i = 0; i < n; i++) {
+        const Node &from = chunks[i / NODE_CHUNK]->nodes[i % NODE_CHUNK];
+
+        if (nums.count(from.info.num) != 0) {
+            dropped++;
+            continue;
+        }
+
+        index = insert(from.info.num);
+        node(index).info = from.info;
+        node(index).metrics = from.metrics;
+        update(index);
+    }
+
+    return dropped;
+}
+
+static size_t copyName(char *dst, char *safe, const char *src, size_t max)
+{
+    size_t len;
+
+    for (len = 0; (len < max) && (src[len] != '\0'); len++) {
+        dst[len] = src[len];
+        safe[len] = isprint((unsigned char) src[len]) ? src[len] : '?';
+    }
+    dst[len] = '\0';
+    safe[len] = '\0';
+
+    return len;
+}
+
+/*
+ * Without a user, or a short name, the short name falls back to the low
+ * 16 bits of the node number in hex.
+ */
+void NodeTable::formatNames(NodeNames &names, uint32_t num,
+                            const meshtastic_User *user)
+{
+    size_t len;
+
+    bzero(&names, sizeof(names));
+    snprintf(names.id, sizeof(names.id), "!%.8x", (unsigned int) num);
+
+    if (num == 0xffffffffU) {
+        len = copyName(names.short_name, names.safe_short_name, "****", 4);
+        names.short_len = (uint8_t) len;
+        len = copyName(names.long_name, names.safe_long_name, "broadcast",
+                       sizeof(names.long_name) - 1);
+        names.long_len = (uint8_t) len;
+    } else if (user != NULL) {
+        len = copyName(names.short_name, names.safe_short_name,
+                       user->short_name, sizeof(names.short_name) - 1);
+        names.short_len = (uint8_t) len;
+        len = copyName(names.long_name, names.safe_long_name,
+                       user->long_name, sizeof(names.long_name) - 1);
+        names.long_len = (uint8_t) len;
+    }
+
+    if (names.short_len == 0) {
+        snprintf(names.short_name, sizeof(names.short_name), "%.4x",
+                 (unsigned int) (num & 0xffffU));
+        memcpy(names.safe_short_name, names.short_name,
+               sizeof(names.short_name));
+        names.short_len = 4;
+    }
+
+    snprintf(names.display_name, sizeof(names.display_name), "%s (%s)",
+             names.short_name, names.id);
+    snprintf(names.safe_display_name, sizeof(names.safe_display_name),
+             "%s (%s)", names.safe_short_name, names.id);
+    names.display_len = (uint8_t) strlen(names.display_name);
+}
+
+NodeMetrics &NodeTable::metrics(size_t index)
+{
+    Node &n = node(index);
+
+    /* The caller is about to write to it */
+    _generation++;
+
+    if (!n.metrics) {
+        n.metrics = make_shared<NodeMetrics>();
+    } else if (!sole_owner(n.metrics)) {
+        n.metrics = make_shared<NodeMetrics>(*n.metrics);
+    }
+
+    return *n.metrics;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,286 @@
+/*
+ * NodeTable.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef NODETABLE_HXX
+#define NODETABLE_HXX
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <libmeshtastic.h>
+
+using namespace std;
+
+/*
+ * The fields that walks and probes of the node table look at, kept
+ * together in one small record per node.
+ */
+struct NodeHot {
+    uint32_t num;
+    uint32_t last_heard;
+    float snr;
+    bool has_user;
+    bool has_hops_away;
+    uint8_t hops_away;
+    char short_name[5];
+};
+
+/*
+ * Latest telemetry of each kind heard from a node; allocated on the first
+ * report, as most nodes never send any, and shared with copies of the
+ * table until either side writes to it.
+ */
+struct NodeMetrics {
+    bool has_device_metrics;
+    meshtastic_DeviceMetrics device_metrics;
+    bool has_environment_metrics;
+    meshtastic_EnvironmentMetrics environment_metrics;
+    bool has_air_quality_metrics;
+    meshtastic_AirQualityMetrics air_quality_metrics;
+    bool has_power_metrics;
+    meshtastic_PowerMetrics power_metrics;
+    bool has_local_stats;
+    meshtastic_LocalStats local_stats;
+    bool has_health_metrics;
+    meshtastic_HealthMetrics health_metrics;
+    bool has_host_metrics;
+    meshtastic_HostMetrics host_metrics;
+};
+
+/*
+ * A node's names, formatted once whenever its user changes so that
+ * printing them costs nothing. The safe_ variants have unprintable
+ * characters replaced by '?' and are the same length as the others.
+ */
+struct NodeNames {
+    char id[10];
+    char short_name[5];
+    char long_name[sizeof(meshtastic_User::long_name)];
+    char display_name[20];
+    char safe_short_name[5];
+    char safe_long_name[sizeof(meshtastic_User::long_name)];
+    char safe_display_name[20];
+    uint8_t short_len;
+    uint8_t long_len;
+    uint8_t display_len;
+
+    inline const char *shortName(bool safe = false) const {
+        return safe ? safe_short_name : short_name;
+    }
+
+    inline const char *longName(bool safe = false) const {
+        return safe ? safe_long_name : long_name;
+    }
+
+    inline const char *displayName(bool safe = false) const {
+        return safe ? safe_display_name : display_name;
+    }
+};
+
+struct Node {
+    meshtastic_NodeInfo info;
+    NodeNames names;
+    shared_ptr<NodeMetrics> metrics;
+};
+
+/*
+ * Everything known about the nodes on the mesh, keyed by node number.
+ *
+ * Nodes are numbered densely in the order they are first seen and are
+ * never moved: a node's index remains valid until clear(), and iteration
+ * always visits nodes in that order. Lookups go through an open-addressing
+ * index with linear probing, which is the only thing rebuilt as the table
+ * grows. Nodes with a user are also indexed by short name, long name and
+ * public key; where several share a name, the one seen first wins.
+ * Whenever a Node's info is changed in place, update() must be called to
+ * bring its NodeHot and these indexes up to date.
+ *
+ * Copies share the chunks of Nodes, their metrics and the name indexes
+ * with the original, and each side clones a part only as it first writes
+ * to it: non-const node(), find() and metrics() are writes. A Node's
+ * address is therefore stable until clear(), or until it is next written
+ * while a copy is alive. Only the thread that writes a table may copy it.
+ *
+ * generation() changes with every change to the table, including any
+ * call to metrics(); copies keep the generation of their original.
+ */
+class NodeTable {
+
+public:
+
+    class const_iterator {
+
+    public:
+
+        inline const_iterator() : _table(NULL), _index(0) {}
+        inline const_iterator(const NodeTable *table, size_t index)
+            : _table(table), _index(index) {}
+
+        inline const Node &operator*() const {
+            return _table->node(_index);
+        }
+
+        inline const Node *operator->() const {
+            return &_table->node(_index);
+        }
+
+        inline const_iterator &operator++() {
+            _index++;
+            return *this;
+        }
+
+        inline const_iterator operator++(int) {
+            const_iterator it = *this;
+            _index++;
+            return it;
+        }
+
+        inline bool operator==(const const_iterator &it) const {
+            return (_index == it._index) && (_table == it._table);
+        }
+
+        inline bool operator!=(const const_iterator &it) const {
+            return !(*this == it);
+        }
+
+        inline size_t index(void) const {
+            return _index;
+        }
+
+    private:
+
+        const NodeTable *_table;
+        size_t _index;
+
+    };
+
+    NodeTable();
+    NodeTable(const NodeTable &table);
+    ~NodeTable();
+
+    void clear(void);
+
+    int indexOf(uint32_t num) const;
+    const Node *find(uint32_t num) const;
+    Node *find(uint32_t num);
+    const NodeHot *findHot(uint32_t num) const;
+    const NodeMetrics *findMetrics(uint32_t num) const;
+    int indexOfShortName(const string &name) const;
+    int indexOfLongName(const string &name) const;
+    int indexOfKey(const meshtastic_User_public_key_t &key) const;
+
+    size_t insert(uint32_t num);
+    void update(size_t index);
+    size_t put(const meshtastic_NodeInfo &info);
+    size_t putUser(uint32_t num, const meshtastic_User &user);
+    NodeMetrics &metrics(size_t index);
+    size_t prune(const unordered_set<uint32_t> &nums);
+
+    static void formatNames(NodeNames &names, uint32_t num,
+                            const meshtastic_User *user);
+
+    inline size_t size(void) const {
+        return _hot.size();
+    }
+
+    inline bool empty(void) const {
+        return _hot.empty();
+    }
+
+    inline uint64_t generation(void) const {
+        return _generation;
+    }
+
+    inline const NodeHot &hot(size_t index) const {
+        return _hot[index];
+    }
+
+    inline const Node &node(size_t index) const {
+        return _chunks[index / NODE_CHUNK]->nodes[index % NODE_CHUNK];
+    }
+
+    inline Node &node(size_t index) {
+        return own(index / NODE_CHUNK).nodes[index % NODE_CHUNK];
+    }
+
+    inline const_iterator begin(void) const {
+        return const_iterator(this, 0);
+    }
+
+    inline const_iterator end(void) const {
+        return const_iterator(this, _hot.size());
+    }
+
+private:
+
+    static const size_t NODE_CHUNK = 32;
+
+    struct Chunk {
+        Node nodes[NODE_CHUNK];
+    };
+
+    struct Slot {
+        uint32_t num;
+        uint32_t index;  /* index + 1, 0 if the slot is free */
+    };
+
+    static inline size_t hash(uint32_t num) {
+        uint32_t h = num * 0x9e3779b1U;
+        return (size_t) (h ^ (h >> 15));
+    }
+
+    void rehash(size_t buckets);
+
+    typedef unordered_multimap<string, uint32_t> NameIndex;
+
+    /* What each node is currently indexed under, to unlink it on update */
+    struct Keys {
+        string shortName;
+        string longName;
+        string key;
+    };
+
+    struct NameIndexes {
+        vector<Keys> keys;
+        NameIndex shortNames;
+        NameIndex longNames;
+        NameIndex publicKeys;
+    };
+
+    Chunk &own(size_t chunk);
+    NameIndexes &ownIndexes(void);
+
+    static int lookup(const NameIndex &index, const string &key);
+    static void unlink(NameIndex &index, const string &key, uint32_t i);
+    static bool relink(NameIndex &index, string &key, const char *p,
+                       size_t len, uint32_t i);
+
+    NodeTable &operator=(const NodeTable &);
+
+private:
+
+    vector<NodeHot> _hot;
+    vector<shared_ptr<Chunk>> _chunks;
+    vector<Slot> _slots;
+    size_t _mask;
+    uint64_t _generation;
+    shared_ptr<NameIndexes> _indexes;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
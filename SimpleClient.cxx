@@ -5,37 +5,140 @@
  */
 
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 #include <SimpleClient.hxx>
 
+#define PORT_TEXT(port, handler)                                        \
+    { port, #handler, NULL,                                             \
+      [](SimpleClient *client, const meshtastic_MeshPacket &packet,     \
+         const void *message) {                                         \
+          (void)(message);                                              \
+          client->handler(packet, TextView::payload(packet));           \
+      } }
+
+#define PORT_PROTO(port, handler, type)                                 \
+    { port, #handler, type##_fields,                                    \
+      [](SimpleClient *client, const meshtastic_MeshPacket &packet,     \
+         const void *message) {                                         \
+          client->handler(packet, *(const type *) message);             \
+      } }
+
+const SimpleClient::PortDecoder SimpleClient::portDecoders[] = {
+    { meshtastic_PortNum_TEXT_MESSAGE_APP, "gotTextMessage", NULL,
+      [](SimpleClient *client, const meshtastic_MeshPacket &packet,
+         const void *message) {
+          (void)(message);
+          client->countTextMessage(packet);
+          client->gotTextView(packet, TextView::payload(packet));
+      } },
+    PORT_PROTO(meshtastic_PortNum_REMOTE_HARDWARE_APP, gotHardwareMessage,
+               meshtastic_HardwareMessage),
+    PORT_PROTO(meshtastic_PortNum_POSITION_APP, gotPosition,
+               meshtastic_Position),
+    PORT_PROTO(meshtastic_PortNum_NODEINFO_APP, gotUser, meshtastic_User),
+    PORT_PROTO(meshtastic_PortNum_ROUTING_APP, gotRouting,
+               meshtastic_Routing),
+    PORT_PROTO(meshtastic_PortNum_ADMIN_APP, gotAdminMessage,
+               meshtastic_AdminMessage),
+    PORT_PROTO(meshtastic_PortNum_WAYPOINT_APP, gotWaypoint,
+               meshtastic_Waypoint),
+    PORT_TEXT(meshtastic_PortNum_DETECTION_SENSOR_APP, gotDetectionSensor),
+    PORT_TEXT(meshtastic_PortNum_ALERT_APP, gotAlert),
+    PORT_PROTO(meshtastic_PortNum_PAXCOUNTER_APP, gotPaxcount,
+               meshtastic_Paxcount),
+    PORT_PROTO(meshtastic_PortNum_STORE_FORWARD_APP, gotStoreForward,
+               meshtastic_StoreAndForward),
+    PORT_TEXT(meshtastic_PortNum_RANGE_TEST_APP, gotRangeTest),
+    PORT_PROTO(meshtastic_PortNum_TELEMETRY_APP, gotTelemetry,
+               meshtastic_Telemetry),
+    PORT_PROTO(meshtastic_PortNum_TRACEROUTE_APP, gotTraceRoute,
+               meshtastic_RouteDiscovery),
+    PORT_PROTO(meshtastic_PortNum_NEIGHBORINFO_APP, gotNeighborInfo,
+               meshtastic_NeighborInfo),
+    PORT_PROTO(meshtastic_PortNum_ATAK_PLUGIN, gotTakPacket,
+               meshtastic_TAKPacket),
+    PORT_PROTO(meshtastic_PortNum_MAP_REPORT_APP, gotMapReport,
+               meshtastic_MapReport),
+};
+
+#define PORT_DECODERS (sizeof(portDecoders) / sizeof(portDecoders[0]))
+
 SimpleClient::SimpleClient()
 {
     bzero(&_mtc, sizeof(_mtc));
     _mtc.handler = this->mtEvent;
     _mtc.ctx = this;
     _isConnected = false;
+    _touched = 0;
+    _sync = 0;
+    _syncNodeInfos = 0;
+    _syncChanged = false;
+    _splitSync = false;
+    _nextSubscription = 1;
+    _notifying = 0;
+    _needSweep = false;
     resetMeshStats();
+    _mDmRx = NULL;
+    _mDmTx = NULL;
+    _mCmRx = NULL;
+    _mCmTx = NULL;
+    _mWantConfigs = NULL;
+    _mHeartbeats = NULL;
+    _mBadPayloads = NULL;
+#if !defined(MT_STATIC_DECODE)
+    _payload = new PortPayload;
+#endif
+    publish();
 }
 
 SimpleClient::~SimpleClient()
 {
+#if !defined(MT_STATIC_DECODE)
+    delete _payload;
+#endif
+}
 
+bool SimpleClient::registerMetrics(const string &prefix)
+{
+    bool result = false;
+
+    if (mt_client_metrics(&_mtc, prefix.c_str()) != 0) {
+        goto done;
+    }
+
+    _metricsPrefix = prefix;
+    _mDmRx = mt_metric_register((prefix + ".dm_rx").c_str(),
+                                MT_METRIC_COUNTER);
+    _mDmTx = mt_metric_register((prefix + ".dm_tx").c_str(),
+                                MT_METRIC_COUNTER);
+    _mCmRx = mt_metric_register((prefix + ".cm_rx").c_str(),
+                                MT_METRIC_COUNTER);
+    _mCmTx = mt_metric_register((prefix + ".cm_tx").c_str(),
+                                MT_METRIC_COUNTER);
+    _mWantConfigs = mt_metric_register((prefix + ".want_configs").c_str(),
+                                       MT_METRIC_COUNTER);
+    _mHeartbeats = mt_metric_register((prefix + ".heartbeats").c_str(),
+                                      MT_METRIC_COUNTER);
+    _mBadPayloads = mt_metric_register((prefix + ".bad_payloads").c_str(),
+                                       MT_METRIC_COUNTER);
+
+    result = (_mDmRx != NULL) && (_mDmTx != NULL) && (_mCmRx != NULL) &&
+        (_mCmTx != NULL) && (_mWantConfigs != NULL) &&
+        (_mHeartbeats != NULL) && (_mBadPayloads != NULL);
+
+done:
+
+    return result;
 }
 
 void SimpleClient::clear(void)
 {
-    _nodeInfos.clear();
+    _nodes.clear();
     _loraConfig = meshtastic_Config_LoRaConfig();
     _channels.clear();
+    _channelIndex.clear();
     _positions.clear();
-    _deviceMetrics.clear();
-    _environmentMetrics.clear();
-    _airQualityMetrics.clear();
-    _powerMetrics.clear();
-    _localStats.clear();
-    _healthMetrics.clear();
-    _hostMetrics.clear();
+    resetSync();
+    touch(SNAPSHOT_STATE | SNAPSHOT_CHANNELS);
 }
 
 uint32_t SimpleClient::whoami(void) const
@@ -50,87 +153,82 @@ string SimpleClient::whoamiString(void) const
 
 string SimpleClient::idString(uint32_t id) const
 {
-    char buf[16];
-#if defined(LIB_PICO_PLATFORM) || defined(ESP_PLATFORM)
-    snprintf(buf, sizeof(buf) - 1, "!%.8lx", id);
-#else
-    snprintf(buf, sizeof(buf) - 1, "!%.8x", id);
-#endif
-    return string(buf);
+    NodeNames scratch;
+
+    return string(names(id, scratch).id);
 }
 
-string SimpleClient::lookupLongName(uint32_t id, bool noUnprintable) const
+/*
+ * Nodes in the table have their names formatted whenever their user
+ * changes, and those stay put until clear(). Other ids get theirs
+ * formatted into the caller's scratch, so that a lookup never writes to
+ * the client.
+ */
+const NodeNames &SimpleClient::names(uint32_t id, NodeNames &scratch) const
 {
-    string s;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
+    const Node *node;
 
-    if (id == 0xffffffffU) {
-        return "broadcast";
+    node = _nodes.find(id);
+    if (node != NULL) {
+        return node->names;
     }
 
-    it = _nodeInfos.find(id);
-    if (it != _nodeInfos.end()) {
-        for (unsigned int i = 0; i < sizeof(it->second.user.long_name); i++) {
-            char c = it->second.user.long_name[i];
-            if (c == '\0') {
-                break;
-            }
-            if (!noUnprintable || isprint(c)) {
-                s += c;
-            } else {
-                s += "?";
-            }
-        }
-    }
+    NodeTable::formatNames(scratch, id, NULL);
 
-    return s;
+    return scratch;
 }
 
-string SimpleClient::lookupShortName(uint32_t id, bool noUnprintable) const
+const char *SimpleClient::shortName(uint32_t id, NodeNames &scratch,
+                                    bool noUnprintable) const
 {
-    string s;
-    map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
+    return names(id, scratch).shortName(noUnprintable);
+}
 
-    if (id == 0xffffffffU) {
-        return "****";
-    }
+const char *SimpleClient::longName(uint32_t id, NodeNames &scratch,
+                                   bool noUnprintable) const
+{
+    return names(id, scratch).longName(noUnprintable);
+}
 
-    it = _nodeInfos.find(id);
-    if ((it != _nodeInfos.end()) && (it->second.user.short_name[0] != '\0')) {
-        for (unsigned int i = 0; i < 4; i++) {
-            char c = it->second.user.short_name[i];
-            if (!noUnprintable || isprint(c)) {
-                s += c;
-            } else {
-                s += "?";
-            }
-        }
-    }
+const char *SimpleClient::displayName(uint32_t id, NodeNames &scratch,
+                                      bool noUnprintable) const
+{
+    return names(id, scratch).displayName(noUnprintable);
+}
 
-    if (s.empty()) {
-        char buf[8];
-        snprintf(buf, sizeof(buf) - 1, "%.4x", (uint16_t) (id & 0xffffU));
-        s = buf;
-    }
+string SimpleClient::lookupLongName(uint32_t id, bool noUnprintable) const
+{
+    NodeNames scratch;
+    const NodeNames &n = names(id, scratch);
 
-    return s;
+    return string(n.longName(noUnprintable), n.long_len);
 }
 
-string SimpleClient::getDisplayName(uint32_t id, bool noUnprintable) const
+string SimpleClient::lookupShortName(uint32_t id, bool noUnprintable) const
 {
-    stringstream ss;
+    NodeNames scratch;
+    const NodeNames &n = names(id, scratch);
 
-    ss << lookupShortName(id, noUnprintable)
-       << " (!" << hex << setfill('0') << setw(8) << id << ")";
+    return string(n.shortName(noUnprintable), n.short_len);
+}
+
+string SimpleClient::getDisplayName(uint32_t id, bool noUnprintable) const
+{
+    NodeNames scratch;
+    const NodeNames &n = names(id, scratch);
 
-    return ss.str();
+    return string(n.displayName(noUnprintable), n.display_len);
 }
 
 uint32_t SimpleClient::getId(const string &name) const
 {
-    uint32_t id = 0xffffffffU;
+    return getId(_nodes, name);
+}
+
+uint32_t SimpleClient::getId(const NodeTable &nodes, const string &name)
+{
     uint32_t node_num = 0xffffffffU;
-    map<uint8_t, meshtastic_Channel>::const_iterator it;
+    int byShort, byLong;
 
     if ((name.size() > 0) && (name[0] == '!')) {
         try {
@@ -141,27 +239,51 @@ uint32_t SimpleClient::getId(const string &name) const
         }
     }
 
-    for (map<uint32_t, meshtastic_NodeInfo>::const_iterator it =
-             _nodeInfos.begin(); it != _nodeInfos.end(); it++) {
-        if (node_num == it->second.num) {
-            id = it->first;
-            break;
-        }
+    if ((node_num != 0xffffffffU) && (nodes.indexOf(node_num) >= 0)) {
+        return node_num;
+    }
 
-        if (it->second.has_user == false) {
-            continue;
-        }
+    /* Whichever node matching either name was seen first */
+    byShort = nodes.indexOfShortName(name);
+    byLong = nodes.indexOfLongName(name);
+    if ((byShort < 0) || ((byLong >= 0) && (byLong < byShort))) {
+        byShort = byLong;
+    }
 
-        if (name == it->second.user.short_name) {
-            id = it->first;
-            break;
-        } else if (name == it->second.user.long_name) {
-            id = it->first;
-            break;
-        }
+    if (byShort < 0) {
+        return 0xffffffffU;
     }
 
-    return id;
+    return nodes.hot(byShort).num;
+}
+
+static const char *modemPresetName(
+    meshtastic_Config_LoRaConfig_ModemPreset preset)
+{
+    switch (preset) {
+    case meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST:
+        return "LongFast";
+    case meshtastic_Config_LoRaConfig_ModemPreset_LONG_SLOW :
+        return "LongSlow";
+    case meshtastic_Config_LoRaConfig_ModemPreset_VERY_LONG_SLOW:
+        return "VeryLongSlow";
+    case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_SLOW:
+        return "MediumSlow";
+    case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_FAST:
+        return "MediumFast";
+    case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_SLOW:
+        return "ShortSlow";
+    case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_FAST:
+        return "ShortFast";
+    case meshtastic_Config_LoRaConfig_ModemPreset_LONG_MODERATE:
+        return "LongModerate";
+    case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_TURBO:
+        return "ShortTurbo";
+    default:
+        break;
+    }
+
+    return "";
 }
 
 string SimpleClient::getChannelName(uint8_t channel) const
@@ -174,37 +296,7 @@ string SimpleClient::getChannelName(uint8_t channel) const
         if (it->second.has_settings) {
             name = it->second.settings.name;
             if (name.empty()) {
-                switch (_loraConfig.modem_preset) {
-                case meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST:
-                    name = "LongFast";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_LONG_SLOW :
-                    name = "LongSlow";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_VERY_LONG_SLOW:
-                    name = "VeryLongSlow";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_SLOW:
-                    name = "MediumSlow";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_MEDIUM_FAST:
-                    name = "MediumFast";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_SLOW:
-                    name = "ShortSlow";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_FAST:
-                    name = "ShortFast";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_LONG_MODERATE:
-                    name = "LongModerate";
-                    break;
-                case meshtastic_Config_LoRaConfig_ModemPreset_SHORT_TURBO:
-                    name = "ShortTurbo";
-                    break;
-                default:
-                    break;
-                }
+                name = modemPresetName(_loraConfig.modem_preset);
             }
         }
     }
@@ -214,17 +306,340 @@ string SimpleClient::getChannelName(uint8_t channel) const
 
 uint8_t SimpleClient::getChannel(const string &name) const
 {
-    uint8_t channel = 0xffU;
+    unordered_map<string, uint8_t>::const_iterator it;
+
+    it = _channelIndex.find(name);
+    if (it == _channelIndex.end()) {
+        return 0xffU;
+    }
+
+    return it->second;
+}
+
+uint8_t SimpleClient::getChannel(const ClientSnapshot &snap,
+                                 const string &name)
+{
+    unordered_map<string, uint8_t>::const_iterator it;
+
+    it = snap.channelIndex->find(name);
+    if (it == snap.channelIndex->end()) {
+        return 0xffU;
+    }
+
+    return it->second;
+}
+
+/*
+ * Channel names depend on the modem preset as well, so the index is
+ * rebuilt whenever either changes; there are only a handful of channels.
+ */
+void SimpleClient::reindexChannels(void)
+{
+    map<uint8_t, meshtastic_Channel>::const_iterator it;
+    string name;
+
+    _channelIndex.clear();
+    for (it = _channels.begin(); it != _channels.end(); it++) {
+        name = getChannelName(it->first);
+        if (!name.empty()) {
+            /* The lowest channel with a given name wins */
+            _channelIndex.insert(make_pair(name, it->first));
+        }
+    }
+}
+
+/*
+ * Safe from any thread: the thread processing the client publishes after
+ * each event, and this only ever picks up what was published.
+ */
+shared_ptr<const ClientSnapshot> SimpleClient::snapshot(void)
+{
+    return atomic_load(&_snapshot);
+}
+
+/*
+ * Only ever called by the thread that updates the client, which is why
+ * _snapshot itself can be read without atomic_load() here.
+ */
+void SimpleClient::publish(void)
+{
+    const shared_ptr<const ClientSnapshot> &prev = _snapshot;
+    shared_ptr<ClientSnapshot> snap;
+    bool nodes;
+
+    nodes = !prev || (prev->nodes->generation() != _nodes.generation());
+    if (prev && !nodes && (_touched == 0)) {
+        return;
+    }
+
+    snap = make_shared<ClientSnapshot>();
+    snap->version = prev ? (prev->version + 1) : 1;
+    snap->isConnected = _isConnected;
+    snap->sync = _sync;
+    snap->syncNodeInfos = _syncNodeInfos;
+    snap->myNodeInfo = _myNodeInfo;
+    snap->loraConfig = _loraConfig;
+
+    if (nodes) {
+        snap->nodes = make_shared<const NodeTable>(_nodes);
+    } else {
+        snap->nodes = prev->nodes;
+    }
+
+    if (!prev || (_touched & SNAPSHOT_CHANNELS)) {
+        snap->channels =
+            make_shared<const map<uint8_t, meshtastic_Channel>>(_channels);
+        snap->channelIndex =
+            make_shared<const unordered_map<string, uint8_t>>(_channelIndex);
+    } else {
+        snap->channels = prev->channels;
+        snap->channelIndex = prev->channelIndex;
+    }
+
+    snap->warm = false;
+    snap->warmSavedAt = 0;
+    if (prev) {
+        snap->staleNodes = prev->staleNodes;
+    } else {
+        snap->staleNodes = make_shared<const unordered_set<uint32_t>>();
+    }
+
+    publishing(*snap, prev.get());
+
+    _touched = 0;
+    atomic_store(&_snapshot, shared_ptr<const ClientSnapshot>(snap));
+}
+
+void SimpleClient::publishing(ClientSnapshot &snap,
+                              const ClientSnapshot *prev)
+{
+    (void)(snap);
+    (void)(prev);
+}
+
+unsigned int SimpleClient::subscribePort(meshtastic_PortNum port,
+                                         const PacketFilter &filter,
+                                         PacketCallback callback)
+{
+    shared_ptr<Subscriber> sub;
+
+    if (((int) port < 0) || !callback) {
+        return 0;
+    }
+
+    sub = make_shared<Subscriber>();
+    sub->handle = _nextSubscription++;
+    sub->dead = false;
+    sub->filter = filter;
+    sub->packet = callback;
+
+    if ((size_t) port >= _portSubscribers.size()) {
+        _portSubscribers.resize((size_t) port + 1);
+    }
+    _portSubscribers[port].push_back(sub);
+
+    return sub->handle;
+}
+
+unsigned int SimpleClient::subscribeVariant(pb_size_t variant,
+                                            FromRadioCallback callback)
+{
+    shared_ptr<Subscriber> sub;
+
+    if (!callback) {
+        return 0;
+    }
+
+    sub = make_shared<Subscriber>();
+    sub->handle = _nextSubscription++;
+    sub->dead = false;
+    sub->fromRadio = callback;
+
+    if ((size_t) variant >= _variantSubscribers.size()) {
+        _variantSubscribers.resize((size_t) variant + 1);
+    }
+    _variantSubscribers[variant].push_back(sub);
+
+    return sub->handle;
+}
+
+bool SimpleClient::unsubscribe(unsigned int handle)
+{
+    vector<Subscribers> *tables[2] = {
+        &_portSubscribers, &_variantSubscribers,
+    };
+    unsigned int t;
+    size_t i, j;
+
+    for (t = 0; t < 2; t++) {
+        for (i = 0; i < tables[t]->size(); i++) {
+            Subscribers &subs = (*tables[t])[i];
+            for (j = 0; j < subs.size(); j++) {
+                if ((subs[j]->handle != handle) || subs[j]->dead) {
+                    continue;
+                }
+
+                subs[j]->dead = true;
+                if (_notifying > 0) {
+                    _needSweep = true;
+                } else {
+                    subs.erase(subs.begin() + j);
+                }
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void SimpleClient::sweep(vector<Subscribers> &table)
+{
+    size_t i, j;
+
+    for (i = 0; i < table.size(); i++) {
+        for (j = 0; j < table[i].size(); ) {
+            if (table[i][j]->dead) {
+                table[i].erase(table[i].begin() + j);
+            } else {
+                j++;
+            }
+        }
+    }
+}
+
+/*
+ * A subscriber may subscribe or unsubscribe from its callback, which is
+ * why each one is held by a reference of our own while it runs and why
+ * the lists are walked by index.
+ */
+void SimpleClient::notify(const meshtastic_FromRadio &fromRadio)
+{
+    const meshtastic_MeshPacket &packet = fromRadio.packet;
+    shared_ptr<Subscriber> sub;
+    size_t i, n;
+
+    if (_syncChanged) {
+        _syncChanged = false;
+        if (_syncCallback) {
+            _syncCallback(_sync, _syncNodeInfos);
+        }
+    }
+
+    if ((fromRadio.which_payload_variant >= _variantSubscribers.size()) &&
+        _portSubscribers.empty()) {
+        return;
+    }
+
+    _notifying++;
+
+    if (fromRadio.which_payload_variant < _variantSubscribers.size()) {
+        n = _variantSubscribers[fromRadio.which_payload_variant].size();
+        for (i = 0; i < n; i++) {
+            sub = _variantSubscribers[fromRadio.which_payload_variant][i];
+            if (!sub->dead) {
+                sub->fromRadio(fromRadio);
+            }
+        }
+    }
+
+    if ((fromRadio.which_payload_variant == meshtastic_FromRadio_packet_tag) &&
+        (packet.which_payload_variant == meshtastic_MeshPacket_decoded_tag) &&
+        ((size_t) packet.decoded.portnum < _portSubscribers.size())) {
+        n = _portSubscribers[packet.decoded.portnum].size();
+        for (i = 0; i < n; i++) {
+            sub = _portSubscribers[packet.decoded.portnum][i];
+            if (!sub->dead && sub->filter.matches(packet)) {
+                sub->packet(packet);
+            }
+        }
+    }
+
+    _notifying--;
+
+    if ((_notifying == 0) && _needSweep) {
+        _needSweep = false;
+        sweep(_portSubscribers);
+        sweep(_variantSubscribers);
+    }
+}
+
+void SimpleClient::enableSplitSync(bool enable)
+{
+    _splitSync = enable;
+}
+
+bool SimpleClient::splitSync(void) const
+{
+    return _splitSync;
+}
+
+void SimpleClient::onSync(SyncCallback callback)
+{
+    _syncCallback = callback;
+}
+
+/*
+ * Called for every record before its handler, so that the handler sees
+ * the stage it completes. The firmware sends my_info, its own node,
+ * metadata, channels, configs, module configs and then every other node,
+ * which is what the stages that are reached mid-session rely on.
+ */
+void SimpleClient::trackSync(const meshtastic_FromRadio &fromRadio)
+{
+    unsigned int sync = _sync | SYNC_TRANSPORT;
+    uint32_t id;
 
-    for (map<uint8_t, meshtastic_Channel>::const_iterator it =
-             _channels.begin(); it != _channels.end(); it++) {
-        if (name == getChannelName(it->first)) {
-            channel = it->first;
-            break;
+    switch (fromRadio.which_payload_variant) {
+    case meshtastic_FromRadio_my_info_tag:
+        /* Each session, or half of a split one, starts with it */
+        sync |= SYNC_MY_INFO;
+        _syncNodeInfos = 0;
+        _syncChanged = true;
+        break;
+    case meshtastic_FromRadio_node_info_tag:
+        _syncNodeInfos++;
+        _syncChanged = true;
+        if (sync & SYNC_CHANNELS) {
+            /* Past the configs */
+            sync |= SYNC_CONFIG;
+        }
+        break;
+    case meshtastic_FromRadio_config_tag:
+    case meshtastic_FromRadio_moduleConfig_tag:
+        if (sync & SYNC_MY_INFO) {
+            /* Past the channels */
+            sync |= SYNC_CHANNELS;
         }
+        break;
+    case meshtastic_FromRadio_config_complete_id_tag:
+        id = fromRadio.config_complete_id;
+        if (id != MT_WANT_CONFIG_ONLY_NODES) {
+            sync |= SYNC_CONFIG | SYNC_CHANNELS;
+        }
+        if (id != MT_WANT_CONFIG_ONLY_CONFIG) {
+            sync |= SYNC_NODES;
+        }
+        break;
+    default:
+        break;
     }
 
-    return channel;
+    if (sync != _sync) {
+        _sync = sync;
+        _syncChanged = true;
+        touch(SNAPSHOT_STATE);
+    }
+}
+
+void SimpleClient::resetSync(void)
+{
+    _isConnected = false;
+    _sync = 0;
+    _syncNodeInfos = 0;
+    _syncChanged = true;
+    touch(SNAPSHOT_STATE);
 }
 
 bool SimpleClient::isChannelValid(uint8_t channel) const
@@ -252,36 +667,55 @@ void SimpleClient::mtEvent(struct mt_client *mtc,
                            const meshtastic_FromRadio *fromRadio)
 {
     SimpleClient *sc = (SimpleClient *) mtc->ctx;
+    const char *name = NULL;
+    uint64_t t0;
 
     (void)(packet);
     (void)(size);
 
+    sc->trackSync(*fromRadio);
+
+    t0 = mt_trace_now(mtc);
     switch (fromRadio->which_payload_variant) {
     case meshtastic_FromRadio_packet_tag:
+        name = "gotPacket";
         sc->gotPacket(fromRadio->packet);
         break;
     case meshtastic_FromRadio_my_info_tag:
+        name = "gotMyNodeInfo";
         sc->gotMyNodeInfo(fromRadio->my_info);
         break;
     case meshtastic_FromRadio_node_info_tag:
+        name = "gotNodeInfo";
         sc->gotNodeInfo(fromRadio->node_info);
         break;
     case meshtastic_FromRadio_config_tag :
+        name = "gotConfig";
         sc->gotConfig(fromRadio->config);
         break;
     case meshtastic_FromRadio_channel_tag:
+        name = "gotChannel";
         sc->gotChannel(fromRadio->channel);
         break;
     case meshtastic_FromRadio_config_complete_id_tag:
+        name = "gotConfigCompleteId";
         sc->gotConfigCompleteId(fromRadio->config_complete_id);
         break;
     case meshtastic_FromRadio_rebooted_tag:
+        name = "gotRebooted";
         sc->gotRebooted(fromRadio->rebooted);
         break;
         break;
     default:
         break;
     }
+
+    mt_trace_span(mtc, name, t0);
+
+    sc->notify(*fromRadio);
+
+    /* Cheap when the event changed nothing a snapshot holds */
+    sc->publish();
 }
 
 bool SimpleClient::sendDisconnect(void)
@@ -297,13 +731,30 @@ bool SimpleClient::sendDisconnect(void)
     return result;
 }
 
+/*
+ * With split sync, the nodes are asked for once the config is complete,
+ * and the config again after that. Callable from any thread: the stages
+ * are only read here, trackSync() on the I/O thread moves them on.
+ */
 bool SimpleClient::sendWantConfig(void)
 {
     bool result = false;
+    uint32_t id = 0;
+
+    if (_splitSync) {
+        id = (isReady(SYNC_CONFIG) && !isReady(SYNC_NODES)) ?
+            MT_WANT_CONFIG_ONLY_NODES : MT_WANT_CONFIG_ONLY_CONFIG;
+    }
+
+    if (id != 0) {
+        result = (mt_send_want_config_id(&_mtc, id) == 0);
+    } else {
+        result = (mt_send_want_config(&_mtc) == 0);
+    }
 
-    result = (mt_send_want_config(&_mtc) == 0);
     if (result) {
         _countWantConfigs++;
+        mt_metric_add(_mWantConfigs, 1);
     }
 
     return result;
@@ -316,6 +767,7 @@ bool SimpleClient::sendHeartbeat(void)
     result = (mt_send_heartbeat(&_mtc) == 0);
     if (result) {
         _countHeartbeats++;
+        mt_metric_add(_mHeartbeats, 1);
     }
 
     return result;
@@ -401,6 +853,7 @@ bool SimpleClient::textMessage(uint32_t dest, uint8_t channel,
 
     if (result) {
         _countTextMessages++;
+        mt_metric_add((dest == 0xffffffffU) ? _mCmTx : _mDmTx, 1);
     }
 
     return result;
@@ -420,100 +873,84 @@ void SimpleClient::gotConfig(const meshtastic_Config &config)
 void SimpleClient::gotLoraConfig(const meshtastic_Config_LoRaConfig &c)
 {
     _loraConfig = c;
+    reindexChannels();
+    touch(SNAPSHOT_STATE | SNAPSHOT_CHANNELS);
 }
 
-void SimpleClient::gotPacket(const meshtastic_MeshPacket &packet)
+/*
+ * Maps every portnum to its slot in portDecoders[] plus one, 0 for none,
+ * so that finding the decoder does not depend on the number of ports.
+ */
+const SimpleClient::PortDecoder *SimpleClient::portDecoder(unsigned int port)
 {
-    int ret;
-    pb_istream_t stream;
+    struct Index {
+        uint8_t slot[meshtastic_PortNum_MAX + 1];
 
-    if (packet.which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
-        switch (packet.decoded.portnum) {
-        case meshtastic_PortNum_TEXT_MESSAGE_APP:
-            if (packet.which_payload_variant ==
-                meshtastic_MeshPacket_decoded_tag) {
-                string message((const char *) packet.decoded.payload.bytes,
-                               packet.decoded.payload.size);
-                gotTextMessage(packet, message);
-            }
-            break;
-        case meshtastic_PortNum_POSITION_APP:
-        {
-            meshtastic_Position position;
-            bzero(&position, sizeof(position));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Position_fields, &position);
-            if (ret == 1) {
-                gotPosition(packet, position);
-            }
-        }
-            break;
-        case meshtastic_PortNum_NODEINFO_APP:
-        {
-            meshtastic_User user;
-            bzero(&user, sizeof(user));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_User_fields, &user);
-            if (ret == 1) {
-                gotUser(packet, user);
-            }
-        }
-            break;
-        case meshtastic_PortNum_ROUTING_APP:
-        {
-            meshtastic_Routing routing;
-            bzero(&routing, sizeof(routing));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Routing_fields, &routing);
-            if (ret == 1) {
-                gotRouting(packet, routing);
-            }
-        }
-            break;
-        case meshtastic_PortNum_TELEMETRY_APP:
-        {
-            meshtastic_Telemetry telemetry;
-            bzero(&telemetry, sizeof(telemetry));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_Telemetry_fields, &telemetry);
-            if (ret == 1) {
-                gotTelemetry(packet, telemetry);
-            }
-        }
-            break;
-        case meshtastic_PortNum_TRACEROUTE_APP:
-        {
-            meshtastic_RouteDiscovery routeDiscovery;
-            bzero(&routeDiscovery, sizeof(routeDiscovery));
-            stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
-                                            packet.decoded.payload.size);
-            ret = pb_decode(&stream, meshtastic_RouteDiscovery_fields,
-                            &routeDiscovery);
-            if (ret == 1) {
-                gotTraceRoute(packet, routeDiscovery);
+        Index() {
+            size_t i;
+
+            bzero(slot, sizeof(slot));
+            for (i = 0; i < PORT_DECODERS; i++) {
+                slot[portDecoders[i].port] = (uint8_t) (i + 1);
             }
         }
-            break;
-        default:
-            break;
+    };
+    static const Index index;
+
+    if ((port > meshtastic_PortNum_MAX) || (index.slot[port] == 0)) {
+        return NULL;
+    }
+
+    return &portDecoders[index.slot[port] - 1];
+}
+
+void SimpleClient::gotPacket(const meshtastic_MeshPacket &packet)
+{
+    const PortDecoder *decoder;
+    pb_istream_t stream;
+    const void *message = NULL;
+    const char *name = "gotRawPayload";
+    uint64_t t0;
+
+    if (packet.which_payload_variant != meshtastic_MeshPacket_decoded_tag) {
+        return;
+    }
+
+    decoder = portDecoder(packet.decoded.portnum);
+    if (decoder == NULL) {
+        t0 = mt_trace_now(&_mtc);
+        gotRawPayload(packet);
+        mt_trace_span(&_mtc, name, t0);
+        return;
+    }
+
+    if (decoder->fields != NULL) {
+        /* pb_decode() clears what it needs to, no more */
+        stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
+                                        packet.decoded.payload.size);
+        if (!pb_decode(&stream, decoder->fields, _payload)) {
+            mt_metric_add(_mBadPayloads, 1);
+            gotBadPayload(packet);
+            return;
         }
+        message = _payload;
     }
+
+    name = decoder->name;
+    t0 = mt_trace_now(&_mtc);
+    decoder->handle(this, packet, message);
+    mt_trace_span(&_mtc, name, t0);
 }
 
 void SimpleClient::gotMyNodeInfo(const meshtastic_MyNodeInfo &myNodeInfo)
 {
     _myNodeInfo = myNodeInfo;
+    touch(SNAPSHOT_STATE);
 }
 
 void SimpleClient::gotNodeInfo(const meshtastic_NodeInfo &nodeInfo)
 {
-    uint32_t num = nodeInfo.num;
-
-    _nodeInfos[num] = nodeInfo;
+    _nodes.put(nodeInfo);
 }
 
 void SimpleClient::gotChannel(const meshtastic_Channel &channel)
@@ -521,12 +958,19 @@ void SimpleClient::gotChannel(const meshtastic_Channel &channel)
     uint8_t index = channel.index;
 
     _channels[index] = channel;
+    reindexChannels();
+    touch(SNAPSHOT_CHANNELS);
 }
 
 void SimpleClient::gotConfigCompleteId(uint32_t id)
 {
-    (void)(id);
-    _isConnected = true;
+    _isConnected = isReady(SYNC_CONFIG | SYNC_NODES);
+    touch(SNAPSHOT_STATE);
+
+    if (_splitSync && (id == MT_WANT_CONFIG_ONLY_CONFIG) &&
+        !isReady(SYNC_NODES)) {
+        sendWantConfig();
+    }
 }
 
 void SimpleClient::gotRebooted(bool rebooted)
@@ -537,18 +981,34 @@ void SimpleClient::gotRebooted(bool rebooted)
     }
 }
 
-void SimpleClient::gotTextMessage(const meshtastic_MeshPacket &packet,
-                                  const string &message)
+void SimpleClient::countTextMessage(const meshtastic_MeshPacket &packet)
 {
-    (void)(message);
-
     if (packet.to == whoami()) {
         _dmRx++;
+        mt_metric_add(_mDmRx, 1);
     } else {
         _cmRx++;
+        mt_metric_add(_mCmRx, 1);
     }
 }
 
+/*
+ * Copies the text into a string for gotTextMessage(); handlers that can
+ * work on the view override this instead and save the allocation.
+ */
+void SimpleClient::gotTextView(const meshtastic_MeshPacket &packet,
+                               TextView message)
+{
+    gotTextMessage(packet, message.str());
+}
+
+void SimpleClient::gotTextMessage(const meshtastic_MeshPacket &packet,
+                                  const string &message)
+{
+    (void)(packet);
+    (void)(message);
+}
+
 void SimpleClient::gotPosition(const meshtastic_MeshPacket &packet,
                                const meshtastic_Position &position)
 {
@@ -559,15 +1019,7 @@ void SimpleClient::gotPosition(const meshtastic_MeshPacket &packet,
 void SimpleClient::gotUser(const meshtastic_MeshPacket &packet,
                            const meshtastic_User &user)
 {
-    if (_nodeInfos.find(packet.from) == _nodeInfos.end()) {
-        meshtastic_NodeInfo nodeInfo;
-
-        bzero(&nodeInfo, sizeof(nodeInfo));
-        nodeInfo.user = user;
-        _nodeInfos[packet.from] = nodeInfo;
-    } else {
-        _nodeInfos[packet.from].user = user;
-    }
+    _nodes.putUser(packet.from, user);
 }
 
 void SimpleClient::gotRouting(const meshtastic_MeshPacket &packet,
@@ -617,43 +1069,64 @@ void SimpleClient::gotTelemetry(const meshtastic_MeshPacket &packet,
 void SimpleClient::gotDeviceMetrics(const meshtastic_MeshPacket &packet,
                                     const meshtastic_DeviceMetrics &metrics)
 {
-    _deviceMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.device_metrics = metrics;
+    m.has_device_metrics = true;
 }
 
 void SimpleClient::gotEnvironmentMetrics(const meshtastic_MeshPacket &packet,
                                          const meshtastic_EnvironmentMetrics &metrics)
 {
-    _environmentMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.environment_metrics = metrics;
+    m.has_environment_metrics = true;
 }
 
 void SimpleClient::gotAirQualityMetrics(const meshtastic_MeshPacket &packet,
                                         const meshtastic_AirQualityMetrics &metrics)
 {
-    _airQualityMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.air_quality_metrics = metrics;
+    m.has_air_quality_metrics = true;
 }
 
 void SimpleClient::gotPowerMetrics(const meshtastic_MeshPacket &packet,
                                    const meshtastic_PowerMetrics &metrics)
 {
-    _powerMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.power_metrics = metrics;
+    m.has_power_metrics = true;
 }
 
 void SimpleClient::gotLocalStats(const meshtastic_MeshPacket &packet,
                                  const meshtastic_LocalStats &stats)
 {
-    _localStats[packet.from] = stats;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.local_stats = stats;
+    m.has_local_stats = true;
 }
 
 void SimpleClient::gotHealthMetrics(const meshtastic_MeshPacket &packet,
                                     const meshtastic_HealthMetrics &metrics)
 {
-    _healthMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.health_metrics = metrics;
+    m.has_health_metrics = true;
 }
 
 void SimpleClient::gotHostMetrics(const meshtastic_MeshPacket &packet,
                                   const meshtastic_HostMetrics &metrics)
 {
-    _hostMetrics[packet.from] = metrics;
+    NodeMetrics &m = _nodes.metrics(_nodes.insert(packet.from));
+
+    m.host_metrics = metrics;
+    m.has_host_metrics = true;
 }
 
 void SimpleClient::gotTraceRoute(const meshtastic_MeshPacket &packet,
@@ -663,24 +1136,120 @@ void SimpleClient::gotTraceRoute(const meshtastic_MeshPacket &packet,
     (void)(routeDiscovery);
 }
 
-uint32_t SimpleClient::meshDeviceBytesReceived(void) const
+void SimpleClient::gotWaypoint(const meshtastic_MeshPacket &packet,
+                               const meshtastic_Waypoint &waypoint)
 {
-    return _mtc.bytes_rx;
+    (void)(packet);
+    (void)(waypoint);
 }
 
-uint32_t SimpleClient::meshDeviceBytesSent(void) const
+void SimpleClient::gotNeighborInfo(const meshtastic_MeshPacket &packet,
+                                   const meshtastic_NeighborInfo &neighborInfo)
 {
-    return _mtc.bytes_tx;
+    (void)(packet);
+    (void)(neighborInfo);
 }
 
-uint32_t SimpleClient::meshDevicePacketsReceived(void) const
+void SimpleClient::gotStoreForward(const meshtastic_MeshPacket &packet,
+                                   const meshtastic_StoreAndForward &storeForward)
 {
-    return _mtc.packets_rx;
+    (void)(packet);
+    (void)(storeForward);
 }
 
-uint32_t SimpleClient::meshDevicePacketsSent(void) const
+void SimpleClient::gotPaxcount(const meshtastic_MeshPacket &packet,
+                               const meshtastic_Paxcount &paxcount)
 {
-    return _mtc.packets_tx;
+    (void)(packet);
+    (void)(paxcount);
+}
+
+void SimpleClient::gotTakPacket(const meshtastic_MeshPacket &packet,
+                                const meshtastic_TAKPacket &takPacket)
+{
+    (void)(packet);
+    (void)(takPacket);
+}
+
+void SimpleClient::gotHardwareMessage(const meshtastic_MeshPacket &packet,
+                                      const meshtastic_HardwareMessage &message)
+{
+    (void)(packet);
+    (void)(message);
+}
+
+void SimpleClient::gotMapReport(const meshtastic_MeshPacket &packet,
+                                const meshtastic_MapReport &mapReport)
+{
+    (void)(packet);
+    (void)(mapReport);
+}
+
+void SimpleClient::gotDetectionSensor(const meshtastic_MeshPacket &packet,
+                                      TextView message)
+{
+    (void)(packet);
+    (void)(message);
+}
+
+void SimpleClient::gotRangeTest(const meshtastic_MeshPacket &packet,
+                                TextView message)
+{
+    (void)(packet);
+    (void)(message);
+}
+
+void SimpleClient::gotAlert(const meshtastic_MeshPacket &packet,
+                            TextView message)
+{
+    (void)(packet);
+    (void)(message);
+}
+
+void SimpleClient::gotRawPayload(const meshtastic_MeshPacket &packet)
+{
+    (void)(packet);
+}
+
+void SimpleClient::gotBadPayload(const meshtastic_MeshPacket &packet)
+{
+    (void)(packet);
+}
+
+uint64_t SimpleClient::meshDeviceBytesReceived(void) const
+{
+    struct mt_client_counters counters;
+
+    mt_client_counters(&_mtc, &counters);
+
+    return counters.bytes_rx;
+}
+
+uint64_t SimpleClient::meshDeviceBytesSent(void) const
+{
+    struct mt_client_counters counters;
+
+    mt_client_counters(&_mtc, &counters);
+
+    return counters.bytes_tx;
+}
+
+uint64_t SimpleClient::meshDevicePacketsReceived(void) const
+{
+    struct mt_client_counters counters;
+
+    mt_client_counters(&_mtc, &counters);
+
+    return counters.packets_rx;
+}
+
+uint64_t SimpleClient::meshDevicePacketsSent(void) const
+{
+    struct mt_client_counters counters;
+
+    mt_client_counters(&_mtc, &counters);
+
+    return counters.packets_tx;
 }
 
 uint32_t SimpleClient::meshDeviceLastRecivedSecondsAgo(void) const
@@ -9,11 +9,61 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <functional>
 #include <mutex>
+#include <atomic>
 #include <libmeshtastic.h>
+#include <meshtastic/storeforward.pb.h>
+#include <meshtastic/paxcount.pb.h>
+#include <meshtastic/atak.pb.h>
+#include <meshtastic/remote_hardware.pb.h>
+#include <NodeTable.hxx>
+#include <TextView.hxx>
 
 using namespace std;
 
+/* Every message that a port decoder may decode into */
+union PortPayload {
+    meshtastic_Position position;
+    meshtastic_User user;
+    meshtastic_Routing routing;
+    meshtastic_AdminMessage adminMessage;
+    meshtastic_Telemetry telemetry;
+    meshtastic_RouteDiscovery routeDiscovery;
+    meshtastic_Waypoint waypoint;
+    meshtastic_NeighborInfo neighborInfo;
+    meshtastic_StoreAndForward storeForward;
+    meshtastic_Paxcount paxcount;
+    meshtastic_TAKPacket takPacket;
+    meshtastic_HardwareMessage hardwareMessage;
+    meshtastic_MapReport mapReport;
+};
+
+/*
+ * An immutable view of the client's state, safe to hold and read from any
+ * thread while the client goes on updating its own. Parts that did not
+ * change between two snapshots are shared by them.
+ */
+struct ClientSnapshot {
+    uint64_t version;
+    bool isConnected;
+    unsigned int sync;
+    unsigned int syncNodeInfos;
+    meshtastic_MyNodeInfo myNodeInfo;
+    meshtastic_Config_LoRaConfig loraConfig;
+    shared_ptr<const NodeTable> nodes;
+    shared_ptr<const map<uint8_t, meshtastic_Channel>> channels;
+    /* Channel names, as getChannelName() makes them, to indexes */
+    shared_ptr<const unordered_map<string, uint8_t>> channelIndex;
+    /* Warm start state, only ever set by MeshClient */
+    bool warm;
+    time_t warmSavedAt;
+    shared_ptr<const unordered_set<uint32_t>> staleNodes;
+};
+
 /*
  * Suitable for use on resource-constraint MCU platforms.
  */
@@ -32,11 +82,97 @@ public:
     string lookupLongName(uint32_t id, bool noUnprintable = false) const;
     string lookupShortName(uint32_t id, bool noUprintable = false) const;
     string getDisplayName(uint32_t id, bool noUnprintable = false) const;
+    const NodeNames &names(uint32_t id, NodeNames &scratch) const;
+    const char *shortName(uint32_t id, NodeNames &scratch,
+                          bool noUnprintable = false) const;
+    const char *longName(uint32_t id, NodeNames &scratch,
+                         bool noUnprintable = false) const;
+    const char *displayName(uint32_t id, NodeNames &scratch,
+                            bool noUnprintable = false) const;
     uint32_t getId(const string &name) const;
+    static uint32_t getId(const NodeTable &nodes, const string &name);
     string getChannelName(uint8_t channel) const;
     uint8_t getChannel(const string &name) const;
+    static uint8_t getChannel(const ClientSnapshot &snap, const string &name);
     bool isChannelValid(uint8_t channel) const;
 
+    virtual shared_ptr<const ClientSnapshot> snapshot(void);
+
+    /*
+     * Registers this client's metrics, and those of its mt_client, as
+     * "<prefix>.dm_rx", "<prefix>.rx.frames" and so on, so that several
+     * clients in one process can be told apart. Nothing is counted per
+     * client until then. Call it before the client is processed.
+     */
+    virtual bool registerMetrics(const string &prefix);
+
+    inline const string &metricsPrefix(void) const {
+        return _metricsPrefix;
+    }
+
+    /*
+     * Subscriptions, for components that want packets without deriving
+     * from the client: callbacks run on the thread that runs the client,
+     * after the got*() handlers have seen the same event. Port
+     * subscribers get decoded packets on their port that pass the filter;
+     * variant subscribers get every FromRadio of their variant (a
+     * meshtastic_FromRadio_*_tag). Both return a handle for unsubscribe(),
+     * or 0 on failure. Subscribe and unsubscribe from the client's own
+     * thread, including from within a callback, or before it starts.
+     */
+    struct PacketFilter {
+        bool has_from;
+        uint32_t from;
+        bool has_to;
+        uint32_t to;
+        bool has_channel;
+        uint8_t channel;
+
+        inline PacketFilter()
+            : has_from(false), from(0),
+              has_to(false), to(0),
+              has_channel(false), channel(0) {}
+
+        inline bool matches(const meshtastic_MeshPacket &packet) const {
+            return (!has_from || (packet.from == from)) &&
+                (!has_to || (packet.to == to)) &&
+                (!has_channel || (packet.channel == channel));
+        }
+    };
+
+    typedef function<void(const meshtastic_MeshPacket &packet)>
+        PacketCallback;
+    typedef function<void(const meshtastic_FromRadio &fromRadio)>
+        FromRadioCallback;
+
+    unsigned int subscribePort(meshtastic_PortNum port,
+                               const PacketFilter &filter,
+                               PacketCallback callback);
+    unsigned int subscribeVariant(pb_size_t variant,
+                                  FromRadioCallback callback);
+    bool unsubscribe(unsigned int handle);
+
+    /* A port subscription that also decodes the payload as a T */
+    template <typename T>
+    unsigned int subscribeDecoded(
+        meshtastic_PortNum port, const pb_msgdesc_t *fields,
+        const PacketFilter &filter,
+        function<void(const meshtastic_MeshPacket &, const T &)> callback) {
+        return subscribePort(
+            port, filter,
+            [fields, callback](const meshtastic_MeshPacket &packet) {
+                T message;
+                pb_istream_t stream;
+
+                bzero(&message, sizeof(message));
+                stream = pb_istream_from_buffer(packet.decoded.payload.bytes,
+                                                packet.decoded.payload.size);
+                if (pb_decode(&stream, fields, &message)) {
+                    callback(packet, message);
+                }
+            });
+    }
+
     bool sendDisconnect(void);
     bool sendWantConfig(void);
     bool sendHeartbeat(void);
@@ -44,6 +180,33 @@ public:
     bool textMessage(uint32_t dest, uint8_t channel, const string &message,
                      unsigned int hop_start = 3, bool want_ack = false);
 
+    /*
+     * How far the radio's config session has got, one bit per stage,
+     * moved on by the I/O thread as records come in. The transport is up
+     * once a frame has arrived; channels are known once the configs that
+     * follow them start to arrive, and that is all sending needs. With
+     * split sync, want_config first asks for everything but the nodes
+     * and then, once that is complete, for the nodes alone, so channels
+     * are known within a second instead of after the whole node DB.
+     * isConnected() still waits for both halves. The sync callback runs
+     * after the handlers, whenever a stage is reached or a NodeInfo comes
+     * in, with the NodeInfos of the session so far.
+     */
+    enum SyncStage {
+        SYNC_TRANSPORT = 0x01,
+        SYNC_MY_INFO = 0x02,
+        SYNC_CONFIG = 0x04,
+        SYNC_CHANNELS = 0x08,
+        SYNC_NODES = 0x10,
+    };
+
+    typedef function<void(unsigned int stages, unsigned int nodeInfos)>
+        SyncCallback;
+
+    void enableSplitSync(bool enable);
+    bool splitSync(void) const;
+    void onSync(SyncCallback callback);
+
 public:
 
     inline bool isConnected(void) const
@@ -51,66 +214,74 @@ public:
         return _isConnected;
     }
 
-    inline const meshtastic_MyNodeInfo &myNodeInfo(void) const
+    inline unsigned int syncStages(void) const
     {
-        return _myNodeInfo;
+        return _sync;
     }
 
-    inline const map<uint32_t, meshtastic_NodeInfo> &nodeInfos(void) const
+    inline bool isReady(unsigned int stages) const
     {
-        return _nodeInfos;
+        return (_sync & stages) == stages;
     }
 
-    inline const meshtastic_Config_LoRaConfig &loraConfig(void) const
+    inline bool canSend(void) const
     {
-        return _loraConfig;
+        return isReady(SYNC_TRANSPORT | SYNC_CHANNELS);
     }
 
-    inline const map<uint8_t, meshtastic_Channel> &channels(void) const
+    inline unsigned int syncNodeInfos(void) const
     {
-        return _channels;
+        return _syncNodeInfos;
     }
 
-    inline const map<uint32_t, meshtastic_Position> &positions(void) const {
-        return _positions;
-    }
-
-    inline const map<uint32_t, meshtastic_DeviceMetrics> &deviceMetrics(void) const
+    inline const meshtastic_MyNodeInfo &myNodeInfo(void) const
     {
-        return _deviceMetrics;
+        return _myNodeInfo;
     }
 
-    inline const map<uint32_t, meshtastic_EnvironmentMetrics> &environmentMetrics(void) const
+    inline const NodeTable &nodes(void) const
     {
-        return _environmentMetrics;
+        return _nodes;
     }
 
-    inline const map<uint32_t, meshtastic_AirQualityMetrics> &airQualityMetrics(void) const
+    inline const meshtastic_Config_LoRaConfig &loraConfig(void) const
     {
-        return _airQualityMetrics;
+        return _loraConfig;
     }
 
-    inline const map<uint32_t, meshtastic_PowerMetrics> &powerMetrics(void) const
+    inline const map<uint8_t, meshtastic_Channel> &channels(void) const
     {
-        return _powerMetrics;
+        return _channels;
     }
 
-    inline const map<uint32_t, meshtastic_LocalStats> &localStats(void) const
-    {
-        return _localStats;
+    inline const map<uint32_t, meshtastic_Position> &positions(void) const {
+        return _positions;
     }
 
-    inline const map<uint32_t, meshtastic_HealthMetrics> &healthMetrics(void) const
-    {
-        return _healthMetrics;
-    }
+protected:
 
-    inline const map<uint32_t, meshtastic_HostMetrics> &hostMetrics(void) const
-    {
-        return _hostMetrics;
+    void reindexChannels(void);
+
+    enum {
+        SNAPSHOT_STATE = 0x1,
+        SNAPSHOT_CHANNELS = 0x2,
+        SNAPSHOT_WARM = 0x4,
+    };
+
+    /* Nodes are tracked through the table's generation instead */
+    inline void touch(unsigned int parts) {
+        _touched |= parts;
     }
 
-protected:
+    void publish(void);
+    /* Lets a derived client fill in its own parts of a new snapshot */
+    virtual void publishing(ClientSnapshot &snap,
+                            const ClientSnapshot *prev);
+
+    void notify(const meshtastic_FromRadio &fromRadio);
+
+    void trackSync(const meshtastic_FromRadio &fromRadio);
+    void resetSync(void);
 
     static void mtEvent(struct mt_client *mtc,
                         const void *packet, size_t size,
@@ -124,6 +295,8 @@ protected:
     virtual void gotChannel(const meshtastic_Channel &channel);
     virtual void gotConfigCompleteId(uint32_t id);
     virtual void gotRebooted(bool rebooted);
+    virtual void gotTextView(const meshtastic_MeshPacket &packet,
+                             TextView message);
     virtual void gotTextMessage(const meshtastic_MeshPacket &packet,
                                 const string &message);
     virtual void gotPosition(const meshtastic_MeshPacket &packet,
@@ -152,6 +325,60 @@ protected:
                                 const meshtastic_HostMetrics &metrics);
     virtual void gotTraceRoute(const meshtastic_MeshPacket &packet,
                                const meshtastic_RouteDiscovery &routeDiscovery);
+    virtual void gotWaypoint(const meshtastic_MeshPacket &packet,
+                             const meshtastic_Waypoint &waypoint);
+    virtual void gotNeighborInfo(const meshtastic_MeshPacket &packet,
+                                 const meshtastic_NeighborInfo &neighborInfo);
+    virtual void gotStoreForward(const meshtastic_MeshPacket &packet,
+                                 const meshtastic_StoreAndForward &storeForward);
+    virtual void gotPaxcount(const meshtastic_MeshPacket &packet,
+                             const meshtastic_Paxcount &paxcount);
+    virtual void gotTakPacket(const meshtastic_MeshPacket &packet,
+                              const meshtastic_TAKPacket &takPacket);
+    virtual void gotHardwareMessage(const meshtastic_MeshPacket &packet,
+                                    const meshtastic_HardwareMessage &message);
+    virtual void gotMapReport(const meshtastic_MeshPacket &packet,
+                              const meshtastic_MapReport &mapReport);
+    virtual void gotDetectionSensor(const meshtastic_MeshPacket &packet,
+                                    TextView message);
+    virtual void gotRangeTest(const meshtastic_MeshPacket &packet,
+                              TextView message);
+    virtual void gotAlert(const meshtastic_MeshPacket &packet,
+                          TextView message);
+
+    /* Ports whose payload is not a protobuf (audio, serial, IP, ...) */
+    virtual void gotRawPayload(const meshtastic_MeshPacket &packet);
+
+    /* The payload did not decode as what its port says it should be */
+    virtual void gotBadPayload(const meshtastic_MeshPacket &packet);
+
+private:
+
+    /*
+     * How the payload of each port is decoded and which got*() handler
+     * it goes to; the message is NULL for text ports. Ports without an
+     * entry go to gotRawPayload().
+     */
+    struct PortDecoder {
+        meshtastic_PortNum port;
+        const char *name;
+        const pb_msgdesc_t *fields;
+        void (*handle)(SimpleClient *client,
+                       const meshtastic_MeshPacket &packet,
+                       const void *message);
+    };
+
+    void countTextMessage(const meshtastic_MeshPacket &packet);
+
+    static const PortDecoder portDecoders[];
+    static const PortDecoder *portDecoder(unsigned int port);
+
+    /* Decode target for every port, reused from one packet to the next */
+#if defined(MT_STATIC_DECODE)
+    PortPayload _payload[1];
+#else
+    PortPayload *_payload;
+#endif
 
 public:
 
@@ -161,17 +388,50 @@ protected:
 
     bool _isConnected;
     meshtastic_MyNodeInfo _myNodeInfo;
-    map<uint32_t, meshtastic_NodeInfo> _nodeInfos;
+    NodeTable _nodes;
     meshtastic_Config_LoRaConfig _loraConfig;
     map<uint8_t, meshtastic_Channel> _channels;
+    unordered_map<string, uint8_t> _channelIndex;
     map<uint32_t, meshtastic_Position> _positions;
-    map<uint32_t, meshtastic_DeviceMetrics> _deviceMetrics;
-    map<uint32_t, meshtastic_EnvironmentMetrics> _environmentMetrics;
-    map<uint32_t, meshtastic_AirQualityMetrics> _airQualityMetrics;
-    map<uint32_t, meshtastic_PowerMetrics> _powerMetrics;
-    map<uint32_t, meshtastic_LocalStats> _localStats;
-    map<uint32_t, meshtastic_HealthMetrics> _healthMetrics;
-    map<uint32_t, meshtastic_HostMetrics> _hostMetrics;
+
+    /* Names handed out for ids that are not in the node table */
+
+    shared_ptr<const ClientSnapshot> _snapshot;
+    unsigned int _touched;
+
+    /* Written by the I/O thread only, read from anywhere */
+    atomic<unsigned int> _sync;
+    atomic<unsigned int> _syncNodeInfos;
+    bool _syncChanged;
+    bool _splitSync;
+    SyncCallback _syncCallback;
+
+private:
+
+    struct Subscriber {
+        unsigned int handle;
+        bool dead;
+        PacketFilter filter;
+        PacketCallback packet;
+        FromRadioCallback fromRadio;
+    };
+
+    typedef vector<shared_ptr<Subscriber>> Subscribers;
+
+    static void sweep(vector<Subscribers> &table);
+
+    /*
+     * Indexed by portnum and by variant tag respectively, and only as
+     * large as the highest one subscribed to. While notify() runs,
+     * entries are only marked dead; they are swept up afterwards.
+     */
+    vector<Subscribers> _portSubscribers;
+    vector<Subscribers> _variantSubscribers;
+    unsigned int _nextSubscription;
+    unsigned int _notifying;
+    bool _needSweep;
+
+protected:
 
 public:
 
@@ -185,10 +445,10 @@ public:
         _countTextMessages = 0;
     }
 
-    uint32_t meshDeviceBytesReceived(void) const;
-    uint32_t meshDeviceBytesSent(void) const;
-    uint32_t meshDevicePacketsReceived(void) const;
-    uint32_t meshDevicePacketsSent(void) const;
+    uint64_t meshDeviceBytesReceived(void) const;
+    uint64_t meshDeviceBytesSent(void) const;
+    uint64_t meshDevicePacketsReceived(void) const;
+    uint64_t meshDevicePacketsSent(void) const;
     uint32_t meshDeviceLastRecivedSecondsAgo(void) const;
 
     inline uint32_t dmRx(void) const {
@@ -230,6 +490,15 @@ protected:
     uint32_t _countHeartbeats;
     uint32_t _countTextMessages;
 
+    string _metricsPrefix;
+    struct mt_metric *_mDmRx;
+    struct mt_metric *_mDmTx;
+    struct mt_metric *_mCmRx;
+    struct mt_metric *_mCmTx;
+    struct mt_metric *_mWantConfigs;
+    struct mt_metric *_mHeartbeats;
+    struct mt_metric *_mBadPayloads;
+
 };
 
 #endif
@@ -6,6 +6,24 @@
 
 #include <SimpleShell.hxx>
 
+/*
+ * The display name of a node as of the snapshot; scratch holds the names
+ * of nodes that are not in it.
+ */
+static const char *displayName(const ClientSnapshot &snap, uint32_t num,
+                               NodeNames &scratch)
+{
+    const Node *node = snap.nodes->find(num);
+
+    if (node != NULL) {
+        return node->names.displayName(true);
+    }
+
+    NodeTable::formatNames(scratch, num, NULL);
+
+    return scratch.displayName(true);
+}
+
 SimpleShell::SimpleShell(shared_ptr<SimpleClient> client)
 {
     setClient(client);
@@ -28,6 +46,10 @@ SimpleShell::SimpleShell(shared_ptr<SimpleClient> client)
     _help_list.push_back("admin");
     _help_list.push_back("mate");
     _help_list.push_back("nvm");
+    _help_list.push_back("metrics");
+    _mCommands = mt_metric_register("shell.commands", MT_METRIC_COUNTER);
+    _mUnknownCommands = mt_metric_register("shell.unknown_commands",
+                                           MT_METRIC_COUNTER);
 }
 
 SimpleShell::~SimpleShell()
@@ -184,6 +206,8 @@ int SimpleShell::exec(char *cmdline)
         goto done;
     }
 
+    mt_metric_add(_mCommands, 1);
+
     if (strcmp(argv[0], "help") == 0) {
         ret = this->help(argc, argv);
     } else if (strcmp(argv[0], "version") == 0) {
@@ -214,7 +238,10 @@ int SimpleShell::exec(char *cmdline)
         ret = this->mate(argc, argv);
     } else if (strcmp(argv[0], "nvm") == 0) {
         ret = this->nvm(argc, argv);
+    } else if (strcmp(argv[0], "metrics") == 0) {
+        ret = this->metrics(argc, argv);
     } else {
+        mt_metric_add(_mUnknownCommands, 1);
         ret = this->unknown_command(argc, argv);
     }
 
@@ -305,30 +332,48 @@ int SimpleShell::reboot(int argc, char **argv)
     return ret;
 }
 
+static struct mt_metric *findMetric(const string &prefix, const char *name)
+{
+    return mt_metric_find((prefix + name).c_str());
+}
+
 int SimpleShell::status(int argc, char **argv)
 {
     int ret = 0;
     unsigned int i;
-    map<uint32_t, meshtastic_DeviceMetrics>::const_iterator dev;
-    map<uint32_t, meshtastic_EnvironmentMetrics>::const_iterator env;
+    struct mt_metric *rx_handler;
+    struct mt_histogram histogram;
+    shared_ptr<const ClientSnapshot> snap;
+    const Node *me;
+    NodeNames myNames;
+    const NodeMetrics *metrics;
+    string prefix;
 
     (void)(argc);
     (void)(argv);
 
-    if (!_client->isConnected()) {
+    /* The client may be updating its state on another thread */
+    snap = _client->snapshot();
+    if (!snap->isConnected) {
         this->printf("Not connected\n");
         goto done;
     }
 
+    me = snap->nodes->find(snap->myNodeInfo.my_node_num);
+    if (me != NULL) {
+        myNames = me->names;
+    } else {
+        NodeTable::formatNames(myNames, snap->myNodeInfo.my_node_num, NULL);
+    }
+
     this->printf("Me: %s %s\n",
-                 _client->getDisplayName(_client->whoami(), true).c_str(),
-                 _client->lookupLongName(_client->whoami(), true).c_str());
+                 myNames.displayName(true), myNames.longName(true));
 
     this->printf("Channels: %d\n",
-                 _client->channels().size());
+                 snap->channels->size());
     for (map<uint8_t, meshtastic_Channel>::const_iterator it =
-             _client->channels().begin();
-         it != _client->channels().end(); it++) {
+             snap->channels->begin();
+         it != snap->channels->end(); it++) {
         if (it->second.has_settings &&
             it->second.role != meshtastic_Channel_Role_DISABLED) {
             this->printf("chan#%u: %s\n",
@@ -338,16 +383,13 @@ int SimpleShell::status(int argc, char **argv)
     }
 
     this->printf("Nodes: %d seen\n",
-                 _client->nodeInfos().size());
-    i = 0;
-    for (map<uint32_t, meshtastic_NodeInfo>::const_iterator it =
-             _client->nodeInfos().begin();
-         it != _client->nodeInfos().end(); it++, i++) {
+                 snap->nodes->size());
+    for (i = 0; i < snap->nodes->size(); i++) {
         if ((i % 4) == 0) {
             this->printf("  ");
         }
         this->printf("%16s  ",
-                     _client->getDisplayName(it->second.num, true).c_str());
+                     snap->nodes->node(i).names.displayName(true));
         if ((i % 4) == 3) {
             this->printf("\n");
         }
@@ -356,48 +398,124 @@ int SimpleShell::status(int argc, char **argv)
         this->printf("\n");
     }
 
-    dev = _client->deviceMetrics().find(_client->whoami());
-    if (dev != _client->deviceMetrics().end()) {
-        if (dev->second.has_channel_utilization) {
+    metrics = (me != NULL) ? me->metrics.get() : NULL;
+    if ((metrics != NULL) && metrics->has_device_metrics) {
+        const meshtastic_DeviceMetrics *dev = &metrics->device_metrics;
+
+        if (dev->has_channel_utilization) {
             this->printf("channel_utilization: %.2f\n",
-                         dev->second.channel_utilization);
+                         dev->channel_utilization);
         }
-        if (dev->second.has_air_util_tx) {
+        if (dev->has_air_util_tx) {
             this->printf("air_util_tx: %.2f\n",
-                         dev->second.air_util_tx);
+                         dev->air_util_tx);
         }
     }
 
-    env = _client->environmentMetrics().find(_client->whoami());
-    if (env != _client->environmentMetrics().end()) {
-        if (env->second.has_temperature) {
+    if ((metrics != NULL) && metrics->has_environment_metrics) {
+        const meshtastic_EnvironmentMetrics *env =
+            &metrics->environment_metrics;
+
+        if (env->has_temperature) {
             this->printf("temperature: %.2f\n",
-                         env->second.temperature);
+                         env->temperature);
         }
-        if (env->second.has_relative_humidity) {
+        if (env->has_relative_humidity) {
             this->printf("relative_humidity: %.2f\n",
-                         env->second.relative_humidity);
+                         env->relative_humidity);
         }
-        if (env->second.has_barometric_pressure) {
+        if (env->has_barometric_pressure) {
             this->printf("barometric_pressure: %.2f\n",
-                         env->second.barometric_pressure);
+                         env->barometric_pressure);
         }
     }
 
-    this->printf("mesh bytes (rx/tx): %u/%u\n",
-                 _client->meshDeviceBytesReceived(),
-                 _client->meshDeviceBytesSent());
-    this->printf("mesh packets (rx/tx): %u/%u\n",
-                 _client->meshDevicePacketsReceived(),
-                 _client->meshDevicePacketsSent());
+    this->printf("mesh bytes (rx/tx): %llu/%llu\n",
+                 (unsigned long long) _client->meshDeviceBytesReceived(),
+                 (unsigned long long) _client->meshDeviceBytesSent());
+    this->printf("mesh packets (rx/tx): %llu/%llu\n",
+                 (unsigned long long) _client->meshDevicePacketsReceived(),
+                 (unsigned long long) _client->meshDevicePacketsSent());
     this->printf("last mesh packet: %us ago\n",
                  _client->meshDeviceLastRecivedSecondsAgo());
 
+    /* This client's own metrics, or the process-wide ones if it has none */
+    prefix = _client->metricsPrefix();
+    if (!prefix.empty()) {
+        prefix += ".";
+    }
+    rx_handler = mt_metric_find("rx.handler_ns");
+    mt_metric_histogram(rx_handler, &histogram);
+    this->printf("rx frames: %llu (decode errors: %llu, resyncs: %llu)\n",
+                 (unsigned long long)
+                 mt_metric_counter(findMetric(prefix, "rx.frames")),
+                 (unsigned long long)
+                 mt_metric_counter(findMetric(prefix, "rx.decode_errors")),
+                 (unsigned long long)
+                 mt_metric_counter(findMetric(prefix, "rx.resyncs")));
+    this->printf("tx frames: %llu (queue depth: %lld)\n",
+                 (unsigned long long)
+                 mt_metric_counter(findMetric(prefix, "tx.frames")),
+                 (long long)
+                 mt_metric_gauge(findMetric(prefix, "tx.queue_depth")));
+    if (histogram.count > 0) {
+        this->printf("handler latency: p50 < %lluns p99 < %lluns\n",
+                     (unsigned long long)
+                     mt_histogram_percentile(&histogram, 50),
+                     (unsigned long long)
+                     mt_histogram_percentile(&histogram, 99));
+    }
+
 done:
 
     return ret;
 }
 
+int SimpleShell::metrics(int argc, char **argv)
+{
+    int ret = 0;
+    unsigned int i, n;
+    struct mt_metric *metric;
+    struct mt_histogram histogram;
+
+    n = mt_metric_count();
+    for (i = 0; i < n; i++) {
+        metric = mt_metric_at(i);
+        if ((argc > 1) &&
+            (strstr(mt_metric_name(metric), argv[1]) == NULL)) {
+            continue;
+        }
+
+        switch (mt_metric_type(metric)) {
+        case MT_METRIC_COUNTER:
+            this->printf("%-32s %llu\n", mt_metric_name(metric),
+                         (unsigned long long) mt_metric_counter(metric));
+            break;
+        case MT_METRIC_GAUGE:
+            this->printf("%-32s %lld\n", mt_metric_name(metric),
+                         (long long) mt_metric_gauge(metric));
+            break;
+        case MT_METRIC_HISTOGRAM:
+            mt_metric_histogram(metric, &histogram);
+            this->printf("%-32s count=%llu avg=%llu p50<%llu p99<%llu\n",
+                         mt_metric_name(metric),
+                         (unsigned long long) histogram.count,
+                         (unsigned long long) ((histogram.count > 0) ?
+                                               (histogram.sum /
+                                                histogram.count) : 0),
+                         (unsigned long long)
+                         mt_histogram_percentile(&histogram, 50),
+                         (unsigned long long)
+                         mt_histogram_percentile(&histogram, 99));
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
 int SimpleShell::wcfg(int argc, char **argv)
 {
     int ret = 0;
@@ -446,25 +564,27 @@ int SimpleShell::hb(int argc, char **argv)
 int SimpleShell::zerohops(int argc, char **argv)
 {
    int ret = 0;
-   map<uint32_t, meshtastic_NodeInfo>::const_iterator it;
+   shared_ptr<const ClientSnapshot> snap = _client->snapshot();
+   const NodeTable &nodes = *snap->nodes;
+   size_t i;
 
     (void)(argc);
     (void)(argv);
 
     this->printf("my zero-hop neighbors:\n");
-    for (it = _client->nodeInfos().begin();
-         it != _client->nodeInfos().end();
-         it++) {
-        if (it->second.num == _client->whoami()) {
+    for (i = 0; i < nodes.size(); i++) {
+        const NodeHot &hot = nodes.hot(i);
+
+        if (hot.num == snap->myNodeInfo.my_node_num) {
             continue;
         }
 
-        if (!(it->second.has_hops_away) || (it->second.hops_away > 0)) {
+        if (!(hot.has_hops_away) || (hot.hops_away > 0)) {
             continue;
         }
 
         this->printf("%s\n",
-                     _client->getDisplayName(it->second.num, true).c_str());
+                     nodes.node(i).names.displayName(true));
     }
 
 
@@ -477,6 +597,7 @@ int SimpleShell::dm(int argc, char **argv)
     int ret = 0;
     uint32_t dest = 0xffffffffU;
     string message;
+    shared_ptr<const ClientSnapshot> snap;
 
     if (argc < 3) {
         this->printf("Usage: %s [name] message\n", argv[0]);
@@ -484,8 +605,9 @@ int SimpleShell::dm(int argc, char **argv)
         goto done;
     }
 
-    dest = _client->getId(argv[1]);
-    if ((dest == 0xffffffffU) || (dest == _client->whoami())) {
+    snap = _client->snapshot();
+    dest = SimpleClient::getId(*snap->nodes, argv[1]);
+    if ((dest == 0xffffffffU) || (dest == snap->myNodeInfo.my_node_num)) {
         this->printf("name '%s' is invalid!\n", argv[1]);
         ret = -1;
         goto done;
@@ -514,6 +636,7 @@ int SimpleShell::cm(int argc, char **argv)
     int ret = 0;
     uint8_t channel = 0xffU;
     string message;
+    shared_ptr<const ClientSnapshot> snap;
 
     if (argc < 3) {
         this->printf("Usage: %s [chan] message\n", argv[0]);
@@ -521,7 +644,8 @@ int SimpleShell::cm(int argc, char **argv)
         goto done;
     }
 
-    channel = _client->getChannel(argv[1]);
+    snap = _client->snapshot();
+    channel = SimpleClient::getChannel(*snap, argv[1]);
     if (channel == 0xffU) {
         this->printf("channel '%s' is invalid!\n", argv[1]);
         ret = -1;
@@ -550,13 +674,17 @@ int SimpleShell::authchan(int argc, char **argv)
 {
     int ret = 0;
     bool result;
+    shared_ptr<const ClientSnapshot> snap;
+
+    /* Channels are resolved from what the client last published */
+    snap = _client->snapshot();
 
     if (argc == 1) {
         for (unsigned int i = 0; i < _nvm->nvmAuthchans().size(); i++) {
             this->printf("%s\n", _nvm->nvmAuthchans()[i].name);
         }
     } else if ((argc == 3) && (strcmp(argv[1], "add") == 0)) {
-        result = _nvm->addNvmAuthChannel(argv[2], *_client);
+        result = _nvm->addNvmAuthChannel(argv[2], *snap);
         if (result == false) {
             this->printf("addNvmAuthChannel failed!\n");
             ret = -1;
@@ -591,7 +719,7 @@ int SimpleShell::authchan(int argc, char **argv)
 
         _nvm->clearNvmAuthChannels();
         for (i = 2; i < argc; i++) {
-            result = _nvm->addNvmAuthChannel(argv[i], *_client);
+            result = _nvm->addNvmAuthChannel(argv[i], *snap);
             if (result) {
                 this->printf("%s - pass\n", argv[i]);
                 pass++;
@@ -620,11 +748,13 @@ int SimpleShell::admin(int argc, char **argv)
     bool result;
 
     if (argc == 1) {
+        shared_ptr<const ClientSnapshot> snap = _client->snapshot();
+        NodeNames scratch;
         unsigned int i;
         for (i = 0; i < _nvm->nvmAdmins().size(); i++) {
             uint32_t node_num = _nvm->nvmAdmins()[i].node_num;
             this->printf("%16s ",
-                         _client->getDisplayName(node_num, true).c_str());
+                         displayName(*snap, node_num, scratch));
             if ((i % 4) == 3) {
                 this->printf("\n");
             }
@@ -709,11 +839,13 @@ int SimpleShell::mate(int argc, char **argv)
     bool result;
 
     if (argc == 1) {
+        shared_ptr<const ClientSnapshot> snap = _client->snapshot();
+        NodeNames scratch;
         unsigned int i;
         for (i = 0; i < _nvm->nvmMates().size(); i++) {
             uint32_t node_num = _nvm->nvmMates()[i].node_num;
             this->printf("%16s ",
-                         _client->getDisplayName(node_num, true).c_str());
+                         displayName(*snap, node_num, scratch));
             if ((i % 4) == 3) {
                 this->printf("\n");
             }
@@ -99,6 +99,7 @@ protected:
     virtual int admin(int argc, char **argv);
     virtual int mate(int argc, char **argv);
     virtual int nvm(int argc, char **argv);
+    virtual int metrics(int argc, char **argv);
     virtual int unknown_command(int argc, char **argv);
 
     time_t _since;
@@ -110,6 +111,9 @@ protected:
 
     vector<string> _help_list;
 
+    struct mt_metric *_mCommands;
+    struct mt_metric *_mUnknownCommands;
+
 protected:
 
 #define CMDLINE_SIZE 256
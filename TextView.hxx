@@ -0,0 +1,133 @@
+/*
+ * TextView.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef TEXTVIEW_HXX
+#define TEXTVIEW_HXX
+
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <libmeshtastic.h>
+
+using namespace std;
+
+/*
+ * A non-owning view of some text, such as the payload of a packet, for
+ * handlers that would rather not copy it into a string. The text is not
+ * NUL-terminated; print it with "%.*s". A view is only valid for as long
+ * as what it points into: a packet's for the duration of the handler.
+ */
+class TextView {
+
+public:
+
+    static const size_t npos = (size_t) -1;
+
+    inline TextView() : _data(""), _size(0) {}
+    inline TextView(const char *data, size_t size)
+        : _data(data), _size(size) {}
+    inline TextView(const char *s) : _data(s), _size(strlen(s)) {}
+    inline TextView(const string &s) : _data(s.data()), _size(s.size()) {}
+
+    /* The payload of a decoded packet */
+    static inline TextView payload(const meshtastic_MeshPacket &packet) {
+        return TextView((const char *) packet.decoded.payload.bytes,
+                        packet.decoded.payload.size);
+    }
+
+    inline const char *data(void) const {
+        return _data;
+    }
+
+    inline size_t size(void) const {
+        return _size;
+    }
+
+    inline int length(void) const {
+        return (int) _size;
+    }
+
+    inline bool empty(void) const {
+        return _size == 0;
+    }
+
+    inline char operator[](size_t i) const {
+        return _data[i];
+    }
+
+    inline const char *begin(void) const {
+        return _data;
+    }
+
+    inline const char *end(void) const {
+        return _data + _size;
+    }
+
+    inline string str(void) const {
+        return string(_data, _size);
+    }
+
+    inline size_t find(char c, size_t from = 0) const {
+        const void *p;
+
+        if (from >= _size) {
+            return npos;
+        }
+
+        p = memchr(_data + from, c, _size - from);
+        return (p != NULL) ? (size_t) ((const char *) p - _data) : npos;
+    }
+
+    inline TextView substr(size_t pos, size_t n = npos) const {
+        if (pos > _size) {
+            pos = _size;
+        }
+        if (n > (_size - pos)) {
+            n = _size - pos;
+        }
+
+        return TextView(_data + pos, n);
+    }
+
+    inline TextView trimmed(void) const {
+        size_t b = 0, e = _size;
+
+        while ((b < e) && isspace((unsigned char) _data[b])) {
+            b++;
+        }
+        while ((e > b) && isspace((unsigned char) _data[e - 1])) {
+            e--;
+        }
+
+        return TextView(_data + b, e - b);
+    }
+
+    inline bool operator==(const TextView &v) const {
+        return (_size == v._size) && (memcmp(_data, v._data, _size) == 0);
+    }
+
+    inline bool operator!=(const TextView &v) const {
+        return !(*this == v);
+    }
+
+private:
+
+    const char *_data;
+    size_t _size;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,359 @@
+/*
+ * WarmCache.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <WarmCache.hxx>
+
+#define WARM_CACHE_MAGIC   "MTWC"
+#define WARM_CACHE_VERSION 1
+
+WarmCache::WarmCache()
+    : _node_num(0x0U),
+      _savedAt(0),
+      _scratch(new meshtastic_FromRadio())
+{
+    _mLoadNs = mt_metric_register("warmcache.load_ns", MT_METRIC_HISTOGRAM);
+    _mSaveNs = mt_metric_register("warmcache.save_ns", MT_METRIC_HISTOGRAM);
+    _mErrors = mt_metric_register("warmcache.errors", MT_METRIC_COUNTER);
+}
+
+WarmCache::~WarmCache()
+{
+
+}
+
+bool WarmCache::setupFor(uint32_t node_num)
+{
+    bool result = false;
+    const char *home;
+    char node_num_hex[16];
+
+    if (node_num == 0x0U || node_num == (uint32_t) (-1)) {
+        result = false;
+        goto done;
+    }
+
+    home = getenv("HOME");
+    if ((home == NULL) || (home[0] == '\0')) {
+        result = false;
+        goto done;
+    }
+
+    snprintf(node_num_hex, sizeof(node_num_hex) - 1, "%.8x", node_num);
+    _path = string(home) + "/.libmeshtastic." + node_num_hex + ".cache";
+    _node_num = node_num;
+    result = true;
+
+done:
+
+    return result;
+}
+
+void WarmCache::clear(void)
+{
+    _records.clear();
+    _savedAt = 0;
+}
+
+/*
+ * The kind of record, records of the same kind replacing one another; 0
+ * for those that are not kept.
+ */
+uint32_t WarmCache::keyOf(const meshtastic_FromRadio &fromRadio)
+{
+    uint32_t key = (uint32_t) fromRadio.which_payload_variant << 16;
+
+    switch (fromRadio.which_payload_variant) {
+    case meshtastic_FromRadio_my_info_tag:
+    case meshtastic_FromRadio_metadata_tag:
+        break;
+    case meshtastic_FromRadio_config_tag:
+        key |= fromRadio.config.which_payload_variant;
+        break;
+    case meshtastic_FromRadio_moduleConfig_tag:
+        key |= fromRadio.moduleConfig.which_payload_variant;
+        break;
+    case meshtastic_FromRadio_channel_tag:
+        key |= fromRadio.channel.index;
+        break;
+    default:
+        key = 0;
+        break;
+    }
+
+    return key;
+}
+
+bool WarmCache::put(const meshtastic_FromRadio &fromRadio)
+{
+    bool result = false;
+    uint32_t key;
+    vector<uint8_t> buf;
+
+    key = keyOf(fromRadio);
+    if (key == 0) {
+        goto done;
+    }
+
+    if (!append(buf, fromRadio)) {
+        goto done;
+    }
+
+    _records[key].swap(buf);
+    result = true;
+
+done:
+
+    return result;
+}
+
+/* Appends the record, prefixed with its length */
+bool WarmCache::append(vector<uint8_t> &buf,
+                       const meshtastic_FromRadio &fromRadio)
+{
+    bool result = false;
+    uint8_t pb[MT_PB_MAX_LEN];
+    pb_ostream_t ostream;
+    uint16_t len;
+
+    ostream = pb_ostream_from_buffer(pb, sizeof(pb));
+    if (!pb_encode(&ostream, meshtastic_FromRadio_fields, &fromRadio)) {
+        goto done;
+    }
+
+    len = (uint16_t) ostream.bytes_written;
+    buf.insert(buf.end(), (const uint8_t *) &len,
+               (const uint8_t *) &len + sizeof(len));
+    buf.insert(buf.end(), pb, pb + len);
+    result = true;
+
+done:
+
+    return result;
+}
+
+bool WarmCache::load(function<void(const meshtastic_FromRadio &)> apply)
+{
+    bool result = false;
+    uint64_t t0;
+
+    t0 = mt_impl_now_ns();
+    result = read(apply);
+    mt_metric_observe(_mLoadNs, mt_impl_now_ns() - t0);
+    if (!result && (errno != ENOENT)) {
+        /* Not having a cache yet is no error */
+        mt_metric_add(_mErrors, 1);
+    }
+
+    return result;
+}
+
+bool WarmCache::save(const NodeTable &nodes)
+{
+    bool result = false;
+    uint64_t t0;
+
+    t0 = mt_impl_now_ns();
+    result = write(nodes);
+    mt_metric_observe(_mSaveNs, mt_impl_now_ns() - t0);
+    if (!result) {
+        mt_metric_add(_mErrors, 1);
+    }
+
+    return result;
+}
+
+/*
+ * Hands every record in the file to apply(), config-type ones before any
+ * node, and keeps the former for the next save.
+ */
+bool WarmCache::read(function<void(const meshtastic_FromRadio &)> apply)
+{
+    bool result = false;
+    FILE *fp = NULL;
+    vector<uint8_t> buf;
+    const uint8_t *p, *end;
+    Header header;
+    uint32_t i;
+    uint16_t len;
+    long size;
+    pb_istream_t istream;
+    uint32_t key;
+
+    if (_path.empty()) {
+        goto done;
+    }
+
+    fp = fopen(_path.c_str(), "r");
+    if (fp == NULL) {
+        goto done;
+    }
+
+    if ((fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < 0) ||
+        (fseek(fp, 0, SEEK_SET) != 0)) {
+        goto done;
+    }
+
+    if ((size_t) size < sizeof(header)) {
+        errno = EINVAL;
+        goto done;
+    }
+
+    buf.resize((size_t) size);
+    if (fread(buf.data(), 1, buf.size(), fp) != buf.size()) {
+        errno = EIO;
+        goto done;
+    }
+
+    memcpy(&header, buf.data(), sizeof(header));
+    if ((memcmp(header.magic, WARM_CACHE_MAGIC,
+                sizeof(header.magic)) != 0) ||
+        (header.version != WARM_CACHE_VERSION) ||
+        (header.node_num != _node_num)) {
+        errno = EINVAL;
+        goto done;
+    }
+
+    _records.clear();
+    p = buf.data() + sizeof(header);
+    end = buf.data() + buf.size();
+    for (i = 0; i < header.records; i++) {
+        if ((size_t) (end - p) < sizeof(len)) {
+            errno = EINVAL;
+            goto done;
+        }
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if ((size_t) (end - p) < len) {
+            errno = EINVAL;
+            goto done;
+        }
+
+        istream = pb_istream_from_buffer(p, len);
+        if (!pb_decode(&istream, meshtastic_FromRadio_fields,
+                       _scratch.get())) {
+            errno = EINVAL;
+            goto done;
+        }
+
+        key = keyOf(*_scratch);
+        if (key != 0) {
+            _records[key].assign(p - sizeof(len), p + len);
+        }
+
+        apply(*_scratch);
+        p += len;
+    }
+
+    _savedAt = (time_t) header.saved;
+    result = true;
+
+done:
+
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    return result;
+}
+
+/*
+ * Written to a temporary file first and renamed over the old one, so the
+ * cache is always either the previous snapshot or the new one.
+ */
+bool WarmCache::write(const NodeTable &nodes)
+{
+    bool result = false;
+    vector<uint8_t> buf;
+    map<uint32_t, vector<uint8_t>>::const_iterator it;
+    NodeTable::const_iterator node;
+    Header header;
+    string tmp;
+    int fd = -1;
+    ssize_t n;
+    size_t off;
+
+    if (_path.empty()) {
+        goto done;
+    }
+
+    memcpy(header.magic, WARM_CACHE_MAGIC, sizeof(header.magic));
+    header.version = WARM_CACHE_VERSION;
+    header.reserved = 0;
+    header.node_num = _node_num;
+    header.records = 0;
+    header.saved = (uint64_t) time(NULL);
+    buf.resize(sizeof(header));
+
+    for (it = _records.begin(); it != _records.end(); it++) {
+        buf.insert(buf.end(), it->second.begin(), it->second.end());
+        header.records++;
+    }
+
+    bzero(_scratch.get(), sizeof(*_scratch));
+    _scratch->which_payload_variant = meshtastic_FromRadio_node_info_tag;
+    for (node = nodes.begin(); node != nodes.end(); node++) {
+        _scratch->node_info = node->info;
+        if (!append(buf, *_scratch)) {
+            goto done;
+        }
+        header.records++;
+    }
+
+    memcpy(buf.data(), &header, sizeof(header));
+
+    tmp = _path + ".tmp";
+    fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0600);
+    if (fd == -1) {
+        goto done;
+    }
+
+    for (off = 0; off < buf.size(); off += (size_t) n) {
+        n = ::write(fd, buf.data() + off, buf.size() - off);
+        if (n <= 0) {
+            goto done;
+        }
+    }
+
+    if (close(fd) != 0) {
+        fd = -1;
+        goto done;
+    }
+    fd = -1;
+
+    if (rename(tmp.c_str(), _path.c_str()) != 0) {
+        goto done;
+    }
+
+    _savedAt = (time_t) header.saved;
+    result = true;
+
+done:
+
+    if (fd != -1) {
+        close(fd);
+    }
+    if (!result && !tmp.empty()) {
+        unlink(tmp.c_str());
+    }
+
+    return result;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
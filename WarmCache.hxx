@@ -0,0 +1,97 @@
+/*
+ * WarmCache.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef WARMCACHE_HXX
+#define WARMCACHE_HXX
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <libmeshtastic.h>
+#include <NodeTable.hxx>
+
+using namespace std;
+
+/*
+ * What a radio sent in its last complete config session, kept on disk so
+ * that the next session can start from it instead of from nothing.
+ *
+ * Config-type records (my_info, config, moduleConfig, channel, metadata)
+ * are remembered as they arrive, the latest of each kind; nodes are taken
+ * from the node table when saving, as packets keep them more current than
+ * their NodeInfo. The file, ~/.libmeshtastic.<node>.cache, is a header
+ * followed by each record as an encoded FromRadio prefixed with its
+ * length, in host byte order: it is a cache, not an interchange format.
+ */
+class WarmCache {
+
+public:
+
+    WarmCache();
+    ~WarmCache();
+
+    bool setupFor(uint32_t node_num);
+    void clear(void);
+
+    bool put(const meshtastic_FromRadio &fromRadio);
+    bool load(function<void(const meshtastic_FromRadio &)> apply);
+    bool save(const NodeTable &nodes);
+
+    inline uint32_t nodeNum(void) const {
+        return _node_num;
+    }
+
+    /* When what was last loaded or saved was saved, 0 if nothing was */
+    inline time_t savedAt(void) const {
+        return _savedAt;
+    }
+
+private:
+
+    struct Header {
+        char magic[4];
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t node_num;
+        uint32_t records;
+        uint64_t saved;
+    };
+
+    static uint32_t keyOf(const meshtastic_FromRadio &fromRadio);
+    bool append(vector<uint8_t> &buf, const meshtastic_FromRadio &fromRadio);
+    bool read(function<void(const meshtastic_FromRadio &)> apply);
+    bool write(const NodeTable &nodes);
+
+    uint32_t _node_num;
+    string _path;
+    time_t _savedAt;
+
+    /* Encoded config-type records, the latest of each kind */
+    map<uint32_t, vector<uint8_t>> _records;
+
+    /* Decode and encode target, too large to put on the stack */
+    unique_ptr<meshtastic_FromRadio> _scratch;
+
+    struct mt_metric *_mLoadNs;
+    struct mt_metric *_mSaveNs;
+    struct mt_metric *_mErrors;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
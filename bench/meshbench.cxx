@@ -0,0 +1,748 @@
+/*
+ * meshbench.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <pb_encode.h>
+#include <libmeshtastic.h>
+#include <MeshClient.hxx>
+#include <MeshPrint.hxx>
+#include <MeshNvm.hxx>
+#include <HomeChat.hxx>
+
+using namespace std;
+
+/*
+ * Microbenchmarks for the receive hot paths, run over a corpus of frames
+ * generated from a fixed seed so that two runs (or two library versions)
+ * see exactly the same input.
+ *
+ * Each benchmark is timed in batches sized to take at least
+ * BENCH_BATCH_NS, so clock overhead stays out of the numbers; p50/p99
+ * are taken over the per-op average of each batch. Allocations are
+ * counted by interposing malloc (glibc) or operator new (elsewhere).
+ */
+
+#define BENCH_NODES         64
+#define BENCH_MY_NODE_NUM   0x0be70000U
+#define BENCH_BATCH_NS      20000ULL
+#define BENCH_READ_CHUNK    64
+
+static uint64_t bench_allocs = 0;
+static uint64_t bench_alloc_bytes = 0;
+
+#if defined(__GLIBC__)
+
+extern "C" {
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+}
+
+#else
+
+void *operator new(size_t size)
+{
+    void *p;
+
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    p = malloc(size != 0 ? size : 1);
+    if (p == NULL) {
+        throw bad_alloc();
+    }
+
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+#endif
+
+struct bench_result {
+    string name;
+    uint64_t ops;
+    double ns_per_op;
+    double p50_ns;
+    double p99_ns;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t bench_seed = 0x6d657368U;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift32 */
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+
+    return bench_seed;
+}
+
+static uint32_t bench_node_num(unsigned int i)
+{
+    return BENCH_MY_NODE_NUM + 1 + i;
+}
+
+class BenchClient : public SimpleClient {
+
+public:
+
+    void feed(const meshtastic_FromRadio &fromRadio) {
+        mtEvent(&_mtc, NULL, 0, &fromRadio);
+    }
+
+    void dispatch(const meshtastic_MeshPacket &packet) {
+        gotPacket(packet);
+    }
+
+};
+
+class BenchMeshClient : public MeshClient {
+
+public:
+
+    void dispatch(const meshtastic_MeshPacket &packet) {
+        gotPacket(packet);
+    }
+
+};
+
+/*
+ * The generated corpus: the wire stream, each frame's offset and length
+ * within it, and the decoded packets for the benchmarks that start past
+ * the decoder.
+ */
+struct bench_corpus {
+    vector<uint8_t> stream;
+    vector<size_t> offsets;
+    vector<size_t> lengths;
+    vector<meshtastic_FromRadio> setup;
+    vector<meshtastic_MeshPacket> packets;
+    vector<meshtastic_MeshPacket> texts;
+};
+
+static bool bench_encode(const pb_msgdesc_t *fields, const void *msg,
+                         uint8_t *buf, size_t size, size_t *len)
+{
+    pb_ostream_t stream = pb_ostream_from_buffer(buf, size);
+
+    if (pb_encode(&stream, fields, msg) != true) {
+        return false;
+    }
+
+    *len = stream.bytes_written;
+
+    return true;
+}
+
+static bool bench_append(struct bench_corpus &corpus,
+                         const meshtastic_FromRadio &fromRadio)
+{
+    uint8_t buf[sizeof(struct mt_pb_header) + MT_PB_MAX_LEN];
+    struct mt_pb_header *header = (struct mt_pb_header *) buf;
+    size_t len;
+
+    if (!bench_encode(meshtastic_FromRadio_fields, &fromRadio,
+                      buf + sizeof(*header), MT_PB_MAX_LEN, &len)) {
+        return false;
+    }
+
+    header->start1 = MT_PB_START1;
+    header->start2 = MT_PB_START2;
+    header->h_len = (len >> 8) & 0xff;
+    header->l_len = len & 0xff;
+    len += sizeof(*header);
+
+    corpus.offsets.push_back(corpus.stream.size());
+    corpus.lengths.push_back(len);
+    corpus.stream.insert(corpus.stream.end(), buf, buf + len);
+
+    return true;
+}
+
+static void bench_user(meshtastic_User &user, uint32_t node_num)
+{
+    bzero(&user, sizeof(user));
+    snprintf(user.id, sizeof(user.id), "!%.8x", node_num);
+    snprintf(user.long_name, sizeof(user.long_name), "Bench Node %.4x",
+             node_num & 0xffffU);
+    snprintf(user.short_name, sizeof(user.short_name), "%.4x",
+             node_num & 0xffffU);
+    user.hw_model = meshtastic_HardwareModel_RAK4631;
+    user.public_key.size = 32;
+    for (unsigned int i = 0; i < user.public_key.size; i++) {
+        user.public_key.bytes[i] = (uint8_t) bench_rand();
+    }
+}
+
+/*
+ * Node and channel infos first, as a want_config would return them, then
+ * a mix of text, position, telemetry, nodeinfo and routing packets.
+ */
+static bool bench_generate(struct bench_corpus &corpus, unsigned int count)
+{
+    static const char *chatter[] = {
+        "hello mesh",
+        "anyone on tonight?",
+        "rollcall",
+        "uptime",
+        "status",
+        "meshstats",
+        "nodes",
+        "env",
+        "ping",
+        "73 de bench",
+    };
+    meshtastic_FromRadio fromRadio;
+    meshtastic_MeshPacket &packet = fromRadio.packet;
+    meshtastic_Position position;
+    meshtastic_Telemetry telemetry;
+    meshtastic_Routing routing;
+    meshtastic_User user;
+    const pb_msgdesc_t *fields;
+    const void *payload;
+    unsigned int i, kind;
+    uint32_t r;
+    size_t len;
+
+    bzero(&fromRadio, sizeof(fromRadio));
+    fromRadio.which_payload_variant = meshtastic_FromRadio_my_info_tag;
+    fromRadio.my_info.my_node_num = BENCH_MY_NODE_NUM;
+    corpus.setup.push_back(fromRadio);
+
+    for (i = 0; i < 2; i++) {
+        bzero(&fromRadio, sizeof(fromRadio));
+        fromRadio.which_payload_variant = meshtastic_FromRadio_channel_tag;
+        fromRadio.channel.index = i;
+        fromRadio.channel.has_settings = true;
+        snprintf(fromRadio.channel.settings.name,
+                 sizeof(fromRadio.channel.settings.name), "%s",
+                 (i == 0) ? "LongFast" : "bench");
+        fromRadio.channel.role = (i == 0) ?
+            meshtastic_Channel_Role_PRIMARY :
+            meshtastic_Channel_Role_SECONDARY;
+        corpus.setup.push_back(fromRadio);
+    }
+
+    for (i = 0; i <= BENCH_NODES; i++) {
+        bzero(&fromRadio, sizeof(fromRadio));
+        fromRadio.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+        fromRadio.node_info.num = (i == 0) ?
+            BENCH_MY_NODE_NUM : bench_node_num(i - 1);
+        fromRadio.node_info.has_user = true;
+        bench_user(fromRadio.node_info.user, fromRadio.node_info.num);
+        fromRadio.node_info.last_heard = 1735689600U + i;
+        corpus.setup.push_back(fromRadio);
+    }
+
+    for (i = 0; i < count; i++) {
+        r = bench_rand();
+
+        bzero(&fromRadio, sizeof(fromRadio));
+        fromRadio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+        packet.from = bench_node_num(r % BENCH_NODES);
+        packet.to = ((r >> 8) % 4 == 0) ? BENCH_MY_NODE_NUM : 0xffffffffU;
+        packet.channel = (r >> 12) % 2;
+        packet.id = bench_rand() & 0x7fffffffU;
+        packet.rx_time = 1735689600U + i;
+        packet.rx_snr = 6.25f;
+        packet.rx_rssi = -90;
+        packet.hop_limit = 3;
+        packet.hop_start = 3;
+        packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+
+        fields = NULL;
+        payload = NULL;
+        kind = (r >> 16) % 100;
+        if (kind < 40) {
+            const char *text = chatter[(r >> 24) % 10];
+
+            packet.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+            len = strlen(text);
+            memcpy(packet.decoded.payload.bytes, text, len);
+            packet.decoded.payload.size = len;
+        } else if (kind < 65) {
+            bzero(&position, sizeof(position));
+            position.has_latitude_i = true;
+            position.latitude_i = 374000000 + (int32_t) (r % 100000);
+            position.has_longitude_i = true;
+            position.longitude_i = -1220000000 - (int32_t) (r % 100000);
+            position.has_altitude = true;
+            position.altitude = (int32_t) (r % 500);
+            position.time = packet.rx_time;
+            position.precision_bits = 32;
+            packet.decoded.portnum = meshtastic_PortNum_POSITION_APP;
+            fields = meshtastic_Position_fields;
+            payload = &position;
+        } else if (kind < 90) {
+            bzero(&telemetry, sizeof(telemetry));
+            telemetry.time = packet.rx_time;
+            telemetry.which_variant = meshtastic_Telemetry_device_metrics_tag;
+            telemetry.variant.device_metrics.has_battery_level = true;
+            telemetry.variant.device_metrics.battery_level = r % 101;
+            telemetry.variant.device_metrics.has_voltage = true;
+            telemetry.variant.device_metrics.voltage = 3.7f;
+            telemetry.variant.device_metrics.has_channel_utilization = true;
+            telemetry.variant.device_metrics.channel_utilization = 12.5f;
+            telemetry.variant.device_metrics.has_air_util_tx = true;
+            telemetry.variant.device_metrics.air_util_tx = 1.5f;
+            telemetry.variant.device_metrics.has_uptime_seconds = true;
+            telemetry.variant.device_metrics.uptime_seconds = r % 864000;
+            packet.decoded.portnum = meshtastic_PortNum_TELEMETRY_APP;
+            fields = meshtastic_Telemetry_fields;
+            payload = &telemetry;
+        } else if (kind < 95) {
+            bench_user(user, packet.from);
+            packet.decoded.portnum = meshtastic_PortNum_NODEINFO_APP;
+            fields = meshtastic_User_fields;
+            payload = &user;
+        } else {
+            bzero(&routing, sizeof(routing));
+            routing.which_variant = meshtastic_Routing_error_reason_tag;
+            routing.error_reason = meshtastic_Routing_Error_NONE;
+            packet.decoded.portnum = meshtastic_PortNum_ROUTING_APP;
+            packet.decoded.request_id = bench_rand() & 0x7fffffffU;
+            fields = meshtastic_Routing_fields;
+            payload = &routing;
+        }
+
+        if ((fields != NULL) &&
+            !bench_encode(fields, payload, packet.decoded.payload.bytes,
+                          sizeof(packet.decoded.payload.bytes), &len)) {
+            return false;
+        }
+        if (fields != NULL) {
+            packet.decoded.payload.size = len;
+        }
+
+        if (!bench_append(corpus, fromRadio)) {
+            return false;
+        }
+
+        corpus.packets.push_back(packet);
+        if (packet.decoded.portnum == meshtastic_PortNum_TEXT_MESSAGE_APP) {
+            corpus.texts.push_back(packet);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Times op(i) for successive i until 'samples' batches have run. The
+ * batch size doubles until a batch takes at least BENCH_BATCH_NS.
+ */
+template <typename Op>
+static struct bench_result bench_run(const string &name, unsigned int samples,
+                                     Op op)
+{
+    struct bench_result result;
+    vector<double> per_op;
+    uint64_t batch = 1;
+    uint64_t i = 0, k;
+    uint64_t t0, t1;
+    uint64_t total_ns = 0;
+    uint64_t allocs0, bytes0;
+
+    /* Warm caches and lazily grown buffers */
+    for (k = 0; k < 1024; k++) {
+        op(i++);
+    }
+
+    for (;;) {
+        t0 = bench_now();
+        for (k = 0; k < batch; k++) {
+            op(i++);
+        }
+        t1 = bench_now();
+        if (((t1 - t0) >= BENCH_BATCH_NS) || (batch >= (1U << 20))) {
+            break;
+        }
+        batch *= 2;
+    }
+
+    per_op.reserve(samples);
+    allocs0 = bench_allocs;
+    bytes0 = bench_alloc_bytes;
+
+    for (unsigned int s = 0; s < samples; s++) {
+        t0 = bench_now();
+        for (k = 0; k < batch; k++) {
+            op(i++);
+        }
+        t1 = bench_now();
+        total_ns += (t1 - t0);
+        per_op.push_back((double) (t1 - t0) / (double) batch);
+    }
+
+    result.name = name;
+    result.ops = batch * samples;
+    result.ns_per_op = (double) total_ns / (double) result.ops;
+    result.allocs_per_op =
+        (double) (bench_allocs - allocs0) / (double) result.ops;
+    result.bytes_per_op =
+        (double) (bench_alloc_bytes - bytes0) / (double) result.ops;
+
+    sort(per_op.begin(), per_op.end());
+    result.p50_ns = per_op[(per_op.size() * 50) / 100];
+    result.p99_ns = per_op[(per_op.size() * 99) / 100];
+
+    return result;
+}
+
+static void bench_null_handler(struct mt_client *mtc, const void *packet,
+                               size_t size,
+                               const meshtastic_FromRadio *from_radio)
+{
+    (void)(mtc);
+    (void)(packet);
+    (void)(size);
+    (void)(from_radio);
+}
+
+/*
+ * Hands a frame to the framer the way mt_serial_process() would, in
+ * reads of BENCH_READ_CHUNK bytes, draining after each.
+ */
+static void bench_feed(struct mt_client *mtc, const uint8_t *buf, size_t len)
+{
+    struct mt_span span[2];
+    unsigned int n, j;
+    size_t chunk, m;
+
+    while (len > 0) {
+        chunk = (len < BENCH_READ_CHUNK) ? len : BENCH_READ_CHUNK;
+        n = mt_framer_spans(mtc, span);
+        for (j = 0, m = 0; (j < n) && (m < chunk); j++) {
+            size_t c = span[j].len < (chunk - m) ? span[j].len : (chunk - m);
+            memcpy(span[j].buf, buf + m, c);
+            m += c;
+        }
+        if (m == 0) {
+            break;
+        }
+        mt_framer_commit(mtc, m);
+        mt_framer_drain(mtc);
+        buf += m;
+        len -= m;
+    }
+}
+
+static void bench_print(const vector<struct bench_result> &results,
+                        bool json)
+{
+    size_t i;
+
+    if (json) {
+        printf("{\n  \"benchmarks\": [\n");
+        for (i = 0; i < results.size(); i++) {
+            printf("    { \"name\": \"%s\", \"ops\": %llu, "
+                   "\"ns_per_op\": %.1f, \"p50_ns\": %.1f, "
+                   "\"p99_ns\": %.1f, \"allocs_per_op\": %.3f, "
+                   "\"bytes_per_op\": %.1f }%s\n",
+                   results[i].name.c_str(),
+                   (unsigned long long) results[i].ops,
+                   results[i].ns_per_op, results[i].p50_ns,
+                   results[i].p99_ns, results[i].allocs_per_op,
+                   results[i].bytes_per_op,
+                   (i + 1 < results.size()) ? "," : "");
+        }
+        printf("  ]\n}\n");
+    } else {
+        printf("%-20s %12s %10s %10s %10s %10s %10s\n",
+               "benchmark", "ops", "ns/op", "p50", "p99",
+               "allocs/op", "bytes/op");
+        for (i = 0; i < results.size(); i++) {
+            printf("%-20s %12llu %10.1f %10.1f %10.1f %10.3f %10.1f\n",
+                   results[i].name.c_str(),
+                   (unsigned long long) results[i].ops,
+                   results[i].ns_per_op, results[i].p50_ns,
+                   results[i].p99_ns, results[i].allocs_per_op,
+                   results[i].bytes_per_op);
+        }
+    }
+}
+
+static const struct option long_options[] = {
+    { "json", no_argument, NULL, 'j', },
+    { "samples", required_argument, NULL, 'n', },
+    { "corpus", required_argument, NULL, 'c', },
+    { "filter", required_argument, NULL, 'f', },
+    { "seed", required_argument, NULL, 's', },
+};
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    bool json = false;
+    unsigned int samples = 200;
+    unsigned int count = 1024;
+    string filter;
+    struct bench_corpus corpus;
+    vector<struct bench_result> results;
+    struct mt_client mtc;
+    shared_ptr<BenchClient> client;
+    shared_ptr<BenchMeshClient> meshClient;
+    shared_ptr<MeshNvm> nvm;
+    shared_ptr<HomeChat> homeChat;
+    ostringstream os;
+    char home[] = "/tmp/meshbench.XXXXXX";
+    const char *old_home;
+    uint8_t drain[1024];
+    char path[256];
+    size_t i;
+
+    for (;;) {
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "jn:c:f:s:",
+                            long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'j':
+            json = true;
+            break;
+        case 'n':
+            samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 's':
+            bench_seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Unrecognized argument specified!\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if ((samples == 0) || (count == 0) || (bench_seed == 0)) {
+        fprintf(stderr, "samples, corpus and seed must be non-zero!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!bench_generate(corpus, count)) {
+        fprintf(stderr, "corpus generation failed!\n");
+        ret = -1;
+        goto done;
+    }
+
+#define BENCH(name, op)                                             \
+    if (filter.empty() || (string(name).find(filter) != string::npos)) { \
+        results.push_back(bench_run(name, samples, op));            \
+    }
+
+    /* Framing alone: the filter drops every frame right after the peek */
+    bzero(&mtc, sizeof(mtc));
+    mtc.fd = -1;
+    mtc.handler = bench_null_handler;
+    mt_filter_enable(&mtc, true);
+    BENCH("framing", [&](uint64_t n) {
+        size_t j = n % corpus.offsets.size();
+        bench_feed(&mtc, &corpus.stream[corpus.offsets[j]],
+                   corpus.lengths[j]);
+    });
+
+    bzero(&mtc, sizeof(mtc));
+    mtc.fd = -1;
+    mtc.handler = bench_null_handler;
+    BENCH("recv_packet", [&](uint64_t n) {
+        size_t j = n % corpus.offsets.size();
+        mt_recv_packet(&mtc, &corpus.stream[corpus.offsets[j]],
+                       corpus.lengths[j]);
+    });
+
+    client = make_shared<BenchClient>();
+    for (i = 0; i < corpus.setup.size(); i++) {
+        client->feed(corpus.setup[i]);
+    }
+
+    BENCH("dispatch.simple", [&](uint64_t n) {
+        client->dispatch(corpus.packets[n % corpus.packets.size()]);
+    });
+
+    meshClient = make_shared<BenchMeshClient>();
+    BENCH("dispatch.mesh", [&](uint64_t n) {
+        meshClient->dispatch(corpus.packets[n % corpus.packets.size()]);
+    });
+
+    BENCH("meshprint", [&](uint64_t n) {
+        os.seekp(0);
+        os << corpus.packets[n % corpus.packets.size()];
+    });
+
+    /* Keep MeshNvm off the real home directory */
+    old_home = getenv("HOME");
+    if (mkdtemp(home) == NULL) {
+        fprintf(stderr, "mkdtemp: %s!\n", strerror(errno));
+        ret = -1;
+        goto done;
+    }
+    setenv("HOME", home, 1);
+
+    nvm = make_shared<MeshNvm>();
+    if (!nvm->setupFor(BENCH_MY_NODE_NUM)) {
+        fprintf(stderr, "MeshNvm setup failed!\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    for (i = 0; i < BENCH_NODES; i++) {
+        meshtastic_User_public_key_t pubkey;
+
+        bzero(&pubkey, sizeof(pubkey));
+        pubkey.size = 32;
+        memset(pubkey.bytes, (int) i, pubkey.size);
+        if (i < 4) {
+            nvm->addNvmAdmin(bench_node_num(i), pubkey);
+        } else if (i < 32) {
+            nvm->addNvmMate(bench_node_num(i), pubkey);
+        }
+    }
+
+    BENCH("nvm.save", [&](uint64_t n) {
+        (void)(n);
+        nvm->saveNvm();
+    });
+
+    BENCH("nvm.load", [&](uint64_t n) {
+        (void)(n);
+        nvm->loadNvm();
+    });
+
+    /* Replies are sent through a loopback and discarded */
+    if (mt_attach(&client->_mtc, &mt_loopback_ops, "bench") != 0) {
+        fprintf(stderr, "mt_attach: %s!\n", strerror(errno));
+        ret = -1;
+        goto cleanup;
+    }
+
+    homeChat = make_shared<HomeChat>(client);
+    homeChat->setNvm(nvm);
+    for (i = 0; i < nvm->nvmAdmins().size(); i++) {
+        homeChat->addAdmin(nvm->nvmAdmins()[i].node_num,
+                           nvm->nvmAdmins()[i].pubkey);
+    }
+    for (i = 0; i < nvm->nvmMates().size(); i++) {
+        homeChat->addMate(nvm->nvmMates()[i].node_num,
+                          nvm->nvmMates()[i].pubkey);
+    }
+
+    BENCH("homechat", [&](uint64_t n) {
+        size_t j = n % corpus.texts.size();
+        homeChat->handleTextView(corpus.texts[j],
+                                 TextView::payload(corpus.texts[j]));
+        while (mt_loopback_pull(&client->_mtc, drain, sizeof(drain)) > 0) {
+            continue;
+        }
+    });
+
+    mt_detach(&client->_mtc);
+
+#undef BENCH
+
+    bench_print(results, json);
+
+cleanup:
+
+    nvm = NULL;
+    homeChat = NULL;
+    snprintf(path, sizeof(path), "%s/.libmeshtastic.%.8x",
+             home, BENCH_MY_NODE_NUM);
+    unlink(path);
+    rmdir(home);
+    if (old_home != NULL) {
+        setenv("HOME", old_home, 1);
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
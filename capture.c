@@ -0,0 +1,365 @@
+/*
+ * capture.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <libmeshtastic.h>
+
+/*
+ * Frames are written as pcapng Enhanced Packet Blocks into one half of a
+ * double buffer while a writer thread flushes the other half, so the
+ * receive and send paths only ever pay for a memcpy under a short lock.
+ * If the writer cannot keep up the frame is dropped and counted rather
+ * than stalling the radio link.
+ */
+
+#define MT_CAPTURE_BUF_SIZE     (256 * 1024)
+#define MT_CAPTURE_FLUSH_MS     1000
+
+#define PCAPNG_SHB              0x0a0d0d0aU
+#define PCAPNG_IDB              0x00000001U
+#define PCAPNG_EPB              0x00000006U
+#define PCAPNG_BOM              0x1a2b3c4dU
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+#define PCAPNG_EPB_INBOUND      0x1U
+#define PCAPNG_EPB_OUTBOUND     0x2U
+
+#define PCAPNG_PAD(n)           (((n) + 3) & ~((size_t) 3))
+
+struct mt_capture {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *buf[2];
+    size_t len;
+    unsigned int active;
+    bool stop;
+    uint64_t mono0;
+    uint64_t real0;
+    uint32_t frames;
+    uint32_t drops;
+};
+
+static uint64_t mt_capture_clock(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static uint8_t *mt_capture_put32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static uint8_t *mt_capture_put16(uint8_t *p, uint16_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static int mt_capture_write(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Section header and a single interface carrying the raw 0x94C3-framed
+ * stream, with nanosecond timestamps. Every start opens a new section,
+ * which keeps appending to an existing capture valid pcapng.
+ */
+static int mt_capture_header(int fd)
+{
+    uint8_t hdr[28 + 32];
+    uint8_t *p = hdr;
+    int64_t section_len = -1;
+
+    p = mt_capture_put32(p, PCAPNG_SHB);
+    p = mt_capture_put32(p, 28);
+    p = mt_capture_put32(p, PCAPNG_BOM);
+    p = mt_capture_put16(p, 1);
+    p = mt_capture_put16(p, 0);
+    memcpy(p, &section_len, sizeof(section_len));
+    p += sizeof(section_len);
+    p = mt_capture_put32(p, 28);
+
+    p = mt_capture_put32(p, PCAPNG_IDB);
+    p = mt_capture_put32(p, 32);
+    p = mt_capture_put16(p, MT_CAPTURE_LINKTYPE);
+    p = mt_capture_put16(p, 0);
+    p = mt_capture_put32(p, sizeof(struct mt_pb_header) + MT_PB_MAX_LEN);
+    p = mt_capture_put16(p, PCAPNG_OPT_IF_TSRESOL);
+    p = mt_capture_put16(p, 1);
+    p = mt_capture_put32(p, 9);
+    p = mt_capture_put32(p, PCAPNG_OPT_END);
+    p = mt_capture_put32(p, 32);
+
+    return mt_capture_write(fd, hdr, p - hdr);
+}
+
+static void *mt_capture_thread(void *arg)
+{
+    struct mt_capture *cap = (struct mt_capture *) arg;
+    struct timespec ts;
+    const uint8_t *buf;
+    size_t len;
+    bool stop;
+
+    pthread_mutex_lock(&cap->lock);
+
+    for (;;) {
+        if ((cap->len == 0) && !cap->stop) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += MT_CAPTURE_FLUSH_MS / 1000;
+            pthread_cond_timedwait(&cap->cond, &cap->lock, &ts);
+        }
+
+        stop = cap->stop;
+        buf = cap->buf[cap->active];
+        len = cap->len;
+        cap->active ^= 1;
+        cap->len = 0;
+
+        pthread_mutex_unlock(&cap->lock);
+
+        if ((len > 0) && (mt_capture_write(cap->fd, buf, len) != 0)) {
+            /* Out of disk or similar; the frames are gone either way */
+            pthread_mutex_lock(&cap->lock);
+            cap->drops++;
+            pthread_mutex_unlock(&cap->lock);
+        }
+
+        if (stop) {
+            break;
+        }
+
+        pthread_mutex_lock(&cap->lock);
+    }
+
+    return NULL;
+}
+
+int mt_capture_start(struct mt_client *mtc, const char *path)
+{
+    int ret = 0;
+    struct mt_capture *cap = NULL;
+
+    if ((mtc == NULL) || (path == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->capture != NULL) {
+        errno = EBUSY;
+        ret = -1;
+        goto done;
+    }
+
+    cap = (struct mt_capture *) calloc(1, sizeof(*cap));
+    if (cap == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    cap->fd = -1;
+    cap->buf[0] = (uint8_t *) malloc(MT_CAPTURE_BUF_SIZE);
+    cap->buf[1] = (uint8_t *) malloc(MT_CAPTURE_BUF_SIZE);
+    if ((cap->buf[0] == NULL) || (cap->buf[1] == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    cap->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (cap->fd == -1) {
+        ret = -1;
+        goto done;
+    }
+
+    ret = mt_capture_header(cap->fd);
+    if (ret != 0) {
+        goto done;
+    }
+
+    /* Monotonic deltas anchored to the wall clock at start */
+    cap->mono0 = mt_capture_clock(CLOCK_MONOTONIC);
+    cap->real0 = mt_capture_clock(CLOCK_REALTIME);
+
+    pthread_mutex_init(&cap->lock, NULL);
+    pthread_cond_init(&cap->cond, NULL);
+
+    ret = pthread_create(&cap->thread, NULL, mt_capture_thread, cap);
+    if (ret != 0) {
+        pthread_cond_destroy(&cap->cond);
+        pthread_mutex_destroy(&cap->lock);
+        errno = ret;
+        ret = -1;
+        goto done;
+    }
+
+    mtc->capture = cap;
+    cap = NULL;
+
+done:
+
+    if (cap != NULL) {
+        if (cap->fd != -1) {
+            close(cap->fd);
+        }
+        free(cap->buf[0]);
+        free(cap->buf[1]);
+        free(cap);
+    }
+
+    return ret;
+}
+
+void mt_capture_stop(struct mt_client *mtc)
+{
+    struct mt_capture *cap;
+
+    if ((mtc == NULL) || (mtc->capture == NULL)) {
+        return;
+    }
+
+    cap = mtc->capture;
+    mtc->capture = NULL;
+
+    pthread_mutex_lock(&cap->lock);
+    cap->stop = true;
+    pthread_cond_signal(&cap->cond);
+    pthread_mutex_unlock(&cap->lock);
+
+    pthread_join(cap->thread, NULL);
+
+    pthread_cond_destroy(&cap->cond);
+    pthread_mutex_destroy(&cap->lock);
+    close(cap->fd);
+    free(cap->buf[0]);
+    free(cap->buf[1]);
+    free(cap);
+}
+
+void mt_capture_frame(struct mt_client *mtc, unsigned int dir,
+                      const uint8_t *buf, size_t len)
+{
+    struct mt_capture *cap;
+    uint64_t ts;
+    uint32_t block_len;
+    uint8_t *p;
+
+    if ((mtc == NULL) || (mtc->capture == NULL) || (buf == NULL)) {
+        return;
+    }
+
+    cap = mtc->capture;
+    ts = cap->real0 + (mt_capture_clock(CLOCK_MONOTONIC) - cap->mono0);
+    block_len = 28 + PCAPNG_PAD(len) + 12 + 4;
+
+    pthread_mutex_lock(&cap->lock);
+
+    if (cap->len + block_len > MT_CAPTURE_BUF_SIZE) {
+        cap->drops++;
+        pthread_cond_signal(&cap->cond);
+        pthread_mutex_unlock(&cap->lock);
+        return;
+    }
+
+    p = cap->buf[cap->active] + cap->len;
+    p = mt_capture_put32(p, PCAPNG_EPB);
+    p = mt_capture_put32(p, block_len);
+    p = mt_capture_put32(p, 0);
+    p = mt_capture_put32(p, (uint32_t) (ts >> 32));
+    p = mt_capture_put32(p, (uint32_t) ts);
+    p = mt_capture_put32(p, len);
+    p = mt_capture_put32(p, len);
+    memcpy(p, buf, len);
+    memset(p + len, 0, PCAPNG_PAD(len) - len);
+    p += PCAPNG_PAD(len);
+    p = mt_capture_put16(p, PCAPNG_OPT_EPB_FLAGS);
+    p = mt_capture_put16(p, 4);
+    p = mt_capture_put32(p, (dir == MT_CAPTURE_TX) ?
+                         PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND);
+    p = mt_capture_put32(p, PCAPNG_OPT_END);
+    p = mt_capture_put32(p, block_len);
+
+    cap->len += block_len;
+    cap->frames++;
+
+    if (cap->len >= (MT_CAPTURE_BUF_SIZE / 2)) {
+        pthread_cond_signal(&cap->cond);
+    }
+
+    pthread_mutex_unlock(&cap->lock);
+}
+
+uint32_t mt_capture_frames(const struct mt_client *mtc)
+{
+    uint32_t n;
+
+    if ((mtc == NULL) || (mtc->capture == NULL)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mtc->capture->lock);
+    n = mtc->capture->frames;
+    pthread_mutex_unlock(&mtc->capture->lock);
+
+    return n;
+}
+
+uint32_t mt_capture_drops(const struct mt_client *mtc)
+{
+    uint32_t n;
+
+    if ((mtc == NULL) || (mtc->capture == NULL)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mtc->capture->lock);
+    n = mtc->capture->drops;
+    pthread_mutex_unlock(&mtc->capture->lock);
+
+    return n;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,699 @@
+/*
+ * emulator.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <termios.h>
+#include <libmeshtastic.h>
+
+/*
+ * Pretends to be device firmware on the master side of a pseudo-terminal,
+ * so that an unmodified client can mt_serial_attach() to the slave. It
+ * answers want_config with a generated node DB, channels and configs,
+ * ACKs packets that ask for it, and once a config session is up sends a
+ * steady stream of synthetic mesh traffic at the configured rate.
+ *
+ * Output is queued and written as the pty drains, so a slow client sees
+ * backpressure instead of lost frames; synthetic traffic is only
+ * generated while the queue is short.
+ */
+
+#define MT_EMU_NODE_BASE        0x0e0e0000U
+#define MT_EMU_OUT_HIGH         (64 * 1024)
+#define MT_EMU_LAT_BASE         373000000
+#define MT_EMU_LON_BASE         (-1220000000)
+
+struct mt_emulator {
+    struct mt_emulator_config config;
+    int master;
+    int slave;
+    char device[64];
+    pthread_t thread;
+    bool running;
+    bool configured;
+    unsigned int seed;
+    uint32_t from_radio_id;
+    uint64_t next_ns;
+    uint8_t in[sizeof(struct mt_pb_header) + MT_PB_MAX_LEN];
+    size_t in_len;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    pthread_mutex_t lock;
+    struct mt_emulator_stats stats;
+};
+
+static uint64_t mt_emulator_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t mt_emulator_node(const struct mt_emulator *emu,
+                                 unsigned int i)
+{
+    return emu->config.node_num + i;
+}
+
+static uint32_t mt_emulator_random_peer(struct mt_emulator *emu)
+{
+    if (emu->config.nodes <= 1) {
+        return emu->config.node_num + 1;
+    }
+
+    return mt_emulator_node(emu, 1 + (rand_r(&emu->seed) %
+                                      (emu->config.nodes - 1)));
+}
+
+static int mt_emulator_queue(struct mt_emulator *emu,
+                             const meshtastic_FromRadio *from_radio)
+{
+    struct mt_pb_header *header;
+    pb_ostream_t ostream;
+    uint8_t *p;
+    size_t need, n;
+
+    need = emu->out_len + sizeof(*header) + MT_PB_MAX_LEN;
+    if (need > emu->out_cap) {
+        if (emu->out_off > 0) {
+            memmove(emu->out, emu->out + emu->out_off,
+                    emu->out_len - emu->out_off);
+            emu->out_len -= emu->out_off;
+            emu->out_off = 0;
+            need = emu->out_len + sizeof(*header) + MT_PB_MAX_LEN;
+        }
+
+        for (n = (emu->out_cap != 0) ? emu->out_cap : 65536; n < need;
+             n *= 2) {
+            continue;
+        }
+
+        if (n > emu->out_cap) {
+            p = (uint8_t *) realloc(emu->out, n);
+            if (p == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            emu->out = p;
+            emu->out_cap = n;
+        }
+    }
+
+    header = (struct mt_pb_header *) (emu->out + emu->out_len);
+    ostream = pb_ostream_from_buffer(emu->out + emu->out_len +
+                                     sizeof(*header), MT_PB_MAX_LEN);
+    if (pb_encode(&ostream, meshtastic_FromRadio_fields, from_radio) != 1) {
+        errno = EIO;
+        return -1;
+    }
+
+    header->start1 = MT_PB_START1;
+    header->start2 = MT_PB_START2;
+    header->h_len = ostream.bytes_written / 256;
+    header->l_len = ostream.bytes_written % 256;
+    emu->out_len += sizeof(*header) + ostream.bytes_written;
+    emu->stats.frames_tx++;
+
+    return 0;
+}
+
+static int mt_emulator_send(struct mt_emulator *emu,
+                            meshtastic_FromRadio *from_radio)
+{
+    from_radio->id = ++emu->from_radio_id;
+
+    return mt_emulator_queue(emu, from_radio);
+}
+
+static void mt_emulator_fill_node(struct mt_emulator *emu, unsigned int i,
+                                  meshtastic_NodeInfo *node)
+{
+    uint32_t num = mt_emulator_node(emu, i);
+
+    bzero(node, sizeof(*node));
+    node->num = num;
+    node->has_user = true;
+    snprintf(node->user.id, sizeof(node->user.id), "!%08x", num);
+    snprintf(node->user.long_name, sizeof(node->user.long_name),
+             "Emulated Node %u", i);
+    snprintf(node->user.short_name, sizeof(node->user.short_name),
+             "E%03u", i % 1000);
+    node->user.hw_model = meshtastic_HardwareModel_PORTDUINO;
+    node->has_position = true;
+    node->position.has_latitude_i = true;
+    node->position.latitude_i = MT_EMU_LAT_BASE +
+        (int32_t) (rand_r(&emu->seed) % 1000000);
+    node->position.has_longitude_i = true;
+    node->position.longitude_i = MT_EMU_LON_BASE +
+        (int32_t) (rand_r(&emu->seed) % 1000000);
+    node->snr = (float) (rand_r(&emu->seed) % 200) / 10.0f - 10.0f;
+    node->last_heard = (uint32_t) time(NULL) -
+        (uint32_t) (rand_r(&emu->seed) % 7200);
+    if (i > 0) {
+        node->has_hops_away = true;
+        node->hops_away = rand_r(&emu->seed) % 4;
+    }
+}
+
+/*
+ * Same order as the firmware's PhoneAPI: my info, own node, metadata,
+ * channels, configs, module configs, every other node, complete. Like the
+ * firmware, MT_WANT_CONFIG_ONLY_CONFIG leaves out the other nodes and
+ * MT_WANT_CONFIG_ONLY_NODES everything from metadata to module configs.
+ */
+static int mt_emulator_want_config(struct mt_emulator *emu, uint32_t id)
+{
+    int ret = 0;
+    meshtastic_FromRadio fr;
+    unsigned int i;
+    bool config = (id != MT_WANT_CONFIG_ONLY_NODES);
+    bool nodes = (id != MT_WANT_CONFIG_ONLY_CONFIG);
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_my_info_tag;
+    fr.my_info.my_node_num = emu->config.node_num;
+    fr.my_info.min_app_version = 30200;
+    ret |= mt_emulator_send(emu, &fr);
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+    mt_emulator_fill_node(emu, 0, &fr.node_info);
+    ret |= mt_emulator_send(emu, &fr);
+
+    if (!config) {
+        goto others;
+    }
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_metadata_tag;
+    snprintf(fr.metadata.firmware_version,
+             sizeof(fr.metadata.firmware_version), "2.6.0.emulator");
+    fr.metadata.device_state_version = 23;
+    ret |= mt_emulator_send(emu, &fr);
+
+    for (i = 0; i < emu->config.channels; i++) {
+        bzero(&fr, sizeof(fr));
+        fr.which_payload_variant = meshtastic_FromRadio_channel_tag;
+        fr.channel.index = i;
+        fr.channel.has_settings = true;
+        snprintf(fr.channel.settings.name, sizeof(fr.channel.settings.name),
+                 (i == 0) ? "" : "emu%u", i);
+        fr.channel.role = (i == 0) ?
+            meshtastic_Channel_Role_PRIMARY :
+            meshtastic_Channel_Role_SECONDARY;
+        ret |= mt_emulator_send(emu, &fr);
+    }
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_config_tag;
+    fr.config.which_payload_variant = meshtastic_Config_device_tag;
+    fr.config.payload_variant.device.role =
+        meshtastic_Config_DeviceConfig_Role_CLIENT;
+    ret |= mt_emulator_send(emu, &fr);
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_config_tag;
+    fr.config.which_payload_variant = meshtastic_Config_lora_tag;
+    fr.config.payload_variant.lora.use_preset = true;
+    fr.config.payload_variant.lora.modem_preset =
+        meshtastic_Config_LoRaConfig_ModemPreset_LONG_FAST;
+    fr.config.payload_variant.lora.region =
+        meshtastic_Config_LoRaConfig_RegionCode_US;
+    fr.config.payload_variant.lora.hop_limit = 3;
+    fr.config.payload_variant.lora.tx_enabled = true;
+    ret |= mt_emulator_send(emu, &fr);
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_moduleConfig_tag;
+    fr.moduleConfig.which_payload_variant = meshtastic_ModuleConfig_mqtt_tag;
+    ret |= mt_emulator_send(emu, &fr);
+
+others:
+
+    for (i = 1; nodes && (i < emu->config.nodes); i++) {
+        bzero(&fr, sizeof(fr));
+        fr.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+        mt_emulator_fill_node(emu, i, &fr.node_info);
+        ret |= mt_emulator_send(emu, &fr);
+    }
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_config_complete_id_tag;
+    fr.config_complete_id = id;
+    ret |= mt_emulator_send(emu, &fr);
+
+    emu->configured = true;
+    emu->stats.configs++;
+    emu->next_ns = mt_emulator_now();
+
+    return ret;
+}
+
+static int mt_emulator_encode(meshtastic_MeshPacket *packet,
+                              const pb_msgdesc_t *fields, const void *msg)
+{
+    pb_ostream_t ostream;
+
+    ostream = pb_ostream_from_buffer(packet->decoded.payload.bytes,
+                                     sizeof(packet->decoded.payload.bytes));
+    if (pb_encode(&ostream, fields, msg) != 1) {
+        errno = EIO;
+        return -1;
+    }
+
+    packet->decoded.payload.size = ostream.bytes_written;
+
+    return 0;
+}
+
+static void mt_emulator_packet(struct mt_emulator *emu,
+                               meshtastic_FromRadio *fr, uint32_t from,
+                               uint32_t to, meshtastic_PortNum portnum)
+{
+    bzero(fr, sizeof(*fr));
+    fr->which_payload_variant = meshtastic_FromRadio_packet_tag;
+    fr->packet.from = from;
+    fr->packet.to = to;
+    fr->packet.id = (rand_r(&emu->seed) & 0x7fffffff) | 1;
+    fr->packet.rx_time = (uint32_t) time(NULL);
+    fr->packet.rx_snr = (float) (rand_r(&emu->seed) % 200) / 10.0f - 10.0f;
+    fr->packet.rx_rssi = -(int32_t) (40 + rand_r(&emu->seed) % 80);
+    fr->packet.hop_start = 3;
+    fr->packet.hop_limit = rand_r(&emu->seed) % 4;
+    fr->packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+    fr->packet.decoded.portnum = portnum;
+}
+
+/*
+ * One synthetic packet: mostly chat, then telemetry and positions, with
+ * the odd routing message, from a random node in the DB.
+ */
+static int mt_emulator_traffic(struct mt_emulator *emu)
+{
+    meshtastic_FromRadio fr;
+    meshtastic_Telemetry telemetry;
+    meshtastic_Position position;
+    meshtastic_Routing routing;
+    unsigned int pick = rand_r(&emu->seed) % 100;
+    uint32_t from = mt_emulator_random_peer(emu);
+    int len;
+
+    if (pick < 40) {
+        mt_emulator_packet(emu, &fr, from, 0xffffffffU,
+                           meshtastic_PortNum_TEXT_MESSAGE_APP);
+        fr.packet.channel = rand_r(&emu->seed) % emu->config.channels;
+        len = snprintf((char *) fr.packet.decoded.payload.bytes,
+                       sizeof(fr.packet.decoded.payload.bytes),
+                       "emulated message %llu from !%08x",
+                       (unsigned long long) emu->stats.generated, from);
+        fr.packet.decoded.payload.size = len;
+    } else if (pick < 70) {
+        mt_emulator_packet(emu, &fr, from, 0xffffffffU,
+                           meshtastic_PortNum_TELEMETRY_APP);
+        bzero(&telemetry, sizeof(telemetry));
+        telemetry.time = (uint32_t) time(NULL);
+        telemetry.which_variant = meshtastic_Telemetry_device_metrics_tag;
+        telemetry.variant.device_metrics.has_battery_level = true;
+        telemetry.variant.device_metrics.battery_level =
+            rand_r(&emu->seed) % 101;
+        telemetry.variant.device_metrics.has_voltage = true;
+        telemetry.variant.device_metrics.voltage = 3.3f +
+            (float) (rand_r(&emu->seed) % 90) / 100.0f;
+        telemetry.variant.device_metrics.has_channel_utilization = true;
+        telemetry.variant.device_metrics.channel_utilization =
+            (float) (rand_r(&emu->seed) % 400) / 10.0f;
+        telemetry.variant.device_metrics.has_uptime_seconds = true;
+        telemetry.variant.device_metrics.uptime_seconds =
+            rand_r(&emu->seed) % 1000000;
+        if (mt_emulator_encode(&fr.packet, meshtastic_Telemetry_fields,
+                               &telemetry) != 0) {
+            return -1;
+        }
+    } else if (pick < 95) {
+        mt_emulator_packet(emu, &fr, from, 0xffffffffU,
+                           meshtastic_PortNum_POSITION_APP);
+        bzero(&position, sizeof(position));
+        position.has_latitude_i = true;
+        position.latitude_i = MT_EMU_LAT_BASE +
+            (int32_t) (rand_r(&emu->seed) % 1000000);
+        position.has_longitude_i = true;
+        position.longitude_i = MT_EMU_LON_BASE +
+            (int32_t) (rand_r(&emu->seed) % 1000000);
+        position.time = (uint32_t) time(NULL);
+        if (mt_emulator_encode(&fr.packet, meshtastic_Position_fields,
+                               &position) != 0) {
+            return -1;
+        }
+    } else {
+        mt_emulator_packet(emu, &fr, from, mt_emulator_random_peer(emu),
+                           meshtastic_PortNum_ROUTING_APP);
+        bzero(&routing, sizeof(routing));
+        routing.which_variant = meshtastic_Routing_error_reason_tag;
+        routing.error_reason = meshtastic_Routing_Error_NONE;
+        fr.packet.decoded.request_id = rand_r(&emu->seed) & 0x7fffffff;
+        if (mt_emulator_encode(&fr.packet, meshtastic_Routing_fields,
+                               &routing) != 0) {
+            return -1;
+        }
+    }
+
+    emu->stats.generated++;
+
+    return mt_emulator_send(emu, &fr);
+}
+
+/*
+ * A packet from the client: report queue space the way the firmware does
+ * and, if asked for, ACK it as though the destination heard it.
+ */
+static int mt_emulator_to_mesh(struct mt_emulator *emu,
+                               const meshtastic_MeshPacket *packet)
+{
+    int ret = 0;
+    meshtastic_FromRadio fr;
+    meshtastic_Routing routing;
+    uint32_t from;
+
+    bzero(&fr, sizeof(fr));
+    fr.which_payload_variant = meshtastic_FromRadio_queueStatus_tag;
+    fr.queueStatus.free = 16;
+    fr.queueStatus.maxlen = 16;
+    fr.queueStatus.mesh_packet_id = packet->id;
+    ret |= mt_emulator_send(emu, &fr);
+
+    if (packet->want_ack) {
+        from = (packet->to == 0xffffffffU) ?
+            mt_emulator_random_peer(emu) : packet->to;
+        mt_emulator_packet(emu, &fr, from, emu->config.node_num,
+                           meshtastic_PortNum_ROUTING_APP);
+        fr.packet.decoded.request_id = packet->id;
+        bzero(&routing, sizeof(routing));
+        routing.which_variant = meshtastic_Routing_error_reason_tag;
+        routing.error_reason = meshtastic_Routing_Error_NONE;
+        ret |= mt_emulator_encode(&fr.packet, meshtastic_Routing_fields,
+                                  &routing);
+        ret |= mt_emulator_send(emu, &fr);
+        emu->stats.acks++;
+    }
+
+    return ret;
+}
+
+static void mt_emulator_handle(struct mt_emulator *emu, const uint8_t *pb,
+                               size_t len)
+{
+    meshtastic_ToRadio to_radio;
+    pb_istream_t istream;
+
+    istream = pb_istream_from_buffer(pb, len);
+    if (pb_decode(&istream, meshtastic_ToRadio_fields, &to_radio) != 1) {
+        emu->stats.errors++;
+        return;
+    }
+
+    emu->stats.frames_rx++;
+
+    switch (to_radio.which_payload_variant) {
+    case meshtastic_ToRadio_want_config_id_tag:
+        mt_emulator_want_config(emu, to_radio.want_config_id);
+        break;
+    case meshtastic_ToRadio_disconnect_tag:
+        emu->configured = false;
+        break;
+    case meshtastic_ToRadio_packet_tag:
+        mt_emulator_to_mesh(emu, &to_radio.packet);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Same 0x94C3 framing as FromRadio, resynchronising on garbage.
+ */
+static void mt_emulator_input(struct mt_emulator *emu)
+{
+    size_t off = 0, len;
+
+    while (emu->in_len - off >= sizeof(struct mt_pb_header)) {
+        if ((emu->in[off] != MT_PB_START1) ||
+            (emu->in[off + 1] != MT_PB_START2)) {
+            off++;
+            continue;
+        }
+
+        len = (emu->in[off + 2] << 8) | emu->in[off + 3];
+        if (len > MT_PB_MAX_LEN) {
+            off++;
+            continue;
+        }
+
+        if (emu->in_len - off < sizeof(struct mt_pb_header) + len) {
+            break;
+        }
+
+        mt_emulator_handle(emu, emu->in + off + sizeof(struct mt_pb_header),
+                           len);
+        off += sizeof(struct mt_pb_header) + len;
+    }
+
+    memmove(emu->in, emu->in + off, emu->in_len - off);
+    emu->in_len -= off;
+}
+
+static void *mt_emulator_thread(void *arg)
+{
+    struct mt_emulator *emu = (struct mt_emulator *) arg;
+    struct pollfd pfd;
+    uint64_t now, interval;
+    ssize_t n;
+    int timeout;
+
+    interval = (emu->config.rate > 0) ?
+        (1000000000ULL / emu->config.rate) : 0;
+
+    while (__atomic_load_n(&emu->running, __ATOMIC_ACQUIRE)) {
+        now = mt_emulator_now();
+
+        pthread_mutex_lock(&emu->lock);
+
+        /* Generate what is due, unless the client is not keeping up */
+        if (emu->configured && (interval > 0)) {
+            if (now > emu->next_ns + 1000000000ULL) {
+                emu->next_ns = now;
+            }
+            while ((emu->next_ns <= now) &&
+                   ((emu->out_len - emu->out_off) < MT_EMU_OUT_HIGH)) {
+                mt_emulator_traffic(emu);
+                emu->next_ns += interval;
+            }
+        }
+
+        timeout = 100;
+        if (emu->configured && (interval > 0) && (emu->next_ns > now) &&
+            ((emu->next_ns - now) / 1000000ULL < (uint64_t) timeout)) {
+            timeout = (int) ((emu->next_ns - now) / 1000000ULL);
+        }
+
+        pfd.fd = emu->master;
+        pfd.events = POLLIN;
+        if (emu->out_len > emu->out_off) {
+            pfd.events |= POLLOUT;
+        }
+        pfd.revents = 0;
+
+        pthread_mutex_unlock(&emu->lock);
+
+        if (poll(&pfd, 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&emu->lock);
+
+        if (pfd.revents & POLLIN) {
+            n = read(emu->master, emu->in + emu->in_len,
+                     sizeof(emu->in) - emu->in_len);
+            if (n > 0) {
+                emu->in_len += n;
+                mt_emulator_input(emu);
+                if (emu->in_len == sizeof(emu->in)) {
+                    /* No frame start in a full buffer, drop it */
+                    emu->in_len = 0;
+                }
+            }
+        }
+
+        if ((pfd.revents & POLLOUT) && (emu->out_len > emu->out_off)) {
+            n = write(emu->master, emu->out + emu->out_off,
+                      emu->out_len - emu->out_off);
+            if (n > 0) {
+                emu->out_off += n;
+                emu->stats.bytes_tx += n;
+                if (emu->out_off == emu->out_len) {
+                    emu->out_off = 0;
+                    emu->out_len = 0;
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&emu->lock);
+
+        if (pfd.revents & POLLHUP) {
+            /* No client has the slave open right now */
+            usleep(10000);
+        }
+    }
+
+    return NULL;
+}
+
+struct mt_emulator *mt_emulator_start(const struct mt_emulator_config *config)
+{
+    struct mt_emulator *emu = NULL;
+    struct termios tty;
+    int ret;
+
+    emu = (struct mt_emulator *) calloc(1, sizeof(*emu));
+    if (emu == NULL) {
+        goto done;
+    }
+
+    emu->master = -1;
+    emu->slave = -1;
+
+    if (config != NULL) {
+        memcpy(&emu->config, config, sizeof(*config));
+    }
+    if (emu->config.node_num == 0) {
+        emu->config.node_num = MT_EMU_NODE_BASE + 1;
+    }
+    if (emu->config.nodes == 0) {
+        emu->config.nodes = 1;
+    }
+    if (emu->config.channels == 0) {
+        emu->config.channels = 1;
+    }
+    if (emu->config.channels > 8) {
+        emu->config.channels = 8;
+    }
+    emu->seed = (emu->config.seed != 0) ?
+        emu->config.seed : (unsigned int) time(NULL);
+
+    emu->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (emu->master == -1) {
+        goto fail;
+    }
+
+    if ((grantpt(emu->master) != 0) || (unlockpt(emu->master) != 0) ||
+        (ptsname_r(emu->master, emu->device, sizeof(emu->device)) != 0)) {
+        goto fail;
+    }
+
+    /*
+     * Keep the slave open ourselves: it must be raw before the client
+     * shows up (no echo of our output back at us), and holding it means
+     * the master does not see a hangup between client sessions.
+     */
+    emu->slave = open(emu->device, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (emu->slave == -1) {
+        goto fail;
+    }
+
+    if (tcgetattr(emu->slave, &tty) != 0) {
+        goto fail;
+    }
+    cfmakeraw(&tty);
+    if (tcsetattr(emu->slave, TCSANOW, &tty) != 0) {
+        goto fail;
+    }
+
+    fcntl(emu->master, F_SETFL, fcntl(emu->master, F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_init(&emu->lock, NULL);
+    emu->running = true;
+    ret = pthread_create(&emu->thread, NULL, mt_emulator_thread, emu);
+    if (ret != 0) {
+        pthread_mutex_destroy(&emu->lock);
+        errno = ret;
+        goto fail;
+    }
+
+    goto done;
+
+fail:
+
+    if (emu->slave != -1) {
+        close(emu->slave);
+    }
+    if (emu->master != -1) {
+        close(emu->master);
+    }
+    free(emu);
+    emu = NULL;
+
+done:
+
+    return emu;
+}
+
+void mt_emulator_stop(struct mt_emulator *emu)
+{
+    if (emu == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&emu->running, false, __ATOMIC_RELEASE);
+    pthread_join(emu->thread, NULL);
+    pthread_mutex_destroy(&emu->lock);
+
+    close(emu->slave);
+    close(emu->master);
+    free(emu->out);
+    free(emu);
+}
+
+const char *mt_emulator_device(const struct mt_emulator *emu)
+{
+    return (emu != NULL) ? emu->device : NULL;
+}
+
+void mt_emulator_stats(struct mt_emulator *emu,
+                       struct mt_emulator_stats *stats)
+{
+    if ((emu == NULL) || (stats == NULL)) {
+        return;
+    }
+
+    pthread_mutex_lock(&emu->lock);
+    memcpy(stats, &emu->stats, sizeof(*stats));
+    pthread_mutex_unlock(&emu->lock);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
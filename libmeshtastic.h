@@ -41,23 +41,153 @@ struct mt_pb_header {
     uint8_t l_len;
 };
 
+#define MT_PB_MAX_LEN 512
+
+/*
+ * Receive ring buffer, must be a power of 2 and large enough to hold a few
+ * maximum-sized frames so that a single read can drain the device.
+ */
+#define MT_INBUF_SIZE 2048
+
+struct mt_span {
+    uint8_t *buf;
+    size_t len;
+};
+
+/*
+ * Hot fields of a FromRadio frame read straight off the wire, without a
+ * full pb_decode. The packet fields are only meaningful when
+ * which_payload_variant is meshtastic_FromRadio_packet_tag; encrypted
+ * packets report portnum 0 (UNKNOWN_APP).
+ */
+struct mt_frame_view {
+    pb_size_t which_payload_variant;
+    uint32_t from;
+    uint32_t to;
+    uint32_t id;
+    uint8_t channel;
+    bool encrypted;
+    uint16_t portnum;
+};
+
+#define MT_PORTNUM_MAX 512
+
+/*
+ * Frames and their payloads are decoded into buffers owned by the client
+ * and reused from one frame to the next, never on the stack. With
+ * MT_STATIC_DECODE they are all embedded in the client, so that one that
+ * is statically allocated receives without touching the heap; it is the
+ * default on microcontrollers.
+ */
+#if !defined(MT_STATIC_DECODE) && \
+    (defined(ESP_PLATFORM) || defined(LIB_PICO_PLATFORM))
+#define MT_STATIC_DECODE
+#endif
+
+struct mt_client;
+struct mt_txq;
+struct mt_capture;
+struct mt_trace;
+struct mt_metric;
+
+/*
+ * A transport moves raw 0x94C3-framed bytes between the client and a radio.
+ * open() sets up mtc->fd/mtc->device/mtc->priv as it sees fit and close()
+ * undoes it. read() is handed free space in the receive ring and returns
+ * the number of bytes stored, 0 if nothing was pending, or -1 (EPIPE on
+ * end of stream). writev() is optional and writes several frames at
+ * once. poll_fd() returns an fd to wait on, or -1 if the
+ * transport has none and should simply be polled. process() is optional
+ * and replaces the generic wait-then-drain step of mt_process(). drop() is
+ * optional too: it closes the link but stays attached, for process() to
+ * reopen it once mtc->backoff has expired. connecting() is optional and
+ * tells whether mtc->fd is still being connected, in which case it is to
+ * be waited on for writability and handed to process() to finish.
+ */
+struct mt_transport_ops {
+    const char *name;
+    int (*open)(struct mt_client *mtc, const char *device);
+    int (*close)(struct mt_client *mtc);
+    int (*read)(struct mt_client *mtc, const struct mt_span *span,
+                unsigned int n);
+    int (*write)(struct mt_client *mtc, const uint8_t *buf, size_t len);
+    int (*writev)(struct mt_client *mtc, const struct mt_span *span,
+                  unsigned int n);
+    int (*poll_fd)(const struct mt_client *mtc);
+    int (*process)(struct mt_client *mtc, uint32_t timeout_ms);
+    void (*drop)(struct mt_client *mtc);
+    bool (*connecting)(const struct mt_client *mtc);
+};
+
+/*
+ * Per-client copies of the process-wide rx/tx metrics, registered under a
+ * prefix of the client's own by mt_client_metrics(). A NULL member is
+ * simply not counted.
+ */
+struct mt_client_metrics {
+    struct mt_metric *rx_frames;
+    struct mt_metric *rx_decode_errors;
+    struct mt_metric *rx_resyncs;
+    struct mt_metric *tx_frames;
+    struct mt_metric *tx_queue_depth;
+};
+
+/*
+ * Link counters, 64-bit so that they do not wrap. The thread processing
+ * the client updates them atomically (on posix); other threads read them
+ * with mt_client_counters().
+ */
+struct mt_client_counters {
+    uint64_t bytes_rx;
+    uint64_t bytes_tx;
+    uint64_t packets_rx;
+    uint64_t packets_tx;
+};
+
 struct mt_client
 {
     uint32_t type;
-#define MT_CLIENT_SERIAL 0
+#define MT_CLIENT_SERIAL   0
+#define MT_CLIENT_TCP      1
+#define MT_CLIENT_LOOPBACK 2
+#define MT_CLIENT_REPLAY   3
+#define MT_CLIENT_CUSTOM   0xffU
+    const struct mt_transport_ops *ops;
+    void *priv;
+    struct mt_txq *txq;
+    struct mt_capture *capture;
+    struct mt_trace *trace;
     int fd;
     const char *device;
-    uint8_t inbuf[sizeof(struct mt_pb_header) + 512];
+    uint16_t port;
+    uint32_t connects;
+    time_t reconnect_ts;
+    unsigned int backoff;
+    uint8_t inbuf[MT_INBUF_SIZE];
     size_t inbuf_len;
+    size_t inbuf_head;
+    uint8_t frame[sizeof(struct mt_pb_header) + MT_PB_MAX_LEN];
+    /* What the handler is given; valid until it returns */
+    meshtastic_FromRadio from_radio;
     void (*handler)(struct mt_client *mtc, const void *packet, size_t size,
                     const meshtastic_FromRadio *from_radio);
     void (*logger)(struct mt_client *mtc, const char *msg, size_t len);
     void *ctx;
+    struct mt_frame_view view;
+    bool filter;
+    uint32_t filter_variants;
+    uint32_t filter_portnums[MT_PORTNUM_MAX / 32];
+    uint32_t frames_filtered;
+    uint32_t decode_errors;
+    uint32_t next_id;
+    /* Deprecated 32-bit mirrors of counters, racy off the I/O thread */
     uint32_t bytes_rx;
     uint32_t bytes_tx;
     uint32_t packets_rx;
     uint32_t packets_tx;
     uint32_t last_packet_ts;
+    struct mt_client_metrics metrics;
+    struct mt_client_counters counters;
 };
 
 #if defined(LIB_PICO_PLATFORM)
@@ -65,19 +195,302 @@ extern void mt_serial_init(void);
 extern void mt_serial_write(unsigned int chan, const void *buf, size_t len);
 #endif
 
+extern int mt_attach(struct mt_client *mtc,
+                     const struct mt_transport_ops *ops, const char *device);
+extern int mt_detach(struct mt_client *mtc);
+extern int mt_process(struct mt_client *mtc, uint32_t timeout_ms);
+extern int mt_reconnect(struct mt_client *mtc);
+extern int mt_drain(struct mt_client *mtc);
+extern int mt_poll_fd(const struct mt_client *mtc);
+extern bool mt_connecting(const struct mt_client *mtc);
+extern int mt_write(struct mt_client *mtc, const uint8_t *buf, size_t len);
+extern int mt_writev(struct mt_client *mtc, const struct mt_span *span,
+                     unsigned int n);
+extern int mt_wait(struct mt_client *mtc, int fd, uint32_t timeout_ms);
+extern void mt_client_counters(const struct mt_client *mtc,
+                               struct mt_client_counters *counters);
+
+/*
+ * Optional lock-free transmit queue (posix only). Once attached, senders
+ * on any thread encode straight into a queue cell and return; the thread
+ * running mt_process() (or MeshLoop) is woken through mt_txq_fd() and
+ * writes the frames out in batches. A full queue fails the send with
+ * ENOBUFS and bumps mt_txq_overruns().
+ */
+#define MT_TXQ_DEFAULT_DEPTH 64
+
+extern int mt_txq_attach(struct mt_client *mtc, unsigned int depth);
+extern void mt_txq_detach(struct mt_client *mtc);
+extern int mt_txq_fd(const struct mt_client *mtc);
+extern int mt_txq_push(struct mt_client *mtc,
+                       int (*fill)(uint8_t *buf, size_t *len,
+                                   const void *arg),
+                       const void *arg);
+extern int mt_txq_flush(struct mt_client *mtc);
+extern uint32_t mt_txq_overruns(const struct mt_client *mtc);
+extern uint32_t mt_txq_errors(const struct mt_client *mtc);
+
+/*
+ * Process-wide metrics registry. Counters are 64-bit and, on posix,
+ * sharded per thread so that hot paths only ever touch a cache line of
+ * their own; reads add the shards up. Gauges hold a single signed value.
+ * Histograms count observations (typically nanoseconds) into power-of-two
+ * buckets: bucket i holds values below 2^i, the last one everything else.
+ * Metrics are registered by name and live as long as the process does;
+ * registering a name again returns the same metric, and every update or
+ * read on a NULL metric is a no-op.
+ */
+#define MT_METRIC_COUNTER   0
+#define MT_METRIC_GAUGE     1
+#define MT_METRIC_HISTOGRAM 2
+
+#define MT_METRIC_NAME_LEN  48
+#define MT_METRIC_BUCKETS   32
+
+struct mt_metric;
+
+struct mt_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[MT_METRIC_BUCKETS];
+};
+
+extern struct mt_metric *mt_metric_register(const char *name,
+                                            unsigned int type);
+extern struct mt_metric *mt_metric_lazy(struct mt_metric **slot,
+                                        const char *name, unsigned int type);
+extern struct mt_metric *mt_metric_find(const char *name);
+extern unsigned int mt_metric_count(void);
+extern struct mt_metric *mt_metric_at(unsigned int index);
+extern const char *mt_metric_name(const struct mt_metric *metric);
+extern unsigned int mt_metric_type(const struct mt_metric *metric);
+
+extern void mt_metric_add(struct mt_metric *metric, uint64_t n);
+extern void mt_metric_set(struct mt_metric *metric, int64_t value);
+extern void mt_metric_adjust(struct mt_metric *metric, int64_t delta);
+extern void mt_metric_observe(struct mt_metric *metric, uint64_t value);
+
+extern uint64_t mt_metric_counter(const struct mt_metric *metric);
+extern int64_t mt_metric_gauge(const struct mt_metric *metric);
+extern void mt_metric_histogram(const struct mt_metric *metric,
+                                struct mt_histogram *histogram);
+extern uint64_t mt_histogram_percentile(const struct mt_histogram *histogram,
+                                        unsigned int percent);
+
+/*
+ * Registers mtc->metrics as "<prefix>.rx.frames" and so on, so that
+ * several clients in one process can be told apart; the unprefixed
+ * metrics keep counting across all of them. Call it before the client is
+ * processed.
+ */
+extern int mt_client_metrics(struct mt_client *mtc, const char *prefix);
+
+/*
+ * Optional frame capture (posix only). Every frame received or written is
+ * appended to a pcapng file as an Enhanced Packet Block on a user link
+ * type, header included, with a nanosecond timestamp and the direction in
+ * epb_flags. Blocks are staged in memory and written by a background
+ * thread; frames that do not fit are counted by mt_capture_drops(). Start
+ * and stop it while the client is not being processed.
+ */
+#define MT_CAPTURE_LINKTYPE 147  /* LINKTYPE_USER0 */
+#define MT_CAPTURE_RX       0
+#define MT_CAPTURE_TX       1
+
+extern int mt_capture_start(struct mt_client *mtc, const char *path);
+extern void mt_capture_stop(struct mt_client *mtc);
+extern void mt_capture_frame(struct mt_client *mtc, unsigned int dir,
+                             const uint8_t *buf, size_t len);
+extern uint32_t mt_capture_frames(const struct mt_client *mtc);
+extern uint32_t mt_capture_drops(const struct mt_client *mtc);
+
+/*
+ * Optional per-packet latency tracing. Each frame is timed from the read
+ * that brought in its first byte, through framing, decode and dispatch,
+ * to the return of its handler; a reply sent from within the handler is
+ * timed until it is written. The stages land in the trace.* histograms
+ * of the metrics registry. If a path is given, every sample'th frame is
+ * also written there as Chrome trace events (chrome://tracing, Perfetto),
+ * which only works where there is a file system. Start and stop it while
+ * the client is not being processed.
+ *
+ * The dispatch in the C++ classes reports each got*() handler it calls
+ * with mt_trace_span(), passing what mt_trace_now() returned before the
+ * call; mt_trace_now() is 0, and mt_trace_span() a no-op, when tracing is
+ * off. The remaining hooks are called by the library itself.
+ */
+extern int mt_trace_start(struct mt_client *mtc, const char *path,
+                          unsigned int sample);
+extern void mt_trace_stop(struct mt_client *mtc);
+extern uint64_t mt_trace_now(const struct mt_client *mtc);
+extern void mt_trace_span(struct mt_client *mtc, const char *name,
+                          uint64_t start);
+extern void mt_trace_read(struct mt_client *mtc, bool fresh);
+extern void mt_trace_frame(struct mt_client *mtc);
+extern void mt_trace_decoded(struct mt_client *mtc,
+                             const struct mt_frame_view *view);
+extern void mt_trace_dispatch(struct mt_client *mtc);
+extern void mt_trace_done(struct mt_client *mtc);
+extern uint64_t mt_trace_reply(struct mt_client *mtc);
+extern void mt_trace_written(struct mt_client *mtc, uint64_t queued);
+
+extern const struct mt_transport_ops mt_serial_ops;
+
 extern int mt_serial_attach(struct mt_client *mtc, const char *device);
 extern int mt_serial_detach(struct mt_client *mtc);
 extern int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms);
+extern int mt_serial_drain(struct mt_client *mtc);
 extern int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
                           size_t size);
 
+/*
+ * TCP transport (posix only). The host name is resolved once, by
+ * mt_tcp_attach() on the caller's thread, and reconnects reuse those
+ * addresses. Connecting never blocks: the socket is returned while the
+ * connect is still in progress (mt_connecting() is true), and
+ * mt_tcp_process() finishes it once the fd turns writable, giving each
+ * address up to 3 seconds to accept.
+ */
+#define MT_TCP_DEFAULT_PORT 4403
+
+extern const struct mt_transport_ops mt_tcp_ops;
+
+extern int mt_tcp_attach(struct mt_client *mtc, const char *host,
+                         uint16_t port);
+extern int mt_tcp_detach(struct mt_client *mtc);
+extern int mt_tcp_process(struct mt_client *mtc, uint32_t timeout_ms);
+extern int mt_tcp_drain(struct mt_client *mtc);
+extern int mt_tcp_send(struct mt_client *mtc, const uint8_t *packet,
+                       size_t size);
+
+/*
+ * In-memory transport: bytes pushed in are read back by the framer as if
+ * they came from a radio and everything the client sends is kept for
+ * mt_loopback_pull(). Not thread-safe; meant for tests and benchmarks.
+ */
+extern const struct mt_transport_ops mt_loopback_ops;
+
+extern int mt_loopback_attach(struct mt_client *mtc);
+extern int mt_loopback_push(struct mt_client *mtc, const void *buf,
+                            size_t len);
+extern size_t mt_loopback_pending(const struct mt_client *mtc);
+extern size_t mt_loopback_pull(struct mt_client *mtc, void *buf, size_t len);
+
+/*
+ * Replays a recording through the framer (posix only): either a raw dump
+ * of the serial byte stream or a capture from mt_capture_start(), whose
+ * inbound frames are paced by their timestamps divided by speed (0 plays
+ * flat out; raw dumps always do). Writes are discarded. The end of the
+ * recording reads as EPIPE. Handler calls are timed per FromRadio variant.
+ */
+#define MT_REPLAY_VARIANTS 32
+
+struct mt_replay_stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t decode_errors;
+    uint64_t handled;
+    uint64_t handler_ns;
+    uint64_t handler_max_ns;
+    uint64_t elapsed_ns;
+    uint64_t variant_calls[MT_REPLAY_VARIANTS];
+    uint64_t variant_ns[MT_REPLAY_VARIANTS];
+};
+
+extern const struct mt_transport_ops mt_replay_ops;
+
+extern int mt_replay_attach(struct mt_client *mtc, const char *path,
+                            float speed);
+extern int mt_replay_stats(const struct mt_client *mtc,
+                           struct mt_replay_stats *stats);
+
+/*
+ * Firmware emulator on a pseudo-terminal (posix only), for load testing
+ * without a radio: attach a client to mt_emulator_device() as if it were
+ * a serial port. want_config is answered with a generated DB of nodes
+ * (own node included) and channels; once configured, synthetic text,
+ * telemetry, position and routing packets arrive at rate per second.
+ * Packets sent with want_ack are ACKed.
+ */
+struct mt_emulator;
+
+struct mt_emulator_config {
+    uint32_t node_num;
+    unsigned int nodes;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int seed;
+};
+
+struct mt_emulator_stats {
+    uint64_t frames_tx;
+    uint64_t bytes_tx;
+    uint64_t frames_rx;
+    uint64_t configs;
+    uint64_t generated;
+    uint64_t acks;
+    uint64_t errors;
+};
+
+extern struct mt_emulator *mt_emulator_start(
+    const struct mt_emulator_config *config);
+extern void mt_emulator_stop(struct mt_emulator *emu);
+extern const char *mt_emulator_device(const struct mt_emulator *emu);
+extern void mt_emulator_stats(struct mt_emulator *emu,
+                              struct mt_emulator_stats *stats);
+
+extern void mt_framer_reset(struct mt_client *mtc);
+extern unsigned int mt_framer_spans(struct mt_client *mtc,
+                                    struct mt_span span[2]);
+extern void mt_framer_commit(struct mt_client *mtc, size_t len);
+extern int mt_framer_drain(struct mt_client *mtc);
+
 extern int mt_recv_packet(struct mt_client *mtc, uint8_t *packet, size_t size);
 
+extern int mt_frame_peek(const uint8_t *pb, size_t len,
+                         struct mt_frame_view *view);
+
+/*
+ * With the filter enabled only frames whose variant (and, for packets,
+ * portnum) has been subscribed to are fully decoded and handed to the
+ * handler; the rest are counted in frames_filtered and dropped.
+ */
+extern void mt_filter_enable(struct mt_client *mtc, bool enable);
+extern void mt_filter_clear(struct mt_client *mtc);
+extern void mt_filter_variant(struct mt_client *mtc, pb_size_t variant,
+                              bool subscribe);
+extern void mt_filter_portnum(struct mt_client *mtc, unsigned int portnum,
+                              bool subscribe);
+extern bool mt_filter_match(const struct mt_client *mtc,
+                            const struct mt_frame_view *view);
+
+/*
+ * Packet ids are handed out from a per-client counter that starts at a
+ * random point, so they never repeat within 2^31 sends and may be taken
+ * from any thread. mt_send_packet() assigns one if packet->id is 0 and
+ * writes it back so that ACKs and replies can be matched by the caller.
+ */
+extern uint32_t mt_packet_id(struct mt_client *mtc);
+extern int mt_send_packet(struct mt_client *mtc,
+                          meshtastic_MeshPacket *packet);
+
 extern int mt_send_null(struct mt_client *mtc);
 extern int mt_send_disconnect(struct mt_client *mtc);
 extern int mt_send_heartbeat(struct mt_client *mtc);
 extern int mt_send_want_config(struct mt_client *mtc);
 
+/*
+ * want_config_id nonces that firmware 2.6 and later treat specially: the
+ * first has everything but the other nodes sent, the second only the
+ * nodes. Older firmware sends everything for either. mt_send_want_config()
+ * picks a random nonce that is neither.
+ */
+#define MT_WANT_CONFIG_ONLY_CONFIG 69420
+#define MT_WANT_CONFIG_ONLY_NODES  69421
+
+extern int mt_send_want_config_id(struct mt_client *mtc, uint32_t id);
+
 extern int mt_text_message(struct mt_client *mtc,
                            uint32_t dest, uint8_t channel,
                            const char *message,
@@ -89,6 +502,7 @@ extern int mt_admin_message_reboot(struct mt_client *mtc,
                                    uint32_t seconds);
 
 extern time_t mt_impl_now(void);
+extern uint64_t mt_impl_now_ns(void);
 
 EXTERN_C_END
 
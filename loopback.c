@@ -0,0 +1,251 @@
+/*
+ * loopback.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libmeshtastic.h>
+
+struct mt_loopback {
+    uint8_t *rx;
+    size_t rx_len;
+    size_t rx_off;
+    size_t rx_cap;
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_cap;
+};
+
+static int mt_loopback_reserve(uint8_t **buf, size_t *cap, size_t need)
+{
+    uint8_t *p;
+    size_t n;
+
+    if (need <= *cap) {
+        return 0;
+    }
+
+    n = (*cap != 0) ? *cap : 4096;
+    while (n < need) {
+        n *= 2;
+    }
+
+    p = (uint8_t *) realloc(*buf, n);
+    if (p == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *buf = p;
+    *cap = n;
+
+    return 0;
+}
+
+static int mt_loopback_open(struct mt_client *mtc, const char *device)
+{
+    int ret = 0;
+    struct mt_loopback *lb;
+
+    mtc->type = MT_CLIENT_LOOPBACK;
+    mtc->device = (const char *) strdup((device != NULL) ?
+                                        device : "loopback");
+    if (mtc->device == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    lb = (struct mt_loopback *) calloc(1, sizeof(*lb));
+    if (lb == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    mtc->priv = lb;
+
+done:
+
+    return ret;
+}
+
+static int mt_loopback_close(struct mt_client *mtc)
+{
+    struct mt_loopback *lb = (struct mt_loopback *) mtc->priv;
+
+    if (lb != NULL) {
+        free(lb->rx);
+        free(lb->tx);
+        free(lb);
+        mtc->priv = NULL;
+    }
+
+    if (mtc->device) {
+        free((void *) mtc->device);
+    }
+
+    mtc->device = NULL;
+
+    return 0;
+}
+
+static int mt_loopback_rx(struct mt_client *mtc, const struct mt_span *span,
+                          unsigned int n)
+{
+    struct mt_loopback *lb = (struct mt_loopback *) mtc->priv;
+    size_t avail, len, total = 0;
+    unsigned int i;
+
+    avail = lb->rx_len - lb->rx_off;
+    for (i = 0; (i < n) && (avail > 0); i++) {
+        len = (span[i].len < avail) ? span[i].len : avail;
+        memcpy(span[i].buf, lb->rx + lb->rx_off, len);
+        lb->rx_off += len;
+        avail -= len;
+        total += len;
+    }
+
+    if (lb->rx_off == lb->rx_len) {
+        lb->rx_off = 0;
+        lb->rx_len = 0;
+    }
+
+    return (int) total;
+}
+
+static int mt_loopback_tx(struct mt_client *mtc, const uint8_t *buf,
+                          size_t len)
+{
+    struct mt_loopback *lb = (struct mt_loopback *) mtc->priv;
+
+    if (mt_loopback_reserve(&lb->tx, &lb->tx_cap, lb->tx_len + len) != 0) {
+        return -1;
+    }
+
+    memcpy(lb->tx + lb->tx_len, buf, len);
+    lb->tx_len += len;
+
+    return 0;
+}
+
+/*
+ * Nothing to wait on, so frame everything that has been pushed so far
+ * rather than one ring's worth per call.
+ */
+static int mt_loopback_service(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    int ret = 0;
+    int frames = 0;
+    size_t pending;
+
+    (void)(timeout_ms);
+
+    while ((pending = mt_loopback_pending(mtc)) > 0) {
+        ret = mt_drain(mtc);
+        if (ret < 0) {
+            return ret;
+        }
+
+        frames += ret;
+        if (mt_loopback_pending(mtc) == pending) {
+            break;
+        }
+    }
+
+    return frames;
+}
+
+const struct mt_transport_ops mt_loopback_ops = {
+    .name = "loopback",
+    .open = mt_loopback_open,
+    .close = mt_loopback_close,
+    .read = mt_loopback_rx,
+    .write = mt_loopback_tx,
+    .writev = NULL,
+    .poll_fd = NULL,
+    .process = mt_loopback_service,
+};
+
+int mt_loopback_attach(struct mt_client *mtc)
+{
+    return mt_attach(mtc, &mt_loopback_ops, NULL);
+}
+
+int mt_loopback_push(struct mt_client *mtc, const void *buf, size_t len)
+{
+    int ret = 0;
+    struct mt_loopback *lb;
+
+    if ((mtc == NULL) || (mtc->ops != &mt_loopback_ops) ||
+        ((buf == NULL) && (len > 0))) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    lb = (struct mt_loopback *) mtc->priv;
+
+    if ((lb->rx_off > 0) && (lb->rx_len + len > lb->rx_cap)) {
+        memmove(lb->rx, lb->rx + lb->rx_off, lb->rx_len - lb->rx_off);
+        lb->rx_len -= lb->rx_off;
+        lb->rx_off = 0;
+    }
+
+    ret = mt_loopback_reserve(&lb->rx, &lb->rx_cap, lb->rx_len + len);
+    if (ret != 0) {
+        goto done;
+    }
+
+    memcpy(lb->rx + lb->rx_len, buf, len);
+    lb->rx_len += len;
+
+done:
+
+    return ret;
+}
+
+size_t mt_loopback_pending(const struct mt_client *mtc)
+{
+    const struct mt_loopback *lb;
+
+    if ((mtc == NULL) || (mtc->ops != &mt_loopback_ops)) {
+        return 0;
+    }
+
+    lb = (const struct mt_loopback *) mtc->priv;
+
+    return lb->rx_len - lb->rx_off;
+}
+
+size_t mt_loopback_pull(struct mt_client *mtc, void *buf, size_t len)
+{
+    struct mt_loopback *lb;
+
+    if ((mtc == NULL) || (mtc->ops != &mt_loopback_ops) || (buf == NULL)) {
+        return 0;
+    }
+
+    lb = (struct mt_loopback *) mtc->priv;
+    if (len > lb->tx_len) {
+        len = lb->tx_len;
+    }
+
+    memcpy(buf, lb->tx, len);
+    memmove(lb->tx, lb->tx + len, lb->tx_len - len);
+    lb->tx_len -= len;
+
+    return len;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
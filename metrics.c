@@ -0,0 +1,471 @@
+/*
+ * metrics.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libmeshtastic.h>
+
+#if !defined(ESP_PLATFORM) && !defined(LIB_PICO_PLATFORM)
+#include <pthread.h>
+#define MT_HAVE_ATOMICS
+#define MT_METRICS_MAX      256
+#define MT_METRIC_SHARDS    16
+#else
+#define MT_METRICS_MAX      64
+#define MT_METRIC_SHARDS    1
+#endif
+
+#define MT_CACHELINE        64
+
+/*
+ * Counters and histograms keep one shard per slot, each padded out to
+ * whole cache lines; a thread always updates the same shard, so
+ * concurrent updates from different threads do not bounce lines between
+ * cores. Threads beyond MT_METRIC_SHARDS share shards, which is why the
+ * updates are still atomic, only uncontended.
+ */
+struct mt_metric_shard {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[];
+};
+
+struct mt_metric {
+    char name[MT_METRIC_NAME_LEN];
+    unsigned int type;
+    size_t shard_size;
+    int64_t gauge;
+    uint8_t *shards;
+};
+
+static struct mt_metric mt_metrics[MT_METRICS_MAX];
+static unsigned int mt_metrics_n = 0;
+
+#if defined(MT_HAVE_ATOMICS)
+static pthread_mutex_t mt_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int mt_metric_next_shard = 0;
+static __thread int mt_metric_thread_shard = -1;
+#endif
+
+static inline struct mt_metric_shard *mt_metric_shard_at(
+    const struct mt_metric *metric, unsigned int i)
+{
+    return (struct mt_metric_shard *)
+        (metric->shards + (i * metric->shard_size));
+}
+
+static inline struct mt_metric_shard *mt_metric_my_shard(
+    struct mt_metric *metric)
+{
+#if defined(MT_HAVE_ATOMICS)
+    if (mt_metric_thread_shard < 0) {
+        mt_metric_thread_shard = (int)
+            (__atomic_fetch_add(&mt_metric_next_shard, 1, __ATOMIC_RELAXED) %
+             MT_METRIC_SHARDS);
+    }
+
+    return mt_metric_shard_at(metric, mt_metric_thread_shard);
+#else
+    return mt_metric_shard_at(metric, 0);
+#endif
+}
+
+static inline void mt_metric_inc64(uint64_t *p, uint64_t n)
+{
+#if defined(MT_HAVE_ATOMICS)
+    __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+#else
+    *p += n;
+#endif
+}
+
+static inline uint64_t mt_metric_load64(const uint64_t *p)
+{
+#if defined(MT_HAVE_ATOMICS)
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+    return *p;
+#endif
+}
+
+static struct mt_metric *mt_metric_lookup(const char *name)
+{
+    unsigned int i, n;
+
+#if defined(MT_HAVE_ATOMICS)
+    n = __atomic_load_n(&mt_metrics_n, __ATOMIC_ACQUIRE);
+#else
+    n = mt_metrics_n;
+#endif
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(mt_metrics[i].name, name) == 0) {
+            return &mt_metrics[i];
+        }
+    }
+
+    return NULL;
+}
+
+struct mt_metric *mt_metric_register(const char *name, unsigned int type)
+{
+    struct mt_metric *metric = NULL;
+    size_t shard_size;
+    void *shards = NULL;
+
+    if ((name == NULL) || (type > MT_METRIC_HISTOGRAM)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    pthread_mutex_lock(&mt_metrics_lock);
+#endif
+
+    metric = mt_metric_lookup(name);
+    if (metric != NULL) {
+        if (metric->type != type) {
+            errno = EEXIST;
+            metric = NULL;
+        }
+        goto done;
+    }
+
+    if (mt_metrics_n >= MT_METRICS_MAX) {
+        errno = ENOSPC;
+        goto done;
+    }
+
+    shard_size = sizeof(struct mt_metric_shard);
+    if (type == MT_METRIC_HISTOGRAM) {
+        shard_size += MT_METRIC_BUCKETS * sizeof(uint64_t);
+    }
+    shard_size = (shard_size + MT_CACHELINE - 1) & ~(MT_CACHELINE - 1);
+
+    if (type != MT_METRIC_GAUGE) {
+#if defined(MT_HAVE_ATOMICS)
+        if (posix_memalign(&shards, MT_CACHELINE,
+                           shard_size * MT_METRIC_SHARDS) != 0) {
+            errno = ENOMEM;
+            goto done;
+        }
+#else
+        shards = malloc(shard_size * MT_METRIC_SHARDS);
+        if (shards == NULL) {
+            goto done;
+        }
+#endif
+        bzero(shards, shard_size * MT_METRIC_SHARDS);
+    }
+
+    metric = &mt_metrics[mt_metrics_n];
+    bzero(metric, sizeof(*metric));
+    strncpy(metric->name, name, sizeof(metric->name) - 1);
+    metric->type = type;
+    metric->shard_size = shard_size;
+    metric->shards = (uint8_t *) shards;
+
+    /* Publish only once the entry is complete, for lock-free readers */
+#if defined(MT_HAVE_ATOMICS)
+    __atomic_store_n(&mt_metrics_n, mt_metrics_n + 1, __ATOMIC_RELEASE);
+#else
+    mt_metrics_n++;
+#endif
+
+done:
+
+#if defined(MT_HAVE_ATOMICS)
+    pthread_mutex_unlock(&mt_metrics_lock);
+#endif
+
+    return metric;
+}
+
+/* Cached in a lazy slot whose registration failed, the registry is full */
+static struct mt_metric mt_metric_unavailable;
+
+/*
+ * For hot paths that would rather not register up front: the metric is
+ * registered on first use and cached in *slot. A failure is cached too,
+ * so that a full registry is not locked and scanned on every call.
+ */
+struct mt_metric *mt_metric_lazy(struct mt_metric **slot, const char *name,
+                                 unsigned int type)
+{
+    struct mt_metric *metric;
+
+    if (slot == NULL) {
+        return NULL;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    metric = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+    metric = *slot;
+#endif
+
+    if (metric == NULL) {
+        metric = mt_metric_register(name, type);
+        if (metric == NULL) {
+            metric = &mt_metric_unavailable;
+        }
+#if defined(MT_HAVE_ATOMICS)
+        __atomic_store_n(slot, metric, __ATOMIC_RELEASE);
+#else
+        *slot = metric;
+#endif
+    }
+
+    return (metric != &mt_metric_unavailable) ? metric : NULL;
+}
+
+struct mt_metric *mt_metric_find(const char *name)
+{
+    if (name == NULL) {
+        return NULL;
+    }
+
+    return mt_metric_lookup(name);
+}
+
+unsigned int mt_metric_count(void)
+{
+#if defined(MT_HAVE_ATOMICS)
+    return __atomic_load_n(&mt_metrics_n, __ATOMIC_ACQUIRE);
+#else
+    return mt_metrics_n;
+#endif
+}
+
+struct mt_metric *mt_metric_at(unsigned int index)
+{
+    if (index >= mt_metric_count()) {
+        return NULL;
+    }
+
+    return &mt_metrics[index];
+}
+
+const char *mt_metric_name(const struct mt_metric *metric)
+{
+    return (metric != NULL) ? metric->name : NULL;
+}
+
+unsigned int mt_metric_type(const struct mt_metric *metric)
+{
+    return (metric != NULL) ? metric->type : MT_METRIC_COUNTER;
+}
+
+void mt_metric_add(struct mt_metric *metric, uint64_t n)
+{
+    if ((metric == NULL) || (metric->type != MT_METRIC_COUNTER)) {
+        return;
+    }
+
+    mt_metric_inc64(&mt_metric_my_shard(metric)->count, n);
+}
+
+void mt_metric_set(struct mt_metric *metric, int64_t value)
+{
+    if ((metric == NULL) || (metric->type != MT_METRIC_GAUGE)) {
+        return;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    __atomic_store_n(&metric->gauge, value, __ATOMIC_RELAXED);
+#else
+    metric->gauge = value;
+#endif
+}
+
+void mt_metric_adjust(struct mt_metric *metric, int64_t delta)
+{
+    if ((metric == NULL) || (metric->type != MT_METRIC_GAUGE)) {
+        return;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    __atomic_fetch_add(&metric->gauge, delta, __ATOMIC_RELAXED);
+#else
+    metric->gauge += delta;
+#endif
+}
+
+void mt_metric_observe(struct mt_metric *metric, uint64_t value)
+{
+    struct mt_metric_shard *shard;
+    unsigned int bucket;
+
+    if ((metric == NULL) || (metric->type != MT_METRIC_HISTOGRAM)) {
+        return;
+    }
+
+    bucket = (value != 0) ? (64 - __builtin_clzll(value)) : 0;
+    if (bucket >= MT_METRIC_BUCKETS) {
+        bucket = MT_METRIC_BUCKETS - 1;
+    }
+
+    shard = mt_metric_my_shard(metric);
+    mt_metric_inc64(&shard->count, 1);
+    mt_metric_inc64(&shard->sum, value);
+    mt_metric_inc64(&shard->buckets[bucket], 1);
+}
+
+static struct mt_metric *mt_metric_prefixed(const char *prefix,
+                                             const char *name,
+                                             unsigned int type)
+{
+    char full[MT_METRIC_NAME_LEN];
+    int len;
+
+    len = snprintf(full, sizeof(full), "%s.%s", prefix, name);
+    if ((len < 0) || ((size_t) len >= sizeof(full))) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    return mt_metric_register(full, type);
+}
+
+int mt_client_metrics(struct mt_client *mtc, const char *prefix)
+{
+    int ret = 0;
+    struct mt_client_metrics metrics;
+
+    if ((mtc == NULL) || (prefix == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    metrics.rx_frames = mt_metric_prefixed(prefix, "rx.frames",
+                                           MT_METRIC_COUNTER);
+    metrics.rx_decode_errors = mt_metric_prefixed(prefix, "rx.decode_errors",
+                                                  MT_METRIC_COUNTER);
+    metrics.rx_resyncs = mt_metric_prefixed(prefix, "rx.resyncs",
+                                            MT_METRIC_COUNTER);
+    metrics.tx_frames = mt_metric_prefixed(prefix, "tx.frames",
+                                           MT_METRIC_COUNTER);
+    metrics.tx_queue_depth = mt_metric_prefixed(prefix, "tx.queue_depth",
+                                                MT_METRIC_GAUGE);
+    if ((metrics.rx_frames == NULL) || (metrics.rx_decode_errors == NULL) ||
+        (metrics.rx_resyncs == NULL) || (metrics.tx_frames == NULL) ||
+        (metrics.tx_queue_depth == NULL)) {
+        /* Whatever did register still counts */
+        ret = -1;
+    }
+
+    mtc->metrics = metrics;
+
+done:
+
+    return ret;
+}
+
+uint64_t mt_metric_counter(const struct mt_metric *metric)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    if ((metric == NULL) || (metric->shards == NULL)) {
+        return 0;
+    }
+
+    for (i = 0; i < MT_METRIC_SHARDS; i++) {
+        total += mt_metric_load64(&mt_metric_shard_at(metric, i)->count);
+    }
+
+    return total;
+}
+
+int64_t mt_metric_gauge(const struct mt_metric *metric)
+{
+    if (metric == NULL) {
+        return 0;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    return __atomic_load_n(&metric->gauge, __ATOMIC_RELAXED);
+#else
+    return metric->gauge;
+#endif
+}
+
+void mt_metric_histogram(const struct mt_metric *metric,
+                         struct mt_histogram *histogram)
+{
+    const struct mt_metric_shard *shard;
+    unsigned int i, j;
+
+    if (histogram == NULL) {
+        return;
+    }
+
+    bzero(histogram, sizeof(*histogram));
+
+    if ((metric == NULL) || (metric->type != MT_METRIC_HISTOGRAM)) {
+        return;
+    }
+
+    for (i = 0; i < MT_METRIC_SHARDS; i++) {
+        shard = mt_metric_shard_at(metric, i);
+        histogram->count += mt_metric_load64(&shard->count);
+        histogram->sum += mt_metric_load64(&shard->sum);
+        for (j = 0; j < MT_METRIC_BUCKETS; j++) {
+            histogram->buckets[j] += mt_metric_load64(&shard->buckets[j]);
+        }
+    }
+}
+
+/*
+ * Upper bound of the bucket holding the given percentile, so the answer
+ * is within a factor of two of the exact value.
+ */
+uint64_t mt_histogram_percentile(const struct mt_histogram *histogram,
+                                 unsigned int percent)
+{
+    uint64_t rank, seen = 0;
+    unsigned int i;
+
+    if ((histogram == NULL) || (histogram->count == 0)) {
+        return 0;
+    }
+
+    if (percent > 100) {
+        percent = 100;
+    }
+
+    rank = (histogram->count * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < MT_METRIC_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    if (i >= (MT_METRIC_BUCKETS - 1)) {
+        return UINT64_MAX;
+    }
+
+    return (uint64_t) 1 << i;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -17,16 +17,846 @@
 #include <pico-plat.h>
 #endif
 
+#if !defined(ESP_PLATFORM) && !defined(LIB_PICO_PLATFORM)
+#include <poll.h>
+#define MT_HAVE_POLL
+#define MT_HAVE_TXQ
+#define MT_HAVE_ATOMICS
+#define MT_HAVE_CAPTURE
+#endif
+
+#define PB_BUF_SIZE MT_PB_MAX_LEN
+
+#define MT_INBUF_MASK (MT_INBUF_SIZE - 1)
+
+/*
+ * Receive and transmit metrics, registered on first use. Frames are
+ * counted per FromRadio variant and packets per portnum, each into a
+ * metric of its own.
+ */
+#define MT_RX_VARIANTS 32
+
+static struct mt_metric *mt_m_rx_bytes;
+static struct mt_metric *mt_m_rx_frames;
+static struct mt_metric *mt_m_rx_filtered;
+static struct mt_metric *mt_m_rx_decode_errors;
+static struct mt_metric *mt_m_rx_resyncs;
+static struct mt_metric *mt_m_rx_handler_ns;
+static struct mt_metric *mt_m_tx_bytes;
+static struct mt_metric *mt_m_tx_frames;
+static struct mt_metric *mt_m_rx_variant[MT_RX_VARIANTS];
+static struct mt_metric *mt_m_rx_portnum[MT_PORTNUM_MAX];
+
+static const char *mt_variant_names[MT_RX_VARIANTS] = {
+    [meshtastic_FromRadio_packet_tag] = "packet",
+    [meshtastic_FromRadio_my_info_tag] = "my_info",
+    [meshtastic_FromRadio_node_info_tag] = "node_info",
+    [meshtastic_FromRadio_config_tag] = "config",
+    [meshtastic_FromRadio_log_record_tag] = "log_record",
+    [meshtastic_FromRadio_config_complete_id_tag] = "config_complete_id",
+    [meshtastic_FromRadio_rebooted_tag] = "rebooted",
+    [meshtastic_FromRadio_moduleConfig_tag] = "moduleConfig",
+    [meshtastic_FromRadio_channel_tag] = "channel",
+    [meshtastic_FromRadio_queueStatus_tag] = "queueStatus",
+    [meshtastic_FromRadio_xmodemPacket_tag] = "xmodemPacket",
+    [meshtastic_FromRadio_metadata_tag] = "metadata",
+    [meshtastic_FromRadio_mqttClientProxyMessage_tag] =
+    "mqttClientProxyMessage",
+    [meshtastic_FromRadio_fileInfo_tag] = "fileInfo",
+    [meshtastic_FromRadio_clientNotification_tag] = "clientNotification",
+    [meshtastic_FromRadio_deviceuiConfig_tag] = "deviceuiConfig",
+};
+
+static inline struct mt_metric *mt_metric_cached(struct mt_metric **slot)
+{
+#if defined(MT_HAVE_ATOMICS)
+    return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#else
+    return *slot;
+#endif
+}
+
+static void mt_count_rx(const struct mt_frame_view *view)
+{
+    struct mt_metric *metric;
+    char name[MT_METRIC_NAME_LEN];
+    unsigned int variant = view->which_payload_variant;
+
+    if (variant >= MT_RX_VARIANTS) {
+        variant = 0;
+    }
+
+    metric = mt_metric_cached(&mt_m_rx_variant[variant]);
+    if (metric == NULL) {
+        if (mt_variant_names[variant] != NULL) {
+            snprintf(name, sizeof(name), "rx.variant.%s",
+                     mt_variant_names[variant]);
+        } else {
+            snprintf(name, sizeof(name), "rx.variant.%u", variant);
+        }
+        metric = mt_metric_lazy(&mt_m_rx_variant[variant], name,
+                                MT_METRIC_COUNTER);
+    }
+    mt_metric_add(metric, 1);
+
+    if ((view->which_payload_variant != meshtastic_FromRadio_packet_tag) ||
+        (view->portnum >= MT_PORTNUM_MAX)) {
+        return;
+    }
+
+    metric = mt_metric_cached(&mt_m_rx_portnum[view->portnum]);
+    if (metric == NULL) {
+        snprintf(name, sizeof(name), "rx.portnum.%u",
+                 (unsigned int) view->portnum);
+        metric = mt_metric_lazy(&mt_m_rx_portnum[view->portnum], name,
+                                MT_METRIC_COUNTER);
+    }
+    mt_metric_add(metric, 1);
+}
+
+static inline void mt_count64(uint64_t *counter, uint64_t n)
+{
+#if defined(MT_HAVE_ATOMICS)
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#else
+    *counter += n;
+#endif
+}
+
+static inline uint64_t mt_load64(const uint64_t *counter)
+{
+#if defined(MT_HAVE_ATOMICS)
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#else
+    return *counter;
+#endif
+}
+
+static inline uint8_t mt_inbuf_peek(const struct mt_client *mtc,
+                                    size_t offset)
+{
+    return mtc->inbuf[(mtc->inbuf_head + offset) & MT_INBUF_MASK];
+}
+
+static void mt_inbuf_consume(struct mt_client *mtc, size_t len)
+{
+    mtc->inbuf_head = (mtc->inbuf_head + len) & MT_INBUF_MASK;
+    mtc->inbuf_len -= len;
+    if (mtc->inbuf_len == 0) {
+        /* Rewind so that the next read gets one contiguous span */
+        mtc->inbuf_head = 0;
+    }
+}
+
+/*
+ * Hand non-frame bytes (firmware debug text) over to the logger.
+ */
+static void mt_inbuf_log(struct mt_client *mtc, size_t len)
+{
+    size_t seg;
+
+    if (mtc->logger != NULL) {
+        seg = MT_INBUF_SIZE - mtc->inbuf_head;
+        if (seg > len) {
+            seg = len;
+        }
+
+        mtc->logger(mtc, (const char *) mtc->inbuf + mtc->inbuf_head, seg);
+        if (seg < len) {
+            mtc->logger(mtc, (const char *) mtc->inbuf, len - seg);
+        }
+    }
+
+    mt_inbuf_consume(mtc, len);
+}
+
+void mt_framer_reset(struct mt_client *mtc)
+{
+    if (mtc != NULL) {
+        mtc->inbuf_head = 0;
+        mtc->inbuf_len = 0;
+    }
+}
+
+unsigned int mt_framer_spans(struct mt_client *mtc, struct mt_span span[2])
+{
+    unsigned int n = 0;
+    size_t tail;
+
+    if ((mtc == NULL) || (span == NULL)) {
+        goto done;
+    }
+
+    if (mtc->inbuf_len >= MT_INBUF_SIZE) {
+        goto done;
+    }
+
+    tail = (mtc->inbuf_head + mtc->inbuf_len) & MT_INBUF_MASK;
+    if ((tail > mtc->inbuf_head) || (mtc->inbuf_len == 0)) {
+        span[n].buf = mtc->inbuf + tail;
+        span[n].len = MT_INBUF_SIZE - tail;
+        n++;
+        if (mtc->inbuf_head > 0) {
+            span[n].buf = mtc->inbuf;
+            span[n].len = mtc->inbuf_head;
+            n++;
+        }
+    } else {
+        span[n].buf = mtc->inbuf + tail;
+        span[n].len = mtc->inbuf_head - tail;
+        n++;
+    }
+
+done:
+
+    return n;
+}
+
+void mt_framer_commit(struct mt_client *mtc, size_t len)
+{
+    if (mtc == NULL) {
+        return;
+    }
+
+    if (len > (MT_INBUF_SIZE - mtc->inbuf_len)) {
+        len = MT_INBUF_SIZE - mtc->inbuf_len;
+    }
+
+    if ((mtc->trace != NULL) && (len > 0)) {
+        mt_trace_read(mtc, mtc->inbuf_len == 0);
+    }
+
+    mtc->inbuf_len += len;
+}
+
+int mt_framer_drain(struct mt_client *mtc)
+{
+    int frames = 0;
+    size_t seg;
+    size_t mt_pb_len;
+    size_t frame_len;
+    const uint8_t *start1;
+    uint8_t *frame;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        frames = -1;
+        goto done;
+    }
+
+    while (mtc->inbuf_len > 0) {
+        if (mt_inbuf_peek(mtc, 0) != MT_PB_START1) {
+            /* Skip over debug text up to the next START1 */
+            seg = MT_INBUF_SIZE - mtc->inbuf_head;
+            if (seg > mtc->inbuf_len) {
+                seg = mtc->inbuf_len;
+            }
+            start1 = (const uint8_t *)
+                memchr(mtc->inbuf + mtc->inbuf_head, MT_PB_START1, seg);
+            if (start1 != NULL) {
+                seg = start1 - (mtc->inbuf + mtc->inbuf_head);
+            }
+            mt_inbuf_log(mtc, seg);
+            continue;
+        }
+
+        if (mtc->inbuf_len < 2) {
+            break;
+        }
+
+        if (mt_inbuf_peek(mtc, 1) != MT_PB_START2) {
+            /* Lone START1, resume the scan right after it */
+            mt_metric_add(mt_metric_lazy(&mt_m_rx_resyncs, "rx.resyncs",
+                                         MT_METRIC_COUNTER), 1);
+            mt_metric_add(mtc->metrics.rx_resyncs, 1);
+            mt_inbuf_log(mtc, 1);
+            continue;
+        }
+
+        if (mtc->inbuf_len < sizeof(struct mt_pb_header)) {
+            break;
+        }
+
+        mt_pb_len = (mt_inbuf_peek(mtc, 2) << 8) | mt_inbuf_peek(mtc, 3);
+        if (mt_pb_len > MT_PB_MAX_LEN) {
+            /* Bogus length, this was not a header after all */
+            mt_metric_add(mt_metric_lazy(&mt_m_rx_resyncs, "rx.resyncs",
+                                         MT_METRIC_COUNTER), 1);
+            mt_metric_add(mtc->metrics.rx_resyncs, 1);
+            mt_inbuf_log(mtc, 1);
+            continue;
+        }
+
+        frame_len = sizeof(struct mt_pb_header) + mt_pb_len;
+        if (mtc->inbuf_len < frame_len) {
+            break;
+        }
+
+        if ((mtc->inbuf_head + frame_len) <= MT_INBUF_SIZE) {
+            frame = mtc->inbuf + mtc->inbuf_head;
+        } else {
+            /* Frame wraps around the end of the ring, linearize it */
+            seg = MT_INBUF_SIZE - mtc->inbuf_head;
+            memcpy(mtc->frame, mtc->inbuf + mtc->inbuf_head, seg);
+            memcpy(mtc->frame + seg, mtc->inbuf, frame_len - seg);
+            frame = mtc->frame;
+        }
+
+        /*
+         * Consume before delivering: the bytes stay intact until the next
+         * read, and the handler is free to reset or detach the client.
+         */
+        mt_inbuf_consume(mtc, frame_len);
+        if (mtc->trace != NULL) {
+            mt_trace_frame(mtc);
+        }
+        if (mt_recv_packet(mtc, frame, frame_len) == 0) {
+            frames++;
+        }
+    }
+
+done:
+
+    return frames;
+}
 
-#define PB_BUF_SIZE 512
+/*
+ * Minimal protobuf wire reader used to peek at a frame before committing
+ * to a full decode.
+ */
+#define MT_WT_VARINT  0
+#define MT_WT_FIXED64 1
+#define MT_WT_LEN     2
+#define MT_WT_FIXED32 5
+
+static const uint8_t *mt_wire_varint(const uint8_t *p, const uint8_t *end,
+                                     uint64_t *value)
+{
+    uint64_t v = 0;
+    unsigned int shift;
+
+    for (shift = 0; (p < end) && (shift < 64); shift += 7) {
+        v |= (uint64_t) (*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *value = v;
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static const uint8_t *mt_wire_fixed32(const uint8_t *p, const uint8_t *end,
+                                      uint32_t *value)
+{
+    if ((end - p) < 4) {
+        return NULL;
+    }
+
+    *value = (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+
+    return p + 4;
+}
+
+/*
+ * Reads one field key and, for length-delimited fields, the length; on
+ * return *p points at the field's value.
+ */
+static const uint8_t *mt_wire_field(const uint8_t *p, const uint8_t *end,
+                                    uint32_t *field, uint32_t *wt,
+                                    size_t *len)
+{
+    uint64_t v;
+
+    p = mt_wire_varint(p, end, &v);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    *field = (uint32_t) (v >> 3);
+    *wt = (uint32_t) (v & 0x7);
+    *len = 0;
+
+    if (*wt == MT_WT_LEN) {
+        p = mt_wire_varint(p, end, &v);
+        if ((p == NULL) || (v > (uint64_t) (end - p))) {
+            return NULL;
+        }
+        *len = (size_t) v;
+    }
+
+    return p;
+}
+
+static const uint8_t *mt_wire_skip(const uint8_t *p, const uint8_t *end,
+                                   uint32_t wt, size_t len)
+{
+    uint64_t v;
+
+    switch (wt) {
+    case MT_WT_VARINT:
+        return mt_wire_varint(p, end, &v);
+    case MT_WT_FIXED64:
+        return ((end - p) < 8) ? NULL : p + 8;
+    case MT_WT_LEN:
+        return p + len;
+    case MT_WT_FIXED32:
+        return ((end - p) < 4) ? NULL : p + 4;
+    default:
+        return NULL;
+    }
+}
+
+static int mt_peek_data(const uint8_t *p, const uint8_t *end,
+                        struct mt_frame_view *view)
+{
+    uint32_t field, wt;
+    size_t len;
+    uint64_t v;
+
+    while (p < end) {
+        p = mt_wire_field(p, end, &field, &wt, &len);
+        if (p == NULL) {
+            return -1;
+        }
+
+        if ((field == 1) && (wt == MT_WT_VARINT)) {
+            p = mt_wire_varint(p, end, &v);
+            view->portnum = (uint16_t) v;
+        } else {
+            p = mt_wire_skip(p, end, wt, len);
+        }
+
+        if (p == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int mt_peek_mesh_packet(const uint8_t *p, const uint8_t *end,
+                               struct mt_frame_view *view)
+{
+    uint32_t field, wt;
+    size_t len;
+    uint64_t v;
+
+    while (p < end) {
+        p = mt_wire_field(p, end, &field, &wt, &len);
+        if (p == NULL) {
+            return -1;
+        }
+
+        if ((field == 1) && (wt == MT_WT_FIXED32)) {
+            p = mt_wire_fixed32(p, end, &view->from);
+        } else if ((field == 2) && (wt == MT_WT_FIXED32)) {
+            p = mt_wire_fixed32(p, end, &view->to);
+        } else if ((field == 3) && (wt == MT_WT_VARINT)) {
+            p = mt_wire_varint(p, end, &v);
+            view->channel = (uint8_t) v;
+        } else if ((field == 4) && (wt == MT_WT_LEN)) {
+            view->encrypted = false;
+            if (mt_peek_data(p, p + len, view) != 0) {
+                return -1;
+            }
+            p += len;
+        } else if ((field == 5) && (wt == MT_WT_LEN)) {
+            view->encrypted = true;
+            view->portnum = 0;
+            p += len;
+        } else if ((field == 6) && (wt == MT_WT_FIXED32)) {
+            p = mt_wire_fixed32(p, end, &view->id);
+        } else {
+            p = mt_wire_skip(p, end, wt, len);
+        }
+
+        if (p == NULL) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int mt_frame_peek(const uint8_t *pb, size_t len, struct mt_frame_view *view)
+{
+    int ret = 0;
+    const uint8_t *p = pb, *end = pb + len;
+    uint32_t field, wt;
+    size_t flen;
+
+    if ((pb == NULL) || (view == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    bzero(view, sizeof(*view));
+
+    while (p < end) {
+        p = mt_wire_field(p, end, &field, &wt, &flen);
+        if (p == NULL) {
+            break;
+        }
+
+        /* The payload oneof: nanopb tags equal the field numbers */
+        if ((field >= meshtastic_FromRadio_packet_tag) && (field < 32)) {
+            view->which_payload_variant = (pb_size_t) field;
+            if (field == meshtastic_FromRadio_packet_tag) {
+                if ((wt != MT_WT_LEN) ||
+                    (mt_peek_mesh_packet(p, p + flen, view) != 0)) {
+                    p = NULL;
+                    break;
+                }
+            }
+        }
+
+        p = mt_wire_skip(p, end, wt, flen);
+        if (p == NULL) {
+            break;
+        }
+    }
+
+    if (p == NULL) {
+        errno = EIO;
+        ret = -1;
+        goto done;
+    }
+
+done:
+
+    return ret;
+}
+
+void mt_filter_enable(struct mt_client *mtc, bool enable)
+{
+    if (mtc != NULL) {
+        mtc->filter = enable;
+    }
+}
+
+void mt_filter_clear(struct mt_client *mtc)
+{
+    if (mtc != NULL) {
+        mtc->filter_variants = 0;
+        bzero(mtc->filter_portnums, sizeof(mtc->filter_portnums));
+    }
+}
+
+void mt_filter_variant(struct mt_client *mtc, pb_size_t variant,
+                       bool subscribe)
+{
+    if ((mtc == NULL) || (variant >= 32)) {
+        return;
+    }
+
+    if (subscribe) {
+        mtc->filter_variants |= (1U << variant);
+    } else {
+        mtc->filter_variants &= ~(1U << variant);
+    }
+}
+
+void mt_filter_portnum(struct mt_client *mtc, unsigned int portnum,
+                       bool subscribe)
+{
+    if ((mtc == NULL) || (portnum >= MT_PORTNUM_MAX)) {
+        return;
+    }
+
+    if (subscribe) {
+        mtc->filter_portnums[portnum / 32] |= (1U << (portnum % 32));
+    } else {
+        mtc->filter_portnums[portnum / 32] &= ~(1U << (portnum % 32));
+    }
+}
+
+bool mt_filter_match(const struct mt_client *mtc,
+                     const struct mt_frame_view *view)
+{
+    unsigned int portnum;
+
+    if (!mtc->filter) {
+        return true;
+    }
+
+    if ((view->which_payload_variant >= 32) ||
+        ((mtc->filter_variants & (1U << view->which_payload_variant)) == 0)) {
+        return false;
+    }
+
+    if (view->which_payload_variant == meshtastic_FromRadio_packet_tag) {
+        portnum = view->portnum;
+        if ((portnum >= MT_PORTNUM_MAX) ||
+            ((mtc->filter_portnums[portnum / 32] &
+              (1U << (portnum % 32))) == 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
 
 int mt_recv_packet(struct mt_client *mtc, uint8_t *packet, size_t size)
 {
     int ret = 0;
-    struct mt_pb_header *header = (struct mt_pb_header *) packet;
-    uint16_t mt_pb_len;
-    pb_istream_t istream;
-    meshtastic_FromRadio from_radio;
+    struct mt_pb_header *header = (struct mt_pb_header *) packet;
+    uint16_t mt_pb_len;
+    pb_istream_t istream;
+    uint64_t t0;
+    bool traced = false;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (packet == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if ((header->start1 != MT_PB_START1) ||
+        (header->start2 != MT_PB_START2)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    mt_pb_len = (header->h_len << 8) | header->l_len;
+    if (size != (sizeof(*header) + mt_pb_len)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+#if defined(MT_HAVE_CAPTURE)
+    if (mtc->capture != NULL) {
+        mt_capture_frame(mtc, MT_CAPTURE_RX, packet, size);
+    }
+#endif
+
+    ret = mt_frame_peek(packet + sizeof(*header), mt_pb_len, &mtc->view);
+    if (ret != 0) {
+        goto done;
+    }
+
+    /* The link is alive regardless of whether anyone wants this frame */
+    mt_count64(&mtc->counters.bytes_rx, sizeof(*header) + mt_pb_len);
+    mt_count64(&mtc->counters.packets_rx, 1);
+    mtc->bytes_rx += (sizeof(*header) + mt_pb_len);
+    mtc->packets_rx++;
+    mtc->last_packet_ts = mt_impl_now();
+    mt_metric_add(mt_metric_lazy(&mt_m_rx_bytes, "rx.bytes",
+                                 MT_METRIC_COUNTER),
+                  sizeof(*header) + mt_pb_len);
+    mt_metric_add(mt_metric_lazy(&mt_m_rx_frames, "rx.frames",
+                                 MT_METRIC_COUNTER), 1);
+    mt_metric_add(mtc->metrics.rx_frames, 1);
+    mt_count_rx(&mtc->view);
+
+    if (!mt_filter_match(mtc, &mtc->view)) {
+        mtc->frames_filtered++;
+        mt_metric_add(mt_metric_lazy(&mt_m_rx_filtered, "rx.filtered",
+                                     MT_METRIC_COUNTER), 1);
+        ret = 0;
+        goto done;
+    }
+
+    /*
+     * pb_decode() initializes the fields itself, and only clears the
+     * oneof member that the frame actually carries.
+     */
+    istream = pb_istream_from_buffer(packet + sizeof(*header), mt_pb_len);
+    ret = pb_decode(&istream, meshtastic_FromRadio_fields, &mtc->from_radio);
+    if (ret != 1) {
+        errno = EIO;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->trace != NULL) {
+        mt_trace_decoded(mtc, &mtc->view);
+        traced = true;
+    }
+
+    if (mtc->handler) {
+        if (traced) {
+            mt_trace_dispatch(mtc);
+        }
+        t0 = mt_impl_now_ns();
+        mtc->handler(mtc, packet, size, &mtc->from_radio);
+        mt_metric_observe(mt_metric_lazy(&mt_m_rx_handler_ns,
+                                         "rx.handler_ns",
+                                         MT_METRIC_HISTOGRAM),
+                          mt_impl_now_ns() - t0);
+    }
+
+    if (traced) {
+        mt_trace_done(mtc);
+    }
+
+    ret = 0;
+
+done:
+
+    if ((ret != 0) && (mtc != NULL)) {
+        mtc->decode_errors++;
+        mt_metric_add(mt_metric_lazy(&mt_m_rx_decode_errors,
+                                     "rx.decode_errors",
+                                     MT_METRIC_COUNTER), 1);
+        mt_metric_add(mtc->metrics.rx_decode_errors, 1);
+    }
+
+    return ret;
+}
+
+int mt_attach(struct mt_client *mtc,
+              const struct mt_transport_ops *ops, const char *device)
+{
+    int ret = 0;
+
+    if ((mtc == NULL) || (ops == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if ((ops->open == NULL) || (ops->read == NULL) || (ops->write == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    mt_detach(mtc);
+
+    mtc->type = MT_CLIENT_CUSTOM;
+    mtc->ops = ops;
+    mtc->priv = NULL;
+    mtc->fd = -1;
+    mtc->device = NULL;
+    mt_framer_reset(mtc);
+
+    ret = ops->open(mtc, device);
+    if (ret != 0) {
+        mt_detach(mtc);
+        ret = -1;
+    }
+
+done:
+
+    return ret;
+}
+
+int mt_detach(struct mt_client *mtc)
+{
+    int ret = 0;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if ((mtc->ops != NULL) && (mtc->ops->close != NULL)) {
+        ret = mtc->ops->close(mtc);
+    }
+
+    mtc->ops = NULL;
+    mtc->priv = NULL;
+    mtc->fd = -1;
+    mt_framer_reset(mtc);
+
+done:
+
+    return ret;
+}
+
+int mt_drain(struct mt_client *mtc)
+{
+    int ret = 0;
+    struct mt_span span[2];
+    unsigned int n;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->ops == NULL) {
+        errno = EBADF;
+        ret = -1;
+        goto done;
+    }
+
+    n = mt_framer_spans(mtc, span);
+    ret = mtc->ops->read(mtc, span, n);
+    if (ret < 0) {
+        mt_framer_reset(mtc);
+        goto done;
+    } else if (ret == 0) {
+        goto done;
+    }
+
+    mt_framer_commit(mtc, (size_t) ret);
+    ret = mt_framer_drain(mtc);
+
+done:
+
+    return ret;
+}
+
+int mt_process(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    int ret = 0;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->ops == NULL) {
+        errno = EBADF;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->ops->process != NULL) {
+#if defined(MT_HAVE_TXQ)
+        if (mtc->txq != NULL) {
+            mt_txq_flush(mtc);
+        }
+#endif
+        ret = mtc->ops->process(mtc, timeout_ms);
+        goto done;
+    }
+
+    ret = mt_wait(mtc, mt_poll_fd(mtc), timeout_ms);
+    if (ret <= 0) {
+        goto done;
+    }
+
+    ret = mt_drain(mtc);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Drops a link that is known or suspected to be dead; the transport
+ * reopens it from mt_process() with backoff. Fails with ENOTSUP for
+ * transports that cannot.
+ */
+int mt_reconnect(struct mt_client *mtc)
+{
+    int ret = 0;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -34,139 +864,488 @@ int mt_recv_packet(struct mt_client *mtc, uint8_t *packet, size_t size)
         goto done;
     }
 
-    if (packet == NULL) {
-        errno = EINVAL;
+    if (mtc->ops == NULL) {
+        errno = EBADF;
         ret = -1;
         goto done;
     }
 
-    if ((header->start1 != MT_PB_START1) ||
-        (header->start2 != MT_PB_START2)) {
-        errno = EINVAL;
+    if (mtc->ops->drop == NULL) {
+        errno = ENOTSUP;
         ret = -1;
         goto done;
     }
 
-    mt_pb_len = (header->h_len << 8) | header->l_len;
-    if (size != (sizeof(*header) + mt_pb_len)) {
+    mtc->ops->drop(mtc);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Waits up to timeout_ms for fd to become readable, writing out anything
+ * queued on the transmit queue in the meantime. Returns 1 if fd is ready
+ * (or there is no fd to wait on), 0 on timeout and -1 on error.
+ */
+int mt_wait(struct mt_client *mtc, int fd, uint32_t timeout_ms)
+{
+    int ret = 0;
+#if defined(MT_HAVE_POLL)
+    struct pollfd pfd[2];
+    nfds_t nfds = 0;
+    int txfd;
+#endif
+
+    if (mtc == NULL) {
         errno = EINVAL;
         ret = -1;
         goto done;
     }
 
-    memset(&from_radio, 0x0, sizeof(from_radio));
-    istream = pb_istream_from_buffer(packet + sizeof(*header), mt_pb_len);
-    ret = pb_decode(&istream, meshtastic_FromRadio_fields, &from_radio);
-    if (ret != 1) {
-        errno = EIO;
-        ret = -1;
+#if defined(MT_HAVE_POLL)
+    txfd = mt_txq_fd(mtc);
+    if (fd < 0) {
+        if (txfd >= 0) {
+            mt_txq_flush(mtc);
+        }
+        ret = 1;
         goto done;
     }
 
-    mtc->bytes_rx += (sizeof(*header) + mt_pb_len);
-    mtc->packets_rx++;
-    mtc->last_packet_ts = mt_impl_now();
+    pfd[nfds].fd = fd;
+    pfd[nfds].events = POLLIN;
+    pfd[nfds].revents = 0;
+    nfds++;
 
-    if (mtc->handler) {
-        mtc->handler(mtc, packet, size, &from_radio);
+    if (txfd >= 0) {
+        pfd[nfds].fd = txfd;
+        pfd[nfds].events = POLLIN;
+        pfd[nfds].revents = 0;
+        nfds++;
     }
 
-    ret = 0;
+    ret = poll(pfd, nfds, timeout_ms);
+    if (ret == -1) {
+        if (errno == EINTR) {
+            ret = 0;
+            goto done;
+        }
+        fprintf(stderr, "%s: %s\n", mtc->device, strerror(errno));
+        goto done;
+    }
+
+    if ((nfds > 1) && (pfd[1].revents != 0)) {
+        mt_txq_flush(mtc);
+    }
+
+    ret = (pfd[0].revents != 0) ? 1 : 0;
+#else
+    (void)(fd);
+    (void)(timeout_ms);
+    ret = 1;
+#endif
 
 done:
 
     return ret;
 }
 
-static int mt_send_to_radio(struct mt_client *mtc,
-                            meshtastic_ToRadio *to_radio)
+int mt_poll_fd(const struct mt_client *mtc)
 {
-    int ret = 0;
-    uint8_t pb_buf[sizeof(struct mt_pb_header) + PB_BUF_SIZE];
-    pb_ostream_t ostream;
-    struct mt_pb_header *header = (struct mt_pb_header *) pb_buf;
+    if ((mtc == NULL) || (mtc->ops == NULL) || (mtc->ops->poll_fd == NULL)) {
+        return -1;
+    }
+
+    return mtc->ops->poll_fd(mtc);
+}
+
+bool mt_connecting(const struct mt_client *mtc)
+{
+    if ((mtc == NULL) || (mtc->ops == NULL) ||
+        (mtc->ops->connecting == NULL)) {
+        return false;
+    }
+
+    return mtc->ops->connecting(mtc);
+}
+
+void mt_client_counters(const struct mt_client *mtc,
+                        struct mt_client_counters *counters)
+{
+    if (counters == NULL) {
+        return;
+    }
 
     if (mtc == NULL) {
+        bzero(counters, sizeof(*counters));
+        return;
+    }
+
+    counters->bytes_rx = mt_load64(&mtc->counters.bytes_rx);
+    counters->bytes_tx = mt_load64(&mtc->counters.bytes_tx);
+    counters->packets_rx = mt_load64(&mtc->counters.packets_rx);
+    counters->packets_tx = mt_load64(&mtc->counters.packets_tx);
+}
+
+int mt_writev(struct mt_client *mtc, const struct mt_span *span,
+              unsigned int n)
+{
+    int ret = 0;
+    unsigned int i;
+
+    if ((mtc == NULL) || (span == NULL)) {
         errno = EINVAL;
         ret = -1;
         goto done;
     }
 
-    if (to_radio == NULL) {
-        errno = EINVAL;
+    if (mtc->ops == NULL) {
+        errno = EBADF;
         ret = -1;
         goto done;
     }
 
-    ostream = pb_ostream_from_buffer(pb_buf + sizeof(*header), PB_BUF_SIZE);
-    ret = pb_encode(&ostream, meshtastic_ToRadio_fields, to_radio);
-    if (ret != 1) {
-        errno = EIO;
+    if (mtc->ops->writev != NULL) {
+        ret = mtc->ops->writev(mtc, span, n);
+    } else {
+        for (i = 0; (i < n) && (ret == 0); i++) {
+            if (span[i].len > 0) {
+                ret = mtc->ops->write(mtc, span[i].buf, span[i].len);
+            }
+        }
+    }
+
+#if defined(MT_HAVE_CAPTURE)
+    if ((ret == 0) && (mtc->capture != NULL)) {
+        for (i = 0; i < n; i++) {
+            if (span[i].len > 0) {
+                mt_capture_frame(mtc, MT_CAPTURE_TX, span[i].buf,
+                                 span[i].len);
+            }
+        }
+    }
+#endif
+
+done:
+
+    return ret;
+}
+
+int mt_write(struct mt_client *mtc, const uint8_t *buf, size_t len)
+{
+    int ret = 0;
+
+    if ((mtc == NULL) || (buf == NULL)) {
+        errno = EINVAL;
         ret = -1;
         goto done;
     }
 
-    header->start1 = MT_PB_START1;
-    header->start2 = MT_PB_START2;
-    header->h_len = ostream.bytes_written / 256;
-    header->l_len = ostream.bytes_written % 256;
-
-    switch (mtc->type) {
-    case MT_CLIENT_SERIAL:
-        ret = mt_serial_send(mtc, pb_buf,
-                             sizeof(*header) + ostream.bytes_written);
-        break;
-    default:
+    if (mtc->ops == NULL) {
         errno = EBADF;
         ret = -1;
-        break;
+        goto done;
     }
 
-    if (ret == 0) {
-        mtc->bytes_tx += (sizeof(*header) + ostream.bytes_written);
-        mtc->packets_tx++;
+    ret = mtc->ops->write(mtc, buf, len);
+
+#if defined(MT_HAVE_CAPTURE)
+    if ((ret == 0) && (mtc->capture != NULL)) {
+        mt_capture_frame(mtc, MT_CAPTURE_TX, buf, len);
     }
+#endif
 
 done:
 
     return ret;
 }
 
-int mt_send_null(struct mt_client *mtc)
+/*
+ * Minimal protobuf wire writer, for frames simple enough to be put
+ * together field by field instead of through a meshtastic_ToRadio. Fields
+ * are written in field number order and left out when zero, just as
+ * nanopb does, so the bytes come out the same.
+ */
+#define MT_WIRE_KEY(field, wt) ((uint8_t) (((field) << 3) | (wt)))
+
+static size_t mt_wire_varint_len(uint32_t v)
+{
+    size_t n = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+static uint8_t *mt_wire_put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+
+    return p;
+}
+
+static uint8_t *mt_wire_put_fixed32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+
+    return p + 4;
+}
+
+static uint8_t *mt_wire_put_header(uint8_t *buf, size_t pb_len)
+{
+    struct mt_pb_header *header = (struct mt_pb_header *) buf;
+
+    header->start1 = MT_PB_START1;
+    header->start2 = MT_PB_START2;
+    header->h_len = pb_len / 256;
+    header->l_len = pb_len % 256;
+
+    return buf + sizeof(*header);
+}
+
+/*
+ * Control frames, kept encoded: they are either constant or, for
+ * want_config_id, differ only in the trailing varint.
+ */
+static const uint8_t mt_frame_null[] = {
+    /* A bare header, the firmware treats it as a no-op */
+    MT_PB_START1, MT_PB_START2, 0x00, 0x00,
+};
+
+static const uint8_t mt_frame_disconnect[] = {
+    MT_PB_START1, MT_PB_START2, 0x00, 0x02,
+    MT_WIRE_KEY(meshtastic_ToRadio_disconnect_tag, MT_WT_VARINT), 0x01,
+};
+
+static const uint8_t mt_frame_heartbeat[] = {
+    MT_PB_START1, MT_PB_START2, 0x00, 0x02,
+    MT_WIRE_KEY(meshtastic_ToRadio_heartbeat_tag, MT_WT_LEN), 0x00,
+};
+
+static const uint8_t mt_frame_want_config[] = {
+    MT_PB_START1, MT_PB_START2, 0x00, 0x00,
+    MT_WIRE_KEY(meshtastic_ToRadio_want_config_id_tag, MT_WT_VARINT),
+};
+
+static const uint8_t mt_admin_device_metadata_request[] = {
+    MT_WIRE_KEY(meshtastic_AdminMessage_get_device_metadata_request_tag,
+                MT_WT_VARINT), 0x01,
+};
+
+#if defined(MT_HAVE_TXQ)
+struct mt_frame_bytes {
+    const uint8_t *buf;
+    size_t len;
+};
+
+static int mt_copy_frame(uint8_t *buf, size_t *len, const void *arg)
+{
+    const struct mt_frame_bytes *frame = (const struct mt_frame_bytes *) arg;
+
+    memcpy(buf, frame->buf, frame->len);
+    *len = frame->len;
+
+    return 0;
+}
+#endif
+
+/*
+ * A ToRadio carrying the packet, encoded as such without first copying
+ * the packet into one.
+ */
+static int mt_encode_packet(uint8_t *buf, size_t *len, const void *arg)
 {
     int ret = 0;
-    struct mt_pb_header header;
+    const meshtastic_MeshPacket *packet = (const meshtastic_MeshPacket *) arg;
+    pb_ostream_t ostream;
 
-    if (mtc == NULL) {
-        errno = EINVAL;
+    ostream = pb_ostream_from_buffer(buf + sizeof(struct mt_pb_header),
+                                     PB_BUF_SIZE);
+    if (!pb_encode_tag(&ostream, PB_WT_STRING,
+                       meshtastic_ToRadio_packet_tag) ||
+        !pb_encode_submessage(&ostream, meshtastic_MeshPacket_fields,
+                              packet)) {
+        errno = EIO;
         ret = -1;
         goto done;
     }
 
-    header.start1 = MT_PB_START1;
-    header.start2 = MT_PB_START2;
-    header.h_len = 0;
-    header.l_len = 0;
+    mt_wire_put_header(buf, ostream.bytes_written);
+    *len = sizeof(struct mt_pb_header) + ostream.bytes_written;
 
-    switch (mtc->type) {
-    case MT_CLIENT_SERIAL:
-        ret = mt_serial_send(mtc, (const uint8_t *) &header, sizeof(header));
-        break;
-    default:
-        errno = EBADF;
+done:
+
+    return ret;
+}
+
+/*
+ * The fields of a decoded packet that the library itself sends. It is
+ * encoded in a single pass straight into the frame, so the payload is
+ * only ever copied there.
+ */
+struct mt_data_packet {
+    uint32_t to;
+    uint32_t id;
+    uint32_t channel;
+    uint32_t hop_limit;
+    uint32_t hop_start;
+    bool want_ack;
+    uint32_t portnum;
+    bool want_response;
+    const uint8_t *payload;
+    size_t payload_len;
+};
+
+static int mt_encode_data_packet(uint8_t *buf, size_t *len, const void *arg)
+{
+    int ret = 0;
+    const struct mt_data_packet *dp = (const struct mt_data_packet *) arg;
+    size_t data_len = 0, packet_len = 0, pb_len;
+    uint8_t *p;
+
+    if (dp->portnum != 0) {
+        data_len += 1 + mt_wire_varint_len(dp->portnum);
+    }
+    if (dp->payload_len > 0) {
+        data_len += 1 + mt_wire_varint_len(dp->payload_len) +
+            dp->payload_len;
+    }
+    if (dp->want_response) {
+        data_len += 2;
+    }
+
+    if (dp->to != 0) {
+        packet_len += 1 + 4;
+    }
+    if (dp->channel != 0) {
+        packet_len += 1 + mt_wire_varint_len(dp->channel);
+    }
+    packet_len += 1 + mt_wire_varint_len(data_len) + data_len;
+    if (dp->id != 0) {
+        packet_len += 1 + 4;
+    }
+    if (dp->hop_limit != 0) {
+        packet_len += 1 + mt_wire_varint_len(dp->hop_limit);
+    }
+    if (dp->want_ack) {
+        packet_len += 2;
+    }
+    if (dp->hop_start != 0) {
+        packet_len += 1 + mt_wire_varint_len(dp->hop_start);
+    }
+
+    pb_len = 1 + mt_wire_varint_len(packet_len) + packet_len;
+    if (pb_len > PB_BUF_SIZE) {
+        errno = EMSGSIZE;
         ret = -1;
-        break;
+        goto done;
+    }
+
+    p = mt_wire_put_header(buf, pb_len);
+    *p++ = MT_WIRE_KEY(meshtastic_ToRadio_packet_tag, MT_WT_LEN);
+    p = mt_wire_put_varint(p, packet_len);
+
+    if (dp->to != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_to_tag, MT_WT_FIXED32);
+        p = mt_wire_put_fixed32(p, dp->to);
+    }
+    if (dp->channel != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_channel_tag, MT_WT_VARINT);
+        p = mt_wire_put_varint(p, dp->channel);
+    }
+
+    *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_decoded_tag, MT_WT_LEN);
+    p = mt_wire_put_varint(p, data_len);
+    if (dp->portnum != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_Data_portnum_tag, MT_WT_VARINT);
+        p = mt_wire_put_varint(p, dp->portnum);
+    }
+    if (dp->payload_len > 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_Data_payload_tag, MT_WT_LEN);
+        p = mt_wire_put_varint(p, dp->payload_len);
+        memcpy(p, dp->payload, dp->payload_len);
+        p += dp->payload_len;
+    }
+    if (dp->want_response) {
+        *p++ = MT_WIRE_KEY(meshtastic_Data_want_response_tag, MT_WT_VARINT);
+        *p++ = 0x01;
+    }
+
+    if (dp->id != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_id_tag, MT_WT_FIXED32);
+        p = mt_wire_put_fixed32(p, dp->id);
+    }
+    if (dp->hop_limit != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_hop_limit_tag,
+                           MT_WT_VARINT);
+        p = mt_wire_put_varint(p, dp->hop_limit);
+    }
+    if (dp->want_ack) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_want_ack_tag, MT_WT_VARINT);
+        *p++ = 0x01;
+    }
+    if (dp->hop_start != 0) {
+        *p++ = MT_WIRE_KEY(meshtastic_MeshPacket_hop_start_tag,
+                           MT_WT_VARINT);
+        p = mt_wire_put_varint(p, dp->hop_start);
     }
 
+    *len = (size_t) (p - buf);
+
 done:
 
     return ret;
 }
 
-int mt_send_disconnect(struct mt_client *mtc)
+/* Writes out a complete frame and accounts for it */
+static int mt_write_frame(struct mt_client *mtc, const uint8_t *buf,
+                          size_t len)
+{
+    int ret = 0;
+    uint64_t queued;
+
+    queued = mt_trace_reply(mtc);
+    ret = mt_write(mtc, buf, len);
+    if (ret == 0) {
+        mt_trace_written(mtc, queued);
+        mt_count64(&mtc->counters.bytes_tx, len);
+        mt_count64(&mtc->counters.packets_tx, 1);
+        mtc->bytes_tx += len;
+        mtc->packets_tx++;
+        mt_metric_add(mt_metric_lazy(&mt_m_tx_bytes, "tx.bytes",
+                                     MT_METRIC_COUNTER), len);
+        mt_metric_add(mt_metric_lazy(&mt_m_tx_frames, "tx.frames",
+                                     MT_METRIC_COUNTER), 1);
+        mt_metric_add(mtc->metrics.tx_frames, 1);
+    }
+
+    return ret;
+}
+
+/*
+ * Sends the frame that fill() encodes, header included, straight into a
+ * transmit queue cell if there is a queue or else into a buffer on the
+ * stack, which must hold sizeof(struct mt_pb_header) + PB_BUF_SIZE bytes.
+ */
+static int mt_send_frame(struct mt_client *mtc,
+                         int (*fill)(uint8_t *buf, size_t *len,
+                                     const void *arg),
+                         const void *arg)
 {
     int ret = 0;
-    meshtastic_ToRadio to_radio;
+    uint8_t pb_buf[sizeof(struct mt_pb_header) + PB_BUF_SIZE];
+    size_t len;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -174,20 +1353,34 @@ int mt_send_disconnect(struct mt_client *mtc)
         goto done;
     }
 
-    memset(&to_radio, 0x0, sizeof(to_radio));
-    to_radio.which_payload_variant = meshtastic_ToRadio_disconnect_tag;
-    to_radio.disconnect = true;
-    ret = mt_send_to_radio(mtc, &to_radio);
+#if defined(MT_HAVE_TXQ)
+    if (mtc->txq != NULL) {
+        /* Encode in place and let the I/O thread do the write */
+        ret = mt_txq_push(mtc, fill, arg);
+        goto done;
+    }
+#endif
+
+    ret = fill(pb_buf, &len, arg);
+    if (ret != 0) {
+        goto done;
+    }
+
+    ret = mt_write_frame(mtc, pb_buf, len);
 
 done:
 
     return ret;
 }
 
-int mt_send_heartbeat(struct mt_client *mtc)
+/* Sends a frame that is already encoded, without copying it if it can */
+static int mt_send_bytes(struct mt_client *mtc, const uint8_t *buf,
+                         size_t len)
 {
     int ret = 0;
-    meshtastic_ToRadio to_radio;
+#if defined(MT_HAVE_TXQ)
+    struct mt_frame_bytes frame;
+#endif
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -195,26 +1388,127 @@ int mt_send_heartbeat(struct mt_client *mtc)
         goto done;
     }
 
-    memset(&to_radio, 0x0, sizeof(to_radio));
-    to_radio.which_payload_variant = meshtastic_ToRadio_heartbeat_tag;
+#if defined(MT_HAVE_TXQ)
+    if (mtc->txq != NULL) {
+        frame.buf = buf;
+        frame.len = len;
+        ret = mt_txq_push(mtc, mt_copy_frame, &frame);
+        goto done;
+    }
+#endif
 
-    ret = mt_send_to_radio(mtc, &to_radio);
+    ret = mt_write_frame(mtc, buf, len);
 
 done:
 
     return ret;
 }
 
-int mt_send_want_config(struct mt_client *mtc)
+static void mt_seed_rand(void)
 {
     static int __seeded_rand = 0;
-    int ret = 0;
-    meshtastic_ToRadio to_radio;
 
     if (!__seeded_rand) {
         srand(time(NULL));
         __seeded_rand = 1;
     }
+}
+
+uint32_t mt_packet_id(struct mt_client *mtc)
+{
+    uint32_t id;
+#if defined(MT_HAVE_ATOMICS)
+    uint32_t zero = 0;
+#endif
+
+    if (mtc == NULL) {
+        return 0;
+    }
+
+#if defined(MT_HAVE_ATOMICS)
+    if (__atomic_load_n(&mtc->next_id, __ATOMIC_RELAXED) == 0) {
+        mt_seed_rand();
+        /* Whoever seeds first wins, the others just use the counter */
+        __atomic_compare_exchange_n(&mtc->next_id, &zero,
+                                    ((uint32_t) rand()) | 1U, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    do {
+        id = __atomic_fetch_add(&mtc->next_id, 1, __ATOMIC_RELAXED);
+        id &= 0x7fffffff;
+    } while (id == 0);
+#else
+    if (mtc->next_id == 0) {
+        mt_seed_rand();
+        mtc->next_id = ((uint32_t) rand()) | 1U;
+    }
+
+    do {
+        id = mtc->next_id++ & 0x7fffffff;
+    } while (id == 0);
+#endif
+
+    return id;
+}
+
+int mt_send_packet(struct mt_client *mtc, meshtastic_MeshPacket *packet)
+{
+    int ret = 0;
+
+    if ((mtc == NULL) || (packet == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (packet->id == 0) {
+        packet->id = mt_packet_id(mtc);
+    }
+
+    ret = mt_send_frame(mtc, mt_encode_packet, packet);
+
+done:
+
+    return ret;
+}
+
+int mt_send_null(struct mt_client *mtc)
+{
+    return mt_send_bytes(mtc, mt_frame_null, sizeof(mt_frame_null));
+}
+
+int mt_send_disconnect(struct mt_client *mtc)
+{
+    return mt_send_bytes(mtc, mt_frame_disconnect,
+                         sizeof(mt_frame_disconnect));
+}
+
+int mt_send_heartbeat(struct mt_client *mtc)
+{
+    return mt_send_bytes(mtc, mt_frame_heartbeat, sizeof(mt_frame_heartbeat));
+}
+
+int mt_send_want_config(struct mt_client *mtc)
+{
+    uint32_t id;
+
+    mt_seed_rand();
+
+    do {
+        id = rand() & 0x7fffffff;
+    } while ((id == MT_WANT_CONFIG_ONLY_CONFIG) ||
+             (id == MT_WANT_CONFIG_ONLY_NODES));
+
+    return mt_send_want_config_id(mtc, id);
+}
+
+int mt_send_want_config_id(struct mt_client *mtc, uint32_t id)
+{
+    int ret = 0;
+    uint8_t frame[sizeof(mt_frame_want_config) + 5];
+    struct mt_pb_header *header = (struct mt_pb_header *) frame;
+    uint8_t *p;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -222,11 +1516,11 @@ int mt_send_want_config(struct mt_client *mtc)
         goto done;
     }
 
-    memset(&to_radio, 0x0, sizeof(to_radio));
-    to_radio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-    to_radio.want_config_id = rand() & 0x7fffffff;
+    memcpy(frame, mt_frame_want_config, sizeof(mt_frame_want_config));
+    p = mt_wire_put_varint(frame + sizeof(mt_frame_want_config), id);
+    header->l_len = (uint8_t) (p - frame - sizeof(*header));
 
-    ret = mt_send_to_radio(mtc, &to_radio);
+    ret = mt_send_bytes(mtc, frame, p - frame);
 
 done:
 
@@ -240,7 +1534,7 @@ int mt_text_message(struct mt_client *mtc,
 {
     int ret = 0;
     size_t message_len = 0;
-    meshtastic_ToRadio to_radio;
+    struct mt_data_packet dp;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -270,21 +1564,18 @@ int mt_text_message(struct mt_client *mtc,
         goto done;
     }
 
-    bzero(&to_radio, sizeof(to_radio));
-    to_radio.which_payload_variant = meshtastic_ToRadio_packet_tag;
-    to_radio.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
-    to_radio.packet.id = rand() & 0x7fffffff;
-    to_radio.packet.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
-    to_radio.packet.to = dest;
-    to_radio.packet.channel = channel;
-    to_radio.packet.want_ack = want_ack;
-    to_radio.packet.hop_start = hop_start;
-    to_radio.packet.hop_limit = hop_start;
-    to_radio.packet.decoded.payload.size = message_len;
-    memcpy(to_radio.packet.decoded.payload.bytes, message,
-           to_radio.packet.decoded.payload.size);
+    bzero(&dp, sizeof(dp));
+    dp.to = dest;
+    dp.id = mt_packet_id(mtc);
+    dp.channel = channel;
+    dp.hop_limit = hop_start;
+    dp.hop_start = hop_start;
+    dp.want_ack = want_ack;
+    dp.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+    dp.payload = (const uint8_t *) message;
+    dp.payload_len = message_len;
 
-    ret = mt_send_to_radio(mtc, &to_radio);
+    ret = mt_send_frame(mtc, mt_encode_data_packet, &dp);
 
 done:
 
@@ -294,11 +1585,7 @@ done:
 int mt_admin_message_device_metadata_request(struct mt_client *mtc)
 {
     int ret = 0;
-    meshtastic_ToRadio to_radio;
-    meshtastic_Data data;
-    meshtastic_MeshPacket packet;
-    meshtastic_AdminMessage admin_message;
-    pb_ostream_t ostream;
+    struct mt_data_packet dp;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -306,29 +1593,14 @@ int mt_admin_message_device_metadata_request(struct mt_client *mtc)
         goto done;
     }
 
-    bzero(&admin_message, sizeof(admin_message));
-    admin_message.which_payload_variant =
-        meshtastic_AdminMessage_get_device_metadata_request_tag;
-    admin_message.get_device_metadata_request = true;
-
-    bzero(&data, sizeof(data));
-    data.portnum = meshtastic_PortNum_ADMIN_APP;
-    data.want_response = true;
-    ostream = pb_ostream_from_buffer(data.payload.bytes, sizeof(data.payload));
-    ret = pb_encode(&ostream, meshtastic_AdminMessage_fields, &admin_message);
-    if (ret != 1) {
-        errno = EIO;
-        ret = -1;
-        goto done;
-    }
-
-    memcpy(&packet.decoded, &data, sizeof(data));
+    bzero(&dp, sizeof(dp));
+    dp.id = mt_packet_id(mtc);
+    dp.portnum = meshtastic_PortNum_ADMIN_APP;
+    dp.want_response = true;
+    dp.payload = mt_admin_device_metadata_request;
+    dp.payload_len = sizeof(mt_admin_device_metadata_request);
 
-    bzero(&to_radio, sizeof(to_radio));
-    to_radio.which_payload_variant = meshtastic_ToRadio_packet_tag;
-    memcpy(&to_radio.packet, &packet, sizeof(packet));
-
-    ret = mt_send_to_radio(mtc, &to_radio);
+    ret = mt_send_frame(mtc, mt_encode_data_packet, &dp);
 
 done:
 
@@ -338,7 +1610,7 @@ done:
 int mt_admin_message_reboot(struct mt_client *mtc, uint32_t seconds)
 {
     int ret = 0;
-    meshtastic_ToRadio to_radio;
+    struct mt_data_packet dp;
 
     if (mtc == NULL) {
         errno = EINVAL;
@@ -346,15 +1618,12 @@ int mt_admin_message_reboot(struct mt_client *mtc, uint32_t seconds)
         goto done;
     }
 
-    bzero(&to_radio, sizeof(to_radio));
-
-    to_radio.which_payload_variant = meshtastic_ToRadio_packet_tag;
-    to_radio.packet.which_payload_variant = meshtastic_MeshPacket_decoded_tag;
-    to_radio.packet.id = rand() & 0x7fffffff;
-    to_radio.packet.decoded.portnum = meshtastic_PortNum_ADMIN_APP;
+    bzero(&dp, sizeof(dp));
+    dp.id = mt_packet_id(mtc);
+    dp.portnum = meshtastic_PortNum_ADMIN_APP;
     (void)(seconds);
 
-    ret = mt_send_to_radio(mtc, &to_radio);
+    ret = mt_send_frame(mtc, mt_encode_data_packet, &dp);
 
 done:
 
@@ -0,0 +1,521 @@
+/*
+ * replay.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libmeshtastic.h>
+
+/*
+ * Feeds a recorded byte stream back through the framer as if a radio sent
+ * it. Two inputs are understood: a raw dump of what a serial port produced
+ * (no timing, always replayed flat out) and a pcapng capture written by
+ * mt_capture_start(), whose inbound frames carry their original
+ * timestamps and may be replayed in real time, scaled, or flat out.
+ */
+
+#define PCAPNG_SHB              0x0a0d0d0aU
+#define PCAPNG_IDB              0x00000001U
+#define PCAPNG_EPB              0x00000006U
+#define PCAPNG_BOM              0x1a2b3c4dU
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+#define PCAPNG_EPB_DIR_MASK     0x3U
+#define PCAPNG_EPB_OUTBOUND     0x2U
+
+struct mt_replay {
+    const uint8_t *map;
+    size_t size;
+    size_t off;
+    bool pcapng;
+    uint64_t ticks_per_sec;
+    const uint8_t *frame;
+    size_t frame_len;
+    size_t frame_off;
+    uint64_t frame_ns;
+    float speed;
+    bool started;
+    bool finished;
+    uint64_t wall0;
+    uint64_t wall1;
+    uint64_t cap0;
+    uint64_t packets0;
+    uint32_t errors0;
+    void (*handler)(struct mt_client *mtc, const void *packet, size_t size,
+                    const meshtastic_FromRadio *from_radio);
+    struct mt_replay_stats stats;
+};
+
+static uint64_t mt_replay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t mt_replay_get32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static uint16_t mt_replay_get16(const uint8_t *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+/*
+ * Times every call into the client's own handler, bucketed by FromRadio
+ * variant, so a replay shows where the receive side spends its time.
+ */
+static void mt_replay_handler(struct mt_client *mtc, const void *packet,
+                              size_t size,
+                              const meshtastic_FromRadio *from_radio)
+{
+    struct mt_replay *rp = (struct mt_replay *) mtc->priv;
+    pb_size_t variant = from_radio->which_payload_variant;
+    uint64_t t0, ns;
+
+    if (rp->handler == NULL) {
+        return;
+    }
+
+    t0 = mt_replay_now();
+    rp->handler(mtc, packet, size, from_radio);
+    ns = mt_replay_now() - t0;
+
+    rp->stats.handled++;
+    rp->stats.handler_ns += ns;
+    if (ns > rp->stats.handler_max_ns) {
+        rp->stats.handler_max_ns = ns;
+    }
+
+    if (variant >= MT_REPLAY_VARIANTS) {
+        variant = 0;
+    }
+    rp->stats.variant_calls[variant]++;
+    rp->stats.variant_ns[variant] += ns;
+}
+
+/*
+ * Steps to the next inbound frame of a pcapng capture; section and
+ * interface blocks update the timestamp resolution on the way. Returns
+ * false at the end of the file or on a block that cannot be parsed.
+ */
+static bool mt_replay_next_frame(struct mt_replay *rp)
+{
+    const uint8_t *b, *opt, *end;
+    uint32_t type, len, caplen, flags;
+    uint16_t code, olen;
+    uint64_t ts;
+    unsigned int i;
+
+    while (rp->off + 12 <= rp->size) {
+        b = rp->map + rp->off;
+        type = mt_replay_get32(b);
+        len = mt_replay_get32(b + 4);
+        if ((len < 12) || (len & 3) || (len > rp->size - rp->off)) {
+            return false;
+        }
+
+        rp->off += len;
+
+        if (type == PCAPNG_SHB) {
+            if ((len < 28) || (mt_replay_get32(b + 8) != PCAPNG_BOM)) {
+                /* Other-endian captures are not supported */
+                return false;
+            }
+            rp->ticks_per_sec = 1000000ULL;
+        } else if (type == PCAPNG_IDB) {
+            rp->ticks_per_sec = 1000000ULL;
+            opt = b + 16;
+            end = b + len - 4;
+            while (opt + 4 <= end) {
+                code = mt_replay_get16(opt);
+                olen = mt_replay_get16(opt + 2);
+                if ((code == PCAPNG_OPT_END) || (opt + 4 + olen > end)) {
+                    break;
+                }
+                if ((code == PCAPNG_OPT_IF_TSRESOL) && (olen >= 1) &&
+                    ((opt[4] & 0x80) == 0)) {
+                    if (opt[4] > 9) {
+                        /* Finer than 1 ns would overflow the conversion */
+                        return false;
+                    }
+                    rp->ticks_per_sec = 1;
+                    for (i = 0; i < opt[4]; i++) {
+                        rp->ticks_per_sec *= 10;
+                    }
+                }
+                opt += 4 + ((olen + 3) & ~3);
+            }
+        } else if ((type == PCAPNG_EPB) && (len >= 32)) {
+            caplen = mt_replay_get32(b + 20);
+            if (28 + caplen > len - 4) {
+                return false;
+            }
+
+            flags = 0;
+            opt = b + 28 + ((caplen + 3) & ~3U);
+            end = b + len - 4;
+            while (opt + 4 <= end) {
+                code = mt_replay_get16(opt);
+                olen = mt_replay_get16(opt + 2);
+                if ((code == PCAPNG_OPT_END) || (opt + 4 + olen > end)) {
+                    break;
+                }
+                if ((code == PCAPNG_OPT_EPB_FLAGS) && (olen == 4)) {
+                    flags = mt_replay_get32(opt + 4);
+                }
+                opt += 4 + ((olen + 3) & ~3);
+            }
+
+            /* Only what the radio sent is replayed */
+            if ((flags & PCAPNG_EPB_DIR_MASK) == PCAPNG_EPB_OUTBOUND) {
+                continue;
+            }
+
+            ts = ((uint64_t) mt_replay_get32(b + 12) << 32) |
+                mt_replay_get32(b + 16);
+            rp->frame = b + 28;
+            rp->frame_len = caplen;
+            rp->frame_off = 0;
+            rp->frame_ns = (ts / rp->ticks_per_sec) * 1000000000ULL +
+                ((ts % rp->ticks_per_sec) * 1000000000ULL) /
+                rp->ticks_per_sec;
+            if (rp->stats.frames == 0) {
+                rp->cap0 = rp->frame_ns;
+            }
+            rp->stats.frames++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Nanoseconds until the current frame is due, 0 if it is due now or the
+ * replay is not paced.
+ */
+static uint64_t mt_replay_due(struct mt_replay *rp)
+{
+    uint64_t now, due;
+
+    if (!rp->pcapng || (rp->speed <= 0.0f) || (rp->frame == NULL)) {
+        return 0;
+    }
+
+    now = mt_replay_now();
+    if (rp->frame_ns <= rp->cap0) {
+        return 0;
+    }
+
+    due = rp->wall0 + (uint64_t) ((rp->frame_ns - rp->cap0) / rp->speed);
+
+    return (due > now) ? (due - now) : 0;
+}
+
+static int mt_replay_open(struct mt_client *mtc, const char *device)
+{
+    int ret = 0;
+    int fd = -1;
+    struct stat st;
+    struct mt_replay *rp = NULL;
+
+    if (device == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    mtc->type = MT_CLIENT_REPLAY;
+    mtc->device = (const char *) strdup(device);
+    if (mtc->device == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    rp = (struct mt_replay *) calloc(1, sizeof(*rp));
+    if (rp == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    fd = open(device, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        ret = -1;
+        goto done;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        ret = -1;
+        goto done;
+    }
+
+    rp->size = (size_t) st.st_size;
+    if (rp->size > 0) {
+        rp->map = (const uint8_t *) mmap(NULL, rp->size, PROT_READ,
+                                         MAP_PRIVATE, fd, 0);
+        if (rp->map == MAP_FAILED) {
+            rp->map = NULL;
+            ret = -1;
+            goto done;
+        }
+        madvise((void *) rp->map, rp->size, MADV_SEQUENTIAL);
+    }
+
+    rp->pcapng = (rp->size >= 4) &&
+        (mt_replay_get32(rp->map) == PCAPNG_SHB);
+    rp->ticks_per_sec = 1000000ULL;
+    rp->packets0 = mtc->counters.packets_rx;
+    rp->errors0 = mtc->decode_errors;
+
+    rp->handler = mtc->handler;
+    mtc->handler = mt_replay_handler;
+    mtc->priv = rp;
+    rp = NULL;
+
+done:
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (rp != NULL) {
+        free(rp);
+    }
+
+    return ret;
+}
+
+static int mt_replay_close(struct mt_client *mtc)
+{
+    struct mt_replay *rp = (struct mt_replay *) mtc->priv;
+
+    if (rp != NULL) {
+        if (mtc->handler == mt_replay_handler) {
+            mtc->handler = rp->handler;
+        }
+        if (rp->map != NULL) {
+            munmap((void *) rp->map, rp->size);
+        }
+        free(rp);
+        mtc->priv = NULL;
+    }
+
+    if (mtc->device) {
+        free((void *) mtc->device);
+    }
+
+    mtc->device = NULL;
+
+    return 0;
+}
+
+static int mt_replay_rx(struct mt_client *mtc, const struct mt_span *span,
+                        unsigned int n)
+{
+    struct mt_replay *rp = (struct mt_replay *) mtc->priv;
+    size_t len, total = 0;
+    unsigned int i = 0;
+    size_t used = 0;
+
+    while (i < n) {
+        if (used == span[i].len) {
+            i++;
+            used = 0;
+            continue;
+        }
+
+        if (rp->pcapng) {
+            if ((rp->frame == NULL) || (rp->frame_off == rp->frame_len)) {
+                if (!mt_replay_next_frame(rp)) {
+                    /* End of file, or a block we cannot make sense of */
+                    rp->frame = NULL;
+                    rp->off = rp->size;
+                    break;
+                }
+            }
+
+            if (mt_replay_due(rp) > 0) {
+                break;
+            }
+
+            len = rp->frame_len - rp->frame_off;
+            if (len > span[i].len - used) {
+                len = span[i].len - used;
+            }
+            memcpy(span[i].buf + used, rp->frame + rp->frame_off, len);
+            rp->frame_off += len;
+        } else {
+            len = rp->size - rp->off;
+            if (len == 0) {
+                break;
+            }
+            if (len > span[i].len - used) {
+                len = span[i].len - used;
+            }
+            memcpy(span[i].buf + used, rp->map + rp->off, len);
+            rp->off += len;
+        }
+
+        used += len;
+        total += len;
+    }
+
+    rp->stats.bytes += total;
+
+    if ((total == 0) && (rp->frame == NULL) && (rp->off >= rp->size)) {
+        /* The recording has been played out */
+        if (!rp->finished) {
+            rp->finished = true;
+            rp->wall1 = mt_replay_now();
+        }
+        errno = EPIPE;
+        return -1;
+    }
+
+    return (int) total;
+}
+
+static int mt_replay_tx(struct mt_client *mtc, const uint8_t *buf,
+                        size_t len)
+{
+    (void)(mtc);
+    (void)(buf);
+    (void)(len);
+
+    /* Nobody is listening; want_config etc. are simply swallowed */
+    return 0;
+}
+
+/*
+ * Sleeps until the next paced frame is due (never past timeout_ms), then
+ * frames as much as is due; flat out, keeps going until the time budget
+ * is used up so the caller's tick still gets to run.
+ */
+static int mt_replay_service(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    struct mt_replay *rp = (struct mt_replay *) mtc->priv;
+    struct timespec ts;
+    uint64_t wait, start, budget;
+    int ret = 0;
+    int frames = 0;
+
+    budget = (uint64_t) timeout_ms * 1000000ULL;
+    start = mt_replay_now();
+
+    if (!rp->started) {
+        rp->started = true;
+        rp->wall0 = start;
+    }
+
+    if (rp->pcapng && (rp->frame == NULL) && (rp->off < rp->size)) {
+        if (!mt_replay_next_frame(rp)) {
+            rp->frame = NULL;
+            rp->off = rp->size;
+        }
+    }
+
+    wait = mt_replay_due(rp);
+    if (wait > 0) {
+        if (wait > budget) {
+            wait = budget;
+        }
+        ts.tv_sec = wait / 1000000000ULL;
+        ts.tv_nsec = wait % 1000000000ULL;
+        nanosleep(&ts, NULL);
+    }
+
+    do {
+        ret = mt_drain(mtc);
+        if (ret < 0) {
+            return (frames > 0) ? frames : ret;
+        }
+
+        frames += ret;
+    } while ((ret > 0) && ((mt_replay_now() - start) < budget));
+
+    return frames;
+}
+
+const struct mt_transport_ops mt_replay_ops = {
+    .name = "replay",
+    .open = mt_replay_open,
+    .close = mt_replay_close,
+    .read = mt_replay_rx,
+    .write = mt_replay_tx,
+    .writev = NULL,
+    .poll_fd = NULL,
+    .process = mt_replay_service,
+};
+
+int mt_replay_attach(struct mt_client *mtc, const char *path, float speed)
+{
+    int ret;
+
+    ret = mt_attach(mtc, &mt_replay_ops, path);
+    if (ret == 0) {
+        ((struct mt_replay *) mtc->priv)->speed = speed;
+    }
+
+    return ret;
+}
+
+int mt_replay_stats(const struct mt_client *mtc,
+                    struct mt_replay_stats *stats)
+{
+    int ret = 0;
+    const struct mt_replay *rp;
+    struct mt_client_counters counters;
+
+    if ((mtc == NULL) || (mtc->ops != &mt_replay_ops) || (stats == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    rp = (const struct mt_replay *) mtc->priv;
+    memcpy(stats, &rp->stats, sizeof(*stats));
+    mt_client_counters(mtc, &counters);
+    stats->packets = counters.packets_rx - rp->packets0;
+    stats->decode_errors = mtc->decode_errors - rp->errors0;
+    if (rp->started) {
+        stats->elapsed_ns =
+            (rp->finished ? rp->wall1 : mt_replay_now()) - rp->wall0;
+    }
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
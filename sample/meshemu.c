@@ -0,0 +1,115 @@
+/*
+ * meshemu.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <libmeshtastic.h>
+
+static volatile sig_atomic_t done_flag = 0;
+
+static void sighandler(int signo)
+{
+    (void)(signo);
+    done_flag = 1;
+}
+
+static const struct option long_options[] = {
+    { "nodes", required_argument, NULL, 'n', },
+    { "channels", required_argument, NULL, 'c', },
+    { "rate", required_argument, NULL, 'r', },
+    { "seed", required_argument, NULL, 's', },
+};
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    struct mt_emulator_config config;
+    struct mt_emulator_stats stats;
+    struct mt_emulator *emu;
+
+    bzero(&config, sizeof(config));
+    config.nodes = 100;
+    config.channels = 2;
+    config.rate = 10;
+
+    for (;;) {
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "n:c:r:s:",
+                            long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'n':
+            config.nodes = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            config.channels = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            config.rate = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Unrecognized argument specified!\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    emu = mt_emulator_start(&config);
+    if (emu == NULL) {
+        fprintf(stderr, "mt_emulator_start: %s!\n", strerror(errno));
+        ret = -1;
+        goto done;
+    }
+
+    signal(SIGINT, sighandler);
+    signal(SIGTERM, sighandler);
+
+    printf("%s\n", mt_emulator_device(emu));
+    fflush(stdout);
+
+    while (!done_flag) {
+        sleep(5);
+        mt_emulator_stats(emu, &stats);
+        printf("configs: %llu rx: %llu tx: %llu (%llu bytes) "
+               "generated: %llu acks: %llu errors: %llu\n",
+               (unsigned long long) stats.configs,
+               (unsigned long long) stats.frames_rx,
+               (unsigned long long) stats.frames_tx,
+               (unsigned long long) stats.bytes_tx,
+               (unsigned long long) stats.generated,
+               (unsigned long long) stats.acks,
+               (unsigned long long) stats.errors);
+        fflush(stdout);
+    }
+
+    mt_emulator_stop(emu);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -41,20 +41,23 @@ static void cleanup(void)
 {
     mt_send_disconnect(&mtc);
     mt_serial_detach(&mtc);
+    mt_trace_stop(&mtc);
 }
 
 static const struct option long_options[] = {
     { "device", required_argument, NULL, 'd', },
+    { "trace", required_argument, NULL, 't', },
 };
 
 int main(int argc, char **argv)
 {
     int ret = 0;
     const char *device = "/dev/ttyAMA0";
+    const char *trace = NULL;
 
     for (;;) {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "d:",
+        int c = getopt_long(argc, argv, "d:t:",
                             long_options, &option_index);
         if (c == -1) {
             break;
@@ -64,6 +67,9 @@ int main(int argc, char **argv)
         case 'd':
             device = optarg;
             break;
+        case 't':
+            trace = optarg;
+            break;
         default:
             fprintf(stderr, "Unrecognized argument specified!\n");
             exit(EXIT_FAILURE);
@@ -71,6 +77,12 @@ int main(int argc, char **argv)
         }
     }
 
+    if ((trace != NULL) && (mt_trace_start(&mtc, trace, 1) != 0)) {
+        fprintf(stderr, "%s: %s!\n", trace, strerror(errno));
+        ret = -1;
+        goto done;
+    }
+
     ret = mt_serial_attach(&mtc, device);
     if (ret != 0) {
         fprintf(stderr, "%s: %s!\n", device, strerror(errno));
@@ -86,7 +98,7 @@ int main(int argc, char **argv)
 
     for (;;) {
         ret = mt_serial_process(&mtc, 1000);
-        if (ret != 0) {
+        if (ret < 0) {
             goto done;
         }
     }
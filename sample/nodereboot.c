@@ -116,7 +116,7 @@ int main(int argc, char **argv)
 
     for (;;) {
         ret = mt_serial_process(&mtc, 1000);
-        if (ret != 0) {
+        if (ret < 0) {
             goto done;
         }
     }
@@ -0,0 +1,134 @@
+/*
+ * nodereplay.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <libmeshtastic.h>
+
+static unsigned long long handled[MT_REPLAY_VARIANTS];
+
+static void mt_handler(struct mt_client *mtc, const void *packet, size_t size,
+                       const meshtastic_FromRadio *from_radio)
+{
+    (void)(mtc);
+    (void)(packet);
+    (void)(size);
+
+    if (from_radio->which_payload_variant < MT_REPLAY_VARIANTS) {
+        handled[from_radio->which_payload_variant]++;
+    }
+}
+
+static struct mt_client mtc = {
+    .type = 0,
+    .fd = -1,
+    .device = NULL,
+    .inbuf = { 0x0, },
+    .inbuf_len = 0,
+    .handler = mt_handler,
+    .logger = NULL,
+    .ctx = NULL,
+};
+
+static const struct option long_options[] = {
+    { "file", required_argument, NULL, 'f', },
+    { "speed", required_argument, NULL, 's', },
+};
+
+int main(int argc, char **argv)
+{
+    int ret = 0;
+    const char *file = NULL;
+    float speed = 0.0f;
+    struct mt_replay_stats stats;
+    double secs;
+    unsigned int i;
+
+    for (;;) {
+        int option_index = 0;
+        int c = getopt_long(argc, argv, "f:s:",
+                            long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'f':
+            file = optarg;
+            break;
+        case 's':
+            speed = strtof(optarg, NULL);
+            break;
+        default:
+            fprintf(stderr, "Unrecognized argument specified!\n");
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (file == NULL) {
+        fprintf(stderr, "Usage: %s -f <capture> [-s <speed>]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    ret = mt_replay_attach(&mtc, file, speed);
+    if (ret != 0) {
+        fprintf(stderr, "%s: %s!\n", file, strerror(errno));
+        goto done;
+    }
+
+    do {
+        ret = mt_process(&mtc, 1000);
+    } while (ret >= 0);
+
+    ret = mt_replay_stats(&mtc, &stats);
+    if (ret != 0) {
+        goto done;
+    }
+
+    secs = (double) stats.elapsed_ns / 1e9;
+    printf("frames: %llu\n", (unsigned long long) stats.packets);
+    printf("bytes: %llu\n", (unsigned long long) stats.bytes);
+    printf("decode errors: %llu\n",
+           (unsigned long long) stats.decode_errors);
+    printf("elapsed: %.3f s\n", secs);
+    if (secs > 0.0) {
+        printf("frames/s: %.0f\n", (double) stats.packets / secs);
+    }
+    if (stats.handled > 0) {
+        printf("handler: %.0f ns/call avg, %llu ns max\n",
+               (double) stats.handler_ns / (double) stats.handled,
+               (unsigned long long) stats.handler_max_ns);
+    }
+    for (i = 0; i < MT_REPLAY_VARIANTS; i++) {
+        if (stats.variant_calls[i] > 0) {
+            printf("  variant %2u: %8llu calls %10.0f ns/call\n", i,
+                   (unsigned long long) stats.variant_calls[i],
+                   (double) stats.variant_ns[i] /
+                   (double) stats.variant_calls[i]);
+        }
+    }
+
+    mt_detach(&mtc);
+
+done:
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
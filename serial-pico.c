@@ -6,114 +6,50 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <pico/time.h>
 #include <pico-plat.h>
 #include <libmeshtastic.h>
 
-int mt_serial_attach(struct mt_client *mtc, const char *device)
+static int mt_serial_open(struct mt_client *mtc, const char *device)
 {
-    int ret = 0;
-
     (void)(device);
 
-    if (mtc == NULL) {
-        errno = EINVAL;
-        ret = -1;
-        goto done;
-    }
-
-    mtc->inbuf_len = 0;
-
-done:
+    mtc->type = MT_CLIENT_SERIAL;
 
-    return ret;
-}
-
-int mt_serial_detach(struct mt_client *mtc)
-{
-    (void)(mtc);
     return 0;
 }
 
-static void mt_log_append(struct mt_client *mtc, uint8_t *buf, size_t size)
-{
-    if (mtc->logger != NULL) {
-        mtc->logger(mtc, (const char *) buf, size);
-    }
-}
-
-int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms)
+static int mt_serial_rx(struct mt_client *mtc, const struct mt_span *span,
+                        unsigned int n)
 {
     int ret = 0;
-    const struct mt_pb_header *mt_pb_header;
-    uint16_t mt_pb_len;
-    size_t should_read = 0;
-
-    (void)(timeout_ms);
+    int total = 0;
+    unsigned int i;
 
-    if (mtc == NULL) {
-        errno = EINVAL;
-        ret = -1;
-        goto done;
-    }
+    (void)(mtc);
 
-    mt_pb_header = (const struct mt_pb_header *) mtc->inbuf;
-    mt_pb_len = (mt_pb_header->h_len << 8) | mt_pb_header->l_len;
-
-    if ((mt_pb_header->start1 == MT_PB_START1) &&
-        (mt_pb_header->start2 == MT_PB_START2) &&
-        (mtc->inbuf_len < sizeof(struct mt_pb_header))) {
-        /* Header is sane but missing length, look for mt_pb_len */
-        should_read = sizeof(struct mt_pb_header) - mtc->inbuf_len;
-    } else if ((mt_pb_header->start1 == MT_PB_START1) &&
-               (mt_pb_header->start2 == MT_PB_START2) &&
-               ((mtc->inbuf_len > sizeof(struct mt_pb_header)) ||
-                (mt_pb_len <
-                 (sizeof(mtc->inbuf) - sizeof(struct mt_pb_header))))) {
-        /* Header is sane, we should read till the packet is filled */
-        should_read = mt_pb_len -
-            (mtc->inbuf_len - sizeof(struct mt_pb_header));
-    } else if (mtc->inbuf_len == 0) {
-        /* Look for START1 */
-        should_read = 1;
-    } else if ((mt_pb_header->start1 == MT_PB_START1) &&
-               (mtc->inbuf_len == 1)) {
-        /* Look for START2 */
-        should_read = 1;
-    } else {
-        /* Start over and look for START1 */
-        mt_log_append(mtc, mtc->inbuf, mtc->inbuf_len);
-        mtc->inbuf_len = 0;
-        should_read = 1;
-    }
+    /* Pull in whatever the UART has buffered, then frame all of it */
+    for (i = 0; i < n; i++) {
+        if (serial1_rx_ready() < 0) {
+            break;
+        }
 
-    if (serial1_rx_ready() >= 0) {
-        ret = serial1_read(mtc->inbuf + mtc->inbuf_len, should_read);
-    } else {
-        ret = 0;
-    }
+        ret = serial1_read(span[i].buf, span[i].len);
+        if (ret <= 0) {
+            break;
+        }
 
-    mtc->inbuf_len += ret;
-    mt_pb_len = (mt_pb_header->h_len << 8) | mt_pb_header->l_len;
-
-    if ((mt_pb_header->start1 == MT_PB_START1) &&
-        (mt_pb_header->start2 == MT_PB_START2) &&
-        (mtc->inbuf_len == (sizeof(struct mt_pb_header) + mt_pb_len))) {
-        ret = mt_recv_packet(mtc, mtc->inbuf, mtc->inbuf_len);
-        mtc->inbuf_len = 0;
-        mtc->inbuf[0] = 0x0;
-        mtc->inbuf[1] = 0x0;
-        goto done;
+        total += ret;
+        if ((size_t) ret < span[i].len) {
+            break;
+        }
     }
 
-    ret = 0;
-
-done:
-
-    return ret;
+    return total;
 }
 
-int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
-                   size_t size)
+static int mt_serial_tx(struct mt_client *mtc, const uint8_t *packet,
+                        size_t size)
 {
     int ret = 0;
 
@@ -129,7 +65,6 @@ int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
         packet += (size_t) ret;
     }
 
-
     ret = 0;
 
 done:
@@ -137,11 +72,53 @@ done:
     return ret;
 }
 
+const struct mt_transport_ops mt_serial_ops = {
+    .name = "serial",
+    .open = mt_serial_open,
+    .close = NULL,
+    .read = mt_serial_rx,
+    .write = mt_serial_tx,
+    .writev = NULL,
+    .poll_fd = NULL,
+    .process = NULL,
+};
+
+int mt_serial_attach(struct mt_client *mtc, const char *device)
+{
+    return mt_attach(mtc, &mt_serial_ops, device);
+}
+
+int mt_serial_detach(struct mt_client *mtc)
+{
+    return mt_detach(mtc);
+}
+
+int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    return mt_process(mtc, timeout_ms);
+}
+
+int mt_serial_drain(struct mt_client *mtc)
+{
+    return mt_drain(mtc);
+}
+
+int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
+                   size_t size)
+{
+    return mt_write(mtc, packet, size);
+}
+
 time_t mt_impl_now(void)
 {
     return time(NULL);
 }
 
+uint64_t mt_impl_now_ns(void)
+{
+    return time_us_64() * 1000ULL;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -11,38 +11,87 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
 #include <termios.h>
+#include <sys/uio.h>
 #include <libmeshtastic.h>
 
-int mt_serial_attach(struct mt_client *mtc, const char *device)
+#define MT_SERIAL_BACKOFF_MIN 1
+#define MT_SERIAL_BACKOFF_MAX 30
+#define MT_SERIAL_BY_ID       "/dev/serial/by-id"
+
+/*
+ * The /dev/serial/by-id link to the same tty as device, if there is one.
+ * Reopening through it follows the radio when USB re-enumerates it under
+ * another ttyACM or ttyUSB number.
+ */
+static char *mt_serial_by_id(const char *device)
 {
-    int ret = 0;
-    struct termios tty;
+    char *path = NULL;
+    char *real = NULL, *target;
+    char link[PATH_MAX];
+    DIR *dir = NULL;
+    struct dirent *ent;
+
+    if (strncmp(device, MT_SERIAL_BY_ID "/",
+                sizeof(MT_SERIAL_BY_ID)) == 0) {
+        path = strdup(device);
+        goto done;
+    }
 
-    if (mtc == NULL) {
-        errno = EINVAL;
-        ret = -1;
+    real = realpath(device, NULL);
+    if (real == NULL) {
         goto done;
     }
 
-    if (device == NULL) {
-        errno = EINVAL;
-        ret = -1;
+    dir = opendir(MT_SERIAL_BY_ID);
+    if (dir == NULL) {
         goto done;
     }
 
-    mt_serial_detach(mtc);
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
 
-    mtc->type = MT_CLIENT_SERIAL;
-    mtc->device = (const char *) strdup(device);
-    if (mtc->device == NULL) {
-        ret = -1;
-        goto done;
+        snprintf(link, sizeof(link), "%s/%s", MT_SERIAL_BY_ID, ent->d_name);
+        target = realpath(link, NULL);
+        if ((target != NULL) && (strcmp(target, real) == 0)) {
+            path = strdup(link);
+        }
+        free(target);
+
+        if (path != NULL) {
+            break;
+        }
     }
 
-    mtc->fd = open(mtc->device, O_RDWR | O_NOCTTY);
+done:
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    free(real);
+
+    return path;
+}
+
+static int mt_serial_connect(struct mt_client *mtc)
+{
+    int ret = 0;
+    int err;
+    const char *path;
+    struct termios tty;
+
+    /* The by-id link, if open() found one */
+    path = (mtc->priv != NULL) ? (const char *) mtc->priv : mtc->device;
+
+    mtc->fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
     if (mtc->fd == -1) {
-        fprintf(stderr, "%s: %s\n", mtc->device, strerror(errno));
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        ret = -1;
         goto done;
     }
 
@@ -75,18 +124,50 @@ int mt_serial_attach(struct mt_client *mtc, const char *device)
         goto done;
     }
 
+    mt_framer_reset(mtc);
+    mtc->connects++;
+    mtc->backoff = 0;
     ret = 0;
 
 done:
 
-    if (ret != 0) {
-        mt_serial_detach(mtc);
+    if ((ret != 0) && (mtc->fd >= 0)) {
+        err = errno;
+        close(mtc->fd);
+        mtc->fd = -1;
+        errno = err;
     }
 
     return ret;
 }
 
-int mt_serial_detach(struct mt_client *mtc)
+/*
+ * Drop the tty but stay attached, the next mt_serial_service() call
+ * reopens it once the backoff has expired. Only ever reached through
+ * mt_reconnect(): a lost tty otherwise fails with EPIPE.
+ */
+static void mt_serial_drop(struct mt_client *mtc)
+{
+    if (mtc->fd >= 0) {
+        close(mtc->fd);
+        mtc->fd = -1;
+    }
+
+    mt_framer_reset(mtc);
+
+    if (mtc->backoff == 0) {
+        mtc->backoff = MT_SERIAL_BACKOFF_MIN;
+    } else if (mtc->backoff < MT_SERIAL_BACKOFF_MAX) {
+        mtc->backoff *= 2;
+        if (mtc->backoff > MT_SERIAL_BACKOFF_MAX) {
+            mtc->backoff = MT_SERIAL_BACKOFF_MAX;
+        }
+    }
+
+    mtc->reconnect_ts = time(NULL) + mtc->backoff;
+}
+
+static int mt_serial_open(struct mt_client *mtc, const char *device)
 {
     int ret = 0;
 
@@ -96,48 +177,57 @@ int mt_serial_detach(struct mt_client *mtc)
         goto done;
     }
 
-    if (mtc->fd >= 0) {
-        close(mtc->fd);
-        mtc->fd = -1;
+    if (device == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
     }
 
-    if (mtc->device) {
-        free((void *) mtc->device);
+    mtc->type = MT_CLIENT_SERIAL;
+    mtc->backoff = 0;
+    mtc->reconnect_ts = 0;
+    mtc->device = (const char *) strdup(device);
+    if (mtc->device == NULL) {
+        ret = -1;
+        goto done;
     }
 
-    mtc->fd = -1;
-    mtc->device = NULL;
-    mtc->inbuf_len = 0;
+    mtc->priv = mt_serial_by_id(device);
 
-    ret = 0;
+    ret = mt_serial_connect(mtc);
 
 done:
 
     return ret;
 }
 
-static void mt_log_append(struct mt_client *mtc, uint8_t *buf, size_t size)
+static int mt_serial_close(struct mt_client *mtc)
 {
-    if (mtc->logger != NULL) {
-        mtc->logger(mtc, (const char *) buf, size);
+    if (mtc->fd >= 0) {
+        close(mtc->fd);
+        mtc->fd = -1;
+    }
+
+    if (mtc->device) {
+        free((void *) mtc->device);
     }
+
+    free(mtc->priv);
+
+    mtc->device = NULL;
+    mtc->priv = NULL;
+    mtc->backoff = 0;
+    mtc->reconnect_ts = 0;
+
+    return 0;
 }
 
-int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms)
+static int mt_serial_rx(struct mt_client *mtc, const struct mt_span *span,
+                        unsigned int n)
 {
     int ret = 0;
-    struct timeval timeout;
-    int nfds;
-    fd_set rfds;
-    const struct mt_pb_header *mt_pb_header;
-    uint16_t mt_pb_len;
-    size_t should_read = 0;
-
-    if (mtc == NULL) {
-        errno = EINVAL;
-        ret = -1;
-        goto done;
-    }
+    struct iovec iov[2];
+    unsigned int i;
 
     if (mtc->fd < 0) {
         errno = EBADFD;
@@ -145,73 +235,54 @@ int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms)
         goto done;
     }
 
-    timeout.tv_sec = timeout_ms / 1000;
-    timeout.tv_usec = (timeout_ms - (timeout.tv_sec * 1000)) * 1000;
-
-    FD_ZERO(&rfds);
-    FD_SET(mtc->fd, &rfds);
-    nfds = mtc->fd + 1;
-
-    ret = select(nfds, &rfds, NULL, NULL, &timeout);
-    if (ret == -1) {
-        fprintf(stderr, "%s: %s\n", mtc->device, strerror(errno));
-        goto done;
-    } else if (ret == 0) {
-        goto done;
-    }
-
-    mt_pb_header = (const struct mt_pb_header *) mtc->inbuf;
-    mt_pb_len = (mt_pb_header->h_len << 8) | mt_pb_header->l_len;
-
-    if ((mt_pb_header->start1 == MT_PB_START1) &&
-        (mt_pb_header->start2 == MT_PB_START2) &&
-        (mtc->inbuf_len < sizeof(struct mt_pb_header))) {
-        /* Header is sane but missing length, look for mt_pb_len */
-        should_read = sizeof(struct mt_pb_header) - mtc->inbuf_len;
-    } else if ((mt_pb_header->start1 == MT_PB_START1) &&
-               (mt_pb_header->start2 == MT_PB_START2) &&
-               ((mtc->inbuf_len > sizeof(struct mt_pb_header)) ||
-                (mt_pb_len <
-                 (sizeof(mtc->inbuf) - sizeof(struct mt_pb_header))))) {
-        /* Header is sane, we should read till the packet is filled */
-        should_read = mt_pb_len -
-            (mtc->inbuf_len - sizeof(struct mt_pb_header));
-    } else if (mtc->inbuf_len == 0) {
-        /* Look for START1 */
-        should_read = 1;
-    } else if ((mt_pb_header->start1 == MT_PB_START1) &&
-               (mtc->inbuf_len == 1)) {
-        /* Look for START2 */
-        should_read = 1;
-    } else {
-        /* Start over and look for START1 */
-        mt_log_append(mtc, mtc->inbuf, mtc->inbuf_len);
-        mtc->inbuf_len = 0;
-        should_read = 1;
+    /* Drain everything the tty has ready into the ring in one go */
+    for (i = 0; (i < n) && (i < 2); i++) {
+        iov[i].iov_base = span[i].buf;
+        iov[i].iov_len = span[i].len;
     }
 
-    ret = read(mtc->fd, mtc->inbuf + mtc->inbuf_len, should_read);
+    ret = readv(mtc->fd, iov, i);
     if (ret == -1) {
+        if ((errno == EINTR) || (errno == EAGAIN)) {
+            ret = 0;
+            goto done;
+        }
         fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
-        mtc->inbuf_len = 0;
         goto done;
     } else if (ret == 0) {
         fprintf(stderr, "%s: EOF!\n", mtc->device);
-        mtc->inbuf_len = 0;
+        errno = EPIPE;
+        ret = -1;
         goto done;
     }
 
-    mtc->inbuf_len += ret;
-    mt_pb_len = (mt_pb_header->h_len << 8) | mt_pb_header->l_len;
+done:
+
+    return ret;
+}
 
-    if ((mt_pb_header->start1 == MT_PB_START1) &&
-        (mt_pb_header->start2 == MT_PB_START2) &&
-        (mtc->inbuf_len == (sizeof(struct mt_pb_header) + mt_pb_len))) {
-        ret = mt_recv_packet(mtc, mtc->inbuf, mtc->inbuf_len);
-        mtc->inbuf_len = 0;
+static int mt_serial_tx(struct mt_client *mtc, const uint8_t *packet,
+                        size_t size)
+{
+    int ret = 0;
+
+    if (mtc->fd < 0) {
+        errno = (mtc->device != NULL) ? EAGAIN : EBADFD;
+        ret = -1;
         goto done;
     }
 
+    while (size > 0) {
+        ret = write(mtc->fd, packet, size);
+        if (ret == -1) {
+            fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+            goto done;
+        }
+
+        size -= (size_t) ret;
+        packet += (size_t) ret;
+    }
+
     ret = 0;
 
 done:
@@ -219,52 +290,157 @@ done:
     return ret;
 }
 
-int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
-                   size_t size)
+static int mt_serial_txv(struct mt_client *mtc, const struct mt_span *span,
+                         unsigned int n)
 {
     int ret = 0;
+    struct iovec iov[16];
+    unsigned int i, cnt;
+    ssize_t len;
 
-    if (mtc == NULL) {
-        errno = EINVAL;
+    if (mtc->fd < 0) {
+        errno = (mtc->device != NULL) ? EAGAIN : EBADFD;
         ret = -1;
         goto done;
     }
 
-    if (mtc->type != MT_CLIENT_SERIAL) {
-        errno = EINVAL;
-        ret = -1;
-        goto done;
+    while (n > 0) {
+        for (cnt = 0; (n > 0) && (cnt < 16); span++, n--) {
+            if (span->len > 0) {
+                iov[cnt].iov_base = span->buf;
+                iov[cnt].iov_len = span->len;
+                cnt++;
+            }
+        }
+
+        /* One syscall for the whole batch, looping only on short writes */
+        for (i = 0; i < cnt; ) {
+            len = writev(mtc->fd, iov + i, cnt - i);
+            if (len == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+                ret = -1;
+                goto done;
+            }
+
+            while ((i < cnt) && ((size_t) len >= iov[i].iov_len)) {
+                len -= iov[i].iov_len;
+                i++;
+            }
+
+            if (i < cnt) {
+                iov[i].iov_base = (uint8_t *) iov[i].iov_base + len;
+                iov[i].iov_len -= len;
+            }
+        }
     }
 
-    if (mtc->fd < 0) {
+done:
+
+    return ret;
+}
+
+static int mt_serial_poll_fd(const struct mt_client *mtc)
+{
+    return mtc->fd;
+}
+
+/*
+ * Same as the generic wait-then-drain, and just as fatal on EOF or a read
+ * error. Only a tty that the caller dropped with mt_reconnect() is
+ * reopened here, with backoff, the client staying attached meanwhile.
+ */
+static int mt_serial_service(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    int ret = 0;
+
+    if (mtc->device == NULL) {
         errno = EBADFD;
         ret = -1;
         goto done;
     }
 
-    while (size > 0) {
-        ret = write(mtc->fd, packet, size);
-        if (ret == -1) {
-            fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+    if (mtc->fd < 0) {
+        if (time(NULL) >= mtc->reconnect_ts) {
+            if (mt_serial_connect(mtc) != 0) {
+                mt_serial_drop(mtc);
+            }
+        }
+
+        if (mtc->fd < 0) {
+            /* Idle for the caller's timeout while the radio is away */
+            poll(NULL, 0, timeout_ms);
+            ret = 0;
             goto done;
         }
+    }
 
-        size -= (size_t) ret;
-        packet += (size_t) ret;
+    ret = mt_wait(mtc, mtc->fd, timeout_ms);
+    if (ret <= 0) {
+        goto done;
     }
 
-    ret = 0;
+    ret = mt_drain(mtc);
 
 done:
 
     return ret;
 }
 
+const struct mt_transport_ops mt_serial_ops = {
+    .name = "serial",
+    .open = mt_serial_open,
+    .close = mt_serial_close,
+    .read = mt_serial_rx,
+    .write = mt_serial_tx,
+    .writev = mt_serial_txv,
+    .poll_fd = mt_serial_poll_fd,
+    .process = mt_serial_service,
+    .drop = mt_serial_drop,
+};
+
+int mt_serial_attach(struct mt_client *mtc, const char *device)
+{
+    return mt_attach(mtc, &mt_serial_ops, device);
+}
+
+int mt_serial_detach(struct mt_client *mtc)
+{
+    return mt_detach(mtc);
+}
+
+int mt_serial_process(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    return mt_process(mtc, timeout_ms);
+}
+
+int mt_serial_drain(struct mt_client *mtc)
+{
+    return mt_drain(mtc);
+}
+
+int mt_serial_send(struct mt_client *mtc, const uint8_t *packet,
+                   size_t size)
+{
+    return mt_write(mtc, packet, size);
+}
+
 time_t mt_impl_now(void)
 {
     return time(NULL);
 }
 
+uint64_t mt_impl_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
 /*
  * Local variables:
  * mode: C
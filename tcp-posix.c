@@ -0,0 +1,633 @@
+/*
+ * tcp-posix.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <libmeshtastic.h>
+
+#define MT_TCP_CONNECT_TIMEOUT_MS 3000
+#define MT_TCP_SEND_TIMEOUT_MS    3000
+#define MT_TCP_BACKOFF_MIN        1
+#define MT_TCP_BACKOFF_MAX        30
+#define MT_TCP_KEEPIDLE           10
+#define MT_TCP_KEEPINTVL          5
+#define MT_TCP_KEEPCNT            3
+
+/*
+ * The host is resolved once, at attach, on the caller's thread; every
+ * reconnect walks the same addresses, so that the thread processing the
+ * client never waits on the resolver.
+ */
+struct mt_tcp {
+    struct addrinfo *res;
+    const struct addrinfo *ai;      /* Being connected to, if not NULL */
+    uint64_t deadline_ns;
+};
+
+/* Waits for events on fd, resuming after a signal with the time left */
+static int mt_tcp_poll(int fd, short events, uint32_t timeout_ms)
+{
+    struct pollfd pfd;
+    uint64_t deadline_ns, now_ns;
+    int ret;
+
+    deadline_ns = mt_impl_now_ns() + (uint64_t) timeout_ms * 1000000ULL;
+
+    for (;;) {
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, (int) timeout_ms);
+        if ((ret != -1) || (errno != EINTR)) {
+            break;
+        }
+
+        now_ns = mt_impl_now_ns();
+        if (now_ns >= deadline_ns) {
+            ret = 0;
+            break;
+        }
+        timeout_ms = (uint32_t) ((deadline_ns - now_ns) / 1000000ULL);
+    }
+
+    return ret;
+}
+
+static void mt_tcp_setup(int fd)
+{
+    int on;
+
+    /* Frames are small and latency matters more than throughput */
+    on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    /* Notice a radio that silently dropped off the LAN */
+    on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    on = MT_TCP_KEEPIDLE;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &on, sizeof(on));
+    on = MT_TCP_KEEPINTVL;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &on, sizeof(on));
+    on = MT_TCP_KEEPCNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &on, sizeof(on));
+}
+
+static void mt_tcp_connected(struct mt_client *mtc)
+{
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+
+    tcp->ai = NULL;
+    mt_tcp_setup(mtc->fd);
+    mt_framer_reset(mtc);
+    mtc->connects++;
+    mtc->backoff = 0;
+}
+
+/*
+ * Starts connecting to ai, or to the first address after it that does
+ * not fail right away. The socket stays non-blocking throughout, and the
+ * connect is finished by mt_tcp_progress() once the fd turns writable.
+ * Returns 0 with mtc->fd set, connected or in progress, or -1 once there
+ * is no address left.
+ */
+static int mt_tcp_connect(struct mt_client *mtc, const struct addrinfo *ai)
+{
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+    int fd, err;
+
+    for (; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family,
+                    ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+
+        mtc->fd = fd;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            mt_tcp_connected(mtc);
+            return 0;
+        }
+
+        if (errno == EINPROGRESS) {
+            tcp->ai = ai;
+            tcp->deadline_ns = mt_impl_now_ns() +
+                MT_TCP_CONNECT_TIMEOUT_MS * 1000000ULL;
+            return 0;
+        }
+
+        err = errno;
+        close(fd);
+        mtc->fd = -1;
+        errno = err;
+    }
+
+    tcp->ai = NULL;
+    fprintf(stderr, "%s:%u: %s\n", mtc->device,
+            (unsigned int) mtc->port, strerror(errno));
+
+    return -1;
+}
+
+/*
+ * Moves a connect in progress along: waits up to timeout_ms for the fd to
+ * turn writable, then takes the outcome from SO_ERROR and moves on to the
+ * next address if it failed or ran out of time. Returns 1 once connected,
+ * 0 while still in progress and -1 once every address has failed.
+ */
+static int mt_tcp_progress(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+    int ret = 0;
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    uint64_t now_ns;
+
+    if (tcp->ai == NULL) {
+        return (mtc->fd >= 0) ? 1 : -1;
+    }
+
+    now_ns = mt_impl_now_ns();
+    if (now_ns < tcp->deadline_ns) {
+        if ((tcp->deadline_ns - now_ns) < timeout_ms * 1000000ULL) {
+            timeout_ms = (uint32_t) ((tcp->deadline_ns - now_ns) /
+                                     1000000ULL);
+        }
+        ret = mt_tcp_poll(mtc->fd, POLLOUT, timeout_ms);
+        if (ret == -1) {
+            err = errno;
+        } else if (ret == 0) {
+            if (mt_impl_now_ns() < tcp->deadline_ns) {
+                return 0;
+            }
+            err = ETIMEDOUT;
+        }
+    } else {
+        err = ETIMEDOUT;
+    }
+
+    if ((err == 0) &&
+        (getsockopt(mtc->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)) {
+        err = errno;
+    }
+
+    if (err == 0) {
+        mt_tcp_connected(mtc);
+        return 1;
+    }
+
+    close(mtc->fd);
+    mtc->fd = -1;
+    errno = err;
+
+    return (mt_tcp_connect(mtc, tcp->ai->ai_next) == 0) ? 0 : -1;
+}
+
+/*
+ * Drop the connection but stay attached, the next mt_tcp_process() call
+ * reconnects once the backoff has expired.
+ */
+static void mt_tcp_drop(struct mt_client *mtc)
+{
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+
+    if (mtc->fd >= 0) {
+        close(mtc->fd);
+        mtc->fd = -1;
+    }
+
+    if (tcp != NULL) {
+        tcp->ai = NULL;
+    }
+
+    mt_framer_reset(mtc);
+
+    if (mtc->backoff == 0) {
+        mtc->backoff = MT_TCP_BACKOFF_MIN;
+    } else if (mtc->backoff < MT_TCP_BACKOFF_MAX) {
+        mtc->backoff *= 2;
+        if (mtc->backoff > MT_TCP_BACKOFF_MAX) {
+            mtc->backoff = MT_TCP_BACKOFF_MAX;
+        }
+    }
+
+    mtc->reconnect_ts = time(NULL) + mtc->backoff;
+}
+
+static bool mt_tcp_connecting(const struct mt_client *mtc)
+{
+    const struct mt_tcp *tcp = (const struct mt_tcp *) mtc->priv;
+
+    return (tcp != NULL) && (tcp->ai != NULL);
+}
+
+static int mt_tcp_open(struct mt_client *mtc, const char *device)
+{
+    int ret = 0;
+    char *host, *colon;
+    struct mt_tcp *tcp;
+    struct addrinfo hints;
+    char service[8];
+
+    if (device == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    mtc->type = MT_CLIENT_TCP;
+    mtc->port = MT_TCP_DEFAULT_PORT;
+    mtc->backoff = 0;
+    mtc->reconnect_ts = 0;
+    mtc->device = (const char *) strdup(device);
+    if (mtc->device == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    /* "host:port" or "[v6addr]:port", a bare v6 literal has no port */
+    host = (char *) mtc->device;
+    if (host[0] == '[') {
+        colon = strchr(host, ']');
+        if (colon != NULL) {
+            memmove(host, host + 1, colon - host - 1);
+            colon[-1] = '\0';
+            colon = (colon[1] == ':') ? colon + 1 : NULL;
+        }
+    } else {
+        colon = strrchr(host, ':');
+        if (colon != strchr(host, ':')) {
+            colon = NULL;
+        }
+    }
+
+    if (colon != NULL) {
+        *colon = '\0';
+        mtc->port = (uint16_t) strtoul(colon + 1, NULL, 10);
+        if (mtc->port == 0) {
+            mtc->port = MT_TCP_DEFAULT_PORT;
+        }
+    }
+
+    tcp = (struct mt_tcp *) calloc(1, sizeof(*tcp));
+    if (tcp == NULL) {
+        ret = -1;
+        goto done;
+    }
+    mtc->priv = tcp;
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%u", (unsigned int) mtc->port);
+
+    ret = getaddrinfo(mtc->device, service, &hints, &tcp->res);
+    if (ret != 0) {
+        fprintf(stderr, "%s: %s\n", mtc->device, gai_strerror(ret));
+        tcp->res = NULL;
+        errno = EHOSTUNREACH;
+        ret = -1;
+        goto done;
+    }
+
+    ret = mt_tcp_connect(mtc, tcp->res);
+
+done:
+
+    return ret;
+}
+
+static int mt_tcp_close(struct mt_client *mtc)
+{
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+
+    if (mtc->fd >= 0) {
+        close(mtc->fd);
+        mtc->fd = -1;
+    }
+
+    if (tcp != NULL) {
+        if (tcp->res != NULL) {
+            freeaddrinfo(tcp->res);
+        }
+        free(tcp);
+        mtc->priv = NULL;
+    }
+
+    if (mtc->device) {
+        free((void *) mtc->device);
+    }
+
+    mtc->device = NULL;
+    mtc->backoff = 0;
+    mtc->reconnect_ts = 0;
+
+    return 0;
+}
+
+static int mt_tcp_rx(struct mt_client *mtc, const struct mt_span *span,
+                     unsigned int n)
+{
+    int ret = 0;
+    struct iovec iov[2];
+    unsigned int i;
+
+    if (mtc->fd < 0) {
+        errno = EBADFD;
+        ret = -1;
+        goto done;
+    }
+
+    if (mt_tcp_connecting(mtc)) {
+        /* Woken on a socket still connecting: nothing to read yet */
+        ret = mt_tcp_progress(mtc, 0);
+        if (ret <= 0) {
+            goto done;
+        }
+    }
+
+    for (i = 0; (i < n) && (i < 2); i++) {
+        iov[i].iov_base = span[i].buf;
+        iov[i].iov_len = span[i].len;
+    }
+
+    ret = readv(mtc->fd, iov, i);
+    if (ret == -1) {
+        if ((errno == EINTR) || (errno == EAGAIN)) {
+            ret = 0;
+            goto done;
+        }
+        fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+        goto done;
+    } else if (ret == 0) {
+        fprintf(stderr, "%s: connection closed!\n", mtc->device);
+        errno = EPIPE;
+        ret = -1;
+        goto done;
+    }
+
+done:
+
+    return ret;
+}
+
+/* The socket buffer is full: give the peer a bounded while to catch up */
+static int mt_tcp_wait_send(struct mt_client *mtc)
+{
+    int ret;
+
+    ret = mt_tcp_poll(mtc->fd, POLLOUT, MT_TCP_SEND_TIMEOUT_MS);
+    if (ret == 0) {
+        errno = ETIMEDOUT;
+        ret = -1;
+    }
+
+    return (ret > 0) ? 0 : -1;
+}
+
+static int mt_tcp_tx(struct mt_client *mtc, const uint8_t *packet,
+                     size_t size)
+{
+    int ret = 0;
+
+    if ((mtc->fd < 0) || mt_tcp_connecting(mtc)) {
+        errno = (mtc->device != NULL) ? EAGAIN : EBADFD;
+        ret = -1;
+        goto done;
+    }
+
+    while (size > 0) {
+        ret = send(mtc->fd, packet, size, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) && (mt_tcp_wait_send(mtc) == 0)) {
+                continue;
+            }
+            fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+            goto done;
+        }
+
+        size -= (size_t) ret;
+        packet += (size_t) ret;
+    }
+
+    ret = 0;
+
+done:
+
+    return ret;
+}
+
+static int mt_tcp_txv(struct mt_client *mtc, const struct mt_span *span,
+                      unsigned int n)
+{
+    int ret = 0;
+    struct iovec iov[16];
+    struct msghdr msg;
+    unsigned int i, cnt;
+    ssize_t len;
+
+    if ((mtc->fd < 0) || mt_tcp_connecting(mtc)) {
+        errno = (mtc->device != NULL) ? EAGAIN : EBADFD;
+        ret = -1;
+        goto done;
+    }
+
+    while (n > 0) {
+        for (cnt = 0; (n > 0) && (cnt < 16); span++, n--) {
+            if (span->len > 0) {
+                iov[cnt].iov_base = span->buf;
+                iov[cnt].iov_len = span->len;
+                cnt++;
+            }
+        }
+
+        for (i = 0; i < cnt; ) {
+            bzero(&msg, sizeof(msg));
+            msg.msg_iov = iov + i;
+            msg.msg_iovlen = cnt - i;
+            len = sendmsg(mtc->fd, &msg, MSG_NOSIGNAL);
+            if (len == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if ((errno == EAGAIN) && (mt_tcp_wait_send(mtc) == 0)) {
+                    continue;
+                }
+                fprintf(stderr, "%s: %s!\n", mtc->device, strerror(errno));
+                ret = -1;
+                goto done;
+            }
+
+            while ((i < cnt) && ((size_t) len >= iov[i].iov_len)) {
+                len -= iov[i].iov_len;
+                i++;
+            }
+
+            if (i < cnt) {
+                iov[i].iov_base = (uint8_t *) iov[i].iov_base + len;
+                iov[i].iov_len -= len;
+            }
+        }
+    }
+
+done:
+
+    return ret;
+}
+
+static int mt_tcp_poll_fd(const struct mt_client *mtc)
+{
+    return mtc->fd;
+}
+
+/*
+ * Same as the generic wait-then-drain, except that a lost connection is
+ * not fatal: the client stays attached and reconnects with backoff.
+ */
+static int mt_tcp_service(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    int ret = 0;
+    struct mt_tcp *tcp = (struct mt_tcp *) mtc->priv;
+
+    if (mtc->device == NULL) {
+        errno = EBADFD;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->fd < 0) {
+        if (time(NULL) >= mtc->reconnect_ts) {
+            if (mt_tcp_connect(mtc, tcp->res) != 0) {
+                mt_tcp_drop(mtc);
+            }
+        }
+
+        if (mtc->fd < 0) {
+            /* Idle for the caller's timeout while the peer is away */
+            poll(NULL, 0, timeout_ms);
+            ret = 0;
+            goto done;
+        }
+    }
+
+    if (tcp->ai != NULL) {
+        if (mt_tcp_progress(mtc, timeout_ms) < 0) {
+            mt_tcp_drop(mtc);
+        }
+        ret = 0;
+        goto done;
+    }
+
+    ret = mt_wait(mtc, mtc->fd, timeout_ms);
+    if (ret <= 0) {
+        goto done;
+    }
+
+    ret = mt_drain(mtc);
+    if (ret < 0) {
+        mt_tcp_drop(mtc);
+        ret = 0;
+    }
+
+done:
+
+    return ret;
+}
+
+const struct mt_transport_ops mt_tcp_ops = {
+    .name = "tcp",
+    .open = mt_tcp_open,
+    .close = mt_tcp_close,
+    .read = mt_tcp_rx,
+    .write = mt_tcp_tx,
+    .writev = mt_tcp_txv,
+    .poll_fd = mt_tcp_poll_fd,
+    .process = mt_tcp_service,
+    .drop = mt_tcp_drop,
+    .connecting = mt_tcp_connecting,
+};
+
+int mt_tcp_attach(struct mt_client *mtc, const char *host, uint16_t port)
+{
+    int ret = 0;
+    char *device = NULL;
+    size_t len;
+
+    if ((mtc == NULL) || (host == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    len = strlen(host) + 10;
+    device = (char *) malloc(len);
+    if (device == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    if (port == 0) {
+        port = MT_TCP_DEFAULT_PORT;
+    }
+
+    snprintf(device, len,
+             (strchr(host, ':') != NULL) ? "[%s]:%u" : "%s:%u",
+             host, (unsigned int) port);
+    ret = mt_attach(mtc, &mt_tcp_ops, device);
+
+done:
+
+    if (device != NULL) {
+        free(device);
+    }
+
+    return ret;
+}
+
+int mt_tcp_detach(struct mt_client *mtc)
+{
+    return mt_detach(mtc);
+}
+
+int mt_tcp_drain(struct mt_client *mtc)
+{
+    return mt_drain(mtc);
+}
+
+int mt_tcp_process(struct mt_client *mtc, uint32_t timeout_ms)
+{
+    return mt_process(mtc, timeout_ms);
+}
+
+int mt_tcp_send(struct mt_client *mtc, const uint8_t *packet, size_t size)
+{
+    return mt_write(mtc, packet, size);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
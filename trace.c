@@ -0,0 +1,397 @@
+/*
+ * trace.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <libmeshtastic.h>
+
+#if !defined(ESP_PLATFORM) && !defined(LIB_PICO_PLATFORM)
+#define MT_HAVE_TLS
+#endif
+
+/*
+ * Each received frame is stamped as it moves through the stack: the read
+ * that brought in its first byte, the read that completed it, the end of
+ * pb_decode(), the start of the handler and its return, plus every span
+ * that the C++ dispatch reports for the got*() handlers it calls. A reply
+ * sent from within the handler is stamped when it is queued and again
+ * when it is written. All of it feeds the trace.* histograms in the
+ * metrics registry; every sample'th frame is also written out as Chrome
+ * trace events (chrome://tracing, Perfetto).
+ */
+
+#define MT_TRACE_HANDLERS   32
+#define MT_TRACE_TID_RX     1
+#define MT_TRACE_TID_TX     2
+
+/* Low bit of a reply stamp: its frame was sampled into the trace file */
+#define MT_TRACE_STAMP_SAMPLED ((uint64_t) 1)
+
+struct mt_trace_handler {
+    const char *name;
+    struct mt_metric *metric;
+};
+
+struct mt_trace {
+    FILE *fp;
+    unsigned int sample;
+    uint64_t frames;
+    uint64_t epoch;
+    bool empty;
+    uint64_t read_ts;
+    uint64_t pending_ts;
+    uint64_t first_ts;
+    uint64_t complete_ts;
+    uint64_t decoded_ts;
+    uint64_t dispatch_ts;
+    bool in_frame;
+    bool sampled;
+    struct mt_frame_view view;
+    struct mt_trace_handler handlers[MT_TRACE_HANDLERS];
+    unsigned int nhandlers;
+};
+
+static struct mt_metric *mt_m_assemble_ns;
+static struct mt_metric *mt_m_decode_ns;
+static struct mt_metric *mt_m_dispatch_ns;
+static struct mt_metric *mt_m_total_ns;
+static struct mt_metric *mt_m_reply_enqueue_ns;
+static struct mt_metric *mt_m_reply_write_ns;
+
+#if defined(MT_HAVE_TLS)
+/* The client whose handler this thread is running, to tell replies apart */
+static __thread struct mt_client *mt_trace_dispatching = NULL;
+#endif
+
+static void mt_trace_event(struct mt_trace *trace, const char *name,
+                           unsigned int tid, uint64_t start, uint64_t end,
+                           const struct mt_frame_view *view)
+{
+    if (trace->fp == NULL) {
+        return;
+    }
+
+    fprintf(trace->fp,
+            "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+            trace->empty ? "" : ",\n", name,
+            (tid == MT_TRACE_TID_RX) ? "rx" : "tx",
+            (double) (start - trace->epoch) / 1000.0,
+            (double) (end - start) / 1000.0, tid);
+    if (view != NULL) {
+        fprintf(trace->fp,
+                ",\"args\":{\"variant\":%u,\"portnum\":%u,"
+                "\"from\":\"!%.8x\",\"id\":%u}",
+                (unsigned int) view->which_payload_variant,
+                (unsigned int) view->portnum,
+                (unsigned int) view->from, (unsigned int) view->id);
+    }
+    fprintf(trace->fp, "}");
+    trace->empty = false;
+}
+
+int mt_trace_start(struct mt_client *mtc, const char *path,
+                   unsigned int sample)
+{
+    int ret = 0;
+    struct mt_trace *trace = NULL;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->trace != NULL) {
+        errno = EBUSY;
+        ret = -1;
+        goto done;
+    }
+
+    trace = (struct mt_trace *) calloc(1, sizeof(*trace));
+    if (trace == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    if ((path != NULL) && (sample > 0)) {
+        trace->fp = fopen(path, "w");
+        if (trace->fp == NULL) {
+            ret = -1;
+            goto done;
+        }
+        fprintf(trace->fp, "[\n");
+    }
+
+    trace->sample = sample;
+    trace->empty = true;
+    trace->epoch = mt_impl_now_ns();
+
+    mtc->trace = trace;
+    trace = NULL;
+
+done:
+
+    free(trace);
+
+    return ret;
+}
+
+void mt_trace_stop(struct mt_client *mtc)
+{
+    struct mt_trace *trace;
+
+    if ((mtc == NULL) || (mtc->trace == NULL)) {
+        return;
+    }
+
+    trace = mtc->trace;
+    mtc->trace = NULL;
+
+    if (trace->fp != NULL) {
+        fprintf(trace->fp, "\n]\n");
+        fclose(trace->fp);
+    }
+
+    free(trace);
+}
+
+uint64_t mt_trace_now(const struct mt_client *mtc)
+{
+    if ((mtc == NULL) || (mtc->trace == NULL)) {
+        return 0;
+    }
+
+    return mt_impl_now_ns();
+}
+
+/*
+ * A got*() handler called from the dispatch has returned; start is what
+ * mt_trace_now() said before calling it.
+ */
+void mt_trace_span(struct mt_client *mtc, const char *name, uint64_t start)
+{
+    struct mt_trace *trace;
+    struct mt_metric *metric = NULL;
+    char metric_name[MT_METRIC_NAME_LEN];
+    uint64_t end;
+    unsigned int i;
+
+    if ((start == 0) || (mtc == NULL) || (mtc->trace == NULL) ||
+        (name == NULL)) {
+        return;
+    }
+
+    end = mt_impl_now_ns();
+    trace = mtc->trace;
+
+    /* Handler names are literals, so the pointer identifies them */
+    for (i = 0; i < trace->nhandlers; i++) {
+        if (trace->handlers[i].name == name) {
+            metric = trace->handlers[i].metric;
+            break;
+        }
+    }
+
+    if ((i == trace->nhandlers) && (i < MT_TRACE_HANDLERS)) {
+        snprintf(metric_name, sizeof(metric_name), "trace.%s_ns", name);
+        metric = mt_metric_register(metric_name, MT_METRIC_HISTOGRAM);
+        trace->handlers[i].name = name;
+        trace->handlers[i].metric = metric;
+        trace->nhandlers++;
+    }
+
+    mt_metric_observe(metric, end - start);
+
+    if (trace->in_frame && trace->sampled) {
+        mt_trace_event(trace, name, MT_TRACE_TID_RX, start, end, NULL);
+    }
+}
+
+/*
+ * Bytes were just added to the receive ring. If nothing was pending,
+ * they start a new frame.
+ */
+void mt_trace_read(struct mt_client *mtc, bool fresh)
+{
+    struct mt_trace *trace = mtc->trace;
+
+    trace->read_ts = mt_impl_now_ns();
+    if (fresh || (trace->pending_ts == 0)) {
+        trace->pending_ts = trace->read_ts;
+    }
+}
+
+/*
+ * The framer found a complete frame. Whatever follows it in the ring
+ * arrived with the latest read at the earliest.
+ */
+void mt_trace_frame(struct mt_client *mtc)
+{
+    struct mt_trace *trace = mtc->trace;
+
+    trace->complete_ts = mt_impl_now_ns();
+    trace->first_ts = (trace->pending_ts != 0) ?
+        trace->pending_ts : trace->complete_ts;
+    trace->pending_ts = trace->read_ts;
+}
+
+void mt_trace_decoded(struct mt_client *mtc, const struct mt_frame_view *view)
+{
+    struct mt_trace *trace = mtc->trace;
+
+    trace->decoded_ts = mt_impl_now_ns();
+    if (trace->complete_ts == 0) {
+        /* Handed to mt_recv_packet() directly, not through the framer */
+        trace->first_ts = trace->decoded_ts;
+        trace->complete_ts = trace->decoded_ts;
+    }
+    trace->view = *view;
+}
+
+void mt_trace_dispatch(struct mt_client *mtc)
+{
+    struct mt_trace *trace = mtc->trace;
+
+    trace->dispatch_ts = mt_impl_now_ns();
+    trace->sampled = (trace->fp != NULL) &&
+        ((trace->frames++ % trace->sample) == 0);
+    trace->in_frame = true;
+#if defined(MT_HAVE_TLS)
+    mt_trace_dispatching = mtc;
+#endif
+}
+
+void mt_trace_done(struct mt_client *mtc)
+{
+    struct mt_trace *trace = mtc->trace;
+    uint64_t end;
+
+#if defined(MT_HAVE_TLS)
+    mt_trace_dispatching = NULL;
+#endif
+
+    if (trace == NULL) {
+        /* The handler stopped tracing */
+        return;
+    }
+
+    end = mt_impl_now_ns();
+
+    mt_metric_observe(mt_metric_lazy(&mt_m_assemble_ns, "trace.assemble_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      trace->complete_ts - trace->first_ts);
+    mt_metric_observe(mt_metric_lazy(&mt_m_decode_ns, "trace.decode_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      trace->decoded_ts - trace->complete_ts);
+    mt_metric_observe(mt_metric_lazy(&mt_m_dispatch_ns, "trace.dispatch_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      end - trace->dispatch_ts);
+    mt_metric_observe(mt_metric_lazy(&mt_m_total_ns, "trace.total_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      end - trace->first_ts);
+
+    if (trace->sampled) {
+        mt_trace_event(trace, "assemble", MT_TRACE_TID_RX,
+                       trace->first_ts, trace->complete_ts, &trace->view);
+        mt_trace_event(trace, "decode", MT_TRACE_TID_RX,
+                       trace->complete_ts, trace->decoded_ts, &trace->view);
+        mt_trace_event(trace, "dispatch", MT_TRACE_TID_RX,
+                       trace->dispatch_ts, end, &trace->view);
+    }
+
+    trace->in_frame = false;
+    trace->sampled = false;
+    trace->complete_ts = 0;
+}
+
+/*
+ * A frame is being queued for sending. Returns its stamp if it is a reply
+ * made from within the handler on the dispatching thread, 0 otherwise.
+ * The stamp is in nanoseconds, its low bit telling whether the frame that
+ * caused the reply is sampled.
+ */
+uint64_t mt_trace_reply(struct mt_client *mtc)
+{
+    struct mt_trace *trace;
+    uint64_t now;
+
+    if ((mtc == NULL) || (mtc->trace == NULL)) {
+        return 0;
+    }
+
+#if defined(MT_HAVE_TLS)
+    if (mt_trace_dispatching != mtc) {
+        return 0;
+    }
+#endif
+
+    trace = mtc->trace;
+    if (!trace->in_frame) {
+        return 0;
+    }
+
+    now = mt_impl_now_ns();
+    mt_metric_observe(mt_metric_lazy(&mt_m_reply_enqueue_ns,
+                                     "trace.reply_enqueue_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      now - trace->first_ts);
+
+    if (trace->sampled) {
+        mt_trace_event(trace, "reply_enqueue", MT_TRACE_TID_RX,
+                       trace->first_ts, now, &trace->view);
+    }
+
+    now &= ~MT_TRACE_STAMP_SAMPLED;
+    if (trace->sampled) {
+        now |= MT_TRACE_STAMP_SAMPLED;
+    }
+
+    return now;
+}
+
+/*
+ * A reply stamped by mt_trace_reply() has been written to the transport.
+ * Called on the I/O thread. Every reply feeds the histogram, only those
+ * of sampled frames make it to the trace file.
+ */
+void mt_trace_written(struct mt_client *mtc, uint64_t queued)
+{
+    struct mt_trace *trace;
+    uint64_t now;
+    bool sampled;
+
+    if ((queued == 0) || (mtc == NULL) || (mtc->trace == NULL)) {
+        return;
+    }
+
+    sampled = (queued & MT_TRACE_STAMP_SAMPLED) != 0;
+    queued &= ~MT_TRACE_STAMP_SAMPLED;
+
+    trace = mtc->trace;
+    now = mt_impl_now_ns();
+    mt_metric_observe(mt_metric_lazy(&mt_m_reply_write_ns,
+                                     "trace.reply_write_ns",
+                                     MT_METRIC_HISTOGRAM),
+                      now - queued);
+    if (sampled) {
+        mt_trace_event(trace, "reply_write", MT_TRACE_TID_TX, queued, now,
+                       NULL);
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
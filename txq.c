@@ -0,0 +1,337 @@
+/*
+ * txq.c
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <libmeshtastic.h>
+
+/*
+ * Bounded multi-producer single-consumer queue of encoded frames, after
+ * Dmitry Vyukov's bounded MPMC queue: each cell carries a sequence number
+ * so producers claim cells with a single CAS on the enqueue position and
+ * the consumer never has to touch it. Frames are encoded directly into
+ * the claimed cell, so there is no allocation or copy on the send path.
+ */
+
+#define MT_TXQ_BATCH     16
+#define MT_CACHELINE     64
+
+static struct mt_metric *mt_m_txq_depth;
+static struct mt_metric *mt_m_txq_overruns;
+static struct mt_metric *mt_m_tx_bytes;
+static struct mt_metric *mt_m_tx_frames;
+
+struct mt_txq_cell {
+    atomic_size_t seq;
+    size_t len;
+    uint64_t trace_ts;
+    uint8_t buf[sizeof(struct mt_pb_header) + MT_PB_MAX_LEN];
+};
+
+struct mt_txq {
+    size_t mask;
+    int efd;
+    struct mt_txq_cell *cells;
+    /* Producers and the consumer each get their own cache line */
+    _Alignas(MT_CACHELINE) atomic_size_t enqueue_pos;
+    _Alignas(MT_CACHELINE) size_t dequeue_pos;
+    atomic_uint overruns;
+    atomic_uint errors;
+};
+
+int mt_txq_attach(struct mt_client *mtc, unsigned int depth)
+{
+    int ret = 0;
+    struct mt_txq *q = NULL;
+    size_t i, n;
+
+    if (mtc == NULL) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    if (mtc->txq != NULL) {
+        goto done;
+    }
+
+    if (depth == 0) {
+        depth = MT_TXQ_DEFAULT_DEPTH;
+    }
+
+    for (n = 2; n < depth; n <<= 1) {
+        continue;
+    }
+
+    if (posix_memalign((void **) &q, MT_CACHELINE, sizeof(*q)) != 0) {
+        q = NULL;
+        errno = ENOMEM;
+        ret = -1;
+        goto done;
+    }
+
+    bzero(q, sizeof(*q));
+
+    q->cells = (struct mt_txq_cell *) calloc(n, sizeof(*q->cells));
+    if (q->cells == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->efd == -1) {
+        ret = -1;
+        goto done;
+    }
+
+    q->mask = n - 1;
+    for (i = 0; i < n; i++) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    atomic_init(&q->enqueue_pos, 0);
+    q->dequeue_pos = 0;
+    atomic_init(&q->overruns, 0);
+    atomic_init(&q->errors, 0);
+
+    mtc->txq = q;
+    q = NULL;
+
+done:
+
+    if (q != NULL) {
+        free(q->cells);
+        free(q);
+    }
+
+    return ret;
+}
+
+void mt_txq_detach(struct mt_client *mtc)
+{
+    struct mt_txq *q;
+
+    if ((mtc == NULL) || (mtc->txq == NULL)) {
+        return;
+    }
+
+    q = mtc->txq;
+    mtc->txq = NULL;
+
+    close(q->efd);
+    free(q->cells);
+    free(q);
+}
+
+int mt_txq_fd(const struct mt_client *mtc)
+{
+    if ((mtc == NULL) || (mtc->txq == NULL)) {
+        return -1;
+    }
+
+    return mtc->txq->efd;
+}
+
+int mt_txq_push(struct mt_client *mtc,
+                int (*fill)(uint8_t *buf, size_t *len, const void *arg),
+                const void *arg)
+{
+    int ret = 0;
+    struct mt_txq *q;
+    struct mt_txq_cell *cell;
+    size_t pos, seq;
+    intptr_t diff;
+    uint64_t one = 1;
+    int err = 0;
+
+    if ((mtc == NULL) || (mtc->txq == NULL) || (fill == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    q = mtc->txq;
+
+    pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Full: the I/O thread has fallen behind, push back */
+            atomic_fetch_add_explicit(&q->overruns, 1, memory_order_relaxed);
+            mt_metric_add(mt_metric_lazy(&mt_m_txq_overruns,
+                                         "tx.queue_overruns",
+                                         MT_METRIC_COUNTER), 1);
+            errno = ENOBUFS;
+            ret = -1;
+            goto done;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos,
+                                       memory_order_relaxed);
+        }
+    }
+
+    /*
+     * The cell is ours and has to be published for the queue to move on;
+     * if encoding fails it stays empty and the writer skips it.
+     */
+    cell->len = 0;
+    cell->trace_ts = mt_trace_reply(mtc);
+    ret = fill(cell->buf, &cell->len, arg);
+    if (ret != 0) {
+        cell->len = 0;
+        err = errno;
+    }
+
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    mt_metric_adjust(mt_metric_lazy(&mt_m_txq_depth, "tx.queue_depth",
+                                    MT_METRIC_GAUGE), 1);
+    mt_metric_adjust(mtc->metrics.tx_queue_depth, 1);
+
+    if (write(q->efd, &one, sizeof(one)) != sizeof(one)) {
+        /* Only fails once the counter saturates, a wakeup is pending */
+        errno = err;
+    }
+
+done:
+
+    return ret;
+}
+
+int mt_txq_flush(struct mt_client *mtc)
+{
+    int ret = 0;
+    int frames = 0;
+    struct mt_txq *q;
+    struct mt_txq_cell *cell;
+    struct mt_span span[MT_TXQ_BATCH];
+    size_t bytes;
+    unsigned int i, n, sent;
+    uint64_t count;
+
+    if ((mtc == NULL) || (mtc->txq == NULL)) {
+        errno = EINVAL;
+        ret = -1;
+        goto done;
+    }
+
+    q = mtc->txq;
+
+    /* Clear the wakeup before looking, so a racing push re-signals */
+    if (read(q->efd, &count, sizeof(count)) != sizeof(count)) {
+        /* EAGAIN, nothing was signalled but look anyway */
+        count = 0;
+    }
+
+    for (;;) {
+        bytes = 0;
+        for (n = 0; n < MT_TXQ_BATCH; n++) {
+            cell = &q->cells[(q->dequeue_pos + n) & q->mask];
+            if (atomic_load_explicit(&cell->seq, memory_order_acquire) !=
+                (q->dequeue_pos + n + 1)) {
+                break;
+            }
+
+            span[n].buf = cell->buf;
+            span[n].len = cell->len;
+            bytes += cell->len;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        if (bytes > 0) {
+            ret = mt_writev(mtc, span, n);
+            if (ret == 0) {
+                __atomic_fetch_add(&mtc->counters.bytes_tx, bytes,
+                                   __ATOMIC_RELAXED);
+                mtc->bytes_tx += bytes;
+                for (i = 0, sent = 0; i < n; i++) {
+                    if (span[i].len > 0) {
+                        mtc->packets_tx++;
+                        sent++;
+                        cell = &q->cells[(q->dequeue_pos + i) & q->mask];
+                        mt_trace_written(mtc, cell->trace_ts);
+                    }
+                }
+                frames += sent;
+                __atomic_fetch_add(&mtc->counters.packets_tx, sent,
+                                   __ATOMIC_RELAXED);
+                mt_metric_add(mt_metric_lazy(&mt_m_tx_bytes, "tx.bytes",
+                                             MT_METRIC_COUNTER), bytes);
+                mt_metric_add(mt_metric_lazy(&mt_m_tx_frames, "tx.frames",
+                                             MT_METRIC_COUNTER), sent);
+                mt_metric_add(mtc->metrics.tx_frames, sent);
+            } else {
+                /* A broken link; drop the batch rather than stall */
+                atomic_fetch_add_explicit(&q->errors, n,
+                                          memory_order_relaxed);
+            }
+        }
+
+        /* Hand the cells back to the producers for the next lap */
+        for (i = 0; i < n; i++) {
+            cell = &q->cells[(q->dequeue_pos + i) & q->mask];
+            atomic_store_explicit(&cell->seq,
+                                  q->dequeue_pos + i + q->mask + 1,
+                                  memory_order_release);
+        }
+        q->dequeue_pos += n;
+        mt_metric_adjust(mt_metric_lazy(&mt_m_txq_depth, "tx.queue_depth",
+                                        MT_METRIC_GAUGE), -(int64_t) n);
+        mt_metric_adjust(mtc->metrics.tx_queue_depth, -(int64_t) n);
+
+        if (ret != 0) {
+            goto done;
+        }
+    }
+
+    ret = frames;
+
+done:
+
+    return ret;
+}
+
+uint32_t mt_txq_overruns(const struct mt_client *mtc)
+{
+    if ((mtc == NULL) || (mtc->txq == NULL)) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&mtc->txq->overruns, memory_order_relaxed);
+}
+
+uint32_t mt_txq_errors(const struct mt_client *mtc)
+{
+    if ((mtc == NULL) || (mtc->txq == NULL)) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&mtc->txq->errors, memory_order_relaxed);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */